@@ -73,6 +73,7 @@ echo "echo \$interface selected"  >> $DEB_DIR/DEBIAN/postinst
 echo "sed -i \"s/eth0/\$interface/g\" /etc/onvif_srvd/config.cfg"  >> $DEB_DIR/DEBIAN/postinst
 echo "sed -i \"s/eth0/\$interface/g\" /lib/systemd/system/wsdd.service"  >> $DEB_DIR/DEBIAN/postinst
 echo "systemctl daemon-reload" >> $DEB_DIR/DEBIAN/postinst
+echo "systemctl enable onvif_srvd.socket" >> $DEB_DIR/DEBIAN/postinst
 echo "systemctl enable onvif_srvd.service" >> $DEB_DIR/DEBIAN/postinst
 echo "systemctl start onvif_srvd.service" >> $DEB_DIR/DEBIAN/postinst
 echo "systemctl enable wsdd.service" >> $DEB_DIR/DEBIAN/postinst
@@ -81,6 +82,7 @@ chmod +x $DEB_DIR/DEBIAN/postinst
 
 echo "#!/bin/bash" > $DEB_DIR/DEBIAN/postrm
 echo "systemctl stop onvif_srvd.service" >> $DEB_DIR/DEBIAN/postrm
+echo "systemctl stop onvif_srvd.socket" >> $DEB_DIR/DEBIAN/postrm
 echo "systemctl stop wsdd.service" >> $DEB_DIR/DEBIAN/postrm
 echo "systemctl daemon-reload" >> $DEB_DIR/DEBIAN/postrm
 chmod +x $DEB_DIR/DEBIAN/postrm
@@ -88,6 +90,7 @@ chmod +x $DEB_DIR/DEBIAN/postrm
 cp -a $OUT_DIR/config.cfg $ETC_DIR/onvif_srvd/
 cp -a $CMAKE_BUILD_DIR/bin/onvif_srvd $BIN_DIR/
 cp -a $OUT_DIR/start_scripts/*.service $LIB_DIR/systemd/system/
+cp -a $OUT_DIR/start_scripts/*.socket $LIB_DIR/systemd/system/
 
 cp -a $OUT_DIR/wsdd/wsdd $BIN_DIR/
 cp -a $OUT_DIR/wsdd/start_scripts/*.service $LIB_DIR/systemd/system/
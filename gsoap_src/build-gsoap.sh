@@ -15,6 +15,7 @@ echo $GSOAP_INSTALL_DIR
 
 # Check if we already have the generated files needed to build onvif_srvd, if we do then skip the build
 if [[ -f $GENERATED_DIR/DeviceBinding.nsmap &&
+ 	-f $GENERATED_DIR/ImagingBinding.nsmap &&
  	-f $GENERATED_DIR/MediaBinding.nsmap &&
  	-f $GENERATED_DIR/onvif.h &&
  	-f $GENERATED_DIR/PTZBinding.nsmap &&
@@ -22,10 +23,13 @@ if [[ -f $GENERATED_DIR/DeviceBinding.nsmap &&
  	-f $GENERATED_DIR/soapDeviceBindingService.cpp &&
  	-f $GENERATED_DIR/soapDeviceBindingService.h &&
  	-f $GENERATED_DIR/soapH.h &&
+ 	-f $GENERATED_DIR/soapImagingBindingService.cpp &&
+ 	-f $GENERATED_DIR/soapImagingBindingService.h &&
  	-f $GENERATED_DIR/soapMediaBindingService.cpp &&
  	-f $GENERATED_DIR/soapMediaBindingService.h &&
  	-f $GENERATED_DIR/soapPTZBindingService.cpp &&
  	-f $GENERATED_DIR/soapPTZBindingService.h &&
+ 	-f $GENERATED_DIR/soapRoutes.h &&
  	-f $GENERATED_DIR/soapStub.h ]]; then
     echo "Generated files exist, skipping gsoap build process."
     exit
@@ -67,6 +71,38 @@ echo '#import "wsse.h" ' >> $GENERATED_DIR/onvif.h
 echo "First Half"
 $SOAPCPP2 -j -L -x -S -d $GENERATED_DIR -I$GSOAP_DIR:$GSOAP_IMPORT_DIR $GENERATED_DIR/onvif.h
 
+# Extract the operation table of every service dispatcher, the daemon builds a
+# perfect hash over it (see ServiceRouter.cpp) and calls the serve functions
+# directly instead of trying each service in turn
+echo "Generate Operation Routes"
+ROUTES=$GENERATED_DIR/soapRoutes.h
+echo "/* Generated by build-gsoap.sh from the soap*BindingService.cpp dispatchers, do not edit */" > $ROUTES
+echo "#ifndef SOAP_ROUTES_H" >> $ROUTES
+echo "#define SOAP_ROUTES_H" >> $ROUTES
+for file in $GENERATED_DIR/soap*BindingService.cpp
+do
+    SERVICE=`basename $file .cpp | sed 's/^soap//'`
+    echo "" >> $ROUTES
+    echo "#include \"soap${SERVICE}.h\"" >> $ROUTES
+    grep -E '^static int serve___' $file | sed -e 's/^static //' -e 's/[;{ ]*$/;/' | sort -u >> $ROUTES
+    echo "#define SOAP_ROUTES_${SERVICE}(ROUTE) \\" >> $ROUTES
+    awk -v service=$SERVICE '
+        /soap_match_tag\(.*"/ { match($0, /"[^"]*"/); tag = substr($0, RSTART, RLENGTH) }
+        /return serve___/ && tag != "" {
+            match($0, /serve___[A-Za-z0-9_]+/)
+            name = substr($0, RSTART, RLENGTH)
+            match($0, /\(.*\)/)
+            args = substr($0, RSTART, RLENGTH)
+            gsub(/this/, "service", args)
+            printf "    ROUTE(%s, %s, %s%s) \\\n", service, tag, name, args
+            tag = ""
+        }' $file >> $ROUTES
+    echo "" >> $ROUTES
+    # the serve functions are file static, the routing table needs to link to them
+    sed -i 's/^static int serve___/int serve___/' $file
+done
+echo "#endif" >> $ROUTES
+
 echo "Apply Patch"
 cd $GSOAP_DIR && patch -p0 < $PATCH_DIR/stdsoapLoopFix.patch
 cd ..
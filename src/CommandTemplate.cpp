@@ -0,0 +1,77 @@
+#include "CommandTemplate.hpp"
+
+
+CommandTemplate::CommandTemplate(std::string const &text)
+{
+    size_t start = 0;
+
+    for (size_t at = text.find('%'); at != std::string::npos; at = text.find('%', at + 1))
+    {
+        if (at + 1 >= text.size() || (text[at + 1] != 's' && text[at + 1] != 't'))
+            continue;
+
+        if (at > start)
+            m_pieces.emplace_back(Piece::Text, text.substr(start, at - start));
+        m_pieces.emplace_back(text[at + 1] == 's' ? Piece::Speed : Piece::Token, std::string());
+        m_hasSpeed |= text[at + 1] == 's';
+
+        start = at + 2;
+        at = start - 1;
+    }
+
+    if (start < text.size())
+        m_pieces.emplace_back(Piece::Text, text.substr(start));
+
+    for (auto const &piece : m_pieces)
+        m_textSize += piece.second.size();
+}
+
+
+std::string CommandTemplate::format(std::string const &speed, std::string const &token) const
+{
+    std::string command;
+    command.reserve(m_textSize + speed.size() + token.size());
+
+    for (auto const &piece : m_pieces)
+    {
+        switch (piece.first)
+        {
+        case Piece::Text:
+            command += piece.second;
+            break;
+        case Piece::Speed:
+            command += speed;
+            break;
+        case Piece::Token:
+            command += token;
+            break;
+        }
+    }
+
+    return command;
+}
+
+
+CommandTemplate CommandTemplate::withToken(std::string const &token) const
+{
+    CommandTemplate bound;
+    bound.m_hasSpeed = m_hasSpeed;
+
+    for (auto const &piece : m_pieces)
+    {
+        if (piece.first == Piece::Speed)
+        {
+            bound.m_pieces.push_back(piece);
+            continue;
+        }
+
+        std::string const &text = piece.first == Piece::Token ? token : piece.second;
+        if (!bound.m_pieces.empty() && bound.m_pieces.back().first == Piece::Text)
+            bound.m_pieces.back().second += text;
+        else if (!text.empty())
+            bound.m_pieces.emplace_back(Piece::Text, text);
+        bound.m_textSize += text.size();
+    }
+
+    return bound;
+}
@@ -0,0 +1,43 @@
+#ifndef COMMAND_TEMPLATE_HPP
+#define COMMAND_TEMPLATE_HPP
+
+#include <string>
+#include <vector>
+
+
+/*******************************************************************************
+ * Backend command with placeholders, split once when it is configured
+ *
+ * "%s" stands for the speed value and "%t" for the preset token, any other
+ * text is kept as is. Formatting appends the pieces into a string reserved at
+ * its final size, the command text is not searched again for every move.
+ ******************************************************************************/
+class CommandTemplate
+{
+  public:
+    CommandTemplate() = default;
+    explicit CommandTemplate(std::string const &text);
+
+    bool empty() const { return m_pieces.empty(); }
+    bool hasSpeed() const { return m_hasSpeed; }
+
+    std::string format(std::string const &speed, std::string const &token = {}) const;
+
+    // the same command with "%t" filled in, "%s" is left for format()
+    CommandTemplate withToken(std::string const &token) const;
+
+  private:
+    enum class Piece
+    {
+        Text,
+        Speed,
+        Token
+    };
+
+    std::vector<std::pair<Piece, std::string>> m_pieces;
+    size_t m_textSize{0};
+    bool m_hasSpeed{false};
+};
+
+
+#endif // COMMAND_TEMPLATE_HPP
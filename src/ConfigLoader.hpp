@@ -44,6 +44,12 @@ class ConfigLoader
             const libconfig::Setting &items = m_cfg->lookup(setting);
             std::size_t length = static_cast<std::size_t>(items.getLength());
             var.clear();
+            // a single value is a list of one
+            if (items.isScalar())
+            {
+                var.push_back(static_cast<T &&>(items));
+                return;
+            }
             var.reserve(length);
             for (std::size_t i = 0; i < length; ++i)
             {
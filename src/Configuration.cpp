@@ -23,9 +23,20 @@ void Configuration::loadAllSettings(ConfigLoader &loader)
     loader.getSetting(logFileSizeMb, "log_file_size_mb");
     loader.getSetting(logFileCount, "log_file_count");
     loader.getSetting(logAsync, "log_async");
+    loader.getSetting(drainTimeout, "drain_timeout");
 
     // ONVIF Service Options
     loader.getSetting(port, "port");
+    loader.getSetting(soapShards, "soap_shards");
+    loader.getSetting(soapShardAffinity, "soap_shard_affinity");
+    loader.getSetting(soapIoUring, "soap_io_uring");
+    loader.getSetting(soapGatherSend, "soap_gather_send");
+    loader.getSetting(unixSocket, "unix_socket");
+    loader.getSetting(httpsPort, "https_port");
+    loader.getSetting(httpsCertificate, "https_certificate");
+    loader.getSetting(httpsKey, "https_key");
+    loader.getSetting(httpCompression, "http_compression");
+    loader.getSetting(compressionThreshold, "compression_threshold");
     loader.getSetting(user, "user");
     loader.getSetting(password, "password");
     loader.getSetting(manufacturer, "manufacturer");
@@ -33,9 +44,33 @@ void Configuration::loadAllSettings(ConfigLoader &loader)
     loader.getSetting(firmware_version, "firmware_ver");
     loader.getSetting(serial_number, "serial_num");
     loader.getSetting(hardware_id, "hardware_id");
-    loader.getSetting(interfaces, "interfaces");
+    loader.getSetting(interfaceListeners, "interface_listeners");
     loader.getSetting(tz_format, "tz_format");
 
+    // PTZ
+    loader.getSetting(ptz, "ptz");
+    loader.getSetting(ptzMoveLeft, "ptz_move_left");
+    loader.getSetting(ptzMoveRight, "ptz_move_right");
+    loader.getSetting(ptzMoveUp, "ptz_move_up");
+    loader.getSetting(ptzMoveDown, "ptz_move_down");
+    loader.getSetting(ptzMoveStop, "ptz_move_stop");
+    loader.getSetting(ptzMovePreset, "ptz_move_preset");
+    loader.getSetting(ptzSetPreset, "ptz_set_preset");
+    loader.getSetting(ptzZoomIn, "ptz_zoom_in");
+    loader.getSetting(ptzZoomOut, "ptz_zoom_out");
+    loader.getSetting(ptzZoomStop, "ptz_zoom_stop");
+    loader.getArray(ptzSpeeds, "ptz_speeds");
+    loader.getSetting(ptzCommandTimeout, "ptz_command_timeout");
+    loader.getSetting(ptzMaxPresets, "ptz_max_presets");
+    loader.getSetting(ptzPresetJournal, "ptz_preset_journal");
+    loader.getSetting(ptzPanTiltRate, "ptz_pan_tilt_rate");
+    loader.getSetting(ptzZoomRate, "ptz_zoom_rate");
+    loader.getSetting(ptzPositionFile, "ptz_position_file");
+    loader.getArray(ptzPanLimits, "ptz_pan_limits");
+    loader.getArray(ptzTiltLimits, "ptz_tilt_limits");
+    loader.getArray(ptzZoomLimits, "ptz_zoom_limits");
+
+    loader.getArray(interfaces, "interfaces");
     loader.getArray(scopes, "scopes");
     loader.getArray(profiles, "profiles");
     loader.getArray(rtspStreams, "rtspStreams");
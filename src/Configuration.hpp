@@ -3,6 +3,7 @@
 #include "ConfigLoader.hpp"
 #include "ServiceContext.h"
 #include "eth_dev_param.h"
+#include <array>
 #include <map>
 #include <optional>
 #include <string>
@@ -95,6 +96,7 @@ struct RTSPStreams
     std::string rtspUrl{};
     bool testStream{};
     std::string testStreamSrc{};
+    std::string warm{}; // "prepared" or "suspended" keeps the media ready between clients, optional
 
     RTSPStreams() = default;
     RTSPStreams(libconfig::Setting const &wf)
@@ -104,6 +106,7 @@ struct RTSPStreams
             wf.lookupValue("rtspUrl", rtspUrl) && wf.lookupValue("testStream", testStream) &&
             wf.lookupValue("testStreamSrc", testStreamSrc))
         {
+            wf.lookupValue("warm", warm);
             return;
         }
         throw std::runtime_error("waveform config parse error");
@@ -148,9 +151,20 @@ struct Configuration
     int logFileSizeMb{0};
     int logFileCount{0};
     bool logAsync{false};
+    int drainTimeout{30}; // seconds the old binary keeps serving RTSP clients after a handover
 
     // ONVIF Service Options
     int port{1000};
+    int soapShards{1};           // SOAP listener threads, each with its own SO_REUSEPORT socket when above 1
+    bool soapShardAffinity{false}; // pin every shard to its own CPU
+    bool soapIoUring{false};       // io_uring transport, falls back to the default one without kernel support
+    bool soapGatherSend{true};     // gather each response and write it with one sendmsg()
+    std::string unixSocket{};      // SOAP listener for co-located clients, none when empty
+    int httpsPort{0};              // HTTPS listener, none when 0; port 0 leaves HTTPS only
+    std::string httpsCertificate{"/etc/onvif_srvd/server.crt"}; // PEM chain, replaced by LoadCertificates
+    std::string httpsKey{"/etc/onvif_srvd/server.key"};
+    bool httpCompression{true};      // gzip/deflate responses for clients sending Accept-Encoding
+    int compressionThreshold{1024}; // bytes, smaller responses are sent plain
     std::string user{"admin"};
     std::string password{"admin"};
     std::string manufacturer{"Rinicom"};
@@ -158,9 +172,33 @@ struct Configuration
     std::string firmware_version{"UNKNOWN"};
     std::string serial_number{"UNKNOWN"};
     std::string hardware_id{"UNKNOWN"};
-    std::string interfaces{"enp5s0"};
+    std::vector<std::string> interfaces{"enp5s0"};
+    bool interfaceListeners{false}; // one SOAP listener bound to each interface instead of the wildcard one
     std::string tz_format{"0"};
 
+    // PTZ, shell commands driving the pan/tilt head
+    bool ptz{false};
+    std::string ptzMoveLeft{}; // "%s" in the move and zoom commands is replaced by the speed value
+    std::string ptzMoveRight{};
+    std::string ptzMoveUp{};
+    std::string ptzMoveDown{};
+    std::string ptzMoveStop{};
+    std::string ptzMovePreset{}; // "%t" is replaced by the preset token
+    std::string ptzSetPreset{};  // stores the current position under "%t" in the head, optional
+    std::string ptzZoomIn{};
+    std::string ptzZoomOut{};
+    std::string ptzZoomStop{};     // ptz_move_stop ends the zoom too when empty
+    std::vector<int> ptzSpeeds{};  // speed values of the backend, slowest first; one fixed speed when empty
+    int ptzCommandTimeout{2000};   // ms a command may run before its shell is killed and restarted
+    int ptzMaxPresets{8};
+    std::string ptzPresetJournal{"/var/lib/onvif_srvd/presets.journal"};
+    float ptzPanTiltRate{0.2f};  // generic position units per second at full speed, for dead reckoning
+    float ptzZoomRate{0.1f};
+    std::string ptzPositionFile{}; // "pan tilt zoom" written by the backend, dead reckoning only when empty
+    std::array<float, 2> ptzPanLimits{-1.0f, 1.0f}; // min, max of the generic position spaces
+    std::array<float, 2> ptzTiltLimits{-1.0f, 1.0f};
+    std::array<float, 2> ptzZoomLimits{0.0f, 1.0f};
+
     std::vector<Scopes> scopes{Scopes{0}, Scopes{1}, Scopes{2}, Scopes{3}};
     std::vector<Profiles> profiles{Profiles{0}, Profiles{1}};
     std::vector<RTSPStreams> rtspStreams{RTSPStreams{0}, RTSPStreams{1}};
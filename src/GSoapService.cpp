@@ -1,4 +1,328 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <map>
+#include <cstring>
+#include <mutex>
+#include <poll.h>
+#include <sched.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <utility>
+
 #include "GSoapService.hpp"
+#include "ListenSockets.hpp"
+#include "UringTransport.hpp"
+#include "VectoredSend.hpp"
+
+
+/*******************************************************************************
+ * Listening sockets by address (port and shard, or unix socket path)
+ *
+ * The socket is bound once and handed to every GSoapInstance created for the
+ * port, so an instance restarted by ThreadWarden accepts on the same socket and
+ * the connections waiting in the backlog are not refused. Only a failure of
+ * the socket itself releases it, the next instance then binds a new one.
+ * A socket inherited from systemd or a previous binary is used before binding.
+ *
+ * Sharded instances each bind their own socket with SO_REUSEPORT, the kernel
+ * spreads new connections over them. A shard that can not (the port is held
+ * by an inherited socket without SO_REUSEPORT) shares the socket of another.
+ ******************************************************************************/
+static constexpr int g_listenBacklog = 128;
+
+static std::mutex g_listenersMutex;
+static std::map<std::string, SOAP_SOCKET> g_listeners;
+
+
+static int listener_port(ServiceContext const &ctx)
+{
+    return ctx.listener_https ? ctx.https_port : ctx.port;
+}
+
+
+// listeners of the same address, the shards of one share this prefix
+static std::string listener_group(ServiceContext const &ctx)
+{
+    return ctx.listener_interface + ":" + std::to_string(listener_port(ctx)) + "/";
+}
+
+
+static std::string listener_key(ServiceContext const &ctx)
+{
+    if (ctx.listener_unix)
+        return "unix:" + ctx.unix_socket;
+    return listener_group(ctx) + std::to_string(ctx.listener_shard);
+}
+
+
+/*******************************************************************************
+ * Dual-stack listener on all addresses, with SO_REUSEPORT for a shard
+ *
+ * The listener of one interface is bound to the device rather than to its
+ * addresses, it serves every IPv4 and IPv6 address the interface has now or
+ * gets later. Falls back to IPv4 when the kernel has no IPv6.
+ ******************************************************************************/
+static SOAP_SOCKET bind_inet(std::string const &device, int port, bool reusePort)
+{
+    int const on = 1;
+    int const off = 0;
+
+    sockaddr_in6 addr6{};
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_addr = in6addr_any;
+    addr6.sin6_port = htons(static_cast<uint16_t>(port));
+
+    sockaddr_in addr4{};
+    addr4.sin_family = AF_INET;
+    addr4.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr4.sin_port = addr6.sin6_port;
+
+    SOAP_SOCKET sock = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool const dualStack = soap_valid_socket(sock);
+    if (!dualStack)
+        sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (!soap_valid_socket(sock))
+        return SOAP_INVALID_SOCKET;
+
+    sockaddr const *addr =
+        dualStack ? reinterpret_cast<sockaddr const *>(&addr6) : reinterpret_cast<sockaddr const *>(&addr4);
+    socklen_t const len = dualStack ? sizeof(addr6) : sizeof(addr4);
+
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+        (dualStack && setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off))) ||
+        (reusePort && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) ||
+        (!device.empty() && setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, device.c_str(), device.size())) ||
+        bind(sock, addr, len) || listen(sock, g_listenBacklog))
+    {
+        close(sock);
+        return SOAP_INVALID_SOCKET;
+    }
+
+    return sock;
+}
+
+
+/*******************************************************************************
+ * Local listener, a stale socket file left by a crash is replaced
+ ******************************************************************************/
+static SOAP_SOCKET bind_unix(std::string const &path)
+{
+    sockaddr_un addr{};
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return SOAP_INVALID_SOCKET;
+
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    struct stat st;
+    if (!lstat(path.c_str(), &st) && S_ISSOCK(st.st_mode))
+        unlink(path.c_str());
+
+    SOAP_SOCKET sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (!soap_valid_socket(sock))
+        return SOAP_INVALID_SOCKET;
+
+    if (bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) || listen(sock, g_listenBacklog))
+    {
+        close(sock);
+        return SOAP_INVALID_SOCKET;
+    }
+
+    // co-located clients run under their own accounts
+    chmod(path.c_str(), 0666);
+    return sock;
+}
+
+
+static SOAP_SOCKET acquire_listener(struct soap *soap, ServiceContext const &ctx)
+{
+    std::lock_guard<std::mutex> lock(g_listenersMutex);
+
+    int const port = listener_port(ctx);
+    int const shard = ctx.listener_shard;
+
+    auto it = g_listeners.find(listener_key(ctx));
+    if (it == g_listeners.end() && ctx.listener_unix)
+    {
+        SOAP_SOCKET sock = ListenSockets::take(ctx.unix_socket);
+        if (!soap_valid_socket(sock))
+            sock = bind_unix(ctx.unix_socket);
+        if (!soap_valid_socket(sock))
+            return SOAP_INVALID_SOCKET;
+
+        it = g_listeners.emplace(listener_key(ctx), sock).first;
+        ListenSockets::hold(sock);
+    }
+    else if (it == g_listeners.end())
+    {
+        SOAP_SOCKET sock = ListenSockets::take(port, ctx.listener_interface);
+
+        if (!soap_valid_socket(sock))
+            sock = bind_inet(ctx.listener_interface, port, shard >= 0);
+
+        if (!soap_valid_socket(sock) && shard >= 0)
+        {
+            std::string const prefix = listener_group(ctx);
+            it = std::find_if(g_listeners.begin(), g_listeners.end(),
+                              [&prefix](auto const &listener) { return !listener.first.compare(0, prefix.size(), prefix); });
+            if (it == g_listeners.end())
+                return SOAP_INVALID_SOCKET;
+            sock = it->second;
+        }
+        else if (!soap_valid_socket(sock))
+        {
+            return SOAP_INVALID_SOCKET;
+        }
+
+        it = g_listeners.emplace(listener_key(ctx), sock).first;
+        ListenSockets::hold(sock);
+    }
+
+    soap->master = it->second;
+    soap->port = ctx.listener_unix ? 0 : port;
+    return it->second;
+}
+
+
+static void release_listener(ServiceContext const &ctx)
+{
+    std::lock_guard<std::mutex> lock(g_listenersMutex);
+
+    auto it = g_listeners.find(listener_key(ctx));
+    if (it == g_listeners.end())
+        return;
+
+    SOAP_SOCKET sock = it->second;
+    g_listeners.erase(it);
+
+    // still in use by another shard
+    for (auto const &listener : g_listeners)
+        if (listener.second == sock)
+            return;
+
+    ListenSockets::release(sock);
+}
+
+
+/*******************************************************************************
+ * soap_accept() for the unix socket listener
+ *
+ * soap_accept() sets TCP options on the client socket, so a local client is
+ * accepted here and handed to gSOAP the way an inetd socket would be. The
+ * client has no IP address, soap->ip stays 0.
+ ******************************************************************************/
+static SOAP_SOCKET accept_local(struct soap *soap)
+{
+    soap->errnum = 0;
+
+    pollfd listener{soap->master, POLLIN, 0};
+    int ready = poll(&listener, 1, soap->accept_timeout > 0 ? soap->accept_timeout * 1000 : -1);
+    if (ready <= 0)
+    {
+        // timeout or signal, like the accept_timeout of soap_accept()
+        soap->errnum = ready < 0 && errno != EINTR ? errno : 0;
+        return SOAP_INVALID_SOCKET;
+    }
+
+    if (listener.revents & (POLLERR | POLLNVAL))
+    {
+        soap->errnum = EBADF;
+        return SOAP_INVALID_SOCKET;
+    }
+
+    SOAP_SOCKET sock = accept4(soap->master, NULL, NULL, SOCK_CLOEXEC);
+    if (!soap_valid_socket(sock))
+    {
+        soap->errnum = errno;
+        return SOAP_INVALID_SOCKET;
+    }
+
+    soap->socket = sock;
+    soap->ip = 0;
+    soap->port = 0;
+    soap->keep_alive = (((soap->imode | soap->omode) & SOAP_IO_KEEPALIVE) != 0);
+    return sock;
+}
+
+
+/*******************************************************************************
+ * Client address of the accepted connection into the context of the instance
+ *
+ * Read from the socket rather than from soap->ip, which only holds IPv4.
+ ******************************************************************************/
+static void read_peer(SOAP_SOCKET sock, ServiceContext &ctx)
+{
+    sockaddr_storage peer{};
+    socklen_t len = sizeof(peer);
+
+    ctx.client_address = {};
+    ctx.client_scope = 0;
+
+    if (getpeername(sock, reinterpret_cast<sockaddr *>(&peer), &len))
+        return;
+
+    if (peer.ss_family == AF_INET)
+    {
+        ctx.client_address = InterfaceEndpoints::mapped(reinterpret_cast<sockaddr_in const &>(peer).sin_addr.s_addr);
+    }
+    else if (peer.ss_family == AF_INET6)
+    {
+        sockaddr_in6 const &peer6 = reinterpret_cast<sockaddr_in6 const &>(peer);
+        memcpy(ctx.client_address.data(), peer6.sin6_addr.s6_addr, ctx.client_address.size());
+        ctx.client_scope = peer6.sin6_scope_id;
+    }
+}
+
+
+/*******************************************************************************
+ * Pin the calling thread to the n-th CPU it is allowed to run on
+ ******************************************************************************/
+static void pin_to_cpu(int n)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        return;
+
+    int count = CPU_COUNT(&allowed);
+    if (count <= 1)
+        return;
+
+    int target = n % count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (!CPU_ISSET(cpu, &allowed) || target--)
+            continue;
+
+        cpu_set_t pinned;
+        CPU_ZERO(&pinned);
+        CPU_SET(cpu, &pinned);
+        sched_setaffinity(0, sizeof(pinned), &pinned);
+        arms::log<arms::LOG_INFO>("SOAP shard {} pinned to CPU {}", n, cpu);
+        return;
+    }
+}
+
+
+/*******************************************************************************
+ * accept() errors that mean the listening socket itself is unusable, anything
+ * else (out of descriptors, aborted handshake, signal) only affects one client
+ ******************************************************************************/
+static bool is_listener_failure(int err)
+{
+    switch (err)
+    {
+    case EBADF:
+    case ENOTSOCK:
+    case EINVAL:
+    case EOPNOTSUPP:
+        return true;
+    default:
+        return false;
+    }
+}
 
 // GSoapInstance Functions
 /*******************************************************************************
@@ -8,14 +332,15 @@
  ******************************************************************************/
 GSoapInstance::GSoapInstance(ServiceContext service_ctx)
     : serviceCtx(std::move(service_ctx)), gSoap{}, DeviceBindingService_inst{gSoap.getSoapPtr()},
-      MediaBindingService_inst{gSoap.getSoapPtr()}, PTZBindingService_inst{gSoap.getSoapPtr()}
+      MediaBindingService_inst{gSoap.getSoapPtr()}, PTZBindingService_inst{gSoap.getSoapPtr()},
+      ImagingBindingService_inst{gSoap.getSoapPtr()}
 {
     if (!gSoap.getSoapPtr())
         throw std::out_of_range("soap context is empty");
 
     gSoap.getSoapPtr()->bind_flags = SO_REUSEADDR;
 
-    if (!soap_valid_socket(soap_bind(gSoap.getSoapPtr(), NULL, serviceCtx.port, 10)))
+    if (!soap_valid_socket(acquire_listener(gSoap.getSoapPtr(), serviceCtx)))
     {
         soap_stream_fault(gSoap.getSoapPtr(), std::cerr);
         exit(EXIT_FAILURE);
@@ -23,8 +348,19 @@ GSoapInstance::GSoapInstance(ServiceContext service_ctx)
 
     gSoap.getSoapPtr()->fget = http_get;
 
+    if (serviceCtx.soap_io_uring)
+        UringTransport::attach(gSoap.getSoapPtr());
+
+    // gathers above the transport, compression above both
+    if (serviceCtx.soap_gather_send)
+        VectoredSend::attach(gSoap.getSoapPtr(), serviceCtx.metrics.get());
+
+    if (serviceCtx.compression && !serviceCtx.compression->attach(gSoap.getSoapPtr()))
+        arms::log<arms::LOG_INFO>("Response compression not available");
+
     gSoap.getSoapPtr()->send_timeout = 3; // timeout in sec
     gSoap.getSoapPtr()->recv_timeout = 3; // timeout in sec
+    gSoap.getSoapPtr()->accept_timeout = 1; // timeout in sec, lets stop() through while idle
 
     // save pointer of service_ctx in soap
     gSoap.getSoapPtr()->user = (void *)&serviceCtx;
@@ -41,7 +377,9 @@ GSoapInstance::GSoapInstance(ServiceContext service_ctx)
  ******************************************************************************/
 GSoapInstance::~GSoapInstance()
 {
-    return;
+    // soap_done() would close the listening socket, the next instance reuses it
+    if (keepListener)
+        gSoap.getSoapPtr()->master = SOAP_INVALID_SOCKET;
 }
 
 
@@ -52,35 +390,174 @@ GSoapInstance::~GSoapInstance()
  * function essentially runs like a while(1) loop until ThreadWarden tells
  * gSoap to stop runing.
  *
+ * A bad request is answered with a SOAP fault and counted, only a failure of
+ * the listening socket makes ThreadWarden restart the instance.
+ *
  * @return 1 if error, 0 if okay
  ******************************************************************************/
 int GSoapInstance::work()
 {
+    struct soap *soap = gSoap.getSoapPtr();
+    ServiceMetrics &metrics = *serviceCtx.metrics;
+
+    // work() runs on the ThreadWarden thread, the constructor may not
+    if (!pinned && serviceCtx.listener_affinity && serviceCtx.listener_shard >= 0)
+        pin_to_cpu(serviceCtx.listener_shard);
+    pinned = true;
+
     // wait new client
-    if (!soap_valid_socket(soap_accept(gSoap.getSoapPtr())))
-        sleep(1);
+    if (!soap_valid_socket(serviceCtx.listener_unix ? accept_local(soap) : soap_accept(soap)))
     {
+        // accept_timeout expired
+        if (soap_valid_socket(soap->master) && soap->errnum == 0)
+            return 0;
+
+        soap_stream_fault(soap, std::cerr);
+
+        if (!soap_valid_socket(soap->master) || is_listener_failure(soap->errnum))
+        {
+            arms::log<arms::LOG_INFO>("SOAP listener failed, rebinding");
+            release_listener(serviceCtx);
+            keepListener = false;
+            metrics.listenerRestarts++;
+            if (serviceCtx.on_listener_failure)
+                serviceCtx.on_listener_failure();
+            return 1;
+        }
+
+        // e.g. out of file descriptors, give the clients a moment to go away
         arms::log<arms::LOG_INFO>("SOAP Invalid Socket");
-        soap_stream_fault(gSoap.getSoapPtr(), std::cerr);
+        metrics.acceptErrors++;
+        usleep(100000);
+        return 0;
+    }
+
+    serviceCtx.request_received = std::chrono::steady_clock::now();
+    read_peer(soap->socket, serviceCtx);
+
+    // refused before a byte of the request is read
+    if (!serviceCtx.listener_unix && !serviceCtx.ip_filter->permits(serviceCtx.client_address))
+    {
+        metrics.rejectedClients++;
+        soap_force_closesock(soap);
+        soap_destroy(soap);
+        soap_end(soap);
+        return 0;
+    }
+
+    if (serviceCtx.listener_https && !startTls(soap))
+    {
+        soap_force_closesock(soap);
+        soap_destroy(soap);
+        soap_end(soap);
+        return 0;
+    }
+
+    metrics.requests++;
+
+    ServiceSet services{FOREACH_SERVICE(ROUTE_TARGET, soap)};
+
+    try
+    {
+        serve(services);
+    }
+    catch (std::exception const &e)
+    {
+        arms::log<arms::LOG_INFO>("SOAP handler exception: {}", e.what());
+        metrics.handlerExceptions++;
+        soap_receiver_fault(soap, "Internal error", e.what());
+        reportFault(soap);
+    }
+
+    soap_destroy(soap); // delete managed C++ objects
+    soap_end(soap);     // delete managed memory
+    return 0;
+}
+
+
+/*******************************************************************************
+ * TLS handshake of an accepted HTTPS client
+ *
+ * The SSL_CTX is the one shared by all HTTPS listeners, taken again only after
+ * a certificate was installed; a client that resumes its session costs no key
+ * exchange.
+ ******************************************************************************/
+bool GSoapInstance::startTls(struct soap *soap)
+{
+    ServiceMetrics &metrics = *serviceCtx.metrics;
+
+    if (!soap->ctx || tlsGeneration != serviceCtx.tls->generation())
+    {
+        if (soap->ctx)
+            SSL_CTX_free(soap->ctx);
+        soap->ctx = serviceCtx.tls->acquire(tlsGeneration);
+    }
+
+    if (!soap->ctx || soap_ssl_accept(soap))
+    {
+        metrics.tlsFailures++;
+        return false;
     }
 
+    metrics.tlsHandshakes++;
+    if (SSL_session_reused(soap->ssl))
+        metrics.tlsResumed++;
+#ifdef BIO_get_ktls_send
+    if (BIO_get_ktls_send(SSL_get_wbio(soap->ssl)))
+        metrics.tlsKernelOffload++;
+#endif
+
+    return true;
+}
+
+
+/*******************************************************************************
+ * Parse one request and hand it to the service serving its operation
+ ******************************************************************************/
+void GSoapInstance::serve(ServiceSet const &services)
+{
+    struct soap *soap = gSoap.getSoapPtr();
+
     // process service
-    if (soap_begin_serve(gSoap.getSoapPtr()))
+    if (soap_begin_serve(soap))
     {
-        arms::log<arms::LOG_INFO>("Process Service");
-        soap_stream_fault(gSoap.getSoapPtr(), std::cerr);
+        // GET requests are answered by http_get and end with SOAP_STOP
+        if (soap->error != SOAP_STOP && soap->error != SOAP_EOF)
+        {
+            arms::log<arms::LOG_INFO>("Malformed request");
+            serviceCtx.metrics->malformedRequests++;
+        }
+        reportFault(soap);
+    }
+    else if (ServiceRouter::dispatch(soap, services) != SOAP_NO_METHOD)
+    {
+        reportFault(soap);
     }
-    FOREACH_SERVICE(DISPATCH_SERVICE, gSoap.getSoapPtr())
+    FOREACH_SERVICE(DISPATCH_SERVICE, soap)
     else
     {
+        // soap->error is SOAP_NO_METHOD, the client gets a "method not implemented" fault
         arms::log<arms::LOG_INFO>("Unknown service");
-        return 1;
+        serviceCtx.metrics->unknownOperations++;
+        reportFault(soap);
     }
+}
 
-    arms::log<arms::LOG_INFO>("Soap Destroy");
-    soap_destroy(gSoap.getSoapPtr()); // delete managed C++ objects
-    soap_end(gSoap.getSoapPtr());     // delete managed memory
-    return 0;
+
+/*******************************************************************************
+ * Send the fault of a failed request, if any, and count it
+ ******************************************************************************/
+void GSoapInstance::reportFault(struct soap *soap)
+{
+    bool const failed = soap->error != SOAP_OK && soap->error != SOAP_STOP && soap->error != SOAP_EOF;
+
+    soap_send_fault(soap);
+
+    if (failed)
+    {
+        serviceCtx.metrics->faults++;
+        soap_stream_fault(soap, std::cerr);
+    }
 }
 
 
@@ -114,6 +591,8 @@ int GSoapInstance::http_get(struct soap* soap)
 {
     if (strchr(soap->path + 1, '/') || strchr(soap->path + 1, '\\'))
         return 403;
+    if (!soap_tag_cmp(soap->path, "/metrics"))
+        return copy_metrics(soap);
     if (!soap_tag_cmp(soap->path, "*.html"))
         return copy_file(soap, soap->path + 1, "text/html");
     if (!soap_tag_cmp(soap->path, "*.xml") || !soap_tag_cmp(soap->path, "*.xsd")
@@ -170,3 +649,26 @@ int GSoapInstance::copy_file(struct soap *soap, const char *name, const char *ty
     fclose(fd);
     return soap_end_send(soap);
 }
+
+
+/*******************************************************************************
+ * Copy Metrics
+ *
+ * Serves the counters of the SOAP listener in the Prometheus text format so
+ * a scraper can watch faults and restarts without parsing the log
+ *
+ * @return SOAP Status
+ ******************************************************************************/
+int GSoapInstance::copy_metrics(struct soap *soap)
+{
+    ServiceContext *ctx = (ServiceContext *)soap->user;
+    std::string const text = ctx->metrics->render();
+
+    soap->http_content = "text/plain; version=0.0.4";
+    if (soap_response(soap, SOAP_FILE) || soap_send_raw(soap, text.c_str(), text.size()))
+    {
+        soap_end_send(soap);
+        return soap->error;
+    }
+    return soap_end_send(soap);
+}
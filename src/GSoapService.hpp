@@ -8,6 +8,7 @@
 #include "soapDeviceBindingService.h"
 #include "soapMediaBindingService.h"
 #include "soapPTZBindingService.h"
+#include "soapImagingBindingService.h"
 
 // ---- armoury ----
 #include "armoury/files.hpp"
@@ -17,6 +18,7 @@
     APPLY(DeviceBindingService, soap)                                                                                    \
     APPLY(MediaBindingService, soap)                                                                                     \
     APPLY(PTZBindingService, soap)                                                                                       \
+    APPLY(ImagingBindingService, soap)                                                                                   \
     /*                                                                                                                   \
      * If you need support for other services,                                                                           \
      * add the desired option to the macro FOREACH_SERVICE.                                                              \
@@ -26,8 +28,6 @@
                                                                                                                        \ \
                                                                                                                        \ \
                                                                                                                        \ \
-            APPLY(ImagingBindingService, soap)                                                                           \
-            APPLY(PTZBindingService, soap)                                                                               \
             APPLY(RecordingBindingService, soap)                                                                         \
             APPLY(ReplayBindingService, soap)                                                                            \
             APPLY(SearchBindingService, soap)                                                                            \
@@ -46,10 +46,37 @@
 #define DISPATCH_SERVICE(service, soap)                                                                                \
     else if (service##_inst.dispatch() != SOAP_NO_METHOD)                                                              \
     {                                                                                                                  \
-        soap_send_fault(soap);                                                                                         \
-        soap_stream_fault(soap, std::cerr);                                                                            \
+        reportFault(soap);                                                                                             \
     }
 
+#define DECLARE_ROUTE_TARGET(service, soap) service *service##_inst;
+
+#define ROUTE_TARGET(service, soap) &service##_inst,
+
+
+/*******************************************************************************
+ * Service instances the routing table can hand a request to
+ ******************************************************************************/
+struct ServiceSet
+{
+    FOREACH_SERVICE(DECLARE_ROUTE_TARGET, soap)
+};
+
+
+/*******************************************************************************
+ * Operation router
+ *
+ * Maps the QName of the request body element straight to the generated serve
+ * function of the owning service through a perfect hash built at compile time
+ * from the dispatcher tables extracted by build-gsoap.sh. Requests it does not
+ * know are left to the dispatch() chain of FOREACH_SERVICE.
+ ******************************************************************************/
+class ServiceRouter
+{
+  public:
+    static int dispatch(struct soap *soap, ServiceSet const &services);
+};
+
 
 /*******************************************************************************
  * Wrapper structure to hold gSoap instance
@@ -112,13 +139,22 @@ class GSoapInstance
     void checkServiceCtx();
     static int http_get(struct soap* soap);
     static int copy_file(struct soap*, const char*, const char*);	/* copy file as HTTP response */
+    static int copy_metrics(struct soap*);                  	/* listener counters as HTTP response */
 
   private:
+    void serve(ServiceSet const &services);
+    void reportFault(struct soap *soap);
+    bool startTls(struct soap *soap);
+
     ServiceContext serviceCtx;
     GSoapWrapper gSoap;
+    bool keepListener{true};
+    bool pinned{false};
+    uint64_t tlsGeneration{0}; // of the SSL_CTX in soap->ctx
     DeviceBindingService DeviceBindingService_inst;
     MediaBindingService MediaBindingService_inst;
     PTZBindingService PTZBindingService_inst;
+    ImagingBindingService ImagingBindingService_inst;
 };
 
 #endif // GSOAPSERVICE_H
@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstring>
+
+#include "IPAddressFilter.hpp"
+
+
+namespace
+{
+
+using Address = IPAddressFilter::Address;
+
+constexpr int g_mappedOffset = 96; // bits in front of an IPv4-mapped address
+
+
+struct ParsedPrefix
+{
+    Address key{};
+    int length{0}; // in bits of the 128 bit key
+};
+
+
+Address mapped_ipv4(uint32_t ipv4)
+{
+    Address key{};
+    key[10] = key[11] = 0xff;
+    key[12] = static_cast<uint8_t>(ipv4 >> 24);
+    key[13] = static_cast<uint8_t>(ipv4 >> 16);
+    key[14] = static_cast<uint8_t>(ipv4 >> 8);
+    key[15] = static_cast<uint8_t>(ipv4);
+    return key;
+}
+
+
+bool parse_prefix(IPAddressFilter::Prefix const &prefix, bool ipv6, ParsedPrefix &parsed)
+{
+    if (ipv6)
+    {
+        if (prefix.length < 0 || prefix.length > 128 ||
+            inet_pton(AF_INET6, prefix.address.c_str(), parsed.key.data()) != 1)
+            return false;
+        parsed.length = prefix.length;
+        return true;
+    }
+
+    in_addr addr;
+    if (prefix.length < 0 || prefix.length > 32 || inet_pton(AF_INET, prefix.address.c_str(), &addr) != 1)
+        return false;
+
+    parsed.key = mapped_ipv4(ntohl(addr.s_addr));
+    parsed.length = g_mappedOffset + prefix.length;
+    return true;
+}
+
+
+inline int bit_at(Address const &key, int bit)
+{
+    return (key[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+
+// the first length bits of both keys are equal
+bool same_prefix(Address const &a, Address const &b, int length)
+{
+    int const bytes = length >> 3;
+    if (memcmp(a.data(), b.data(), bytes))
+        return false;
+
+    int const rest = length & 7;
+    if (!rest)
+        return true;
+
+    uint8_t const mask = static_cast<uint8_t>(0xff << (8 - rest));
+    return !((a[bytes] ^ b[bytes]) & mask);
+}
+
+
+bool same_entry(IPAddressFilter::Prefix const &a, IPAddressFilter::Prefix const &b, bool ipv6)
+{
+    ParsedPrefix pa, pb;
+    return parse_prefix(a, ipv6, pa) && parse_prefix(b, ipv6, pb) && pa.length == pb.length &&
+           same_prefix(pa.key, pb.key, pa.length);
+}
+
+} // namespace
+
+
+/*******************************************************************************
+ * Path compressed binary trie
+ *
+ * Each node stores the key bits from the root down to its depth. A node whose
+ * prefix is in the list is terminal and has no children, every address below
+ * it matches.
+ ******************************************************************************/
+struct IPAddressFilter::Compiled
+{
+    struct Node
+    {
+        Address key{};
+        int depth{0};
+        bool terminal{false};
+        int32_t child[2]{-1, -1};
+    };
+
+    bool allow{false};
+    bool empty{true};
+    std::vector<Node> nodes;
+
+    explicit Compiled(std::vector<ParsedPrefix> const &prefixes, bool allowList);
+
+    bool matches(Address const &key) const
+    {
+        int32_t index = nodes.empty() ? -1 : 0;
+
+        while (index >= 0)
+        {
+            Node const &node = nodes[index];
+            if (!same_prefix(key, node.key, node.depth))
+                return false;
+            if (node.terminal)
+                return true;
+            if (node.depth == 128)
+                return false;
+            index = node.child[bit_at(key, node.depth)];
+        }
+        return false;
+    }
+
+    bool permits(Address const &key) const
+    {
+        return empty || matches(key) == allow;
+    }
+
+  private:
+    struct RawNode
+    {
+        int32_t child[2]{-1, -1};
+        bool terminal{false};
+    };
+
+    int32_t compress(std::vector<RawNode> const &raw, int32_t index, int depth, Address key);
+};
+
+
+IPAddressFilter::Compiled::Compiled(std::vector<ParsedPrefix> const &prefixes, bool allowList)
+    : allow{allowList}, empty{prefixes.empty()}
+{
+    if (empty)
+        return;
+
+    // uncompressed trie, one node per bit
+    std::vector<RawNode> raw(1);
+    for (ParsedPrefix const &prefix : prefixes)
+    {
+        int32_t index = 0;
+        for (int depth = 0; depth < prefix.length && !raw[index].terminal; ++depth)
+        {
+            int const bit = bit_at(prefix.key, depth);
+            if (raw[index].child[bit] < 0)
+            {
+                raw[index].child[bit] = static_cast<int32_t>(raw.size());
+                raw.emplace_back();
+            }
+            index = raw[index].child[bit];
+        }
+        raw[index].terminal = true;
+    }
+
+    compress(raw, 0, 0, Address{});
+}
+
+
+int32_t IPAddressFilter::Compiled::compress(std::vector<RawNode> const &raw, int32_t index, int depth, Address key)
+{
+    // skip the chain of single child nodes
+    while (!raw[index].terminal && (raw[index].child[0] < 0) != (raw[index].child[1] < 0))
+    {
+        int const bit = raw[index].child[1] >= 0;
+        if (bit)
+            key[depth >> 3] |= static_cast<uint8_t>(0x80 >> (depth & 7));
+        index = raw[index].child[bit];
+        ++depth;
+    }
+
+    int32_t const compiled = static_cast<int32_t>(nodes.size());
+    nodes.push_back(Node{key, depth, raw[index].terminal, {-1, -1}});
+
+    if (raw[index].terminal)
+        return compiled;
+
+    for (int bit = 0; bit < 2; ++bit)
+    {
+        if (raw[index].child[bit] < 0)
+            continue;
+
+        Address childKey = key;
+        if (bit)
+            childKey[depth >> 3] |= static_cast<uint8_t>(0x80 >> (depth & 7));
+
+        int32_t child = compress(raw, raw[index].child[bit], depth + 1, childKey);
+        nodes[compiled].child[bit] = child;
+    }
+
+    return compiled;
+}
+
+
+IPAddressFilter::IPAddressFilter() : m_compiled{std::make_shared<Compiled const>(std::vector<ParsedPrefix>{}, false)}
+{
+}
+
+
+IPAddressFilter::Rules IPAddressFilter::get() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_rules;
+}
+
+
+bool IPAddressFilter::set(Rules rules)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return apply(std::move(rules));
+}
+
+
+bool IPAddressFilter::add(Rules const &rules)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Rules merged = m_rules;
+    if (merged.ipv4.empty() && merged.ipv6.empty())
+        merged.type = rules.type;
+
+    auto merge = [](std::vector<Prefix> &list, std::vector<Prefix> const &added, bool ipv6) {
+        for (Prefix const &prefix : added)
+            if (std::none_of(list.begin(), list.end(),
+                             [&](Prefix const &existing) { return same_entry(existing, prefix, ipv6); }))
+                list.push_back(prefix);
+    };
+    merge(merged.ipv4, rules.ipv4, false);
+    merge(merged.ipv6, rules.ipv6, true);
+
+    return apply(std::move(merged));
+}
+
+
+bool IPAddressFilter::remove(Rules const &rules)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Rules remaining = m_rules;
+
+    auto drop = [](std::vector<Prefix> &list, std::vector<Prefix> const &removed, bool ipv6) {
+        for (Prefix const &prefix : removed)
+            list.erase(std::remove_if(list.begin(), list.end(),
+                                      [&](Prefix const &existing) { return same_entry(existing, prefix, ipv6); }),
+                       list.end());
+    };
+    drop(remaining.ipv4, rules.ipv4, false);
+    drop(remaining.ipv6, rules.ipv6, true);
+
+    return apply(std::move(remaining));
+}
+
+
+bool IPAddressFilter::permits(Address const &client) const
+{
+    return std::atomic_load(&m_compiled)->permits(client);
+}
+
+
+/*******************************************************************************
+ * Validate and compile the rules, then publish them (m_mutex held)
+ ******************************************************************************/
+bool IPAddressFilter::apply(Rules rules)
+{
+    std::vector<ParsedPrefix> parsed;
+    parsed.reserve(rules.ipv4.size() + rules.ipv6.size());
+
+    for (Prefix const &prefix : rules.ipv4)
+        if (!parse_prefix(prefix, false, parsed.emplace_back()))
+            return false;
+
+    for (Prefix const &prefix : rules.ipv6)
+        if (!parse_prefix(prefix, true, parsed.emplace_back()))
+            return false;
+
+    std::atomic_store(&m_compiled,
+                      std::shared_ptr<Compiled const>{std::make_shared<Compiled>(parsed, rules.type == Type::Allow)});
+    m_rules = std::move(rules);
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef IP_ADDRESS_FILTER_HPP
+#define IP_ADDRESS_FILTER_HPP
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/*******************************************************************************
+ * Client address filter of the ONVIF Set/Add/Remove/GetIPAddressFilter calls
+ *
+ * The prefixes of both families are compiled into one path compressed binary
+ * trie over 128 bit keys, IPv4 as IPv4-mapped IPv6 (::ffff:0:0/96), so a check
+ * is a walk of at most one node per branching bit. The compiled trie is
+ * immutable and swapped atomically on update, the listener threads check
+ * without taking a lock.
+ *
+ * An empty list filters nothing, whatever its type, so clearing the filter can
+ * not lock every client out.
+ ******************************************************************************/
+class IPAddressFilter
+{
+  public:
+    using Address = std::array<uint8_t, 16>;
+
+    enum class Type
+    {
+        Allow,
+        Deny
+    };
+
+    struct Prefix
+    {
+        std::string address; // textual form as set
+        int length{0};
+    };
+
+    struct Rules
+    {
+        Type type{Type::Deny};
+        std::vector<Prefix> ipv4;
+        std::vector<Prefix> ipv6;
+    };
+
+    IPAddressFilter();
+
+    Rules get() const;
+
+    // false if an address or prefix length is invalid, the filter is unchanged then
+    bool set(Rules rules);
+    bool add(Rules const &rules);
+    bool remove(Rules const &rules);
+
+    // IPv4 clients as IPv4-mapped IPv6
+    bool permits(Address const &client) const;
+
+  private:
+    struct Compiled;
+
+    bool apply(Rules rules);
+
+    mutable std::mutex m_mutex; // serialises updates
+    Rules m_rules;
+    std::shared_ptr<Compiled const> m_compiled;
+};
+
+
+#endif // IP_ADDRESS_FILTER_HPP
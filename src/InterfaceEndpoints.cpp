@@ -0,0 +1,245 @@
+#include <arpa/inet.h>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+
+#include "InterfaceEndpoints.hpp"
+
+
+namespace
+{
+
+using Address = InterfaceEndpoints::Address;
+using Endpoint = InterfaceEndpoints::Endpoint;
+
+
+std::string fill_host(std::string const &url, std::string const &host)
+{
+    std::string::size_type const at = url.find("%s");
+    if (at == std::string::npos)
+        return url;
+
+    return url.substr(0, at) + host + url.substr(at + 2);
+}
+
+
+// the usual form for HTTP over a unix socket, the path percent-encoded as host
+std::string unix_xaddr(std::string const &path)
+{
+    static char const hex[] = "0123456789ABCDEF";
+
+    std::string xaddr{"http+unix://"};
+    for (char c : path)
+    {
+        unsigned char const u = static_cast<unsigned char>(c);
+        if (isalnum(u) || c == '-' || c == '.' || c == '_' || c == '~')
+        {
+            xaddr += c;
+            continue;
+        }
+        xaddr += '%';
+        xaddr += hex[u >> 4];
+        xaddr += hex[u & 0xf];
+    }
+    return xaddr;
+}
+
+
+bool is_mapped(Address const &address)
+{
+    static uint8_t const prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    return !memcmp(address.data(), prefix, sizeof(prefix));
+}
+
+
+bool same_prefix(Address const &a, Address const &b, int length)
+{
+    int const bytes = length >> 3;
+    if (memcmp(a.data(), b.data(), bytes))
+        return false;
+
+    int const rest = length & 7;
+    return !rest || !((a[bytes] ^ b[bytes]) & static_cast<uint8_t>(0xff << (8 - rest)));
+}
+
+
+Endpoint make_endpoint(std::string name, unsigned int index, InterfaceEndpoints::Prefix const &prefix,
+                       std::vector<InterfaceEndpoints::Media> const &media, int port, int httpsPort)
+{
+    char text[INET6_ADDRSTRLEN] = "";
+
+    Endpoint endpoint;
+    endpoint.name = std::move(name);
+    endpoint.index = index;
+    endpoint.prefix = prefix;
+
+    if (is_mapped(prefix.address))
+    {
+        inet_ntop(AF_INET, &prefix.address[12], text, sizeof(text));
+        endpoint.host = text;
+    }
+    else
+    {
+        inet_ntop(AF_INET6, prefix.address.data(), text, sizeof(text));
+        endpoint.host = std::string{"["} + text + "]";
+    }
+
+    endpoint.xaddr = "http://" + endpoint.host + ":" + std::to_string(port);
+    if (httpsPort)
+        endpoint.xaddrHttps = "https://" + endpoint.host + ":" + std::to_string(httpsPort);
+
+    for (InterfaceEndpoints::Media const &profile : media)
+    {
+        endpoint.streamUris[profile.profile] = fill_host(profile.streamUrl, endpoint.host);
+        endpoint.snapshotUris[profile.profile] = fill_host(profile.snapshotUrl, endpoint.host);
+    }
+
+    return endpoint;
+}
+
+
+std::string find_uri(std::unordered_map<std::string, std::string> const &uris, std::string const &profile)
+{
+    auto it = uris.find(profile);
+    return it == uris.end() ? std::string{} : it->second;
+}
+
+
+int mask_length(uint32_t mask)
+{
+    return __builtin_popcount(mask);
+}
+
+} // namespace
+
+
+std::string InterfaceEndpoints::Endpoint::streamUri(std::string const &profile) const
+{
+    return find_uri(streamUris, profile);
+}
+
+
+std::string InterfaceEndpoints::Endpoint::snapshotUri(std::string const &profile) const
+{
+    return find_uri(snapshotUris, profile);
+}
+
+
+InterfaceEndpoints::InterfaceEndpoints()
+{
+    rebuild({}, {}, 0, 0, {});
+}
+
+
+InterfaceEndpoints::Address InterfaceEndpoints::mapped(uint32_t ipv4)
+{
+    Address address{};
+    address[10] = address[11] = 0xff;
+    memcpy(&address[12], &ipv4, sizeof(ipv4));
+    return address;
+}
+
+
+void InterfaceEndpoints::rebuild(std::vector<Interface> const &interfaces, std::vector<Media> const &media, int port,
+                                 int httpsPort, std::string const &unixSocket)
+{
+    auto table = std::make_shared<Table>();
+
+    for (Interface const &interface : interfaces)
+    {
+        // a link without IPv4 would become ::ffff:0:0/96, the subnet of every IPv4 client
+        if (interface.ip)
+        {
+            Prefix const ipv4{mapped(interface.ip), 96 + mask_length(interface.mask)};
+            table->ipv4.push_back(make_endpoint(interface.name, interface.index, ipv4, media, port, httpsPort));
+        }
+
+        for (Prefix const &ipv6 : interface.ipv6)
+            table->ipv6.push_back(make_endpoint(interface.name, interface.index, ipv6, media, port, httpsPort));
+    }
+
+    // media of a co-located client stays on loopback
+    Address loopback6{};
+    loopback6[15] = 1;
+    table->loopback = make_endpoint("lo", 0, {mapped(htonl(INADDR_LOOPBACK)), 104}, media, port, httpsPort);
+    table->loopback6 = make_endpoint("lo", 0, {loopback6, 128}, media, port, httpsPort);
+    table->unixSocket = table->loopback;
+    table->unixSocket.xaddr = unix_xaddr(unixSocket);
+
+    std::atomic_store(&m_table, std::shared_ptr<Table const>{std::move(table)});
+}
+
+
+/*******************************************************************************
+ * Endpoint for a client, optionally only among the addresses of one interface
+ *
+ * An address on the client subnet first, the longest prefix wins. A link-local
+ * IPv6 client gets an address of the interface it came in on. Routed clients
+ * get the first address of the family, IPv4 of the first interface if the
+ * device has no IPv6 address.
+ ******************************************************************************/
+InterfaceEndpoints::Endpoint const *InterfaceEndpoints::select(Table const &table, Address const &client,
+                                                               unsigned int scope, std::string const *interface)
+{
+    bool const ipv4 = is_mapped(client);
+
+    if (ipv4 && (client[12] == 0 || client[12] == 127))
+        return &table.loopback;
+    if (!ipv4 && same_prefix(client, table.loopback6.prefix.address, 128))
+        return &table.loopback6;
+
+    std::vector<Endpoint> const &family = ipv4 ? table.ipv4 : table.ipv6;
+    bool const linkLocal = !ipv4 && client[0] == 0xfe && (client[1] & 0xc0) == 0x80;
+
+    Endpoint const *best = nullptr;
+    Endpoint const *first = nullptr;
+
+    for (Endpoint const &endpoint : family)
+    {
+        if (interface && endpoint.name != *interface)
+            continue;
+
+        if (!first)
+            first = &endpoint;
+
+        if (linkLocal && scope && endpoint.index == scope)
+            return &endpoint;
+
+        if (same_prefix(client, endpoint.prefix.address, endpoint.prefix.length) &&
+            (!best || endpoint.prefix.length > best->prefix.length))
+            best = &endpoint;
+    }
+
+    if (best)
+        return best;
+    if (first)
+        return first;
+
+    // nothing of the client family, e.g. an IPv6 client of a device with IPv4 only
+    for (Endpoint const &endpoint : table.ipv4)
+        if (!interface || endpoint.name == *interface)
+            return &endpoint;
+
+    return ipv4 ? &table.loopback : &table.loopback6;
+}
+
+
+InterfaceEndpoints::EndpointPtr InterfaceEndpoints::forClient(Address const &client, unsigned int scope) const
+{
+    std::shared_ptr<Table const> table = std::atomic_load(&m_table);
+    return EndpointPtr{table, select(*table, client, scope, nullptr)};
+}
+
+
+InterfaceEndpoints::EndpointPtr InterfaceEndpoints::forInterface(std::string const &name, Address const &client) const
+{
+    std::shared_ptr<Table const> table = std::atomic_load(&m_table);
+    return EndpointPtr{table, select(*table, client, 0, &name)};
+}
+
+
+InterfaceEndpoints::EndpointPtr InterfaceEndpoints::forUnixSocket() const
+{
+    std::shared_ptr<Table const> table = std::atomic_load(&m_table);
+    return EndpointPtr{table, &table->unixSocket};
+}
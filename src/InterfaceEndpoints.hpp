@@ -0,0 +1,103 @@
+#ifndef INTERFACE_ENDPOINTS_HPP
+#define INTERFACE_ENDPOINTS_HPP
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/*******************************************************************************
+ * Addresses the device is reached on, one endpoint per interface address
+ *
+ * The XAddr and the stream and snapshot URIs of every profile are formatted
+ * once per address when the addresses change, a request only picks the
+ * endpoint matching the client and copies the strings. The table is immutable
+ * and swapped atomically on rebuild.
+ *
+ * Media URIs come from the profile templates, the first "%s" is replaced by
+ * the address of the endpoint, IPv6 literals in brackets.
+ *
+ * Client addresses are 16 bytes, IPv4 clients as IPv4-mapped IPv6.
+ ******************************************************************************/
+class InterfaceEndpoints
+{
+  public:
+    using Address = std::array<uint8_t, 16>;
+
+    struct Prefix
+    {
+        Address address{};
+        int length{0};
+    };
+
+    struct Interface
+    {
+        std::string name;
+        unsigned int index{0};
+        uint32_t ip{0};   // network byte order, 0 for a link without IPv4
+        uint32_t mask{0}; // network byte order
+        std::vector<Prefix> ipv6;
+    };
+
+    struct Media
+    {
+        std::string profile;
+        std::string streamUrl;
+        std::string snapshotUrl;
+    };
+
+    struct Endpoint
+    {
+        std::string name;
+        unsigned int index{0};
+        Prefix prefix;    // address of the endpoint and its subnet
+        std::string host; // as it goes into a URI
+        std::string xaddr;
+        std::string xaddrHttps; // empty without an HTTPS listener
+        std::unordered_map<std::string, std::string> streamUris;   // by profile
+        std::unordered_map<std::string, std::string> snapshotUris; // by profile
+
+        std::string streamUri(std::string const &profile) const;
+        std::string snapshotUri(std::string const &profile) const;
+    };
+
+    using EndpointPtr = std::shared_ptr<Endpoint const>;
+
+    InterfaceEndpoints();
+
+    // httpsPort 0 and an empty unixSocket for no such listener
+    void rebuild(std::vector<Interface> const &interfaces, std::vector<Media> const &media, int port, int httpsPort,
+                 std::string const &unixSocket);
+
+    // endpoint of the address facing the client, scope is the interface index
+    // of a link-local client
+    EndpointPtr forClient(Address const &client, unsigned int scope = 0) const;
+
+    // the same among the addresses of one interface, for a listener bound to it
+    EndpointPtr forInterface(std::string const &name, Address const &client) const;
+
+    EndpointPtr forUnixSocket() const;
+
+    static Address mapped(uint32_t ipv4); // network byte order
+
+  private:
+    struct Table
+    {
+        std::vector<Endpoint> ipv4; // first address of every interface, in config order
+        std::vector<Endpoint> ipv6;
+        Endpoint loopback;
+        Endpoint loopback6;
+        Endpoint unixSocket;
+    };
+
+    static Endpoint const *select(Table const &table, Address const &client, unsigned int scope,
+                                  std::string const *interface);
+
+    std::shared_ptr<Table const> m_table;
+};
+
+
+#endif // INTERFACE_ENDPOINTS_HPP
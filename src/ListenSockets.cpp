@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <limits.h>
+#include <mutex>
+#include <net/if.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "ListenSockets.hpp"
+#include <armoury/logger.hpp>
+
+extern char **environ;
+
+
+namespace
+{
+
+constexpr int g_firstListenFd = 3; // SD_LISTEN_FDS_START
+constexpr char g_readyVariable[] = "ONVIF_SRVD_READY_FD";
+
+std::mutex g_mutex;
+std::vector<int> g_inherited;
+std::vector<int> g_held;
+
+
+bool is_listen_variable(char const *entry)
+{
+    return !strncmp(entry, "LISTEN_PID=", 11) || !strncmp(entry, "LISTEN_FDS=", 11) ||
+           !strncmp(entry, "LISTEN_FDNAMES=", 15) ||
+           (!strncmp(entry, g_readyVariable, sizeof(g_readyVariable) - 1) && entry[sizeof(g_readyVariable) - 1] == '=');
+}
+
+
+int bound_port(int fd)
+{
+    sockaddr_storage addr{};
+    socklen_t len = sizeof(addr);
+
+    if (getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len))
+        return -1;
+
+    if (addr.ss_family == AF_INET)
+        return ntohs(reinterpret_cast<sockaddr_in const &>(addr).sin_port);
+    if (addr.ss_family == AF_INET6)
+        return ntohs(reinterpret_cast<sockaddr_in6 const &>(addr).sin6_port);
+
+    return -1;
+}
+
+
+// interface the socket is bound to with SO_BINDTODEVICE, empty for none
+std::string bound_device(int fd)
+{
+    char device[IFNAMSIZ] = "";
+    socklen_t len = sizeof(device);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, device, &len) || !len)
+        return {};
+
+    return std::string(device, strnlen(device, len));
+}
+
+
+std::string bound_path(int fd)
+{
+    sockaddr_un addr{};
+    socklen_t len = sizeof(addr);
+
+    if (getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) || addr.sun_family != AF_UNIX ||
+        len <= offsetof(sockaddr_un, sun_path) || !addr.sun_path[0])
+        return {};
+
+    return std::string(addr.sun_path, strnlen(addr.sun_path, len - offsetof(sockaddr_un, sun_path)));
+}
+
+
+int take_if(std::vector<int> &fds, std::function<bool(int)> const &matches)
+{
+    auto it = std::find_if(fds.begin(), fds.end(), matches);
+    if (it == fds.end())
+        return -1;
+
+    int fd = *it;
+    fds.erase(it);
+    return fd;
+}
+
+
+// async-signal-safe decimal formatting for the forked child
+char *format_pid(char *end, pid_t pid)
+{
+    *--end = '\0';
+    do
+    {
+        *--end = static_cast<char>('0' + pid % 10);
+        pid /= 10;
+    } while (pid);
+    return end;
+}
+
+
+/*******************************************************************************
+ * Path of the binary on disk, even after it was replaced by the upgrade
+ ******************************************************************************/
+std::string executable_path()
+{
+    char path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len <= 0)
+        return {};
+
+    std::string result(path, static_cast<size_t>(len));
+    std::string const deleted{" (deleted)"};
+    if (result.size() > deleted.size() &&
+        !result.compare(result.size() - deleted.size(), deleted.size(), deleted))
+        result.resize(result.size() - deleted.size());
+
+    return result;
+}
+
+} // namespace
+
+
+void ListenSockets::inherit()
+{
+    char const *pid = getenv("LISTEN_PID");
+    char const *fds = getenv("LISTEN_FDS");
+
+    if (pid && fds && strtol(pid, NULL, 10) == getpid())
+    {
+        int count = static_cast<int>(strtol(fds, NULL, 10));
+
+        std::lock_guard<std::mutex> lock(g_mutex);
+        for (int fd = g_firstListenFd; fd < g_firstListenFd + count; ++fd)
+        {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            g_inherited.push_back(fd);
+        }
+
+        arms::log<arms::LOG_INFO>("Inherited {} listening sockets", count);
+    }
+
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    // readiness pipe of a handover, kept until ready()
+    if (char const *ready = getenv(g_readyVariable))
+        fcntl(static_cast<int>(strtol(ready, NULL, 10)), F_SETFD, FD_CLOEXEC);
+}
+
+
+int ListenSockets::take(int port, std::string const &device)
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return take_if(g_inherited,
+                   [port, &device](int fd) { return bound_port(fd) == port && bound_device(fd) == device; });
+}
+
+
+int ListenSockets::take(std::string const &path)
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return take_if(g_inherited, [&path](int fd) { return bound_path(fd) == path; });
+}
+
+
+void ListenSockets::closeUnclaimed()
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+
+    for (int fd : g_inherited)
+    {
+        arms::log<arms::LOG_INFO>("Closing unclaimed listening socket for port {}", bound_port(fd));
+        close(fd);
+    }
+    g_inherited.clear();
+}
+
+
+void ListenSockets::hold(int fd)
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (std::find(g_held.begin(), g_held.end(), fd) == g_held.end())
+        g_held.push_back(fd);
+}
+
+
+void ListenSockets::release(int fd)
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_held.erase(std::remove(g_held.begin(), g_held.end(), fd), g_held.end());
+}
+
+
+/*******************************************************************************
+ * Exec the binary again with the held sockets as LISTEN_FDS
+ *
+ * Everything the child needs is prepared before fork(), the child only moves
+ * the sockets to 3.., the readiness pipe right after them and fills in its
+ * pid, which is async-signal-safe. The child reports ready by writing to the
+ * pipe, a child that exits or does not report in time is killed.
+ ******************************************************************************/
+pid_t ListenSockets::handover(std::chrono::seconds readyTimeout)
+{
+    std::string const path = executable_path();
+    if (path.empty())
+        return -1;
+
+    std::vector<int> fds;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        fds = g_held;
+    }
+
+    int const count = static_cast<int>(fds.size());
+    int const readyFd = g_firstListenFd + count;
+    if (count > 64)
+        return -1;
+
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC))
+        return -1;
+
+    std::string const fdsEntry = "LISTEN_FDS=" + std::to_string(count);
+    std::string const readyEntry = std::string(g_readyVariable) + "=" + std::to_string(readyFd);
+
+    char pidEntry[32] = "LISTEN_PID=";
+    char pidDigits[16];
+
+    std::vector<char *> env;
+    for (char **entry = environ; *entry; ++entry)
+        if (!is_listen_variable(*entry))
+            env.push_back(*entry);
+    env.push_back(const_cast<char *>(fdsEntry.c_str()));
+    env.push_back(const_cast<char *>(readyEntry.c_str()));
+    env.push_back(pidEntry);
+    env.push_back(NULL);
+
+    char *const argv[] = {const_cast<char *>(path.c_str()), NULL};
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        // out of the way of the target range first, then into place (dup2 clears CLOEXEC)
+        int moved[64];
+        for (int i = 0; i < count; ++i)
+            moved[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, readyFd + 1);
+        int movedReady = fcntl(pipeFds[1], F_DUPFD_CLOEXEC, readyFd + 1);
+
+        for (int i = 0; i < count; ++i)
+            dup2(moved[i], g_firstListenFd + i);
+        dup2(movedReady, readyFd);
+
+        strcat(pidEntry, format_pid(pidDigits + sizeof(pidDigits), getpid()));
+
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+
+        execve(path.c_str(), argv, env.data());
+        _exit(EXIT_FAILURE);
+    }
+
+    close(pipeFds[1]);
+
+    if (child < 0)
+    {
+        arms::log<arms::LOG_INFO>("Handover fork failed: {}", errno);
+        close(pipeFds[0]);
+        return -1;
+    }
+
+    pollfd readyPoll{pipeFds[0], POLLIN, 0};
+    char byte = 0;
+    bool const isReady = poll(&readyPoll, 1, static_cast<int>(readyTimeout.count() * 1000)) == 1 &&
+                         read(pipeFds[0], &byte, 1) == 1;
+    close(pipeFds[0]);
+
+    if (!isReady)
+    {
+        arms::log<arms::LOG_INFO>("New binary {} did not start, handover cancelled", path);
+        kill(child, SIGKILL);
+        waitpid(child, NULL, 0);
+        return -1;
+    }
+
+    arms::log<arms::LOG_INFO>("Handed the listening sockets over to pid {}", child);
+    return child;
+}
+
+
+void ListenSockets::ready()
+{
+    if (char const *ready = getenv(g_readyVariable))
+    {
+        int fd = static_cast<int>(strtol(ready, NULL, 10));
+        ssize_t written = write(fd, "1", 1);
+        (void)written;
+        close(fd);
+        unsetenv(g_readyVariable);
+    }
+
+    notify("READY=1");
+}
+
+
+void ListenSockets::notify(char const *state)
+{
+    char const *path = getenv("NOTIFY_SOCKET");
+    if (!path || (path[0] != '/' && path[0] != '@'))
+        return;
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    size_t len = strlen(path);
+    if (len >= sizeof(addr.sun_path))
+        return;
+    memcpy(addr.sun_path, path, len);
+    if (addr.sun_path[0] == '@')
+        addr.sun_path[0] = '\0';
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return;
+
+    sendto(fd, state, strlen(state), MSG_NOSIGNAL, reinterpret_cast<sockaddr *>(&addr),
+           static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + len));
+    close(fd);
+}
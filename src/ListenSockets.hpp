@@ -0,0 +1,51 @@
+#ifndef LISTEN_SOCKETS_HPP
+#define LISTEN_SOCKETS_HPP
+
+#include <chrono>
+#include <string>
+#include <sys/types.h>
+
+
+/*******************************************************************************
+ * Listening sockets shared with systemd and with the next daemon binary
+ *
+ * Sockets passed in by socket activation (LISTEN_FDS) are claimed by port, so
+ * the SOAP and RTSP listeners use the socket systemd already holds instead of
+ * binding their own and a restart never refuses a connection.
+ *
+ * Every socket in use is held here, a handover execs the binary again with all
+ * of them passed on the same protocol and waits for it to report ready. Both
+ * processes accept from the same kernel queue until the old one stops, so the
+ * port is never closed, and a new binary that fails to start leaves the old
+ * one serving.
+ ******************************************************************************/
+class ListenSockets
+{
+  public:
+    // read and clear LISTEN_FDS, call once before any listener is created
+    static void inherit();
+
+    // inherited socket bound to the port (and interface, BindToDevice= of the
+    // socket unit) or unix socket path, -1 if there is none
+    static int take(int port, std::string const &device = {});
+    static int take(std::string const &path);
+
+    // close inherited sockets no listener claimed
+    static void closeUnclaimed();
+
+    // socket to pass on at the next handover
+    static void hold(int fd);
+    static void release(int fd);
+
+    // start the new binary with the held sockets, returns its pid once it is ready or -1
+    static pid_t handover(std::chrono::seconds readyTimeout);
+
+    // startup done, tell the previous binary and systemd
+    static void ready();
+
+    // state message to the systemd notification socket, if there is one
+    static void notify(char const *state);
+};
+
+
+#endif // LISTEN_SOCKETS_HPP
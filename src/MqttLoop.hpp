@@ -0,0 +1,62 @@
+#ifndef MQTT_LOOP_HPP
+#define MQTT_LOOP_HPP
+
+#include <functional>
+#include <mosquitto.h>
+#include <unistd.h>
+
+
+/*******************************************************************************
+ * Network loop of the MQTT client, run by a ThreadWarden under the supervisor
+ *
+ * A lost broker connection is re-established in place, any other error of the
+ * loop is reported through onFailure and ends the worker.
+ ******************************************************************************/
+class MqttLoop
+{
+  public:
+    static constexpr char const *g_workerName{"mqttLoop"};
+    static constexpr bool g_copyDataOnce{true};
+    struct Input
+    {
+        struct mosquitto *mosq{nullptr};
+        std::function<void()> onFailure;
+    } dataIn;
+    struct Output
+    {
+    } dataOut;
+    MqttLoop()
+    {
+    }
+    int work()
+    {
+        if (!dataIn.mosq)
+        {
+            return fail();
+        }
+
+        int rc = mosquitto_loop(dataIn.mosq, 100, 1);
+        if (rc == MOSQ_ERR_NO_CONN || rc == MOSQ_ERR_CONN_LOST)
+        {
+            // the broker may simply not be up yet, retry at the loop pace
+            if (mosquitto_reconnect(dataIn.mosq) != MOSQ_ERR_SUCCESS)
+                usleep(100000);
+            return 0;
+        }
+
+        return rc == MOSQ_ERR_SUCCESS ? 0 : fail();
+    }
+
+  private:
+    int fail()
+    {
+        if (dataIn.onFailure)
+        {
+            dataIn.onFailure();
+        }
+        return 1;
+    }
+};
+
+
+#endif // MQTT_LOOP_HPP
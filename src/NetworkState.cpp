@@ -0,0 +1,345 @@
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <poll.h>
+#include <set>
+#include <sstream>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "NetworkState.hpp"
+
+
+namespace
+{
+
+constexpr int g_burstMs = 20; // quiet time that ends a burst of netlink notifications
+
+constexpr uint32_t g_inotifyMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+
+std::string dir_name(std::string const &path)
+{
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos)
+        return ".";
+    return slash ? path.substr(0, slash) : "/";
+}
+
+
+std::string base_name(std::string const &path)
+{
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+
+// the line without its comment, split at white space
+std::vector<std::string> tokens(std::string line)
+{
+    size_t comment = line.find_first_of("#;");
+    if (comment != std::string::npos)
+        line.erase(comment);
+
+    std::vector<std::string> words;
+    std::istringstream in(line);
+    for (std::string word; in >> word;)
+        words.push_back(word);
+    return words;
+}
+
+
+void add_unique(std::vector<std::string> &list, std::string const &value)
+{
+    for (std::string const &known : list)
+    {
+        if (known == value)
+            return;
+    }
+    list.push_back(value);
+}
+
+
+void read_resolv_conf(std::string const &path, NetworkState::Snapshot &snapshot)
+{
+    std::ifstream file(path);
+
+    for (std::string line; std::getline(file, line);)
+    {
+        std::vector<std::string> words = tokens(line);
+        if (words.size() < 2)
+            continue;
+
+        if (words[0] == "nameserver")
+            add_unique(snapshot.nameservers, words[1]);
+        else if (words[0] == "search" || words[0] == "domain")
+            snapshot.searchDomains.assign(words.begin() + 1, words.end()); // the last one wins
+    }
+}
+
+
+// server and pool lines of ntpd and chrony, NTP= of systemd-timesyncd
+void read_ntp_conf(std::string const &path, NetworkState::Snapshot &snapshot)
+{
+    std::ifstream file(path);
+
+    for (std::string line; std::getline(file, line);)
+    {
+        if (line.compare(0, 4, "NTP=") == 0)
+        {
+            for (std::string const &server : tokens(line.substr(4)))
+                add_unique(snapshot.ntpServers, server);
+            continue;
+        }
+
+        std::vector<std::string> words = tokens(line);
+        if (words.size() >= 2 && (words[0] == "server" || words[0] == "pool"))
+            add_unique(snapshot.ntpServers, words[1]);
+    }
+}
+
+} // namespace
+
+
+RtNetlink::Link const *NetworkState::Snapshot::link(std::string const &name) const
+{
+    for (RtNetlink::Link const &entry : links)
+    {
+        if (entry.name == name)
+            return &entry;
+    }
+    return nullptr;
+}
+
+
+NetworkState::NetworkState() : NetworkState(Paths{})
+{
+}
+
+
+NetworkState::NetworkState(Paths paths) : m_paths(std::move(paths)), m_snapshot(std::make_shared<Snapshot>())
+{
+    // subscribe first, a change during the initial read is then seen by poll()
+    watch();
+    update(true, true);
+}
+
+
+NetworkState::~NetworkState()
+{
+    if (m_netlinkFd >= 0)
+        close(m_netlinkFd);
+    if (m_inotifyFd >= 0)
+        close(m_inotifyFd);
+}
+
+
+NetworkState::SnapshotPtr NetworkState::snapshot() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_snapshot;
+}
+
+
+void NetworkState::refresh()
+{
+    update(true, true);
+}
+
+
+void NetworkState::setOnChange(std::function<void()> onChange)
+{
+    std::lock_guard<std::mutex> lock(m_updateMutex);
+    m_onChange = std::move(onChange);
+}
+
+
+/*******************************************************************************
+ * Open the netlink multicast socket and the inotify watches
+ ******************************************************************************/
+void NetworkState::watch()
+{
+    if (m_netlinkFd < 0)
+    {
+        m_netlinkFd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+
+        sockaddr_nl local{};
+        local.nl_family = AF_NETLINK;
+        local.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+
+        if (m_netlinkFd >= 0 && bind(m_netlinkFd, reinterpret_cast<sockaddr *>(&local), sizeof(local)) != 0)
+        {
+            close(m_netlinkFd);
+            m_netlinkFd = -1;
+        }
+    }
+
+    if (m_inotifyFd >= 0)
+        return;
+
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotifyFd < 0)
+        return;
+
+    std::vector<std::string> files{m_paths.resolvConf, m_paths.hostname};
+    files.insert(files.end(), m_paths.ntpConf.begin(), m_paths.ntpConf.end());
+
+    // the directories, files are replaced by a rename; a symlinked file
+    // (resolv.conf of systemd-resolved) also through the directory of its target
+    std::set<std::string> directories;
+    for (std::string const &file : files)
+    {
+        directories.insert(dir_name(file));
+        add_unique(m_watchedNames, base_name(file));
+
+        char target[PATH_MAX];
+        if (realpath(file.c_str(), target) && file != target)
+        {
+            directories.insert(dir_name(target));
+            add_unique(m_watchedNames, base_name(target));
+        }
+    }
+
+    for (std::string const &directory : directories)
+        inotify_add_watch(m_inotifyFd, directory.c_str(), g_inotifyMask);
+}
+
+
+// true if a notification arrived, including a lost one
+bool NetworkState::drainNetlink()
+{
+    bool changed = false;
+    char buffer[8192];
+
+    while (true)
+    {
+        ssize_t r = recv(m_netlinkFd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (r > 0)
+            changed = true;
+        else if (r < 0 && errno == ENOBUFS)
+            changed = true; // the socket overran, the dump catches up
+        else if (r < 0 && errno == EINTR)
+            continue;
+        else
+            return changed;
+    }
+}
+
+
+// true if one of the watched files changed
+bool NetworkState::drainInotify()
+{
+    bool changed = false;
+    alignas(inotify_event) char buffer[4096];
+
+    while (true)
+    {
+        ssize_t r = read(m_inotifyFd, buffer, sizeof(buffer));
+        if (r <= 0)
+            return changed;
+
+        for (char *p = buffer; p < buffer + r;)
+        {
+            inotify_event const *event = reinterpret_cast<inotify_event const *>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                changed = true;
+                continue;
+            }
+
+            if (!event->len)
+                continue;
+
+            for (std::string const &name : m_watchedNames)
+            {
+                if (name == event->name)
+                    changed = true;
+            }
+        }
+    }
+}
+
+
+bool NetworkState::poll(int timeoutMs)
+{
+    if (m_netlinkFd < 0 || m_inotifyFd < 0)
+        watch();
+    if (m_netlinkFd < 0)
+        return false;
+
+    pollfd fds[2] = {{m_netlinkFd, POLLIN, 0}, {m_inotifyFd, POLLIN, 0}};
+    nfds_t const count = m_inotifyFd >= 0 ? 2 : 1;
+
+    int r = ::poll(fds, count, timeoutMs);
+    if (r < 0)
+        return errno == EINTR;
+    if (r == 0)
+        return true;
+
+    bool links = false;
+    if (fds[0].revents)
+    {
+        // one dump for the whole burst
+        pollfd burst{m_netlinkFd, POLLIN, 0};
+        do
+            links |= drainNetlink();
+        while (::poll(&burst, 1, g_burstMs) > 0);
+    }
+
+    bool files = count > 1 && fds[1].revents && drainInotify();
+
+    if (links || files)
+        update(links, files);
+
+    return true;
+}
+
+
+/*******************************************************************************
+ * Build the next snapshot, the parts not read again are taken over
+ ******************************************************************************/
+void NetworkState::update(bool links, bool files)
+{
+    std::lock_guard<std::mutex> serial(m_updateMutex);
+
+    Snapshot next = *snapshot();
+
+    if (links)
+    {
+        RtNetlink netlink;
+        std::vector<RtNetlink::Link> dumped;
+
+        // a failed dump keeps the previous links, the next notification retries
+        if (netlink.dump(dumped))
+            next.links = std::move(dumped);
+    }
+
+    if (files)
+    {
+        char hostname[HOST_NAME_MAX + 1] = {};
+        if (gethostname(hostname, sizeof(hostname) - 1) == 0)
+            next.hostname = hostname;
+
+        next.nameservers.clear();
+        next.searchDomains.clear();
+        read_resolv_conf(m_paths.resolvConf, next);
+
+        next.ntpServers.clear();
+        for (std::string const &path : m_paths.ntpConf)
+            read_ntp_conf(path, next);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_snapshot = std::make_shared<Snapshot const>(std::move(next));
+    }
+
+    if (m_onChange)
+        m_onChange();
+}
@@ -0,0 +1,91 @@
+#ifndef NETWORK_STATE_HPP
+#define NETWORK_STATE_HPP
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "RtNetlink.hpp"
+
+
+/*******************************************************************************
+ * Cached network configuration of the device
+ *
+ * The links with their addresses and default routes, the hostname, the DNS
+ * resolvers and the NTP servers are read once into an immutable snapshot that
+ * the GetNetworkInterfaces, GetNetworkDefaultGateway, GetHostname, GetDNS and
+ * GetNTP handlers answer from, so a request costs no syscall.
+ *
+ * The snapshot is rebuilt when the kernel reports a link, address or route
+ * change on a netlink multicast socket, and when inotify reports a write to
+ * one of the files (or a rename over it, how resolvers and hostnamectl update
+ * them). A burst of netlink notifications, like the one of a batched
+ * SetNetworkInterfaces, is collected into a single dump. poll() is driven by
+ * a RunLoopWorker, refresh() by the handlers changing the configuration;
+ * the rebuilds are serialized so neither loses the changes of the other.
+ ******************************************************************************/
+class NetworkState
+{
+  public:
+    struct Paths
+    {
+        std::string resolvConf{"/etc/resolv.conf"};
+        std::string hostname{"/etc/hostname"};
+        std::vector<std::string> ntpConf{"/etc/ntp.conf", "/etc/chrony.conf", "/etc/chrony/chrony.conf",
+                                         "/etc/systemd/timesyncd.conf"};
+    };
+
+    struct Snapshot
+    {
+        std::vector<RtNetlink::Link> links;
+        std::string hostname;
+        std::vector<std::string> nameservers;
+        std::vector<std::string> searchDomains;
+        std::vector<std::string> ntpServers;
+
+        RtNetlink::Link const *link(std::string const &name) const;
+    };
+
+    using SnapshotPtr = std::shared_ptr<Snapshot const>;
+
+    NetworkState();
+    explicit NetworkState(Paths paths);
+    ~NetworkState();
+
+    NetworkState(NetworkState const &) = delete;
+    NetworkState &operator=(NetworkState const &) = delete;
+
+    SnapshotPtr snapshot() const;
+
+    // read everything again now, after the daemon changed the configuration itself
+    void refresh();
+
+    // wait up to timeoutMs for changes and apply them, false if watching failed
+    bool poll(int timeoutMs);
+
+    // called after every rebuild of the snapshot, on the thread that rebuilt it
+    void setOnChange(std::function<void()> onChange);
+
+  private:
+    void watch();
+    bool drainNetlink();
+    bool drainInotify();
+    void update(bool links, bool files);
+
+    Paths const m_paths;
+
+    mutable std::mutex m_mutex; // the snapshot pointer
+    SnapshotPtr m_snapshot;
+
+    std::mutex m_updateMutex; // one rebuild at a time, held across read, modify and store
+    std::function<void()> m_onChange;
+
+    int m_netlinkFd{-1};
+    int m_inotifyFd{-1};
+    std::vector<std::string> m_watchedNames; // file names inside the watched directories
+};
+
+
+#endif // NETWORK_STATE_HPP
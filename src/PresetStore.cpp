@@ -0,0 +1,593 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "PresetStore.hpp"
+#include "armoury/logger.hpp"
+
+
+namespace
+{
+
+constexpr size_t g_compactSlack = 32; // dead records tolerated before compacting
+
+
+bool tokenChars(std::string const &token)
+{
+    return std::all_of(token.begin(), token.end(), [](char c) {
+        return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-' || c == '.';
+    });
+}
+
+
+uint32_t checksum(std::string const &text)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (unsigned char c : text)
+    {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+std::string escape(std::string const &field)
+{
+    std::string out;
+    out.reserve(field.size());
+    for (char c : field)
+    {
+        if (c == '\\')
+            out += "\\\\";
+        else if (c == '\t')
+            out += "\\t";
+        else if (c == '\n')
+            out += "\\n";
+        else
+            out += c;
+    }
+    return out;
+}
+
+
+std::vector<std::string> split(std::string const &line)
+{
+    std::vector<std::string> fields(1);
+    for (size_t i = 0; i < line.size(); ++i)
+    {
+        char c = line[i];
+        if (c == '\t')
+            fields.emplace_back();
+        else if (c == '\\' && i + 1 < line.size())
+        {
+            c = line[++i];
+            fields.back() += c == 't' ? '\t' : c == 'n' ? '\n' : c;
+        }
+        else
+            fields.back() += c;
+    }
+    return fields;
+}
+
+
+// fields joined by tabs and the checksum of them as the last field
+std::string record(std::vector<std::string> const &fields)
+{
+    std::string line;
+    for (std::string const &field : fields)
+    {
+        if (!line.empty())
+            line += '\t';
+        line += escape(field);
+    }
+
+    char sum[16];
+    snprintf(sum, sizeof(sum), "\t%08x\n", checksum(line));
+    return line + sum;
+}
+
+
+std::string number(float value)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "%.7g", value);
+    return text;
+}
+
+
+std::vector<std::string> set_record(PresetStore::Preset const &preset)
+{
+    if (!preset.position)
+        return {"S", preset.token, preset.name, "", "", ""};
+
+    return {"S", preset.token, preset.name, number(preset.position->pan), number(preset.position->tilt),
+            number(preset.position->zoom)};
+}
+
+
+char const *const g_directions = "FBE"; // TourDirection in journal records
+
+
+std::vector<std::string> tour_record(PresetStore::Tour const &tour)
+{
+    std::vector<std::string> fields{"T",
+                                    tour.token,
+                                    tour.name,
+                                    tour.autoStart ? "1" : "0",
+                                    tour.recurringTime ? std::to_string(*tour.recurringTime) : "",
+                                    tour.recurringDuration ? std::to_string(*tour.recurringDuration) : "",
+                                    std::string(1, g_directions[static_cast<int>(tour.direction)]),
+                                    tour.randomOrder ? "1" : "0"};
+
+    for (PresetStore::TourSpot const &spot : tour.spots)
+    {
+        fields.push_back(spot.preset);
+        fields.push_back(spot.speed ? number(*spot.speed) : "");
+        fields.push_back(std::to_string(spot.stayMs));
+    }
+    return fields;
+}
+
+
+// fields of a tour record after the type, nullptr if malformed
+std::shared_ptr<PresetStore::Tour> parse_tour(std::vector<std::string> const &fields)
+{
+    if (fields.size() < 8 || (fields.size() - 8) % 3 != 0 || fields[6].size() != 1 || !strchr(g_directions, fields[6][0]))
+        return nullptr;
+
+    auto tour = std::make_shared<PresetStore::Tour>();
+    tour->token = fields[1];
+    tour->name = fields[2];
+    tour->autoStart = fields[3] == "1";
+    if (!fields[4].empty())
+        tour->recurringTime = atoi(fields[4].c_str());
+    if (!fields[5].empty())
+        tour->recurringDuration = strtoll(fields[5].c_str(), nullptr, 10);
+    tour->direction = static_cast<PresetStore::TourDirection>(strchr(g_directions, fields[6][0]) - g_directions);
+    tour->randomOrder = fields[7] == "1";
+
+    for (size_t i = 8; i < fields.size(); i += 3)
+    {
+        PresetStore::TourSpot spot;
+        spot.preset = fields[i];
+        if (!fields[i + 1].empty())
+            spot.speed = strtof(fields[i + 1].c_str(), nullptr);
+        spot.stayMs = strtoll(fields[i + 2].c_str(), nullptr, 10);
+        tour->spots.push_back(spot);
+    }
+    return tour;
+}
+
+
+bool write_all(int fd, std::string const &data)
+{
+    size_t done = 0;
+    while (done < data.size())
+    {
+        ssize_t r = write(fd, data.data() + done, data.size() - done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        done += static_cast<size_t>(r);
+    }
+    return true;
+}
+
+} // namespace
+
+
+PresetStore::PresetStore(std::string journalFile, size_t capacity, std::string const &gotoCommand)
+    : m_journalFile(std::move(journalFile)), m_capacity(capacity), m_gotoCommand(gotoCommand)
+{
+}
+
+
+PresetStore::~PresetStore()
+{
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+
+std::string PresetStore::get_str_err() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_err;
+}
+
+
+// tokens go into backend commands, the client can not pass shell syntax
+bool PresetStore::validToken(std::string const &token)
+{
+    if (!tokenChars(token))
+    {
+        m_err = "invalid token";
+        return false;
+    }
+    return true;
+}
+
+
+PresetStore::PresetPtr PresetStore::make(std::string token, std::string name, std::optional<Position> position) const
+{
+    auto preset = std::make_shared<Preset>();
+    preset->token = std::move(token);
+    preset->name = std::move(name);
+    preset->position = position;
+
+    // compiled here once instead of on every GotoPreset
+    preset->command = m_gotoCommand.withToken(preset->token);
+
+    return preset;
+}
+
+
+/*******************************************************************************
+ * Apply one journal line, false for a torn or corrupt one
+ ******************************************************************************/
+bool PresetStore::replay(std::string const &line)
+{
+    size_t const tab = line.rfind('\t');
+    if (tab == std::string::npos || strtoul(line.c_str() + tab + 1, nullptr, 16) != checksum(line.substr(0, tab)))
+        return false;
+
+    std::vector<std::string> fields = split(line.substr(0, tab));
+
+    if (fields[0] == "S" && fields.size() == 6)
+    {
+        std::optional<Position> position;
+        if (!fields[3].empty())
+            position = Position{strtof(fields[3].c_str(), nullptr), strtof(fields[4].c_str(), nullptr),
+                                strtof(fields[5].c_str(), nullptr)};
+
+        if (!m_presets.count(fields[1]))
+            m_order.push_back(fields[1]);
+        m_presets[fields[1]] = make(fields[1], fields[2], position);
+    }
+    else if (fields[0] == "R" && fields.size() == 2)
+    {
+        if (m_presets.erase(fields[1]))
+            m_order.erase(std::find(m_order.begin(), m_order.end(), fields[1]));
+    }
+    else if (fields[0] == "T")
+    {
+        TourPtr tour = parse_tour(fields);
+        if (!tour)
+            return false;
+
+        auto it = std::find_if(m_tours.begin(), m_tours.end(), [&](TourPtr const &t) { return t->token == tour->token; });
+        if (it != m_tours.end())
+            *it = tour;
+        else
+            m_tours.push_back(tour);
+    }
+    else if (fields[0] == "U" && fields.size() == 2)
+    {
+        m_tours.erase(std::remove_if(m_tours.begin(), m_tours.end(),
+                                     [&](TourPtr const &t) { return t->token == fields[1]; }),
+                      m_tours.end());
+    }
+    else
+        return false;
+
+    ++m_records;
+    return true;
+}
+
+
+bool PresetStore::load()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::string journal;
+    int fd = open(m_journalFile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 && errno != ENOENT)
+    {
+        m_err = m_journalFile + ": " + strerror(errno);
+        return false;
+    }
+
+    if (fd >= 0)
+    {
+        char buffer[4096];
+        ssize_t r;
+        while ((r = read(fd, buffer, sizeof(buffer))) > 0 || (r < 0 && errno == EINTR))
+        {
+            if (r > 0)
+                journal.append(buffer, static_cast<size_t>(r));
+        }
+        close(fd);
+    }
+
+    // a crash can only tear the last line, anything after a bad one is dropped
+    bool clean = true;
+    size_t begin = 0;
+    while (begin < journal.size())
+    {
+        size_t end = journal.find('\n', begin);
+        if (end == std::string::npos || !replay(journal.substr(begin, end - begin)))
+        {
+            clean = false;
+            break;
+        }
+        begin = end + 1;
+    }
+
+    if (!clean)
+        arms::log<arms::LOG_INFO>("Preset journal {} truncated after {} records", m_journalFile, m_records);
+
+    if (!clean || bloated())
+        return compact();
+
+    m_fd = open(m_journalFile.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        m_err = m_journalFile + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+
+bool PresetStore::append(std::string const &line)
+{
+    if (m_fd < 0 || !write_all(m_fd, line) || fdatasync(m_fd) != 0)
+    {
+        m_err = m_journalFile + ": " + strerror(errno);
+
+        // a partly written line would hide every later one on the next load
+        if (m_fd >= 0)
+            compact();
+        return false;
+    }
+
+    ++m_records;
+    return true;
+}
+
+
+// dead records outweigh the live ones
+bool PresetStore::bloated() const
+{
+    return m_records > 2 * (m_presets.size() + m_tours.size()) + g_compactSlack;
+}
+
+
+/*******************************************************************************
+ * Rewrite the journal with one record per live preset and tour
+ ******************************************************************************/
+bool PresetStore::compact()
+{
+    std::string contents;
+    for (std::string const &token : m_order)
+        contents += record(set_record(*m_presets.at(token)));
+    for (TourPtr const &tour : m_tours)
+        contents += record(tour_record(*tour));
+
+    std::string const staged = m_journalFile + ".new";
+    int fd = open(staged.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool written = fd >= 0 && write_all(fd, contents) && fsync(fd) == 0;
+    if (fd >= 0 && close(fd) != 0)
+        written = false;
+
+    if (!written || rename(staged.c_str(), m_journalFile.c_str()) != 0)
+    {
+        m_err = staged + ": " + strerror(errno);
+        unlink(staged.c_str());
+        return false;
+    }
+
+    // the rename itself is durable once the directory is synced
+    size_t const slash = m_journalFile.rfind('/');
+    std::string const directory = slash == std::string::npos ? "." : slash ? m_journalFile.substr(0, slash) : "/";
+    int dirFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd >= 0)
+    {
+        fsync(dirFd);
+        close(dirFd);
+    }
+
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = open(m_journalFile.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    m_records = m_presets.size() + m_tours.size();
+
+    if (m_fd < 0)
+    {
+        m_err = m_journalFile + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+
+bool PresetStore::set(std::string token, std::string name, std::optional<Position> position, std::string &setToken)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    while (token.empty())
+    {
+        token = "Preset" + std::to_string(m_nextToken++);
+        if (m_presets.count(token))
+            token.clear();
+    }
+
+    if (!validToken(token))
+        return false;
+
+    auto existing = m_presets.find(token);
+    if (existing == m_presets.end() && m_presets.size() >= m_capacity)
+    {
+        m_err = "maximum number of presets reached";
+        return false;
+    }
+
+    if (name.empty())
+        name = existing != m_presets.end() ? existing->second->name : token;
+
+    for (auto const &entry : m_presets)
+    {
+        if (entry.first != token && entry.second->name == name)
+        {
+            m_err = "preset name already exists";
+            return false;
+        }
+    }
+
+    PresetPtr preset = make(token, name, position);
+    if (!append(record(set_record(*preset))))
+        return false;
+
+    if (existing == m_presets.end())
+        m_order.push_back(token);
+    m_presets[token] = preset;
+    setToken = token;
+
+    if (bloated())
+        compact();
+    return true;
+}
+
+
+bool PresetStore::remove(std::string const &token)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_presets.count(token))
+    {
+        m_err = "no such preset";
+        return false;
+    }
+
+    if (!append(record({"R", token})))
+        return false;
+
+    m_presets.erase(token);
+    m_order.erase(std::find(m_order.begin(), m_order.end(), token));
+
+    if (bloated())
+        compact();
+    return true;
+}
+
+
+PresetStore::PresetPtr PresetStore::find(std::string const &token) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_presets.find(token);
+    return it == m_presets.end() ? nullptr : it->second;
+}
+
+
+PresetStore::PresetPtr PresetStore::findOrPassThrough(std::string const &token) const
+{
+    if (PresetPtr preset = find(token))
+        return preset;
+
+    if (token.empty() || !tokenChars(token))
+        return nullptr;
+
+    // the head keeps the presets set before the store existed, the token
+    // reaches them like it did when every GotoPreset was passed through
+    return make(token, token, std::nullopt);
+}
+
+
+std::vector<PresetStore::PresetPtr> PresetStore::list() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::vector<PresetPtr> presets;
+    presets.reserve(m_order.size());
+    for (std::string const &token : m_order)
+        presets.push_back(m_presets.at(token));
+    return presets;
+}
+
+
+bool PresetStore::setTour(Tour tour, std::string &setToken)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto const named = [&tour](TourPtr const &t) { return t->token == tour.token; };
+
+    while (tour.token.empty())
+    {
+        tour.token = "Tour" + std::to_string(m_nextTour++);
+        if (std::find_if(m_tours.begin(), m_tours.end(), named) != m_tours.end())
+            tour.token.clear();
+    }
+
+    if (!validToken(tour.token))
+        return false;
+
+    if (tour.name.empty())
+        tour.name = tour.token;
+
+    auto saved = std::make_shared<Tour const>(std::move(tour));
+    if (!append(record(tour_record(*saved))))
+        return false;
+
+    // tour was moved from, the saved one carries the token
+    auto it = std::find_if(m_tours.begin(), m_tours.end(),
+                           [&saved](TourPtr const &t) { return t->token == saved->token; });
+    if (it != m_tours.end())
+        *it = saved;
+    else
+        m_tours.push_back(saved);
+    setToken = saved->token;
+
+    if (bloated())
+        compact();
+    return true;
+}
+
+
+bool PresetStore::removeTour(std::string const &token)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = std::find_if(m_tours.begin(), m_tours.end(), [&token](TourPtr const &t) { return t->token == token; });
+    if (it == m_tours.end())
+    {
+        m_err = "no such preset tour";
+        return false;
+    }
+
+    if (!append(record({"U", token})))
+        return false;
+
+    m_tours.erase(it);
+
+    if (bloated())
+        compact();
+    return true;
+}
+
+
+PresetStore::TourPtr PresetStore::findTour(std::string const &token) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (TourPtr const &tour : m_tours)
+    {
+        if (tour->token == token)
+            return tour;
+    }
+    return nullptr;
+}
+
+
+std::vector<PresetStore::TourPtr> PresetStore::tours() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_tours;
+}
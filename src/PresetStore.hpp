@@ -0,0 +1,137 @@
+#ifndef PRESET_STORE_HPP
+#define PRESET_STORE_HPP
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CommandTemplate.hpp"
+
+
+/*******************************************************************************
+ * PTZ presets of the SetPreset, RemovePreset, GetPresets and GotoPreset calls
+ *
+ * A preset maps its token to a position, when one is known, and to the
+ * backend command that moves the head there. The command is compiled with its
+ * token once when the preset is set or loaded, so GotoPreset is a hash lookup
+ * and only the speed left to fill in. Presets set on the head before the store
+ * was kept are not in it; GotoPreset still passes their token to the backend.
+ *
+ * The preset tours are kept alongside, a tour refers to its presets by token
+ * so a preset removed later is skipped by the tour instead of breaking it.
+ *
+ * Presets and tours persist in an append-only journal, one checksummed line
+ * per set or removal written and synced before the call returns. Loading
+ * replays the journal up to the first torn or corrupt line; it is compacted
+ * into a new file renamed over the old one when dead records outweigh the
+ * live ones.
+ ******************************************************************************/
+class PresetStore
+{
+  public:
+    struct Position
+    {
+        float pan{0.0f};
+        float tilt{0.0f};
+        float zoom{0.0f};
+    };
+
+    struct Preset
+    {
+        std::string token;
+        std::string name;
+        std::optional<Position> position;
+        CommandTemplate command; // moves the head to the preset, "%s" left for the speed
+    };
+
+    using PresetPtr = std::shared_ptr<Preset const>;
+
+    enum class TourDirection
+    {
+        Forward,
+        Backward,
+        Extended // forward, then back again
+    };
+
+    struct TourSpot
+    {
+        std::string preset; // token, empty for the home position
+        std::optional<float> speed;
+        int64_t stayMs{0};
+    };
+
+    struct Tour
+    {
+        std::string token;
+        std::string name;
+        bool autoStart{false};
+        std::optional<int> recurringTime;         // cycles, forever when unset
+        std::optional<int64_t> recurringDuration; // ms, forever when unset
+        TourDirection direction{TourDirection::Forward};
+        bool randomOrder{false};
+        std::vector<TourSpot> spots;
+    };
+
+    using TourPtr = std::shared_ptr<Tour const>;
+
+    // gotoCommand: backend command template, "%t" is replaced by the preset token
+    PresetStore(std::string journalFile, size_t capacity, std::string const &gotoCommand);
+    ~PresetStore();
+
+    PresetStore(PresetStore const &) = delete;
+    PresetStore &operator=(PresetStore const &) = delete;
+
+    // replay the journal, false if it exists but can not be read
+    bool load();
+
+    size_t capacity() const { return m_capacity; }
+
+    // adds or replaces the preset, an empty token is generated; false when the
+    // store is full, the token is not [A-Za-z0-9_.-], the name belongs to
+    // another preset or the journal write failed
+    bool set(std::string token, std::string name, std::optional<Position> position, std::string &setToken);
+    bool remove(std::string const &token);
+
+    PresetPtr find(std::string const &token) const;
+    // find() or, for a valid token not in the store, a preset without a
+    // position whose command just passes the token to the backend
+    PresetPtr findOrPassThrough(std::string const &token) const;
+    std::vector<PresetPtr> list() const;
+
+    // adds or replaces the tour, an empty token is generated
+    bool setTour(Tour tour, std::string &setToken);
+    bool removeTour(std::string const &token);
+
+    TourPtr findTour(std::string const &token) const;
+    std::vector<TourPtr> tours() const;
+
+    std::string get_str_err() const;
+
+  private:
+    PresetPtr make(std::string token, std::string name, std::optional<Position> position) const;
+    bool validToken(std::string const &token);
+    bool replay(std::string const &line);
+    bool append(std::string const &record);
+    bool bloated() const;
+    bool compact();
+
+    std::string const m_journalFile;
+    size_t const m_capacity;
+    CommandTemplate const m_gotoCommand;
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, PresetPtr> m_presets;
+    std::vector<std::string> m_order; // tokens in creation order, for GetPresets
+    std::vector<TourPtr> m_tours;     // in creation order
+    size_t m_records{0};              // lines in the journal
+    unsigned int m_nextToken{1};
+    unsigned int m_nextTour{1};
+    int m_fd{-1};
+    std::string m_err;
+};
+
+
+#endif // PRESET_STORE_HPP
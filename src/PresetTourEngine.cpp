@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <numeric>
+
+#include "PresetTourEngine.hpp"
+
+
+namespace
+{
+
+constexpr std::chrono::milliseconds g_minStay{100}; // a tour of zero stay times must not spin
+
+} // namespace
+
+
+PresetTourEngine::PresetTourEngine(std::shared_ptr<PresetStore> store, Dispatch dispatch)
+    : m_store(std::move(store)), m_dispatch(std::move(dispatch))
+{
+}
+
+
+bool PresetTourEngine::start(std::string const &token, std::string const &node)
+{
+    PresetStore::TourPtr tour = m_store->findTour(token);
+    if (!tour || tour->spots.empty())
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Clock::time_point const now = Clock::now();
+
+    auto it = m_running.find(token);
+    if (it != m_running.end())
+    {
+        // a paused tour goes on with the rest of its stay time
+        if (it->second.state == State::Paused)
+        {
+            it->second.state = State::Touring;
+            schedule(token, it->second, now + it->second.remaining);
+            m_wake.notify_all();
+        }
+        return true;
+    }
+
+    // one head, one tour
+    for (auto other = m_running.begin(); other != m_running.end();)
+    {
+        if (other->second.node == node)
+            other = m_running.erase(other);
+        else
+            ++other;
+    }
+
+    Running &running = m_running[token];
+    running.tour = tour;
+    running.node = node;
+    if (tour->recurringDuration)
+        running.endAt = now + std::chrono::milliseconds(*tour->recurringDuration);
+    newCycle(running);
+
+    schedule(token, running, now);
+    m_wake.notify_all();
+    return true;
+}
+
+
+void PresetTourEngine::stop(std::string const &token)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // its queued deadline is dropped when it comes up
+    m_running.erase(token);
+}
+
+
+void PresetTourEngine::pause(std::string const &token)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_running.find(token);
+    if (it == m_running.end() || it->second.state != State::Touring)
+        return;
+
+    Running &running = it->second;
+    running.state = State::Paused;
+    running.remaining = std::max(running.deadline - Clock::now(), Clock::duration::zero());
+    running.generation = ++m_generation;
+}
+
+
+void PresetTourEngine::autoStart(std::string const &node)
+{
+    for (PresetStore::TourPtr const &tour : m_store->tours())
+    {
+        if (tour->autoStart)
+            start(tour->token, node);
+    }
+}
+
+
+PresetTourEngine::State PresetTourEngine::state(std::string const &token, PresetStore::TourSpot *current) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_running.find(token);
+    if (it == m_running.end())
+        return State::Idle;
+
+    if (current)
+        *current = it->second.tour->spots[it->second.current];
+    return it->second.state;
+}
+
+
+void PresetTourEngine::schedule(std::string const &token, Running &running, Clock::time_point at)
+{
+    running.deadline = at;
+    running.generation = ++m_generation;
+    m_queue.push({at, token, running.generation});
+}
+
+
+/*******************************************************************************
+ * Spot indices of the next cycle of a tour
+ ******************************************************************************/
+void PresetTourEngine::newCycle(Running &running)
+{
+    size_t const count = running.tour->spots.size();
+
+    running.order.resize(count);
+    std::iota(running.order.begin(), running.order.end(), 0);
+    running.next = 0;
+
+    if (running.tour->randomOrder)
+        std::shuffle(running.order.begin(), running.order.end(), m_random);
+    else if (running.tour->direction == PresetStore::TourDirection::Backward)
+        std::reverse(running.order.begin(), running.order.end());
+    else if (running.tour->direction == PresetStore::TourDirection::Extended)
+    {
+        for (size_t i = count - 1; i-- > 1;)
+            running.order.push_back(i);
+    }
+}
+
+
+/*******************************************************************************
+ * Move on to the next spot, false when the tour is over
+ ******************************************************************************/
+bool PresetTourEngine::advance(Running &running)
+{
+    if (Clock::now() >= running.endAt)
+        return false;
+
+    // spots of removed presets are skipped, a tour left without any ends
+    for (size_t tries = 0; tries <= running.tour->spots.size(); ++tries)
+    {
+        if (running.next >= running.order.size())
+        {
+            ++running.cycles;
+            if (running.tour->recurringTime && running.cycles >= *running.tour->recurringTime)
+                return false;
+            newCycle(running);
+        }
+
+        running.current = running.order[running.next++];
+
+        std::string const &preset = running.tour->spots[running.current].preset;
+        if (preset.empty() || m_store->find(preset))
+            return true;
+    }
+
+    return false;
+}
+
+
+void PresetTourEngine::run(int timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Clock::time_point const limit = Clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    while (true)
+    {
+        // deadlines of stopped, paused or rescheduled tours
+        while (!m_queue.empty())
+        {
+            auto it = m_running.find(m_queue.top().token);
+            if (it != m_running.end() && it->second.generation == m_queue.top().generation &&
+                it->second.state == State::Touring)
+                break;
+            m_queue.pop();
+        }
+
+        Clock::time_point const now = Clock::now();
+
+        if (!m_queue.empty() && m_queue.top().at <= now)
+        {
+            Deadline const due = m_queue.top();
+            m_queue.pop();
+
+            Running &running = m_running.at(due.token);
+            if (!advance(running))
+            {
+                m_running.erase(due.token);
+                continue;
+            }
+
+            // anchored to the deadline, the stay only shrinks when the timer is late
+            PresetStore::TourSpot const spot = running.tour->spots[running.current];
+            Clock::duration const stay = std::max<Clock::duration>(std::chrono::milliseconds(spot.stayMs), g_minStay);
+            schedule(due.token, running, std::max(due.at + stay, now));
+
+            lock.unlock();
+            m_dispatch(spot);
+            lock.lock();
+            continue;
+        }
+
+        if (now >= limit)
+            return;
+
+        m_wake.wait_until(lock, m_queue.empty() ? limit : std::min(limit, m_queue.top().at));
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef PRESET_TOUR_ENGINE_HPP
+#define PRESET_TOUR_ENGINE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "PresetStore.hpp"
+
+
+/*******************************************************************************
+ * Runs the preset tours of OperatePresetTour
+ *
+ * Every touring tour has its next step in one deadline queue, served by a
+ * single timer thread calling run(). A step moves the head to its spot through
+ * the dispatch callback and queues the next step after the stay time of the
+ * spot. The deadlines are anchored to the previous deadline rather than to the
+ * time the thread woke up, so the dwell times do not drift over a long tour.
+ *
+ * A node runs one tour at a time, starting a tour stops the one running on
+ * the same node. Start, stop and pause wake the timer thread, they take effect
+ * immediately; a paused tour keeps the rest of its current stay time.
+ ******************************************************************************/
+class PresetTourEngine
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+    using Dispatch = std::function<void(PresetStore::TourSpot const &spot)>;
+
+    enum class State
+    {
+        Idle,
+        Touring,
+        Paused
+    };
+
+    PresetTourEngine(std::shared_ptr<PresetStore> store, Dispatch dispatch);
+
+    PresetTourEngine(PresetTourEngine const &) = delete;
+    PresetTourEngine &operator=(PresetTourEngine const &) = delete;
+
+    // false if the store has no such tour or it has no spots
+    bool start(std::string const &token, std::string const &node);
+    void stop(std::string const &token);
+    void pause(std::string const &token);
+
+    // start the tours marked AutoStart
+    void autoStart(std::string const &node);
+
+    // current spot is set while touring or paused
+    State state(std::string const &token, PresetStore::TourSpot *current = nullptr) const;
+
+    // wait up to timeoutMs and run the steps that fell due
+    void run(int timeoutMs);
+
+  private:
+    struct Running
+    {
+        PresetStore::TourPtr tour;
+        std::string node;
+        State state{State::Touring};
+        std::vector<size_t> order; // spot indices of the current cycle
+        size_t next{0};            // into order
+        size_t current{0};         // spot index
+        int cycles{0};
+        Clock::time_point deadline;
+        Clock::duration remaining{}; // of the stay time while paused
+        Clock::time_point endAt{Clock::time_point::max()};
+        uint64_t generation{0};
+    };
+
+    struct Deadline
+    {
+        Clock::time_point at;
+        std::string token;
+        uint64_t generation;
+
+        bool operator>(Deadline const &other) const { return at > other.at; }
+    };
+
+    void schedule(std::string const &token, Running &running, Clock::time_point at);
+    bool advance(Running &running);
+    void newCycle(Running &running);
+
+    std::shared_ptr<PresetStore> m_store;
+    Dispatch m_dispatch;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::unordered_map<std::string, Running> m_running;
+    std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> m_queue;
+    uint64_t m_generation{0};
+    std::minstd_rand m_random{std::random_device{}()};
+};
+
+
+#endif // PRESET_TOUR_ENGINE_HPP
@@ -0,0 +1,194 @@
+#include <algorithm>
+
+#include "PtzCommandPipeline.hpp"
+
+
+namespace
+{
+
+bool same(PtzState::Vector const &a, PtzState::Vector const &b)
+{
+    return a.pan == b.pan && a.tilt == b.tilt && a.zoom == b.zoom;
+}
+
+} // namespace
+
+
+PtzCommandPipeline::PtzCommandPipeline(std::shared_ptr<PtzState> state, Backend backend,
+                                       std::shared_ptr<ServiceMetrics> metrics)
+    : m_state(std::move(state)), m_backend(std::move(backend)), m_metrics(std::move(metrics))
+{
+}
+
+
+PtzState::Vector PtzCommandPipeline::move(PtzState::Vector const &velocity, Clock::time_point received)
+{
+    PtzState::Vector const quantized = m_backend.quantize(velocity);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopAt.reset();
+    queueMove(quantized, received);
+    return quantized;
+}
+
+
+PtzState::Vector PtzCommandPipeline::pulse(PtzState::Vector const &velocity, Clock::duration length,
+                                           Clock::time_point received)
+{
+    PtzState::Vector const quantized = m_backend.quantize(velocity);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    queueMove(quantized, received);
+    m_stopAt = Clock::now() + length;
+    m_wake.notify_one();
+    return quantized;
+}
+
+
+void PtzCommandPipeline::stop(Clock::time_point received)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopAt.reset();
+    queueStop(received);
+}
+
+
+void PtzCommandPipeline::queueMove(PtzState::Vector const &quantized, Clock::time_point received)
+{
+    m_metrics->ptzCommands++;
+
+    if (same(quantized, m_intended))
+    {
+        m_metrics->ptzCoalesced++;
+        return;
+    }
+
+    // the waiting move is overtaken by this one
+    if (!m_queue.empty() && m_queue.back().kind == Kind::Move)
+    {
+        m_metrics->ptzCoalesced++;
+        m_queue.pop_back();
+    }
+
+    m_queue.push_back({Kind::Move, quantized, {}, {}, received});
+    m_intended = quantized;
+    m_wake.notify_one();
+}
+
+
+void PtzCommandPipeline::queueStop(Clock::time_point received)
+{
+    m_metrics->ptzCommands++;
+
+    // motions not written yet are void, a stop already waiting in front will do
+    auto const dropped = std::remove_if(m_queue.begin(), m_queue.end(), [](Entry const &entry) {
+        return entry.kind == Kind::Move || entry.kind == Kind::MoveTo;
+    });
+    m_metrics->ptzCoalesced += static_cast<uint64_t>(m_queue.end() - dropped);
+    m_queue.erase(dropped, m_queue.end());
+
+    m_intended = PtzState::Vector{};
+
+    if (!m_queue.empty() && m_queue.front().kind == Kind::Stop)
+    {
+        m_metrics->ptzCoalesced++;
+        return;
+    }
+
+    m_queue.push_front({Kind::Stop, {}, {}, {}, received});
+    m_wake.notify_one();
+}
+
+
+void PtzCommandPipeline::moveTo(std::string command, std::optional<PtzState::Vector> target, Clock::time_point received)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_metrics->ptzCommands++;
+    m_stopAt.reset();
+
+    // the head drives to the preset on its own
+    m_queue.push_back({Kind::MoveTo, {}, std::move(command), target, received});
+    m_intended = PtzState::Vector{};
+    m_wake.notify_one();
+}
+
+
+void PtzCommandPipeline::send(std::string command, Clock::time_point received)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_queue.push_back({Kind::Send, {}, std::move(command), {}, received});
+    m_wake.notify_one();
+}
+
+
+void PtzCommandPipeline::write(std::string const &command, Clock::time_point received)
+{
+    if (command.empty() || !m_backend.write(command))
+        return;
+
+    m_metrics->ptzWrites++;
+    m_metrics->ptzLatency.observe(Clock::now() - received);
+}
+
+
+void PtzCommandPipeline::execute(Entry const &entry)
+{
+    switch (entry.kind)
+    {
+    case Kind::Move:
+        for (std::string const &command : m_backend.commands(m_running, entry.velocity))
+            write(command, entry.received);
+        m_running = entry.velocity;
+        m_state->move(entry.velocity);
+        break;
+
+    case Kind::Stop:
+        for (std::string const &command : m_backend.stop)
+            write(command, entry.received);
+        m_running = PtzState::Vector{};
+        m_state->stop();
+        break;
+
+    case Kind::MoveTo:
+        write(entry.command, entry.received);
+        m_running = PtzState::Vector{};
+        m_state->moveTo(entry.target);
+        break;
+
+    case Kind::Send:
+        write(entry.command, entry.received);
+        break;
+    }
+}
+
+
+void PtzCommandPipeline::run(int timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    Clock::time_point wake = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    if (m_stopAt)
+        wake = std::min(wake, *m_stopAt);
+
+    if (m_queue.empty())
+        m_wake.wait_until(lock, wake);
+
+    // the pulse is over, the latency of its stop counts from when it was due
+    if (m_stopAt && Clock::now() >= *m_stopAt)
+    {
+        queueStop(*m_stopAt);
+        m_stopAt.reset();
+    }
+
+    while (!m_queue.empty())
+    {
+        Entry const entry = std::move(m_queue.front());
+        m_queue.pop_front();
+
+        // a stop queued meanwhile goes in front of the next entry, not of this one
+        lock.unlock();
+        execute(entry);
+        lock.lock();
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef PTZ_COMMAND_PIPELINE_HPP
+#define PTZ_COMMAND_PIPELINE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "PtzState.hpp"
+#include "ServiceMetrics.hpp"
+
+
+/*******************************************************************************
+ * Single path of every command to the PTZ backend
+ *
+ * The handlers queue what the operator wants and return, one actuator thread
+ * calling run() writes the backend commands. A joystick sends ContinuousMove
+ * many times a second with nearly the same velocity, so a move is quantized to
+ * what the backend can tell apart and dropped when it matches the motion the
+ * head already has or is about to get; a move still waiting in the queue is
+ * replaced by the newer one. The backend sees a command per change of intent,
+ * not per request.
+ *
+ * A pulse is a move the actuator thread stops on its own once its time is up,
+ * so RelativeMove returns at once; any other motion or stop asked for in the
+ * meantime cancels the pending stop.
+ *
+ * Stop goes ahead of everything waiting and drops the queued moves. The
+ * latency from the receipt of the SOAP request to the write of its command is
+ * recorded in the metrics, with the number of motions asked for, coalesced and
+ * written.
+ ******************************************************************************/
+class PtzCommandPipeline
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Backend
+    {
+        // velocity the head can run closest to the asked one
+        std::function<PtzState::Vector(PtzState::Vector const &velocity)> quantize;
+        // commands taking the head from one quantized velocity to the other
+        std::function<std::vector<std::string>(PtzState::Vector const &from, PtzState::Vector const &to)> commands;
+        // commands stopping every axis
+        std::vector<std::string> stop;
+        // hands a command to the backend, false if it could not
+        std::function<bool(std::string const &command)> write;
+    };
+
+    PtzCommandPipeline(std::shared_ptr<PtzState> state, Backend backend, std::shared_ptr<ServiceMetrics> metrics);
+
+    PtzCommandPipeline(PtzCommandPipeline const &) = delete;
+    PtzCommandPipeline &operator=(PtzCommandPipeline const &) = delete;
+
+    // returns the quantized velocity the head will run at
+    PtzState::Vector move(PtzState::Vector const &velocity, Clock::time_point received);
+    PtzState::Vector pulse(PtzState::Vector const &velocity, Clock::duration length, Clock::time_point received);
+    void stop(Clock::time_point received);
+
+    // a preset or home command, target is its position when known
+    void moveTo(std::string command, std::optional<PtzState::Vector> target, Clock::time_point received);
+
+    // a command that does not move the head
+    void send(std::string command, Clock::time_point received);
+
+    // wait up to timeoutMs and write what is queued
+    void run(int timeoutMs);
+
+  private:
+    enum class Kind
+    {
+        Move,
+        Stop,
+        MoveTo,
+        Send
+    };
+
+    struct Entry
+    {
+        Kind kind;
+        PtzState::Vector velocity;              // Move
+        std::string command;                    // MoveTo, Send
+        std::optional<PtzState::Vector> target; // MoveTo
+        Clock::time_point received;
+    };
+
+    void queueMove(PtzState::Vector const &quantized, Clock::time_point received);
+    void queueStop(Clock::time_point received);
+    void write(std::string const &command, Clock::time_point received);
+    void execute(Entry const &entry);
+
+    std::shared_ptr<PtzState> m_state;
+    Backend m_backend;
+    std::shared_ptr<ServiceMetrics> m_metrics;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<Entry> m_queue;
+    PtzState::Vector m_intended; // velocity once the queue is written
+    std::optional<Clock::time_point> m_stopAt; // end of the running pulse
+
+    PtzState::Vector m_running; // velocity the head was last commanded to, actuator thread only
+};
+
+
+#endif // PTZ_COMMAND_PIPELINE_HPP
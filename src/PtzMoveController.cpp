@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cmath>
+
+#include "PtzMoveController.hpp"
+#include "armoury/logger.hpp"
+
+
+namespace
+{
+
+constexpr float g_tolerance = 0.005f; // of the generic position space
+constexpr float g_gain = 4.0f;        // velocity per unit of remaining distance
+constexpr float g_minSpeed = 0.05f;   // below it the head does not start moving
+
+constexpr std::chrono::milliseconds g_tick{50};   // of the loop with position feedback
+constexpr std::chrono::milliseconds g_slack{2000}; // over twice the planned travel time, before giving up
+
+
+// velocity of one axis towards its target, slowing down over the last part
+float approach(float error, float speed)
+{
+    if (std::fabs(error) <= g_tolerance)
+        return 0.0f;
+
+    float const magnitude = std::clamp(g_gain * std::fabs(error), g_minSpeed, std::max(speed, g_minSpeed));
+    return std::copysign(magnitude, error);
+}
+
+
+// time one axis needs to its target at the velocity it runs, max when it stays
+std::chrono::duration<float> arrival(float error, float velocity, float rate)
+{
+    if (velocity == 0.0f || rate <= 0.0f || std::signbit(velocity) != std::signbit(error))
+        return std::chrono::duration<float>::max();
+
+    return std::chrono::duration<float>(std::fabs(error) / (std::fabs(velocity) * rate));
+}
+
+
+bool same(PtzState::Vector const &a, PtzState::Vector const &b)
+{
+    return a.pan == b.pan && a.tilt == b.tilt && a.zoom == b.zoom;
+}
+
+} // namespace
+
+
+PtzMoveController::PtzMoveController(std::shared_ptr<PtzState> state, Actuate actuate, bool closedLoop, bool zoom)
+    : m_state(std::move(state)), m_actuate(std::move(actuate)), m_closedLoop(closedLoop), m_zoom(zoom)
+{
+}
+
+
+bool PtzMoveController::moveTo(PtzState::Vector target, PtzState::Vector speed)
+{
+    PtzState::Status const status = m_state->status();
+    if (!status.position)
+        return false;
+
+    if (!m_zoom)
+        target.zoom = status.position->zoom;
+    if (!m_state->limits().contains(target))
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Clock::time_point const now = Clock::now();
+
+    speed.pan = std::clamp(speed.pan, 0.0f, 1.0f);
+    speed.tilt = std::clamp(speed.tilt, 0.0f, 1.0f);
+    speed.zoom = std::clamp(speed.zoom, 0.0f, 1.0f);
+
+    // twice the travel time of the slowest axis at the requested speed
+    PtzState::Vector const rates = m_state->rates();
+    auto travel = [](float distance, float axisSpeed, float rate) {
+        return rate > 0.0f ? std::fabs(distance) / (std::max(axisSpeed, g_minSpeed) * rate) : 0.0f;
+    };
+    float const planned = std::max({travel(target.pan - status.position->pan, speed.pan, rates.pan),
+                                    travel(target.tilt - status.position->tilt, speed.tilt, rates.tilt),
+                                    travel(target.zoom - status.position->zoom, speed.zoom, rates.zoom)});
+
+    m_target = target;
+    m_speed = speed;
+    m_nextStep = now;
+    m_giveUp = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(2 * planned)) + g_slack;
+
+    m_wake.notify_all();
+    return true;
+}
+
+
+void PtzMoveController::cancel()
+{
+    // waits for a step in progress, no command of the controller follows
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_target.reset();
+    m_commanded = PtzState::Vector{};
+    m_running = PtzState::Vector{};
+}
+
+
+bool PtzMoveController::moving() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_target.has_value();
+}
+
+
+void PtzMoveController::finish()
+{
+    if (!same(m_commanded, PtzState::Vector{}))
+        m_actuate(PtzState::Vector{});
+
+    m_target.reset();
+    m_commanded = PtzState::Vector{};
+    m_running = PtzState::Vector{};
+}
+
+
+void PtzMoveController::step(Clock::time_point now)
+{
+    PtzState::Status const status = m_state->status();
+
+    if (now >= m_giveUp)
+    {
+        arms::log<arms::LOG_WARNING>("PTZ AbsoluteMove did not reach its target in time, stopped");
+        finish();
+        return;
+    }
+
+    // the feedback may come back after a restart of the backend
+    if (!status.position)
+    {
+        m_nextStep = now + g_tick;
+        return;
+    }
+
+    PtzState::Vector const error{m_target->pan - status.position->pan, m_target->tilt - status.position->tilt,
+                                 m_zoom ? m_target->zoom - status.position->zoom : 0.0f};
+
+    PtzState::Vector const velocity{approach(error.pan, m_speed.pan), approach(error.tilt, m_speed.tilt),
+                                    approach(error.zoom, m_speed.zoom)};
+
+    if (same(velocity, PtzState::Vector{}))
+    {
+        finish();
+        return;
+    }
+
+    if (!same(velocity, m_commanded))
+    {
+        m_running = m_actuate(velocity);
+        m_commanded = velocity;
+    }
+
+    // the head may run slower or faster than commanded
+    PtzState::Vector const rates = m_state->rates();
+    std::chrono::duration<float> due = std::min({arrival(error.pan, m_running.pan, rates.pan),
+                                                 arrival(error.tilt, m_running.tilt, rates.tilt),
+                                                 arrival(error.zoom, m_running.zoom, rates.zoom)});
+
+    if (m_closedLoop)
+        due = std::min<std::chrono::duration<float>>(due, g_tick);
+    else if (due == std::chrono::duration<float>::max())
+        due = g_tick; // an axis the head did not start, the give up time ends it
+
+    m_nextStep = now + std::chrono::duration_cast<Clock::duration>(due);
+}
+
+
+void PtzMoveController::run(int timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Clock::time_point const limit = Clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    while (true)
+    {
+        Clock::time_point const now = Clock::now();
+
+        // the head is commanded with the lock held, so cancel() can not be overtaken
+        if (m_target && m_nextStep <= now)
+        {
+            step(now);
+            continue;
+        }
+
+        if (now >= limit)
+            return;
+
+        m_wake.wait_until(lock, m_target ? std::min(limit, m_nextStep) : limit);
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef PTZ_MOVE_CONTROLLER_HPP
+#define PTZ_MOVE_CONTROLLER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include "PtzState.hpp"
+
+
+/*******************************************************************************
+ * Drives the PTZ head to the target of AbsoluteMove
+ *
+ * The head only takes velocity commands, so each step compares the position
+ * of the PtzState with the target, commands a velocity towards it that slows
+ * down close to it, and stops every axis within the tolerance. A new velocity
+ * is only sent when it differs from the running one.
+ *
+ * With position feedback the loop corrects against the reported position
+ * every tick. Without it the PtzState position is dead-reckoned, so the step
+ * is instead scheduled at the moment the first moving axis is due at its
+ * target: a timed move, without polling in between.
+ *
+ * run() is driven by a RunLoopWorker. Another move command of a client calls
+ * cancel() before it takes over the head.
+ ******************************************************************************/
+class PtzMoveController
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    // runs the head at the velocity, all zero stops it; returns the velocity
+    // the head really runs at
+    using Actuate = std::function<PtzState::Vector(PtzState::Vector const &velocity)>;
+
+    // zoom: the backend has zoom commands, otherwise zoom targets are ignored
+    PtzMoveController(std::shared_ptr<PtzState> state, Actuate actuate, bool closedLoop, bool zoom);
+
+    PtzMoveController(PtzMoveController const &) = delete;
+    PtzMoveController &operator=(PtzMoveController const &) = delete;
+
+    // speed 0..1 per axis; false when the target is out of the limits or the
+    // current position is not known
+    bool moveTo(PtzState::Vector target, PtzState::Vector speed);
+
+    // forget the target, the head is left to the caller
+    void cancel();
+
+    bool moving() const;
+
+    // wait up to timeoutMs and run the steps that fell due
+    void run(int timeoutMs);
+
+  private:
+    void step(Clock::time_point now);
+    void finish();
+
+    std::shared_ptr<PtzState> m_state;
+    Actuate m_actuate;
+    bool const m_closedLoop;
+    bool const m_zoom;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::optional<PtzState::Vector> m_target;
+    PtzState::Vector m_speed;
+    PtzState::Vector m_commanded; // velocity last sent to the head
+    PtzState::Vector m_running;   // what the head made of it
+    Clock::time_point m_nextStep;
+    Clock::time_point m_giveUp;
+};
+
+
+#endif // PTZ_MOVE_CONTROLLER_HPP
@@ -0,0 +1,94 @@
+#include <cerrno>
+#include <fstream>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "PtzPositionFile.hpp"
+
+
+PtzPositionFile::PtzPositionFile(std::string path, std::shared_ptr<PtzState> state)
+    : m_path(std::move(path)), m_state(std::move(state))
+{
+    size_t slash = m_path.rfind('/');
+    m_name = slash == std::string::npos ? m_path : m_path.substr(slash + 1);
+
+    // watch first, a write during the initial read is then seen by poll()
+    watch();
+    read();
+}
+
+
+PtzPositionFile::~PtzPositionFile()
+{
+    if (m_inotifyFd >= 0)
+        close(m_inotifyFd);
+}
+
+
+bool PtzPositionFile::watch()
+{
+    if (m_inotifyFd >= 0)
+        return true;
+
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotifyFd < 0)
+        return false;
+
+    size_t slash = m_path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : slash ? m_path.substr(0, slash) : "/";
+
+    if (inotify_add_watch(m_inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        close(m_inotifyFd);
+        m_inotifyFd = -1;
+        return false;
+    }
+    return true;
+}
+
+
+// a file that is missing or not three numbers is left alone
+void PtzPositionFile::read()
+{
+    std::ifstream file(m_path);
+
+    PtzState::Vector position;
+    if (file >> position.pan >> position.tilt >> position.zoom)
+        m_state->report(position);
+}
+
+
+bool PtzPositionFile::poll(int timeoutMs)
+{
+    if (!watch())
+        return false;
+
+    pollfd fd{m_inotifyFd, POLLIN, 0};
+    int r = ::poll(&fd, 1, timeoutMs);
+    if (r < 0)
+        return errno == EINTR;
+    if (r == 0)
+        return true;
+
+    bool changed = false;
+    alignas(inotify_event) char buffer[4096];
+
+    for (ssize_t n; (n = ::read(m_inotifyFd, buffer, sizeof(buffer))) > 0;)
+    {
+        for (char *p = buffer; p < buffer + n;)
+        {
+            inotify_event const *event = reinterpret_cast<inotify_event const *>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            if ((event->mask & IN_Q_OVERFLOW) || (event->len && m_name == event->name))
+                changed = true;
+        }
+    }
+
+    // a burst of writes is read once
+    if (changed)
+        read();
+
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef PTZ_POSITION_FILE_HPP
+#define PTZ_POSITION_FILE_HPP
+
+#include <memory>
+#include <string>
+
+#include "PtzState.hpp"
+
+
+/*******************************************************************************
+ * Position feedback of the PTZ backend
+ *
+ * The backend writes "pan tilt zoom" of the generic spaces into a file, in
+ * place or by a rename over it. inotify on its directory reports the writes,
+ * each one is read once and handed to the PtzState, GetStatus never reads the
+ * file itself. poll() is driven by a RunLoopWorker.
+ ******************************************************************************/
+class PtzPositionFile
+{
+  public:
+    PtzPositionFile(std::string path, std::shared_ptr<PtzState> state);
+    ~PtzPositionFile();
+
+    PtzPositionFile(PtzPositionFile const &) = delete;
+    PtzPositionFile &operator=(PtzPositionFile const &) = delete;
+
+    // wait up to timeoutMs for a write, false if inotify is not available
+    bool poll(int timeoutMs);
+
+  private:
+    bool watch();
+    void read();
+
+    std::string const m_path;
+    std::string m_name; // in its directory
+    std::shared_ptr<PtzState> m_state;
+    int m_inotifyFd{-1};
+};
+
+
+#endif // PTZ_POSITION_FILE_HPP
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <cmath>
+
+#include "PtzState.hpp"
+
+
+namespace
+{
+
+constexpr float g_arrivedTolerance = 0.01f; // of the generic spaces, a report this close to the target is arrival
+constexpr int g_overdueFactor = 3;          // travel times waited for a report of arrival
+
+
+bool near(PtzState::Vector const &a, PtzState::Vector const &b)
+{
+    return std::abs(a.pan - b.pan) <= g_arrivedTolerance && std::abs(a.tilt - b.tilt) <= g_arrivedTolerance &&
+           std::abs(a.zoom - b.zoom) <= g_arrivedTolerance;
+}
+
+} // namespace
+
+
+bool PtzState::Limits::valid() const
+{
+    return -1.0f <= min.pan && min.pan < max.pan && max.pan <= 1.0f &&
+           -1.0f <= min.tilt && min.tilt < max.tilt && max.tilt <= 1.0f &&
+           0.0f <= min.zoom && min.zoom < max.zoom && max.zoom <= 1.0f;
+}
+
+
+bool PtzState::Limits::contains(Vector const &position) const
+{
+    return min.pan <= position.pan && position.pan <= max.pan &&
+           min.tilt <= position.tilt && position.tilt <= max.tilt &&
+           min.zoom <= position.zoom && position.zoom <= max.zoom;
+}
+
+
+PtzState::PtzState(Vector rates, Limits limits, bool feedback)
+    : m_rates(rates), m_limits(limits), m_feedback(feedback), m_since(Clock::now())
+{
+}
+
+
+/*******************************************************************************
+ * Position at now, moved by the velocity since the last command
+ ******************************************************************************/
+PtzState::Vector PtzState::estimate(Clock::time_point now) const
+{
+    float const seconds = std::chrono::duration<float>(now - m_since).count();
+
+    Vector position;
+    position.pan = std::clamp(m_position.pan + m_velocity.pan * m_rates.pan * seconds, m_limits.min.pan, m_limits.max.pan);
+    position.tilt = std::clamp(m_position.tilt + m_velocity.tilt * m_rates.tilt * seconds, m_limits.min.tilt, m_limits.max.tilt);
+    position.zoom = std::clamp(m_position.zoom + m_velocity.zoom * m_rates.zoom * seconds, m_limits.min.zoom, m_limits.max.zoom);
+    return position;
+}
+
+
+/*******************************************************************************
+ * Time the head needs from one position to another at full speed, the whole
+ * range of an axis when either end is not known
+ ******************************************************************************/
+PtzState::Clock::duration PtzState::travelTime(std::optional<Vector> const &from, std::optional<Vector> const &to) const
+{
+    Vector const a = from && to ? *from : m_limits.min;
+    Vector const b = from && to ? *to : m_limits.max;
+
+    auto axis = [](float begin, float end, float rate) { return rate > 0.0f ? std::abs(end - begin) / rate : 0.0f; };
+    float const seconds = std::max({axis(a.pan, b.pan, m_rates.pan), axis(a.tilt, b.tilt, m_rates.tilt),
+                                    axis(a.zoom, b.zoom, m_rates.zoom)});
+
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(seconds));
+}
+
+
+/*******************************************************************************
+ * Status at now, a move to a preset or home over by now counts as arrived
+ ******************************************************************************/
+PtzState::Status PtzState::snapshot(Clock::time_point now) const
+{
+    Status status;
+    status.velocity = m_velocity;
+    status.reported = m_reported;
+
+    if (m_travelling && now < m_arrival)
+    {
+        // the last known position until the head reports its arrival
+        if (m_known)
+            status.position = estimate(now);
+        status.panTiltMoving = true;
+        status.zoomMoving = true;
+        return status;
+    }
+
+    if (m_travelling && !m_feedback)
+        status.position = m_target;
+    else if (m_known)
+        status.position = estimate(now);
+    status.panTiltMoving = m_velocity.pan != 0.0f || m_velocity.tilt != 0.0f;
+    status.zoomMoving = m_velocity.zoom != 0.0f;
+    return status;
+}
+
+
+void PtzState::move(Vector velocity)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Clock::time_point const now = Clock::now();
+
+    // the motion so far is folded in, the new velocity counts from now; it
+    // also ends a move to a preset, wherever the head has got to
+    std::optional<Vector> const position = snapshot(now).position;
+    m_known = position.has_value();
+    if (position)
+        m_position = *position;
+    m_velocity = velocity;
+    m_since = now;
+    m_travelling = false;
+}
+
+
+void PtzState::stop()
+{
+    move(Vector{});
+}
+
+
+void PtzState::moveTo(std::optional<Vector> target)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Clock::time_point const now = Clock::now();
+
+    std::optional<Vector> const position = snapshot(now).position;
+    m_known = position.has_value();
+    if (position)
+        m_position = *position;
+    m_velocity = Vector{};
+    m_since = now;
+    m_reported = false;
+
+    // with feedback a known target is left to the reports, the time is a bound
+    m_travelling = true;
+    m_target = target;
+    m_arrival = now + travelTime(position, target) * (m_feedback && target ? g_overdueFactor : 1);
+}
+
+
+void PtzState::report(Vector position)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // dead reckoning goes on from the reported position
+    Clock::time_point const now = Clock::now();
+    m_position = position;
+    m_since = now;
+    m_known = true;
+    m_reported = true;
+
+    if (m_travelling && (now >= m_arrival || (m_target && near(position, *m_target))))
+        m_travelling = false;
+}
+
+
+PtzState::Status PtzState::status() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return snapshot(Clock::now());
+}
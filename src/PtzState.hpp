@@ -0,0 +1,102 @@
+#ifndef PTZ_STATE_HPP
+#define PTZ_STATE_HPP
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+
+
+/*******************************************************************************
+ * Last known motion of the PTZ head, the answer of GetStatus
+ *
+ * The handlers record every velocity they command, every stop and every move
+ * to a preset; the position between backend reports is dead-reckoned from the
+ * velocity and the configured rates, so a client polling GetStatus many times
+ * a second costs a lock and a multiplication, never a backend call.
+ *
+ * Positions are in the generic spaces, pan and tilt -1..1, zoom 0..1, within
+ * the configured limits of the head. The position is unknown on startup until
+ * the backend reports one or the head goes home.
+ *
+ * A move to a preset or home is MOVING until the head has arrived: with
+ * feedback, until a report close to the target, without it or without a
+ * target, for the time the move takes at full speed. With feedback that time
+ * is only waited out several times over, so a head stopping short of the
+ * target does not stay MOVING; its position is then the last one reported.
+ ******************************************************************************/
+class PtzState
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Vector
+    {
+        float pan{0.0f};
+        float tilt{0.0f};
+        float zoom{0.0f};
+    };
+
+    struct Limits
+    {
+        Vector min{-1.0f, -1.0f, 0.0f};
+        Vector max{1.0f, 1.0f, 1.0f};
+
+        // min below max, inside the generic spaces
+        bool valid() const;
+        bool contains(Vector const &position) const;
+    };
+
+    struct Status
+    {
+        std::optional<Vector> position; // unset while unknown
+        Vector velocity;
+        bool reported{false};           // position follows a backend report, not only dead reckoning
+        bool panTiltMoving{false};
+        bool zoomMoving{false};
+    };
+
+    // rates: position units per second at velocity 1, of the generic spaces;
+    // feedback: the backend reports the position, see report()
+    PtzState(Vector rates, Limits limits, bool feedback);
+
+    PtzState(PtzState const &) = delete;
+    PtzState &operator=(PtzState const &) = delete;
+
+    // velocity -1..1 per axis, as the actuator runs it
+    void move(Vector velocity);
+    void stop();
+
+    // a move to a preset or home, target unset when its position is not known
+    void moveTo(std::optional<Vector> target);
+
+    // position read back from the backend
+    void report(Vector position);
+
+    Status status() const;
+
+    Vector rates() const { return m_rates; }
+    Limits limits() const { return m_limits; }
+
+  private:
+    Vector estimate(Clock::time_point now) const;
+    Status snapshot(Clock::time_point now) const;
+    Clock::duration travelTime(std::optional<Vector> const &from, std::optional<Vector> const &to) const;
+
+    Vector const m_rates;
+    Limits const m_limits;
+    bool const m_feedback;
+
+    mutable std::mutex m_mutex;
+    Vector m_position;              // at m_since
+    Vector m_velocity;              // since m_since
+    Clock::time_point m_since;
+    bool m_known{false};
+    bool m_reported{false};
+    bool m_travelling{false};       // a move to a preset or home not yet arrived
+    std::optional<Vector> m_target; // of that move, unset when not known
+    Clock::time_point m_arrival;    // the travel is over by then at the latest
+};
+
+
+#endif // PTZ_STATE_HPP
@@ -0,0 +1,479 @@
+#include <cctype>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <zlib.h>
+
+#include "ResponseCompression.hpp"
+
+
+char const *const ResponseCompression::g_pluginId = "ResponseCompression-1.0";
+
+
+namespace
+{
+
+constexpr int g_level = 6; // zlib default, most of the gain of level 9 for XML
+constexpr size_t g_cacheEntries = 64;
+constexpr size_t g_maxCachedBody = 256 * 1024;
+constexpr size_t g_seenLimit = 1024;
+constexpr size_t g_maxHeader = 8192; // larger headers are passed through unchanged
+
+
+/*******************************************************************************
+ * Plugin data of one context, the response being sent and the wrapped hooks
+ ******************************************************************************/
+struct CompressionData
+{
+    enum class State
+    {
+        Header,     // collecting the response header
+        Body,       // buffering a body to compress
+        PassThrough // sending unchanged until the next request
+    };
+
+    ResponseCompression *owner{nullptr};
+    ResponseCompression::Encoding accepted{ResponseCompression::Encoding::Identity};
+    State state{State::Header};
+    std::string header;
+    std::string body;
+    size_t contentLength{0};
+
+    int (*fparse)(struct soap *){nullptr};
+    int (*fparsehdr)(struct soap *, char const *, char const *){nullptr};
+    int (*fsend)(struct soap *, char const *, size_t){nullptr};
+};
+
+
+CompressionData *compression_data(struct soap *soap)
+{
+    return static_cast<CompressionData *>(soap_lookup_plugin(soap, ResponseCompression::g_pluginId));
+}
+
+
+bool equals_nocase(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+            return false;
+    return true;
+}
+
+
+std::string_view trim(std::string_view text)
+{
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+        text.remove_prefix(1);
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t'))
+        text.remove_suffix(1);
+    return text;
+}
+
+
+uint64_t body_key(std::string_view body, ResponseCompression::Encoding encoding)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : body)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash ^ (static_cast<uint64_t>(encoding) * 0x9e3779b97f4a7c15ull);
+}
+
+
+std::string deflate_body(std::string_view body, ResponseCompression::Encoding encoding)
+{
+    z_stream stream{};
+    int const windowBits = encoding == ResponseCompression::Encoding::Gzip ? 15 + 16 : 15;
+
+    if (deflateInit2(&stream, g_level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return {};
+
+    std::string out(deflateBound(&stream, body.size()), '\0');
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(body.data()));
+    stream.avail_in = static_cast<uInt>(body.size());
+    stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+
+    int const result = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    return result == Z_STREAM_END ? out : std::string{};
+}
+
+
+/*******************************************************************************
+ * What the header says about the body that follows
+ ******************************************************************************/
+struct HeaderInfo
+{
+    bool informational{false}; // 1xx, no body follows
+    bool hasLength{false};
+    size_t contentLength{0};
+    bool encoded{false}; // Content-Encoding or Transfer-Encoding already set
+    bool textual{false};
+};
+
+
+HeaderInfo parse_header(std::string_view header)
+{
+    HeaderInfo info;
+
+    size_t lineEnd = header.find("\r\n");
+    std::string_view status = header.substr(0, lineEnd);
+    size_t space = status.find(' ');
+    info.informational = space != std::string_view::npos && space + 1 < status.size() && status[space + 1] == '1';
+
+    while (lineEnd != std::string_view::npos && lineEnd + 2 < header.size())
+    {
+        size_t const start = lineEnd + 2;
+        lineEnd = header.find("\r\n", start);
+        std::string_view line = header.substr(start, lineEnd - start);
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos)
+            continue;
+
+        std::string_view key = trim(line.substr(0, colon));
+        std::string_view value = trim(line.substr(colon + 1));
+
+        if (equals_nocase(key, "Content-Length"))
+        {
+            info.hasLength = true;
+            info.contentLength = std::strtoul(std::string(value).c_str(), nullptr, 10);
+        }
+        else if (equals_nocase(key, "Content-Encoding") || equals_nocase(key, "Transfer-Encoding"))
+            info.encoded = true;
+        else if (equals_nocase(key, "Content-Type"))
+            info.textual = value.substr(0, 5) == "text/" || value.find("xml") != std::string_view::npos;
+    }
+
+    return info;
+}
+
+
+// the header without its Content-Length, ending before the empty line
+std::string rewrite_header(std::string_view header, size_t length, ResponseCompression::Encoding encoding)
+{
+    std::string out;
+    out.reserve(header.size() + 64);
+
+    size_t start = 0;
+    while (start < header.size())
+    {
+        size_t end = header.find("\r\n", start);
+        if (end == std::string_view::npos || end == start)
+            break;
+
+        std::string_view line = header.substr(start, end - start);
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos || !equals_nocase(trim(line.substr(0, colon)), "Content-Length"))
+            out.append(line).append("\r\n");
+        start = end + 2;
+    }
+
+    out += "Content-Length: " + std::to_string(length) + "\r\n";
+    out += "Content-Encoding: ";
+    out += encoding == ResponseCompression::Encoding::Gzip ? "gzip\r\n" : "deflate\r\n";
+    out += "Vary: Accept-Encoding\r\n\r\n";
+    return out;
+}
+
+
+int send_buffered(struct soap *soap, CompressionData &data, std::string const &text)
+{
+    return text.empty() ? SOAP_OK : data.fsend(soap, text.data(), text.size());
+}
+
+
+/*******************************************************************************
+ * Send the buffered body, compressed when that makes it smaller
+ ******************************************************************************/
+int finish_body(struct soap *soap, CompressionData &data)
+{
+    ResponseCompression &owner = *data.owner;
+
+    std::string header = std::move(data.header);
+    std::string body = std::move(data.body);
+    data.header.clear();
+    data.body.clear();
+    data.state = CompressionData::State::PassThrough;
+
+    std::shared_ptr<std::string const> compressed = owner.compress(body, data.accepted);
+
+    if (!compressed || compressed->empty() || compressed->size() >= body.size())
+    {
+        int error = send_buffered(soap, data, header);
+        return error ? error : send_buffered(soap, data, body);
+    }
+
+    std::string const rewritten = rewrite_header(header, compressed->size(), data.accepted);
+    int error = send_buffered(soap, data, rewritten);
+    return error ? error : send_buffered(soap, data, *compressed);
+}
+
+
+int compression_parse(struct soap *soap)
+{
+    CompressionData *data = compression_data(soap);
+    if (!data)
+        return SOAP_PLUGIN_ERROR;
+
+    // a new request, its response starts with a header again
+    data->accepted = ResponseCompression::Encoding::Identity;
+    data->state = CompressionData::State::Header;
+    data->header.clear();
+    data->body.clear();
+
+    return data->fparse(soap);
+}
+
+
+int compression_parsehdr(struct soap *soap, char const *key, char const *val)
+{
+    CompressionData *data = compression_data(soap);
+    if (!data)
+        return SOAP_PLUGIN_ERROR;
+
+    if (!soap_tag_cmp(key, "Accept-Encoding"))
+        data->accepted = ResponseCompression::negotiate(val ? val : "");
+
+    return data->fparsehdr(soap, key, val);
+}
+
+
+int compression_send(struct soap *soap, char const *s, size_t n)
+{
+    CompressionData *data = compression_data(soap);
+    if (!data)
+        return SOAP_EOF;
+
+    if (data->state == CompressionData::State::PassThrough ||
+        (data->state == CompressionData::State::Header && data->accepted == ResponseCompression::Encoding::Identity))
+        return data->fsend(soap, s, n);
+
+    if (data->state == CompressionData::State::Body)
+    {
+        data->body.append(s, n);
+        return data->body.size() < data->contentLength ? SOAP_OK : finish_body(soap, *data);
+    }
+
+    data->header.append(s, n);
+
+    size_t end = data->header.find("\r\n\r\n");
+    if (end == std::string::npos)
+    {
+        if (data->header.size() <= g_maxHeader)
+            return SOAP_OK;
+
+        data->state = CompressionData::State::PassThrough;
+        return send_buffered(soap, *data, std::exchange(data->header, {}));
+    }
+
+    std::string rest = data->header.substr(end + 4);
+    data->header.resize(end + 4);
+
+    HeaderInfo const info = parse_header(data->header);
+
+    if (info.informational)
+    {
+        // 100 Continue, the response proper follows
+        int error = send_buffered(soap, *data, std::exchange(data->header, {}));
+        return error || rest.empty() ? error : compression_send(soap, rest.data(), rest.size());
+    }
+
+    if (!info.hasLength || info.encoded || !info.textual || info.contentLength < data->owner->threshold())
+    {
+        data->state = CompressionData::State::PassThrough;
+        int error = send_buffered(soap, *data, std::exchange(data->header, {}));
+        return error ? error : send_buffered(soap, *data, rest);
+    }
+
+    data->state = CompressionData::State::Body;
+    data->contentLength = info.contentLength;
+    data->body = std::move(rest);
+    data->body.reserve(info.contentLength);
+
+    return data->body.size() < data->contentLength ? SOAP_OK : finish_body(soap, *data);
+}
+
+
+void compression_delete(struct soap *soap, struct soap_plugin *plugin)
+{
+    CompressionData *data = static_cast<CompressionData *>(plugin->data);
+
+    soap->fparse = data->fparse;
+    soap->fparsehdr = data->fparsehdr;
+    soap->fsend = data->fsend;
+
+    delete data;
+}
+
+
+int compression_create(struct soap *soap, struct soap_plugin *plugin, void *arg);
+
+
+int compression_copy(struct soap *soap, struct soap_plugin *dst, struct soap_plugin *src)
+{
+    return compression_create(soap, dst, static_cast<CompressionData *>(src->data)->owner);
+}
+
+
+int compression_create(struct soap *soap, struct soap_plugin *plugin, void *arg)
+{
+    CompressionData *data = new (std::nothrow) CompressionData;
+    if (!data)
+        return SOAP_EOM;
+
+    data->owner = static_cast<ResponseCompression *>(arg);
+    data->fparse = soap->fparse;
+    data->fparsehdr = soap->fparsehdr;
+    data->fsend = soap->fsend;
+
+    soap->fparse = compression_parse;
+    soap->fparsehdr = compression_parsehdr;
+    soap->fsend = compression_send;
+
+    plugin->id = ResponseCompression::g_pluginId;
+    plugin->data = data;
+    plugin->fcopy = compression_copy;
+    plugin->fdelete = compression_delete;
+    return SOAP_OK;
+}
+
+} // namespace
+
+
+ResponseCompression::ResponseCompression(size_t threshold, std::shared_ptr<ServiceMetrics> metrics)
+    : m_threshold{threshold}, m_metrics{std::move(metrics)}
+{
+}
+
+
+bool ResponseCompression::attach(struct soap *soap)
+{
+    if (soap_register_plugin_arg(soap, compression_create, this) != SOAP_OK)
+    {
+        soap->error = SOAP_OK;
+        return false;
+    }
+    return true;
+}
+
+
+/*******************************************************************************
+ * Pick the encoding of the response
+ *
+ * gzip is preferred over deflate at the same quality, an encoding (or "*")
+ * listed with q=0 is refused.
+ ******************************************************************************/
+ResponseCompression::Encoding ResponseCompression::negotiate(std::string_view acceptEncoding)
+{
+    double gzip = -1.0, deflate = -1.0, any = -1.0;
+
+    while (!acceptEncoding.empty())
+    {
+        size_t comma = acceptEncoding.find(',');
+        std::string_view item = acceptEncoding.substr(0, comma);
+        acceptEncoding = comma == std::string_view::npos ? std::string_view{} : acceptEncoding.substr(comma + 1);
+
+        size_t semicolon = item.find(';');
+        std::string_view coding = trim(item.substr(0, semicolon));
+        double quality = 1.0;
+
+        if (semicolon != std::string_view::npos)
+        {
+            std::string_view parameter = trim(item.substr(semicolon + 1));
+            if (parameter.size() > 2 && (parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=')
+                quality = std::strtod(std::string(parameter.substr(2)).c_str(), nullptr);
+        }
+
+        if (equals_nocase(coding, "gzip") || equals_nocase(coding, "x-gzip"))
+            gzip = quality;
+        else if (equals_nocase(coding, "deflate"))
+            deflate = quality;
+        else if (coding == "*")
+            any = quality;
+    }
+
+    if (gzip < 0.0)
+        gzip = any;
+    if (deflate < 0.0)
+        deflate = any;
+
+    if (gzip > 0.0 && gzip >= deflate)
+        return Encoding::Gzip;
+    if (deflate > 0.0)
+        return Encoding::Deflate;
+    return Encoding::Identity;
+}
+
+
+std::shared_ptr<std::string const> ResponseCompression::compress(std::string_view body, Encoding encoding)
+{
+    if (encoding == Encoding::Identity)
+        return nullptr;
+
+    uint64_t const key = body_key(body, encoding);
+    bool const cacheable = body.size() <= g_maxCachedBody;
+
+    if (cacheable)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_index.find(key);
+        if (it != m_index.end() && it->second->plain == body)
+        {
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            if (m_metrics)
+            {
+                m_metrics->compressionCacheHits++;
+                m_metrics->compressedResponses++;
+                m_metrics->compressionSavedBytes += body.size() - it->second->compressed->size();
+            }
+            return it->second->compressed;
+        }
+    }
+
+    // compressed outside the lock, listeners compressing different bodies do not wait for each other
+    auto compressed = std::make_shared<std::string const>(deflate_body(body, encoding));
+
+    bool const smaller = !compressed->empty() && compressed->size() < body.size();
+
+    if (m_metrics && smaller)
+    {
+        m_metrics->compressedResponses++;
+        m_metrics->compressionSavedBytes += body.size() - compressed->size();
+    }
+
+    // only bodies that are worth compressing are kept
+    if (!cacheable || !smaller)
+        return compressed;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_index.count(key))
+        return compressed;
+
+    if (m_seen.insert(key).second)
+    {
+        if (m_seen.size() > g_seenLimit)
+            m_seen = {key};
+        return compressed;
+    }
+
+    m_entries.push_front(Entry{key, std::string(body), compressed});
+    m_index[key] = m_entries.begin();
+
+    if (m_entries.size() > g_cacheEntries)
+    {
+        m_index.erase(m_entries.back().key);
+        m_entries.pop_back();
+    }
+
+    return compressed;
+}
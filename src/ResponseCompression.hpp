@@ -0,0 +1,80 @@
+#ifndef RESPONSE_COMPRESSION_HPP
+#define RESPONSE_COMPRESSION_HPP
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "ServiceMetrics.hpp"
+#include "stdsoap2.h"
+
+
+/*******************************************************************************
+ * Negotiated gzip/deflate compression of the HTTP responses
+ *
+ * A gSOAP plugin wrapping the fparse, fparsehdr and fsend hooks. The encoding
+ * is picked from the Accept-Encoding header of the request; the response
+ * header is held back until it is complete, then a response with a
+ * Content-Length of at least the threshold and a textual content type is
+ * buffered, compressed and sent with its header rewritten. Everything else
+ * (small responses, images, clients without Accept-Encoding) passes straight
+ * through once the header is seen.
+ *
+ * Compressed bodies are cached by their plain bytes and shared by every
+ * listener: the static responses (GetCapabilities, GetServices, GetProfiles
+ * until a configuration changes) are compressed once and then served from the
+ * cache. A body is only cached when it was sent before, so one-off responses
+ * carrying a time stamp do not evict them.
+ ******************************************************************************/
+class ResponseCompression
+{
+  public:
+    static char const *const g_pluginId;
+
+    enum class Encoding
+    {
+        Identity,
+        Gzip,
+        Deflate
+    };
+
+    ResponseCompression(size_t threshold, std::shared_ptr<ServiceMetrics> metrics);
+
+    ResponseCompression(ResponseCompression const &) = delete;
+    ResponseCompression &operator=(ResponseCompression const &) = delete;
+
+    // install the plugin on a context, false if it could not be registered
+    bool attach(struct soap *soap);
+
+    // preferred encoding of an Accept-Encoding header value
+    static Encoding negotiate(std::string_view acceptEncoding);
+
+    size_t threshold() const { return m_threshold; }
+
+    // compressed body, from the cache when the same body was compressed before
+    std::shared_ptr<std::string const> compress(std::string_view body, Encoding encoding);
+
+  private:
+    struct Entry
+    {
+        uint64_t key;
+        std::string plain;
+        std::shared_ptr<std::string const> compressed;
+    };
+
+    size_t const m_threshold;
+    std::shared_ptr<ServiceMetrics> m_metrics;
+
+    std::mutex m_mutex;
+    std::list<Entry> m_entries; // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+    std::unordered_set<uint64_t> m_seen; // compressed once, cached on the next request
+};
+
+
+#endif // RESPONSE_COMPRESSION_HPP
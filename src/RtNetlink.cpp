@@ -0,0 +1,536 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "RtNetlink.hpp"
+
+
+namespace
+{
+
+constexpr size_t g_receiveBuffer = 32 * 1024;
+
+
+uint32_t prefix_mask(int prefix)
+{
+    return prefix <= 0 ? 0 : htonl(~uint32_t{0} << (32 - std::min(prefix, 32)));
+}
+
+
+bool in_subnet(uint32_t ip, RtNetlink::Address4 const &address)
+{
+    uint32_t const mask = prefix_mask(address.prefix);
+    return (ip & mask) == (address.ip & mask);
+}
+
+
+RtNetlink::Link *find_link(std::vector<RtNetlink::Link> &links, unsigned int index)
+{
+    auto it = std::find_if(links.begin(), links.end(), [index](RtNetlink::Link const &link) {
+        return link.index == index;
+    });
+    return it == links.end() ? nullptr : &*it;
+}
+
+
+// attributes following the family header of a message
+template <typename Visit> void for_each_attribute(rtattr *rta, int length, Visit visit)
+{
+    for (; RTA_OK(rta, length); rta = RTA_NEXT(rta, length))
+        visit(rta);
+}
+
+} // namespace
+
+
+/*******************************************************************************
+ * Requests sent together in one sendmsg(), each one acknowledged
+ ******************************************************************************/
+class RtNetlink::Batch
+{
+  public:
+    explicit Batch(uint32_t &seq) : m_seq{seq}, m_first{seq + 1} {}
+
+    template <typename Header> Header *add(uint16_t type, uint16_t flags)
+    {
+        m_current = m_data.size();
+        m_data.resize(m_current + NLMSG_SPACE(sizeof(Header)));
+
+        nlmsghdr *nlh = message();
+        nlh->nlmsg_len = NLMSG_LENGTH(sizeof(Header));
+        nlh->nlmsg_type = type;
+        nlh->nlmsg_flags = static_cast<uint16_t>(NLM_F_REQUEST | flags);
+        nlh->nlmsg_seq = ++m_seq;
+        m_count++;
+
+        return static_cast<Header *>(NLMSG_DATA(nlh));
+    }
+
+    void attribute(uint16_t type, void const *data, size_t length)
+    {
+        size_t const offset = m_current + NLMSG_ALIGN(message()->nlmsg_len);
+        m_data.resize(offset + RTA_SPACE(length));
+
+        rtattr *rta = reinterpret_cast<rtattr *>(&m_data[offset]);
+        rta->rta_type = type;
+        rta->rta_len = static_cast<uint16_t>(RTA_LENGTH(length));
+        memcpy(RTA_DATA(rta), data, length);
+
+        message()->nlmsg_len = static_cast<uint32_t>(NLMSG_ALIGN(message()->nlmsg_len) + RTA_SPACE(length));
+    }
+
+    template <typename Value> void attribute(uint16_t type, Value const &value)
+    {
+        attribute(type, &value, sizeof(value));
+    }
+
+    // an answer to one of our requests, not to an earlier abandoned batch
+    bool owns(uint32_t seq) const { return m_count && seq >= m_first && seq - m_first < m_count; }
+
+    bool empty() const { return m_count == 0; }
+    size_t count() const { return m_count; }
+    void *data() { return m_data.data(); }
+    size_t size() const { return m_data.size(); }
+
+  private:
+    nlmsghdr *message() { return reinterpret_cast<nlmsghdr *>(&m_data[m_current]); }
+
+    uint32_t &m_seq;
+    uint32_t const m_first;
+    std::vector<char> m_data;
+    size_t m_current{0};
+    size_t m_count{0};
+};
+
+
+RtNetlink::RtNetlink()
+{
+    m_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (m_fd < 0)
+        return;
+
+    sockaddr_nl local{};
+    local.nl_family = AF_NETLINK;
+
+    if (bind(m_fd, reinterpret_cast<sockaddr *>(&local), sizeof(local)) != 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+
+RtNetlink::~RtNetlink()
+{
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+
+/*******************************************************************************
+ * Send the batch and read its answers
+ *
+ * A dump request returns its messages in replies, other requests are counted
+ * until every one of them is acknowledged; error receives the first failure.
+ *
+ * @return false if the socket failed
+ ******************************************************************************/
+bool RtNetlink::request(Batch &batch, std::vector<std::vector<char>> *replies, int *error)
+{
+    if (m_fd < 0 || batch.empty())
+        return false;
+
+    sockaddr_nl kernel{};
+    kernel.nl_family = AF_NETLINK;
+
+    iovec iov{batch.data(), batch.size()};
+    msghdr msg{};
+    msg.msg_name = &kernel;
+    msg.msg_namelen = sizeof(kernel);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    ssize_t sent;
+    do
+        sent = sendmsg(m_fd, &msg, 0);
+    while (sent < 0 && errno == EINTR);
+
+    if (sent != static_cast<ssize_t>(batch.size()))
+        return false;
+
+    size_t pending = batch.count();
+    std::vector<char> buffer(g_receiveBuffer);
+
+    while (pending)
+    {
+        ssize_t received = recv(m_fd, buffer.data(), buffer.size(), 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+
+        int length = static_cast<int>(received);
+        for (nlmsghdr *nlh = reinterpret_cast<nlmsghdr *>(buffer.data()); NLMSG_OK(nlh, length);
+             nlh = NLMSG_NEXT(nlh, length))
+        {
+            if (!batch.owns(nlh->nlmsg_seq))
+                continue;
+
+            if (nlh->nlmsg_type == NLMSG_DONE)
+            {
+                pending--;
+            }
+            else if (nlh->nlmsg_type == NLMSG_ERROR)
+            {
+                int const code = -static_cast<nlmsgerr *>(NLMSG_DATA(nlh))->error;
+                if (code && error && !*error)
+                    *error = code;
+                pending--;
+            }
+            else if (replies)
+            {
+                replies->emplace_back(reinterpret_cast<char *>(nlh), reinterpret_cast<char *>(nlh) + nlh->nlmsg_len);
+            }
+        }
+    }
+
+    return true;
+}
+
+
+bool RtNetlink::dump(std::vector<Link> &links)
+{
+    links.clear();
+    return dumpLinks(links) && dumpAddresses(links) && dumpRoutes(links);
+}
+
+
+bool RtNetlink::dumpLinks(std::vector<Link> &links)
+{
+    Batch batch{m_seq};
+    batch.add<ifinfomsg>(RTM_GETLINK, NLM_F_DUMP)->ifi_family = AF_UNSPEC;
+
+    std::vector<std::vector<char>> replies;
+    int error = 0;
+    if (!request(batch, &replies, &error) || error)
+        return false;
+
+    for (std::vector<char> &reply : replies)
+    {
+        nlmsghdr *nlh = reinterpret_cast<nlmsghdr *>(reply.data());
+        if (nlh->nlmsg_type != RTM_NEWLINK)
+            continue;
+
+        ifinfomsg *ifi = static_cast<ifinfomsg *>(NLMSG_DATA(nlh));
+
+        Link link;
+        link.index = static_cast<unsigned int>(ifi->ifi_index);
+        link.flags = ifi->ifi_flags;
+
+        for_each_attribute(IFLA_RTA(ifi), static_cast<int>(IFLA_PAYLOAD(nlh)), [&link, ifi](rtattr *rta) {
+            if (rta->rta_type == IFLA_IFNAME)
+                link.name = static_cast<char const *>(RTA_DATA(rta));
+            else if (rta->rta_type == IFLA_MTU)
+                memcpy(&link.mtu, RTA_DATA(rta), sizeof(link.mtu));
+            else if (rta->rta_type == IFLA_ADDRESS && ifi->ifi_type == ARPHRD_ETHER &&
+                     RTA_PAYLOAD(rta) == link.hwaddr.size())
+            {
+                memcpy(link.hwaddr.data(), RTA_DATA(rta), link.hwaddr.size());
+                link.hasHwaddr = true;
+            }
+        });
+
+        links.push_back(std::move(link));
+    }
+
+    return true;
+}
+
+
+bool RtNetlink::dumpAddresses(std::vector<Link> &links)
+{
+    Batch batch{m_seq};
+    batch.add<ifaddrmsg>(RTM_GETADDR, NLM_F_DUMP)->ifa_family = AF_UNSPEC;
+
+    std::vector<std::vector<char>> replies;
+    int error = 0;
+    if (!request(batch, &replies, &error) || error)
+        return false;
+
+    for (std::vector<char> &reply : replies)
+    {
+        nlmsghdr *nlh = reinterpret_cast<nlmsghdr *>(reply.data());
+        if (nlh->nlmsg_type != RTM_NEWADDR)
+            continue;
+
+        ifaddrmsg *ifa = static_cast<ifaddrmsg *>(NLMSG_DATA(nlh));
+        Link *link = find_link(links, ifa->ifa_index);
+        if (!link)
+            continue;
+
+        for_each_attribute(IFA_RTA(ifa), static_cast<int>(IFA_PAYLOAD(nlh)), [link, ifa](rtattr *rta) {
+            if (ifa->ifa_family == AF_INET && rta->rta_type == IFA_LOCAL)
+            {
+                Address4 address;
+                memcpy(&address.ip, RTA_DATA(rta), sizeof(address.ip));
+                address.prefix = ifa->ifa_prefixlen;
+                link->ipv4.push_back(address);
+            }
+            else if (ifa->ifa_family == AF_INET6 && rta->rta_type == IFA_ADDRESS)
+            {
+                Eth_IPv6_Addr address;
+                memcpy(&address.addr, RTA_DATA(rta), sizeof(address.addr));
+                address.prefix = ifa->ifa_prefixlen;
+
+                if (!IN6_IS_ADDR_LINKLOCAL(&address.addr) && !IN6_IS_ADDR_LOOPBACK(&address.addr))
+                    link->ipv6.push_back(address);
+            }
+        });
+    }
+
+    return true;
+}
+
+
+bool RtNetlink::dumpRoutes(std::vector<Link> &links)
+{
+    Batch batch{m_seq};
+    batch.add<rtmsg>(RTM_GETROUTE, NLM_F_DUMP)->rtm_family = AF_UNSPEC;
+
+    std::vector<std::vector<char>> replies;
+    int error = 0;
+    if (!request(batch, &replies, &error) || error)
+        return false;
+
+    for (std::vector<char> &reply : replies)
+    {
+        nlmsghdr *nlh = reinterpret_cast<nlmsghdr *>(reply.data());
+        if (nlh->nlmsg_type != RTM_NEWROUTE)
+            continue;
+
+        rtmsg *rtm = static_cast<rtmsg *>(NLMSG_DATA(nlh));
+        if (rtm->rtm_dst_len != 0 || rtm->rtm_type != RTN_UNICAST)
+            continue;
+
+        uint32_t table = rtm->rtm_table;
+        uint32_t oif = 0;
+        rtattr *gateway = nullptr;
+
+        for_each_attribute(RTM_RTA(rtm), static_cast<int>(RTM_PAYLOAD(nlh)), [&](rtattr *rta) {
+            if (rta->rta_type == RTA_TABLE)
+                memcpy(&table, RTA_DATA(rta), sizeof(table));
+            else if (rta->rta_type == RTA_OIF)
+                memcpy(&oif, RTA_DATA(rta), sizeof(oif));
+            else if (rta->rta_type == RTA_GATEWAY)
+                gateway = rta;
+        });
+
+        Link *link = find_link(links, oif);
+        if (table != RT_TABLE_MAIN || !gateway || !link)
+            continue;
+
+        if (rtm->rtm_family == AF_INET && !link->gateway)
+            memcpy(&link->gateway, RTA_DATA(gateway), sizeof(link->gateway));
+        else if (rtm->rtm_family == AF_INET6 && !link->gateway6)
+        {
+            in6_addr address;
+            memcpy(&address, RTA_DATA(gateway), sizeof(address));
+            link->gateway6 = address;
+        }
+    }
+
+    return true;
+}
+
+
+/*******************************************************************************
+ * Requests taking the link from its current state to the changed one
+ *
+ * The link comes up before the addresses and routes are set, a route needs a
+ * running link, and goes down last. Taking the link down or removing its
+ * address flushes the default route, it is then added again.
+ ******************************************************************************/
+void RtNetlink::build(Batch &batch, Link const &current, Change const &change)
+{
+    bool const wasUp = (current.flags & IFF_UP) != 0;
+    bool const up = change.up.value_or(wasUp);
+    bool routesFlushed = false;
+
+    auto link = [&]() {
+        ifinfomsg *ifi = batch.add<ifinfomsg>(RTM_NEWLINK, NLM_F_ACK);
+        ifi->ifi_family = AF_UNSPEC;
+        ifi->ifi_index = static_cast<int>(current.index);
+        return ifi;
+    };
+
+    auto set_up = [&](bool on) {
+        ifinfomsg *ifi = link();
+        ifi->ifi_change = IFF_UP;
+        ifi->ifi_flags = on ? IFF_UP : 0;
+    };
+
+    if (change.hwaddr && (!current.hasHwaddr || *change.hwaddr != current.hwaddr))
+    {
+        // most drivers refuse a new address while the link is running
+        if (wasUp)
+        {
+            set_up(false);
+            routesFlushed = true;
+        }
+
+        link();
+        batch.attribute(IFLA_ADDRESS, change.hwaddr->data(), change.hwaddr->size());
+
+        if (up)
+            set_up(true);
+    }
+    else if (up && !wasUp)
+    {
+        set_up(true);
+    }
+
+    if (change.mtu && *change.mtu != current.mtu)
+    {
+        link();
+        batch.attribute(IFLA_MTU, static_cast<uint32_t>(*change.mtu));
+    }
+
+    if (change.ipv4)
+    {
+        bool replaced = current.ipv4.empty();
+        for (Address4 const &old : current.ipv4)
+        {
+            if (old.ip != change.ipv4->ip || old.prefix != change.ipv4->prefix)
+            {
+                address(batch, RTM_DELADDR, current.index, old);
+                replaced = true;
+            }
+        }
+
+        if (replaced)
+        {
+            address(batch, RTM_NEWADDR, current.index, *change.ipv4);
+            routesFlushed = true;
+        }
+    }
+
+    // the old gateway is kept only while it is still reachable
+    uint32_t gateway = change.gateway.value_or(current.gateway);
+    if (!change.gateway && change.ipv4 && gateway && !in_subnet(gateway, *change.ipv4))
+        gateway = 0;
+
+    auto route = [&](uint16_t type, uint16_t flags, uint32_t via) {
+        rtmsg *rtm = batch.add<rtmsg>(type, NLM_F_ACK | flags);
+        rtm->rtm_family = AF_INET;
+        rtm->rtm_table = RT_TABLE_MAIN;
+        rtm->rtm_protocol = RTPROT_STATIC;
+        rtm->rtm_scope = RT_SCOPE_UNIVERSE;
+        rtm->rtm_type = RTN_UNICAST;
+        batch.attribute(RTA_GATEWAY, via);
+        batch.attribute(RTA_OIF, static_cast<uint32_t>(current.index));
+    };
+
+    if (up && gateway && (gateway != current.gateway || routesFlushed))
+        route(RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE, gateway);
+    else if (!gateway && current.gateway && !routesFlushed)
+        route(RTM_DELROUTE, 0, current.gateway);
+
+    if (!up && wasUp)
+        set_up(false);
+}
+
+
+void RtNetlink::address(Batch &batch, uint16_t type, unsigned int index, Address4 const &ipv4)
+{
+    uint16_t const flags = type == RTM_NEWADDR ? NLM_F_CREATE | NLM_F_REPLACE : 0;
+
+    ifaddrmsg *ifa = batch.add<ifaddrmsg>(type, NLM_F_ACK | flags);
+    ifa->ifa_family = AF_INET;
+    ifa->ifa_prefixlen = static_cast<unsigned char>(ipv4.prefix);
+    ifa->ifa_index = index;
+
+    batch.attribute(IFA_LOCAL, ipv4.ip);
+    batch.attribute(IFA_ADDRESS, ipv4.ip);
+    if (type == RTM_NEWADDR && ipv4.prefix < 31)
+        batch.attribute(IFA_BROADCAST, static_cast<uint32_t>(ipv4.ip | ~prefix_mask(ipv4.prefix)));
+}
+
+
+int RtNetlink::apply(Change const &change)
+{
+    return apply(std::vector<Change>{change});
+}
+
+
+int RtNetlink::apply(std::vector<Change> const &changes)
+{
+    std::vector<Link> links;
+    if (!dump(links))
+        return EIO;
+
+    Batch batch{m_seq};
+    for (Change const &change : changes)
+    {
+        Link const *current = find_link(links, change.index);
+        if (!current)
+            return ENODEV;
+        build(batch, *current, change);
+    }
+
+    if (batch.empty())
+        return 0;
+
+    int error = 0;
+    bool const sent = request(batch, nullptr, &error);
+    if (sent && !error)
+        return 0;
+
+    // put every link back to what was read before the change
+    std::vector<Link> after;
+    if (!dump(after))
+        return error ? error : EIO;
+
+    Batch undo{m_seq};
+    for (Change const &change : changes)
+    {
+        Link const *now = find_link(after, change.index);
+        if (now)
+            restore(undo, *find_link(links, change.index), *now);
+    }
+
+    if (!undo.empty())
+        request(undo, nullptr, nullptr);
+
+    return error ? error : EIO;
+}
+
+
+void RtNetlink::restore(Batch &batch, Link const &before, Link const &now)
+{
+    Change rollback;
+    rollback.index = before.index;
+    if (before.hasHwaddr)
+        rollback.hwaddr = before.hwaddr;
+    rollback.mtu = before.mtu;
+    rollback.gateway = before.gateway;
+    rollback.up = (before.flags & IFF_UP) != 0;
+    if (!before.ipv4.empty())
+        rollback.ipv4 = before.ipv4.front();
+
+    build(batch, now, rollback);
+    for (size_t i = 1; i < before.ipv4.size(); ++i)
+        address(batch, RTM_NEWADDR, before.index, before.ipv4[i]);
+
+    // a link that had no address loses the one it got
+    if (before.ipv4.empty())
+    {
+        for (Address4 const &added : now.ipv4)
+            address(batch, RTM_DELADDR, before.index, added);
+    }
+}
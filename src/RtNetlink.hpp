@@ -0,0 +1,92 @@
+#ifndef RT_NETLINK_HPP
+#define RT_NETLINK_HPP
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "eth_dev_param.h"
+
+
+/*******************************************************************************
+ * rtnetlink access to the network configuration
+ *
+ * dump() reads the links, their addresses and the default routes of every
+ * interface with one dump request each on a single socket, where the ioctl
+ * getters of Eth_Dev_Param cost a syscall per field and interface.
+ *
+ * apply() sends every request of a change (MAC, MTU, IPv4 address and prefix,
+ * default gateway, link state) in one sendmsg() and collects the
+ * acknowledgements; changes of several links go into the same batch. rtnetlink
+ * has no transactions, so when one of them fails every link of the batch is
+ * put back to the state read before the change. A MAC change on a link that
+ * is up takes it down and up again within the same batch.
+ ******************************************************************************/
+class RtNetlink
+{
+  public:
+    using HwAddress = std::array<uint8_t, 6>;
+
+    struct Address4
+    {
+        uint32_t ip{0}; // network order
+        int prefix{0};
+    };
+
+    struct Link
+    {
+        std::string name;
+        unsigned int index{0};
+        unsigned int flags{0}; // IFF_*
+        int mtu{0};
+        bool hasHwaddr{false};
+        HwAddress hwaddr{};
+        std::vector<Address4> ipv4;
+        std::vector<Eth_IPv6_Addr> ipv6; // global and unique local only
+        uint32_t gateway{0};             // IPv4 default route through the link, 0 for none
+        std::optional<in6_addr> gateway6;
+    };
+
+    struct Change
+    {
+        unsigned int index{0};
+        std::optional<HwAddress> hwaddr;
+        std::optional<int> mtu;
+        std::optional<Address4> ipv4;     // replaces the IPv4 addresses of the link
+        std::optional<uint32_t> gateway;  // 0 removes the default route through the link
+        std::optional<bool> up;
+    };
+
+    RtNetlink();
+    ~RtNetlink();
+
+    RtNetlink(RtNetlink const &) = delete;
+    RtNetlink &operator=(RtNetlink const &) = delete;
+
+    bool is_open() const { return m_fd >= 0; }
+
+    bool dump(std::vector<Link> &links);
+
+    // 0 on success, otherwise the errno of the first failed request
+    int apply(Change const &change);
+    int apply(std::vector<Change> const &changes); // one change per link
+
+  private:
+    class Batch;
+
+    bool request(Batch &batch, std::vector<std::vector<char>> *replies, int *error);
+    bool dumpLinks(std::vector<Link> &links);
+    bool dumpAddresses(std::vector<Link> &links);
+    bool dumpRoutes(std::vector<Link> &links);
+    void build(Batch &batch, Link const &current, Change const &change);
+    void address(Batch &batch, uint16_t type, unsigned int index, Address4 const &ipv4);
+    void restore(Batch &batch, Link const &before, Link const &now);
+
+    int m_fd{-1};
+    uint32_t m_seq{0};
+};
+
+
+#endif // RT_NETLINK_HPP
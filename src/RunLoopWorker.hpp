@@ -0,0 +1,67 @@
+#ifndef RUN_LOOP_WORKER_HPP
+#define RUN_LOOP_WORKER_HPP
+
+#include <functional>
+#include <memory>
+#include <type_traits>
+
+
+/*******************************************************************************
+ * Runs one loop of the daemon by a ThreadWarden under the supervisor
+ *
+ * Every work() calls Step of the Loop once, which waits up to g_waitMs for
+ * something to do. A Step returning bool tells with false that the loop can
+ * not go on, like a socket that can not be opened; that and a missing loop
+ * are reported through onFailure and end the worker.
+ ******************************************************************************/
+template <class Loop, auto Step, char const *Name> class RunLoopWorker
+{
+  public:
+    static constexpr char const *g_workerName{Name};
+    static constexpr bool g_copyDataOnce{true};
+    static constexpr int g_waitMs{100};
+    struct Input
+    {
+        std::shared_ptr<Loop> loop;
+        std::function<void()> onFailure;
+    } dataIn;
+    struct Output
+    {
+    } dataOut;
+    RunLoopWorker()
+    {
+    }
+    int work()
+    {
+        if (!dataIn.loop)
+        {
+            return fail();
+        }
+
+        if constexpr (std::is_same_v<std::invoke_result_t<decltype(Step), Loop &, int>, bool>)
+        {
+            if (!std::invoke(Step, *dataIn.loop, g_waitMs))
+            {
+                return fail();
+            }
+        }
+        else
+        {
+            std::invoke(Step, *dataIn.loop, g_waitMs);
+        }
+        return 0;
+    }
+
+  private:
+    int fail()
+    {
+        if (dataIn.onFailure)
+        {
+            dataIn.onFailure();
+        }
+        return 1;
+    }
+};
+
+
+#endif // RUN_LOOP_WORKER_HPP
@@ -1,10 +1,13 @@
 #include <arpa/inet.h>
 
 #include <stdlib.h> // defines getenv in POSIX
+#include <string.h>
 #include <sstream>
 #include <iomanip>
+#include <cmath>
 
 #include "ServiceContext.h"
+#include "rtsp-streams.hpp"
 #include "stools.h"
 
 
@@ -13,6 +16,15 @@
 
 ServiceContext::ServiceContext():
     port     ( 1000    ),
+    https_port        ( 0     ),
+    listener_https    ( false ),
+    listener_shard    ( -1    ),
+    listener_affinity ( false ),
+    soap_io_uring     ( false ),
+    soap_gather_send  ( true  ),
+    listener_unix     ( false ),
+    client_address    ( {}    ),
+    client_scope      ( 0     ),
     user     ( "admin" ),
     password ( "admin" ),
 
@@ -24,6 +36,11 @@ ServiceContext::ServiceContext():
     serial_number    ( "000001"         ),
     hardware_id      ( "000002"         ),
 
+    metrics   ( std::make_shared<ServiceMetrics>()  ),
+    ip_filter ( std::make_shared<IPAddressFilter>() ),
+    endpoints ( std::make_shared<InterfaceEndpoints>() ),
+    network   ( std::make_shared<NetworkState>() ),
+
     //private
     tz_format(TZ_UTC_OFFSET)
 {
@@ -41,7 +58,9 @@ void ServiceContext::InitMqttComms()
         mosquitto_lib_cleanup();
     }
     mosquitto_connect(mosq, "localhost", 1883, 60);
-    mosquitto_loop_start(mosq);
+
+    // the network loop is run by a supervised MqttLoop worker
+    mosquitto_threaded_set(mosq, true);
 }
 
 
@@ -63,7 +82,6 @@ void ServiceContext::CloseMqttComms()
 {
     DEBUG_MSG("\nClosing MQTT Comms\n");
     mosquitto_disconnect(mosq);
-    mosquitto_loop_stop(mosq, 1);
     mosquitto_destroy(mosq);
 }
 
@@ -190,43 +208,73 @@ bool ServiceContext::set_tz_format(const char* new_val)
 
 
 
-std::string ServiceContext::getServerIpFromClientIp(uint32_t client_ip) const
+InterfaceEndpoints::EndpointPtr ServiceContext::get_endpoint() const
 {
-    char server_ip[INET_ADDRSTRLEN];
+    if (listener_unix)
+        return endpoints->forUnixSocket();
 
+    if (!listener_interface.empty())
+        return endpoints->forInterface(listener_interface, client_address);
+
+    return endpoints->forClient(client_address, client_scope);
+}
 
-    if (eth_ifs.size() == 1)
-    {
-        eth_ifs[0].get_ip(server_ip);
-        return server_ip;
-    }
 
-    for(size_t i = 0; i < eth_ifs.size(); ++i)
+
+/*******************************************************************************
+ * Format the XAddr and media URIs of every interface, call after the
+ * interfaces or profiles changed
+ ******************************************************************************/
+void ServiceContext::update_endpoints()
+{
+    std::vector<InterfaceEndpoints::Interface> interfaces;
+    std::vector<InterfaceEndpoints::Media> media;
+
+    NetworkState::SnapshotPtr state = network->snapshot();
+
+    for(const Eth_Dev_Param &eth_if : eth_ifs)
     {
-        uint32_t if_ip, if_mask;
-        eth_ifs[i].get_ip(&if_ip);
-        eth_ifs[i].get_mask(&if_mask);
+        InterfaceEndpoints::Interface interface;
+        interface.name  = eth_if.dev_name();
 
-        if( (if_ip & if_mask) == (client_ip & if_mask) )
+        const RtNetlink::Link* link = state->link(interface.name);
+        if( link )
         {
-            eth_ifs[i].get_ip(server_ip);
-            return server_ip;
+            interface.index = link->index;
+
+            // the primary address
+            if( !link->ipv4.empty() )
+            {
+                interface.ip   = link->ipv4.front().ip;
+                interface.mask = link->ipv4.front().prefix ? htonl(~0u << (32 - link->ipv4.front().prefix)) : 0;
+            }
         }
+
+        const std::vector<Eth_IPv6_Addr> no_ipv6;
+        for(const Eth_IPv6_Addr &addr : link ? link->ipv6 : no_ipv6)
+        {
+            InterfaceEndpoints::Prefix prefix;
+            memcpy(prefix.address.data(), addr.addr.s6_addr, prefix.address.size());
+            prefix.length = addr.prefix;
+            interface.ipv6.push_back(prefix);
+        }
+
+        interfaces.push_back(interface);
     }
 
+    for(const auto &profile : profiles)
+        media.push_back({profile.first, profile.second.get_url(), profile.second.get_snapurl()});
 
-    return "127.0.0.1";  //localhost
+
+    endpoints->rebuild(interfaces, media, port, https_port, unix_socket);
 }
 
 
 
-std::string ServiceContext::getXAddr(soap *soap) const
+std::string ServiceContext::getXAddr() const
 {
-    std::ostringstream os;
-
-    os << "http://" << getServerIpFromClientIp(htonl(soap->ip)) << ":" << port;
-
-    return os.str();
+    InterfaceEndpoints::EndpointPtr endpoint = get_endpoint();
+    return listener_https ? endpoint->xaddrHttps : endpoint->xaddr;
 }
 
 
@@ -253,36 +301,16 @@ bool ServiceContext::add_profile(const StreamProfile &profile)
 
 
 
-std::string ServiceContext::get_stream_uri(const std::string &profile_url, uint32_t client_ip) const
+std::string ServiceContext::get_stream_uri(const std::string &profile_name) const
 {
-    std::string uri(profile_url);
-    std::string template_str("%s");
-
-
-    auto it = uri.find(template_str, 0);
-
-    if( it != std::string::npos )
-        uri.replace(it, template_str.size(), getServerIpFromClientIp(client_ip));
-
-
-    return uri;
+    return get_endpoint()->streamUri(profile_name);
 }
 
 
 
-std::string ServiceContext::get_snapshot_uri(const std::string &profile_url, uint32_t client_ip) const
+std::string ServiceContext::get_snapshot_uri(const std::string &profile_name) const
 {
-    std::string uri(profile_url);
-    std::string template_str("%s");
-
-
-    auto it = uri.find(template_str, 0);
-
-    if( it != std::string::npos )
-        uri.replace(it, template_str.size(), getServerIpFromClientIp(client_ip));
-
-
-    return uri;
+    return get_endpoint()->snapshotUri(profile_name);
 }
 
 
@@ -293,9 +321,9 @@ tds__DeviceServiceCapabilities *ServiceContext::getDeviceServiceCapabilities(soa
 
     capabilities->Network = soap_new_tds__NetworkCapabilities(soap);
 
-    capabilities->Network->IPFilter            = soap_new_ptr(soap, false);
+    capabilities->Network->IPFilter            = soap_new_ptr(soap, true);
     capabilities->Network->ZeroConfiguration   = soap_new_ptr(soap, false);
-    capabilities->Network->IPVersion6          = soap_new_ptr(soap, false);
+    capabilities->Network->IPVersion6          = soap_new_ptr(soap, true);
     capabilities->Network->DynDNS              = soap_new_ptr(soap, false);
     capabilities->Network->Dot11Configuration  = soap_new_ptr(soap, false);
     capabilities->Network->Dot1XConfigurations = soap_new_ptr(soap, 0);
@@ -377,6 +405,36 @@ tptz__Capabilities *ServiceContext::getPTZServiceCapabilities(soap *soap)
 
 
 
+timg__Capabilities *ServiceContext::getImagingServiceCapabilities(soap *soap)
+{
+    timg__Capabilities *capabilities = soap_new_timg__Capabilities(soap);
+
+    capabilities->ImageStabilization = soap_new_ptr(soap, false);
+
+    return capabilities;
+}
+
+
+
+StreamControl* ServiceContext::get_stream_control(const std::string &profile_token) const
+{
+    auto profile = profiles.find(profile_token);
+
+    if( profile == profiles.end() )
+        return NULL;
+
+
+    auto control = stream_controls.find(profile->second.get_stream());
+
+    if( control == stream_controls.end() )
+        return NULL;
+
+
+    return control->second.get();
+}
+
+
+
 
 // ------------------------------- StreamProfile -------------------------------
 
@@ -400,26 +458,48 @@ tt__VideoEncoderConfiguration* StreamProfile::get_video_enc_cfg(struct soap *soa
 {
     tt__VideoEncoderConfiguration* enc_cfg = soap_new_tt__VideoEncoderConfiguration(soap);
 
+    ServiceContext* ctx     = (ServiceContext*)soap->user;
+    StreamControl*  control = ctx->get_stream_control(name);
+    StreamSnapshot  snapshot;
+
+    if( control )
+        snapshot = control->getSnapshot();
+
+
+    // values the running pipeline does not report fall back to the profile config
+    int cur_width  = snapshot.format.width  ? snapshot.format.width  : width;
+    int cur_height = snapshot.format.height ? snapshot.format.height : height;
+
     enc_cfg->Name               = name;
     enc_cfg->token              = name;
-    enc_cfg->Resolution         = soap_new_req_tt__VideoResolution(soap, width, height);
-    enc_cfg->RateControl        = soap_new_req_tt__VideoRateControl(soap, 0, 0, 0);
+    enc_cfg->Resolution         = soap_new_req_tt__VideoResolution(soap, cur_width, cur_height);
+    enc_cfg->RateControl        = soap_new_req_tt__VideoRateControl(soap, snapshot.format.framerate, 1, static_cast<int>(snapshot.bitrate.value));
     enc_cfg->Multicast          = soap_new_tt__MulticastConfiguration(soap);
     enc_cfg->Multicast->Address = soap_new_tt__IPAddress(soap);
     enc_cfg->Encoding           = static_cast<tt__VideoEncoding>(type);
 
+    if( (enc_cfg->Encoding == tt__VideoEncoding__H264) && snapshot.govLength.available )
+        enc_cfg->H264 = soap_new_req_tt__H264Configuration(soap, static_cast<int>(snapshot.govLength.value), tt__H264Profile__Main);
+
     return enc_cfg;
 }
 
 
 
-tt__PTZConfiguration* StreamProfile::get_ptz_cfg(struct soap *soap) const
+tt__PTZConfiguration* StreamProfile::get_ptz_cfg(struct soap *soap)
 {
+    ServiceContext* ctx = (ServiceContext*)soap->user;
+
+    PtzState::Limits limits;
+    if (ctx->ptz_state) {
+        limits = ctx->ptz_state->limits();
+    }
+
     tt__PTZConfiguration* ptz_cfg = soap_new_tt__PTZConfiguration(soap);
 
     ptz_cfg->Name               = "PTZ";
     ptz_cfg->token              = "PTZToken";
-    ptz_cfg->NodeToken          = "PTZNodeToken";
+    ptz_cfg->NodeToken          = PTZNode::node_token;
 
     ptz_cfg->DefaultAbsolutePantTiltPositionSpace    = soap_new_std__string(soap);
     *ptz_cfg->DefaultAbsolutePantTiltPositionSpace   = "http://www.onvif.org/ver10/tptz/PanTiltSpaces/PositionGenericSpace";
@@ -443,13 +523,13 @@ tt__PTZConfiguration* StreamProfile::get_ptz_cfg(struct soap *soap) const
     ptz_cfg->PanTiltLimits                     = soap_new_tt__PanTiltLimits(soap);
     ptz_cfg->PanTiltLimits->Range              = soap_new_tt__Space2DDescription(soap);
     ptz_cfg->PanTiltLimits->Range->URI         = "http://www.onvif.org/ver10/tptz/PanTiltSpaces/PositionGenericSpace";
-    ptz_cfg->PanTiltLimits->Range->XRange      = soap_new_req_tt__FloatRange(soap, -INFINITY, INFINITY);
-    ptz_cfg->PanTiltLimits->Range->YRange      = soap_new_req_tt__FloatRange(soap, -INFINITY, INFINITY);
+    ptz_cfg->PanTiltLimits->Range->XRange      = soap_new_req_tt__FloatRange(soap, limits.min.pan, limits.max.pan);
+    ptz_cfg->PanTiltLimits->Range->YRange      = soap_new_req_tt__FloatRange(soap, limits.min.tilt, limits.max.tilt);
 
     ptz_cfg->ZoomLimits                        = soap_new_tt__ZoomLimits(soap);
     ptz_cfg->ZoomLimits->Range                 = soap_new_tt__Space1DDescription(soap);
     ptz_cfg->ZoomLimits->Range->URI            = "http://www.onvif.org/ver10/tptz/ZoomSpaces/PositionGenericSpace";
-    ptz_cfg->ZoomLimits->Range->XRange         = soap_new_req_tt__FloatRange(soap, -INFINITY, INFINITY);
+    ptz_cfg->ZoomLimits->Range->XRange         = soap_new_req_tt__FloatRange(soap, limits.min.zoom, limits.max.zoom);
 
     return ptz_cfg;
 }
@@ -598,11 +678,27 @@ bool StreamProfile::set_type(const char *new_val)
 
 
 
+bool StreamProfile::set_stream(const char *new_val)
+{
+    if(!new_val)
+    {
+        str_err = "stream is empty";
+        return false;
+    }
+
+
+    stream = new_val;
+    return true;
+}
+
+
+
 void StreamProfile::clear()
 {
     name.clear();
     url.clear();
     snapurl.clear();
+    stream.clear();
 
     width  = -1;
     height = -1;
@@ -639,6 +735,194 @@ void PTZNode::clear()
     move_down.clear();
     move_stop.clear();
     move_preset.clear();
+    set_preset.clear();
+    zoom_in.clear();
+    zoom_out.clear();
+    zoom_stop.clear();
+    max_presets = 8;
+
+    tmpl_left       = CommandTemplate();
+    tmpl_right      = CommandTemplate();
+    tmpl_up         = CommandTemplate();
+    tmpl_down       = CommandTemplate();
+    tmpl_zoom_in    = CommandTemplate();
+    tmpl_zoom_out   = CommandTemplate();
+    tmpl_home       = CommandTemplate();
+    tmpl_set_preset = CommandTemplate();
+
+    set_speeds({});
+}
+
+
+
+bool PTZNode::set_max_presets(int new_val)
+{
+    if( new_val < 1 )
+    {
+        str_err = "MaximumNumberOfPresets must be at least 1";
+        return false;
+    }
+
+
+    max_presets = new_val;
+    return true;
+}
+
+
+
+/*******************************************************************************
+ * Speed values of the backend, slowest first
+ *
+ * A velocity runs the head at the slowest speed step not slower than it, the
+ * steps are looked up by the velocity in hundredths instead of searched for
+ * every move.
+ ******************************************************************************/
+bool PTZNode::set_speeds(const std::vector<int> &new_val)
+{
+    for(size_t i = 0; i < new_val.size(); ++i)
+    {
+        if( new_val[i] <= 0 || (i && new_val[i] <= new_val[i - 1]) )
+        {
+            str_err = "Speeds must be positive and ascending";
+            return false;
+        }
+    }
+
+
+    speed_values.clear();
+    speed_fractions.clear();
+
+    if( new_val.empty() )
+    {
+        // one speed, the one of the commands
+        speed_values.push_back("");
+        speed_fractions.push_back(1.0f);
+    }
+
+    for(int speed : new_val)
+    {
+        speed_values.push_back(std::to_string(speed));
+        speed_fractions.push_back(float(speed) / new_val.back());
+    }
+
+
+    // the speeds need not be evenly spaced, each entry takes the first fraction reaching it
+    size_t const steps = speed_values.size();
+    size_t step = 0;
+    for(size_t i = 0; i < speed_step.size(); ++i)
+    {
+        while( step < steps - 1 && speed_fractions[step] < i / 100.0f )
+            ++step;
+
+        speed_step[i] = uint8_t(step);
+    }
+
+    return true;
+}
+
+
+
+float PTZNode::quantize_axis(float velocity, bool available) const
+{
+    if( !available || velocity == 0.0f )
+        return 0.0f;
+
+    long const index = std::lround(std::min(std::fabs(velocity), 1.0f) * 100);
+    return std::copysign(speed_fractions[speed_step[index]], velocity);
+}
+
+
+
+// speed value of a quantized velocity, the fastest one for any other
+std::string PTZNode::speed_value(float velocity) const
+{
+    float const fraction = std::fabs(velocity);
+
+    for(size_t i = 0; i < speed_fractions.size(); ++i)
+    {
+        if( speed_fractions[i] == fraction )
+            return speed_values[i];
+    }
+
+    return speed_values.back();
+}
+
+
+
+PtzState::Vector PTZNode::quantize(const PtzState::Vector &velocity) const
+{
+    return PtzState::Vector{quantize_axis(velocity.pan,  !tmpl_left.empty() && !tmpl_right.empty()),
+                            quantize_axis(velocity.tilt, !tmpl_up.empty()   && !tmpl_down.empty()),
+                            quantize_axis(velocity.zoom, has_zoom())};
+}
+
+
+
+std::vector<std::string> PTZNode::velocity_commands(const PtzState::Vector &from, const PtzState::Vector &to) const
+{
+    std::vector<std::string> commands;
+
+    // a direction command does not end the other one, the head is stopped
+    // first when an axis stops or turns, and the axes still moving sent again
+    auto turned = [](float from, float to) { return from != 0.0f && (to == 0.0f || (from > 0) != (to > 0)); };
+    bool const stop = turned(from.pan, to.pan) || turned(from.tilt, to.tilt);
+
+    if( stop )
+        commands.push_back(move_stop);
+
+    if( to.pan != 0.0f && (stop || to.pan != from.pan) )
+        commands.push_back((to.pan > 0 ? tmpl_right : tmpl_left).format(speed_value(to.pan)));
+
+    if( to.tilt != 0.0f && (stop || to.tilt != from.tilt) )
+        commands.push_back((to.tilt > 0 ? tmpl_up : tmpl_down).format(speed_value(to.tilt)));
+
+
+    // without a zoom stop command the pan and tilt stop ends the zoom too
+    bool const zoom_stopped = stop && zoom_stop.empty();
+
+    if( to.zoom == 0.0f && from.zoom != 0.0f && !zoom_stopped )
+        commands.push_back(zoom_stop.empty() ? move_stop : zoom_stop);
+
+    if( to.zoom != 0.0f && (zoom_stopped || to.zoom != from.zoom) )
+        commands.push_back((to.zoom > 0 ? tmpl_zoom_in : tmpl_zoom_out).format(speed_value(to.zoom)));
+
+    return commands;
+}
+
+
+
+std::vector<std::string> PTZNode::stop_commands() const
+{
+    std::vector<std::string> commands;
+
+    if( !move_stop.empty() )
+        commands.push_back(move_stop);
+
+    if( !zoom_stop.empty() && zoom_stop != move_stop )
+        commands.push_back(zoom_stop);
+
+    return commands;
+}
+
+
+
+std::string PTZNode::preset_command(const CommandTemplate &command, const float *speed) const
+{
+    float const velocity = speed ? quantize_axis(*speed, true) : 1.0f;
+
+    return command.format(velocity ? speed_value(velocity) : speed_values.front());
+}
+
+
+
+bool PTZNode::set_move_preset(const char *new_val)
+{
+    if( !set_cmd_value(new_val, move_preset, tmpl_home) )
+        return false;
+
+
+    tmpl_home = tmpl_home.withToken("1");
+    return true;
 }
 
 
@@ -655,3 +939,15 @@ bool PTZNode::set_str_value(const char* new_val, std::string& value)
     value = new_val;
     return true;
 }
+
+
+
+bool PTZNode::set_cmd_value(const char* new_val, std::string& value, CommandTemplate& tmpl)
+{
+    if( !set_str_value(new_val, value) )
+        return false;
+
+
+    tmpl = CommandTemplate(value);
+    return true;
+}
@@ -2,17 +2,35 @@
 #define SERVICECONTEXT_H
 
 
+#include <array>
+#include <chrono>
+#include <functional>
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 
 #include "soapH.h"
+#include "CommandTemplate.hpp"
+#include "IPAddressFilter.hpp"
+#include "InterfaceEndpoints.hpp"
+#include "NetworkState.hpp"
+#include "PresetStore.hpp"
+#include "PresetTourEngine.hpp"
+#include "PtzCommandPipeline.hpp"
+#include "PtzMoveController.hpp"
+#include "PtzState.hpp"
+#include "ResponseCompression.hpp"
+#include "TlsContext.hpp"
+#include "ServiceMetrics.hpp"
 #include "eth_dev_param.h"
 #include "mosquitto_hander.h"
 #include "smacros.h"
 
 
 
+class StreamControl;
+
 
 
 class StreamProfile
@@ -27,6 +45,7 @@ class StreamProfile
         std::string  get_url    (void) const { return url;    }
         std::string  get_snapurl(void) const { return snapurl;}
         int          get_type   (void) const { return type;   }
+        std::string  get_stream (void) const { return stream; }
 
 
         tt__Profile*     get_profile(struct soap *soap) const;
@@ -40,6 +59,7 @@ class StreamProfile
         bool set_url    (const char *new_val);
         bool set_snapurl(const char *new_val);
         bool set_type   (const char *new_val);
+        bool set_stream (const char *new_val);
 
 
         std::string get_str_err()  const { return str_err;         }
@@ -57,6 +77,7 @@ class StreamProfile
         std::string  url;
         std::string  snapurl;
         int          type;
+        std::string  stream;   //rtspUrl of the RTSP stream serving this profile
 
 
         std::string  str_err;
@@ -64,7 +85,7 @@ class StreamProfile
 
         tt__VideoSourceConfiguration*  get_video_src_cnf(struct soap *soap) const;
         tt__VideoEncoderConfiguration* get_video_enc_cfg(struct soap *soap) const;
-        tt__PTZConfiguration*          get_ptz_cfg(struct soap *soap) const;
+        static tt__PTZConfiguration*   get_ptz_cfg(struct soap *soap);
 };
 
 
@@ -77,6 +98,9 @@ class PTZNode
 
         PTZNode() { clear(); }
 
+        // token of the one PTZ node of the device
+        static constexpr const char *node_token = "PTZNodeToken";
+
         bool         enable;
 
         std::string  get_move_left   (void) const { return move_left;   }
@@ -85,16 +109,39 @@ class PTZNode
         std::string  get_move_down   (void) const { return move_down;   }
         std::string  get_move_stop   (void) const { return move_stop;   }
         std::string  get_move_preset (void) const { return move_preset;   }
+        std::string  get_set_preset  (void) const { return set_preset;    }
+        std::string  get_zoom_in     (void) const { return zoom_in;       }
+        std::string  get_zoom_out    (void) const { return zoom_out;      }
+        std::string  get_zoom_stop   (void) const { return zoom_stop;     }
+        int          get_max_presets (void) const { return max_presets;   }
+        bool         has_zoom        (void) const { return !zoom_in.empty() && !zoom_out.empty(); }
 
 
 
-        //methods for parsing opt from cmd
-        bool set_move_left   (const char *new_val) { return set_str_value(new_val, move_left  ); }
-        bool set_move_right  (const char *new_val) { return set_str_value(new_val, move_right ); }
-        bool set_move_up     (const char *new_val) { return set_str_value(new_val, move_up    ); }
-        bool set_move_down   (const char *new_val) { return set_str_value(new_val, move_down  ); }
+        //methods for parsing opt from cmd, "%s" in the move and zoom commands is the speed value
+        bool set_move_left   (const char *new_val) { return set_cmd_value(new_val, move_left,  tmpl_left    ); }
+        bool set_move_right  (const char *new_val) { return set_cmd_value(new_val, move_right, tmpl_right   ); }
+        bool set_move_up     (const char *new_val) { return set_cmd_value(new_val, move_up,    tmpl_up      ); }
+        bool set_move_down   (const char *new_val) { return set_cmd_value(new_val, move_down,  tmpl_down    ); }
         bool set_move_stop   (const char *new_val) { return set_str_value(new_val, move_stop  ); }
-        bool set_move_preset (const char *new_val) { return set_str_value(new_val, move_preset); }
+        bool set_move_preset (const char *new_val);
+        bool set_set_preset  (const char *new_val) { return set_cmd_value(new_val, set_preset, tmpl_set_preset); }
+        bool set_zoom_in     (const char *new_val) { return set_cmd_value(new_val, zoom_in,    tmpl_zoom_in ); }
+        bool set_zoom_out    (const char *new_val) { return set_cmd_value(new_val, zoom_out,   tmpl_zoom_out); }
+        bool set_zoom_stop   (const char *new_val) { return set_str_value(new_val, zoom_stop  ); }
+        bool set_max_presets (int new_val);
+        bool set_speeds      (const std::vector<int> &new_val);
+
+
+        //velocity the commands can run the head at, and the commands from one to the other
+        PtzState::Vector         quantize(const PtzState::Vector &velocity) const;
+        std::vector<std::string> velocity_commands(const PtzState::Vector &from, const PtzState::Vector &to) const;
+        std::vector<std::string> stop_commands() const;
+
+        //preset or home command with its "%s" replaced, full speed when none is asked for
+        std::string preset_command(const CommandTemplate &command, const float *speed) const;
+        std::string home_command(const float *speed) const { return preset_command(tmpl_home, speed); }
+        std::string set_preset_command(const std::string &token) const { return tmpl_set_preset.format(std::string(), token); }
 
 
         std::string get_str_err()  const { return str_err;         }
@@ -111,11 +158,34 @@ class PTZNode
         std::string  move_down;
         std::string  move_stop;
         std::string  move_preset;
+        std::string  set_preset;
+        std::string  zoom_in;
+        std::string  zoom_out;
+        std::string  zoom_stop;
+        int          max_presets;
+
+        //backend speed values, slowest first; empty for the one speed of the commands
+        std::vector<std::string>  speed_values;
+        std::vector<float>        speed_fractions;  //of the fastest one, the velocity the head runs at
+        std::array<uint8_t, 101>  speed_step;       //index into speed_values by |velocity| in hundredths
+
+        CommandTemplate  tmpl_left;
+        CommandTemplate  tmpl_right;
+        CommandTemplate  tmpl_up;
+        CommandTemplate  tmpl_down;
+        CommandTemplate  tmpl_zoom_in;
+        CommandTemplate  tmpl_zoom_out;
+        CommandTemplate  tmpl_home;        //move_preset with the home token "1"
+        CommandTemplate  tmpl_set_preset;
 
 
         std::string  str_err;
 
         bool set_str_value(const char *new_val, std::string& value);
+        bool set_cmd_value(const char *new_val, std::string& value, CommandTemplate& tmpl);
+
+        float       quantize_axis(float velocity, bool available) const;
+        std::string speed_value(float velocity) const;
 };
 
 
@@ -143,6 +213,23 @@ class ServiceContext
 
 
         int         port;
+        int         https_port;        //0 for no HTTPS listener
+        bool        listener_https;    //the instance accepts TLS on https_port
+        int         listener_shard;    //SO_REUSEPORT listener of this instance, -1 for the single shared one
+        bool        listener_affinity; //pin the instance of a shard to one CPU
+        bool        soap_io_uring;     //SOAP socket I/O through io_uring when the kernel has it
+        bool        soap_gather_send;  //one write per response instead of one per gSOAP fragment
+        std::string unix_socket;       //path of the listener for co-located clients, empty for none
+        bool        listener_unix;     //the instance serves unix_socket
+        std::string listener_interface; //interface the listener of the instance is bound to, empty for all
+
+        //peer of the connection being served (IPv4 mapped to IPv6, zero over the
+        //unix socket) and the interface index of a link-local peer
+        InterfaceEndpoints::Address client_address;
+        unsigned int                client_scope;
+
+        //connection of the request being served accepted, for the PTZ command latency
+        std::chrono::steady_clock::time_point request_received;
         std::string user;
         std::string password;
 
@@ -171,8 +258,11 @@ class ServiceContext
         TimeZoneForamt get_tz_format() const { return tz_format; }
         bool set_tz_format(const char *new_val);
 
-        std::string getServerIpFromClientIp(uint32_t client_ip) const;
-        std::string getXAddr(struct soap* soap) const;
+        std::string getXAddr() const;
+
+        //precomputed addresses of the interface facing the client of the request
+        InterfaceEndpoints::EndpointPtr get_endpoint() const;
+        void update_endpoints();
 
 
 
@@ -183,18 +273,59 @@ class ServiceContext
         bool add_profile(const StreamProfile& profile);
 
 
-        std::string get_stream_uri(const std::string& profile_url, uint32_t client_ip) const;
-        std::string get_snapshot_uri(const std::string& profile_url, uint32_t client_ip) const;
+        std::string get_stream_uri(const std::string& profile_name) const;
+        std::string get_snapshot_uri(const std::string& profile_name) const;
 
 
         const std::map<std::string, StreamProfile> &get_profiles(void) { return profiles; }
         PTZNode* get_ptz_node(void) { return &ptz_node; }
 
+        //presets of the PTZ node, shared by all copies of the context, null without PTZ
+        std::shared_ptr<PresetStore> presets;
+
+        //preset tours of the PTZ node, shared by all copies of the context, null without PTZ
+        std::shared_ptr<PresetTourEngine> tours;
+
+        //commanded motion and position of the PTZ head, shared by all copies of the context, null without PTZ
+        std::shared_ptr<PtzState> ptz_state;
+
+        //AbsoluteMove control loop, shared by all copies of the context, null without PTZ
+        std::shared_ptr<PtzMoveController> ptz_moves;
+
+        //every command to the PTZ backend, shared by all copies of the context, null without PTZ
+        std::shared_ptr<PtzCommandPipeline> ptz_commands;
+
+
+        //live control of the running RTSP pipelines, key is the stream rtspUrl
+        std::map<std::string, std::shared_ptr<StreamControl>> stream_controls;
+        StreamControl* get_stream_control(const std::string& profile_token) const;
+
+        //counters of the SOAP listener, shared by all copies of the context
+        std::shared_ptr<ServiceMetrics> metrics;
+
+        //client filter of Set/Add/Remove/GetIPAddressFilter, shared by all copies of the context
+        std::shared_ptr<IPAddressFilter> ip_filter;
+
+        //per-interface XAddr and media URIs, shared by all copies of the context
+        std::shared_ptr<InterfaceEndpoints> endpoints;
+
+        //snapshot of links, routes, hostname, DNS and NTP, shared by all copies of the context
+        std::shared_ptr<NetworkState> network;
+
+        //certificate and session cache of the HTTPS listeners, null without HTTPS
+        std::shared_ptr<TlsContext> tls;
+
+        //Accept-Encoding negotiation and compressed response cache, null when disabled
+        std::shared_ptr<ResponseCompression> compression;
+
+        //reports a failed SOAP listener to the supervisor
+        std::function<void()> on_listener_failure;
+
         // service capabilities
         tds__DeviceServiceCapabilities* getDeviceServiceCapabilities(struct soap* soap);
         trt__Capabilities*  getMediaServiceCapabilities    (struct soap* soap);
         tptz__Capabilities*  getPTZServiceCapabilities     (struct soap* soap);
-//        timg__Capabilities* getImagingServiceCapabilities  (struct soap* soap);
+        timg__Capabilities* getImagingServiceCapabilities  (struct soap* soap);
 //        trc__Capabilities*  getRecordingServiceCapabilities(struct soap* soap);
 //        tse__Capabilities*  getSearchServiceCapabilities   (struct soap* soap);
 //        trv__Capabilities*  getReceiverServiceCapabilities (struct soap* soap);
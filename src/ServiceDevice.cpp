@@ -7,11 +7,67 @@
 -----------------------------------------------------------------------------
 */
 
+#include <algorithm>
+#include <arpa/inet.h>
 #include <ctime>
+#include <net/if.h>
 
 #include "soapDeviceBindingService.h"
 #include "ServiceContext.h"
+#include "RtNetlink.hpp"
 #include "smacros.h"
+#include "stools.h"
+
+
+
+static IPAddressFilter::Rules to_filter_rules(const tt__IPAddressFilter &filter)
+{
+    IPAddressFilter::Rules rules;
+
+    rules.type = (filter.Type == tt__IPAddressFilterType__Allow) ? IPAddressFilter::Type::Allow
+                                                                   : IPAddressFilter::Type::Deny;
+
+    for(const tt__PrefixedIPv4Address* prefix : filter.IPv4Address)
+    {
+        if( prefix )
+            rules.ipv4.push_back({prefix->Address, prefix->PrefixLength});
+    }
+
+    for(const tt__PrefixedIPv6Address* prefix : filter.IPv6Address)
+    {
+        if( prefix )
+            rules.ipv6.push_back({prefix->Address, prefix->PrefixLength});
+    }
+
+    return rules;
+}
+
+
+
+static bool in_subnet(const RtNetlink::Address4 &net, uint32_t ip)
+{
+    uint32_t mask = net.prefix ? htonl(~0u << (32 - net.prefix)) : 0;
+
+    return (net.ip & mask) == (ip & mask);
+}
+
+
+
+static tt__IPAddressFilter* soap_new_filter(struct soap *soap, const IPAddressFilter::Rules &rules)
+{
+    tt__IPAddressFilter* filter = soap_new_tt__IPAddressFilter(soap);
+
+    filter->Type = (rules.type == IPAddressFilter::Type::Allow) ? tt__IPAddressFilterType__Allow
+                                                                : tt__IPAddressFilterType__Deny;
+
+    for(const IPAddressFilter::Prefix &prefix : rules.ipv4)
+        filter->IPv4Address.push_back(soap_new_req_tt__PrefixedIPv4Address(soap, prefix.address, prefix.length));
+
+    for(const IPAddressFilter::Prefix &prefix : rules.ipv6)
+        filter->IPv6Address.push_back(soap_new_req_tt__PrefixedIPv6Address(soap, prefix.address, prefix.length));
+
+    return filter;
+}
 
 
 
@@ -24,7 +80,7 @@ int DeviceBindingService::GetServices(_tds__GetServices *tds__GetServices, _tds_
 
     ServiceContext* ctx = (ServiceContext*)this->soap->user;
 
-    std::string XAddr = ctx->getXAddr(this->soap);
+    std::string XAddr = ctx->getXAddr();
 
 
 
@@ -67,6 +123,18 @@ int DeviceBindingService::GetServices(_tds__GetServices *tds__GetServices, _tds_
     }
 
 
+    tds__GetServicesResponse.Service.push_back(soap_new_tds__Service(this->soap));
+    tds__GetServicesResponse.Service.back()->Namespace  = "http://www.onvif.org/ver20/imaging/wsdl";
+    tds__GetServicesResponse.Service.back()->XAddr      = XAddr;
+    tds__GetServicesResponse.Service.back()->Version    = soap_new_req_tt__OnvifVersion(this->soap, 2, 2);
+    if (tds__GetServices->IncludeCapability)
+    {
+        tds__GetServicesResponse.Service.back()->Capabilities        = soap_new__tds__Service_Capabilities(this->soap);
+        timg__Capabilities *capabilities                             = ctx->getImagingServiceCapabilities(this->soap);
+        tds__GetServicesResponse.Service.back()->Capabilities->__any = soap_dom_element(this->soap, NULL, "timg:Capabilities", capabilities, capabilities->soap_type());
+    }
+
+
     return SOAP_OK;
 }
 
@@ -321,7 +389,7 @@ int DeviceBindingService::GetCapabilities(_tds__GetCapabilities *tds__GetCapabil
 
     ServiceContext* ctx = (ServiceContext*)this->soap->user;
 
-    std::string XAddr = ctx->getXAddr(this->soap);
+    std::string XAddr = ctx->getXAddr();
 
 
 
@@ -354,6 +422,13 @@ int DeviceBindingService::GetCapabilities(_tds__GetCapabilities *tds__GetCapabil
             tds__GetCapabilitiesResponse.Capabilities->Media->StreamingCapabilities = soap_new_tt__RealTimeStreamingCapabilities(this->soap);
         }
 
+
+        if(!tds__GetCapabilitiesResponse.Capabilities->Imaging && ( (category == tt__CapabilityCategory__All) || (category == tt__CapabilityCategory__Imaging) ) )
+        {
+            tds__GetCapabilitiesResponse.Capabilities->Imaging  = soap_new_tt__ImagingCapabilities(this->soap);
+            tds__GetCapabilitiesResponse.Capabilities->Imaging->XAddr = XAddr;
+        }
+
         if (ctx->get_ptz_node()->enable) {
             if(!tds__GetCapabilitiesResponse.Capabilities->PTZ && ( (category == tt__CapabilityCategory__All) || (category == tt__CapabilityCategory__PTZ) ) )
             {
@@ -379,7 +454,26 @@ int DeviceBindingService::SetDPAddresses(_tds__SetDPAddresses *tds__SetDPAddress
 
 int DeviceBindingService::GetHostname(_tds__GetHostname *tds__GetHostname, _tds__GetHostnameResponse &tds__GetHostnameResponse)
 {
-    SOAP_EMPTY_HANDLER(tds__GetHostname, "Device");
+    UNUSED(tds__GetHostname);
+    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    NetworkState::SnapshotPtr state = ctx->network->snapshot();
+
+
+    tds__GetHostnameResponse.HostnameInformation = soap_new_tt__HostnameInformation(this->soap);
+    tds__GetHostnameResponse.HostnameInformation->FromDHCP = false;
+
+    if( !state->hostname.empty() )
+    {
+        tds__GetHostnameResponse.HostnameInformation->Name = soap_new_std__string(this->soap);
+        tds__GetHostnameResponse.HostnameInformation->Name->assign(state->hostname);
+    }
+
+
+    return SOAP_OK;
 }
 
 
@@ -400,7 +494,41 @@ int DeviceBindingService::SetHostnameFromDHCP(_tds__SetHostnameFromDHCP *tds__Se
 
 int DeviceBindingService::GetDNS(_tds__GetDNS *tds__GetDNS, _tds__GetDNSResponse &tds__GetDNSResponse)
 {
-    SOAP_EMPTY_HANDLER(tds__GetDNS, "Device");
+    UNUSED(tds__GetDNS);
+    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    NetworkState::SnapshotPtr state = ctx->network->snapshot();
+
+
+    tds__GetDNSResponse.DNSInformation = soap_new_tt__DNSInformation(this->soap);
+    tds__GetDNSResponse.DNSInformation->FromDHCP     = false;
+    tds__GetDNSResponse.DNSInformation->SearchDomain = state->searchDomains;
+
+    for(const std::string &nameserver : state->nameservers)
+    {
+        tt__IPAddress* address = soap_new_tt__IPAddress(this->soap);
+
+        if( nameserver.find(':') == std::string::npos )
+        {
+            address->Type        = tt__IPType__IPv4;
+            address->IPv4Address = soap_new_std__string(this->soap);
+            address->IPv4Address->assign(nameserver);
+        }
+        else
+        {
+            address->Type        = tt__IPType__IPv6;
+            address->IPv6Address = soap_new_std__string(this->soap);
+            address->IPv6Address->assign(nameserver);
+        }
+
+        tds__GetDNSResponse.DNSInformation->DNSManual.push_back(address);
+    }
+
+
+    return SOAP_OK;
 }
 
 
@@ -414,7 +542,47 @@ int DeviceBindingService::SetDNS(_tds__SetDNS *tds__SetDNS, _tds__SetDNSResponse
 
 int DeviceBindingService::GetNTP(_tds__GetNTP *tds__GetNTP, _tds__GetNTPResponse &tds__GetNTPResponse)
 {
-    SOAP_EMPTY_HANDLER(tds__GetNTP, "Device");
+    UNUSED(tds__GetNTP);
+    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    NetworkState::SnapshotPtr state = ctx->network->snapshot();
+
+
+    tds__GetNTPResponse.NTPInformation = soap_new_tt__NTPInformation(this->soap);
+    tds__GetNTPResponse.NTPInformation->FromDHCP = false;
+
+    for(const std::string &server : state->ntpServers)
+    {
+        tt__NetworkHost* host = soap_new_tt__NetworkHost(this->soap);
+        struct in6_addr tmp_addr;
+
+        if( inet_pton(AF_INET, server.c_str(), &tmp_addr) > 0 )
+        {
+            host->Type        = tt__NetworkHostType__IPv4;
+            host->IPv4Address = soap_new_std__string(this->soap);
+            host->IPv4Address->assign(server);
+        }
+        else if( inet_pton(AF_INET6, server.c_str(), &tmp_addr) > 0 )
+        {
+            host->Type        = tt__NetworkHostType__IPv6;
+            host->IPv6Address = soap_new_std__string(this->soap);
+            host->IPv6Address->assign(server);
+        }
+        else
+        {
+            host->Type    = tt__NetworkHostType__DNS;
+            host->DNSname = soap_new_std__string(this->soap);
+            host->DNSname->assign(server);
+        }
+
+        tds__GetNTPResponse.NTPInformation->NTPManual.push_back(host);
+    }
+
+
+    return SOAP_OK;
 }
 
 
@@ -449,29 +617,61 @@ int DeviceBindingService::GetNetworkInterfaces(_tds__GetNetworkInterfaces *tds__
     ServiceContext* ctx = (ServiceContext*)this->soap->user;
 
 
-    for(size_t i = 0; i < ctx->eth_ifs.size(); ++i)
+    NetworkState::SnapshotPtr state = ctx->network->snapshot();
+
+    for(const Eth_Dev_Param &eth_if : ctx->eth_ifs)
     {
+        const RtNetlink::Link* link = state->link(eth_if.dev_name());
+        if( !link )
+            continue;
 
-        char tmp_buf[20];
 
-        tds__GetNetworkInterfacesResponse.NetworkInterfaces.push_back(soap_new_tt__NetworkInterface(this->soap));
-        tds__GetNetworkInterfacesResponse.NetworkInterfaces.back()->Enabled = true;
-        tds__GetNetworkInterfacesResponse.NetworkInterfaces.back()->Info = soap_new_tt__NetworkInterfaceInfo(this->soap);
-        tds__GetNetworkInterfacesResponse.NetworkInterfaces.back()->Info->Name = soap_new_std__string(this->soap);
-        tds__GetNetworkInterfacesResponse.NetworkInterfaces.back()->Info->Name->assign(ctx->eth_ifs[i].dev_name());
+        char tmp_buf[INET6_ADDRSTRLEN];
 
-        ctx->eth_ifs[i].get_hwaddr(tmp_buf);
-        tds__GetNetworkInterfacesResponse.NetworkInterfaces.back()->Info->HwAddress = tmp_buf;
+        tt__NetworkInterface* net_if = soap_new_tt__NetworkInterface(this->soap);
+        net_if->token   = link->name;
+        net_if->Enabled = (link->flags & IFF_UP) != 0;
 
-        tds__GetNetworkInterfacesResponse.NetworkInterfaces.back()->IPv4 = soap_new_tt__IPv4NetworkInterface(this->soap);
-        tds__GetNetworkInterfacesResponse.NetworkInterfaces.back()->IPv4->Config = soap_new_tt__IPv4Configuration(this->soap);
-        tds__GetNetworkInterfacesResponse.NetworkInterfaces.back()->IPv4->Config->Manual.push_back(soap_new_tt__PrefixedIPv4Address(this->soap));
+        net_if->Info       = soap_new_tt__NetworkInterfaceInfo(this->soap);
+        net_if->Info->Name = soap_new_std__string(this->soap);
+        net_if->Info->Name->assign(link->name);
+        net_if->Info->MTU  = soap_new_ptr(this->soap, link->mtu);
 
-        ctx->eth_ifs[i].get_ip(tmp_buf);
+        if( link->hasHwaddr )
+        {
+            sprintf(tmp_buf, "%02x:%02x:%02x:%02x:%02x:%02x", link->hwaddr[0], link->hwaddr[1], link->hwaddr[2],
+                                                               link->hwaddr[3], link->hwaddr[4], link->hwaddr[5]);
+            net_if->Info->HwAddress = tmp_buf;
+        }
 
-        tds__GetNetworkInterfacesResponse.NetworkInterfaces.back()->IPv4->Config->Manual.back()->Address = tmp_buf;
-        tds__GetNetworkInterfacesResponse.NetworkInterfaces.back()->IPv4->Config->Manual.back()->PrefixLength = ctx->eth_ifs[i].get_mask_prefix();
 
+        net_if->IPv4          = soap_new_tt__IPv4NetworkInterface(this->soap);
+        net_if->IPv4->Enabled = !link->ipv4.empty();
+        net_if->IPv4->Config  = soap_new_tt__IPv4Configuration(this->soap);
+        net_if->IPv4->Config->DHCP = false;
+
+        for(const RtNetlink::Address4 &addr : link->ipv4)
+        {
+            inet_ntop(AF_INET, &addr.ip, tmp_buf, sizeof(tmp_buf));
+
+            net_if->IPv4->Config->Manual.push_back(soap_new_req_tt__PrefixedIPv4Address(this->soap, tmp_buf, addr.prefix));
+        }
+
+
+        net_if->IPv6          = soap_new_tt__IPv6NetworkInterface(this->soap);
+        net_if->IPv6->Enabled = !link->ipv6.empty();
+        net_if->IPv6->Config  = soap_new_tt__IPv6Configuration(this->soap);
+        net_if->IPv6->Config->DHCP = tt__IPv6DHCPConfiguration__Off;
+
+        for(const Eth_IPv6_Addr &addr : link->ipv6)
+        {
+            inet_ntop(AF_INET6, &addr.addr, tmp_buf, sizeof(tmp_buf));
+
+            net_if->IPv6->Config->Manual.push_back(soap_new_req_tt__PrefixedIPv6Address(this->soap, tmp_buf, addr.prefix));
+        }
+
+
+        tds__GetNetworkInterfacesResponse.NetworkInterfaces.push_back(net_if);
     }
 
 
@@ -482,7 +682,70 @@ int DeviceBindingService::GetNetworkInterfaces(_tds__GetNetworkInterfaces *tds__
 
 int DeviceBindingService::SetNetworkInterfaces(_tds__SetNetworkInterfaces *tds__SetNetworkInterfaces, _tds__SetNetworkInterfacesResponse &tds__SetNetworkInterfacesResponse)
 {
-    SOAP_EMPTY_HANDLER(tds__SetNetworkInterfaces, "Device");
+    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    const tt__NetworkInterfaceSetConfiguration* config = tds__SetNetworkInterfaces->NetworkInterface;
+    if( !config )
+        return SOAP_FAULT;
+
+
+    const Eth_Dev_Param* eth_if = nullptr;
+
+    for(const Eth_Dev_Param &dev : ctx->eth_ifs)
+    {
+        if( tds__SetNetworkInterfaces->InterfaceToken == dev.dev_name() )
+            eth_if = &dev;
+    }
+
+    if( !eth_if )
+        return SOAP_FAULT;
+
+
+    RtNetlink::Change change;
+    change.index = eth_if->get_index();
+
+    if( config->Enabled )
+        change.up = *config->Enabled;
+
+    if( config->MTU )
+        change.mtu = *config->MTU;
+
+    if( config->IPv4 )
+    {
+        // there is no DHCP client to hand the interface to
+        if( config->IPv4->DHCP && *config->IPv4->DHCP )
+            return SOAP_FAULT;
+
+        if( !config->IPv4->Manual.empty() )
+        {
+            const tt__PrefixedIPv4Address* manual = config->IPv4->Manual.front();
+            struct in_addr in;
+
+            if( !manual || inet_pton(AF_INET, manual->Address.c_str(), &in) <= 0 ||
+                manual->PrefixLength < 1 || manual->PrefixLength > 32 )
+                return SOAP_FAULT;
+
+            change.ipv4 = RtNetlink::Address4{in.s_addr, manual->PrefixLength};
+        }
+    }
+
+
+    // all or nothing: a failed request puts the link back as it was
+    RtNetlink netlink;
+
+    if( netlink.apply(change) != 0 )
+        return SOAP_FAULT;
+
+
+    // a Get right after the Set must not see the old state, the endpoints follow
+    ctx->network->refresh();
+    tds__SetNetworkInterfacesResponse.RebootNeeded = false;
+
+
+    return SOAP_OK;
 }
 
 
@@ -503,14 +766,117 @@ int DeviceBindingService::SetNetworkProtocols(_tds__SetNetworkProtocols *tds__Se
 
 int DeviceBindingService::GetNetworkDefaultGateway(_tds__GetNetworkDefaultGateway *tds__GetNetworkDefaultGateway, _tds__GetNetworkDefaultGatewayResponse &tds__GetNetworkDefaultGatewayResponse)
 {
-    SOAP_EMPTY_HANDLER(tds__GetNetworkDefaultGateway, "Device");
+    UNUSED(tds__GetNetworkDefaultGateway);
+    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    NetworkState::SnapshotPtr state = ctx->network->snapshot();
+
+    tds__GetNetworkDefaultGatewayResponse.NetworkGateway = soap_new_tt__NetworkGateway(this->soap);
+
+    for(const Eth_Dev_Param &eth_if : ctx->eth_ifs)
+    {
+        const RtNetlink::Link* link = state->link(eth_if.dev_name());
+        if( !link )
+            continue;
+
+
+        char tmp_buf[INET6_ADDRSTRLEN];
+
+        if( link->gateway )
+        {
+            inet_ntop(AF_INET, &link->gateway, tmp_buf, sizeof(tmp_buf));
+            tds__GetNetworkDefaultGatewayResponse.NetworkGateway->IPv4Address.push_back(tmp_buf);
+        }
+
+        if( link->gateway6 )
+        {
+            inet_ntop(AF_INET6, &*link->gateway6, tmp_buf, sizeof(tmp_buf));
+            tds__GetNetworkDefaultGatewayResponse.NetworkGateway->IPv6Address.push_back(tmp_buf);
+        }
+    }
+
+
+    return SOAP_OK;
 }
 
 
 
 int DeviceBindingService::SetNetworkDefaultGateway(_tds__SetNetworkDefaultGateway *tds__SetNetworkDefaultGateway, _tds__SetNetworkDefaultGatewayResponse &tds__SetNetworkDefaultGatewayResponse)
 {
-    SOAP_EMPTY_HANDLER(tds__SetNetworkDefaultGateway, "Device");
+    UNUSED(tds__SetNetworkDefaultGatewayResponse);
+    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    // only IPv4 default routes are managed
+    if( !tds__SetNetworkDefaultGateway->IPv6Address.empty() || ctx->eth_ifs.empty() )
+        return SOAP_FAULT;
+
+
+    NetworkState::SnapshotPtr state = ctx->network->snapshot();
+    std::vector<RtNetlink::Change> changes;
+    unsigned int gateway_index = 0;
+
+
+    if( !tds__SetNetworkDefaultGateway->IPv4Address.empty() )
+    {
+        struct in_addr gateway;
+
+        if( inet_pton(AF_INET, tds__SetNetworkDefaultGateway->IPv4Address.front().c_str(), &gateway) <= 0 )
+            return SOAP_FAULT;
+
+
+        // the interface with the gateway in its subnet, the first one otherwise
+        RtNetlink::Change change;
+        change.index   = ctx->eth_ifs.front().get_index();
+        change.gateway = gateway.s_addr;
+
+        for(const Eth_Dev_Param &eth_if : ctx->eth_ifs)
+        {
+            const RtNetlink::Link* link = state->link(eth_if.dev_name());
+            if( !link )
+                continue;
+
+            for(const RtNetlink::Address4 &addr : link->ipv4)
+            {
+                if( in_subnet(addr, gateway.s_addr) )
+                    change.index = link->index;
+            }
+        }
+
+        gateway_index = change.index;
+        changes.push_back(change);
+    }
+
+
+    // one default gateway, none for an empty list: drop the routes through the other interfaces
+    for(const Eth_Dev_Param &eth_if : ctx->eth_ifs)
+    {
+        const RtNetlink::Link* link = state->link(eth_if.dev_name());
+        if( !link || !link->gateway || link->index == gateway_index )
+            continue;
+
+        RtNetlink::Change drop;
+        drop.index   = link->index;
+        drop.gateway = 0;
+
+        changes.push_back(drop);
+    }
+
+
+    // one batch, a failed request puts every interface back
+    RtNetlink netlink;
+
+    if( !changes.empty() && netlink.apply(changes) != 0 )
+        return SOAP_FAULT;
+
+
+    ctx->network->refresh();
+    return SOAP_OK;
 }
 
 
@@ -531,28 +897,78 @@ int DeviceBindingService::SetZeroConfiguration(_tds__SetZeroConfiguration *tds__
 
 int DeviceBindingService::GetIPAddressFilter(_tds__GetIPAddressFilter *tds__GetIPAddressFilter, _tds__GetIPAddressFilterResponse &tds__GetIPAddressFilterResponse)
 {
-    SOAP_EMPTY_HANDLER(tds__GetIPAddressFilter, "Device");
+    UNUSED(tds__GetIPAddressFilter);
+    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+    tds__GetIPAddressFilterResponse.IPAddressFilter = soap_new_filter(this->soap, ctx->ip_filter->get());
+
+
+    return SOAP_OK;
 }
 
 
 
 int DeviceBindingService::SetIPAddressFilter(_tds__SetIPAddressFilter *tds__SetIPAddressFilter, _tds__SetIPAddressFilterResponse &tds__SetIPAddressFilterResponse)
 {
-    SOAP_EMPTY_HANDLER(tds__SetIPAddressFilter, "Device");
+    UNUSED(tds__SetIPAddressFilterResponse);
+    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if( !tds__SetIPAddressFilter->IPAddressFilter )
+        return SOAP_FAULT;
+
+
+    // rejected as a whole if any address is invalid
+    bool ok = ctx->ip_filter->set(to_filter_rules(*tds__SetIPAddressFilter->IPAddressFilter));
+
+
+    return ok ? SOAP_OK : SOAP_FAULT;
 }
 
 
 
 int DeviceBindingService::AddIPAddressFilter(_tds__AddIPAddressFilter *tds__AddIPAddressFilter, _tds__AddIPAddressFilterResponse &tds__AddIPAddressFilterResponse)
 {
-    SOAP_EMPTY_HANDLER(tds__AddIPAddressFilter, "Device");
+    UNUSED(tds__AddIPAddressFilterResponse);
+    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if( !tds__AddIPAddressFilter->IPAddressFilter )
+        return SOAP_FAULT;
+
+
+    // rejected as a whole if any address is invalid
+    bool ok = ctx->ip_filter->add(to_filter_rules(*tds__AddIPAddressFilter->IPAddressFilter));
+
+
+    return ok ? SOAP_OK : SOAP_FAULT;
 }
 
 
 
 int DeviceBindingService::RemoveIPAddressFilter(_tds__RemoveIPAddressFilter *tds__RemoveIPAddressFilter, _tds__RemoveIPAddressFilterResponse &tds__RemoveIPAddressFilterResponse)
 {
-    SOAP_EMPTY_HANDLER(tds__RemoveIPAddressFilter, "Device");
+    UNUSED(tds__RemoveIPAddressFilterResponse);
+    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if( !tds__RemoveIPAddressFilter->IPAddressFilter )
+        return SOAP_FAULT;
+
+
+    // rejected as a whole if any address is invalid
+    bool ok = ctx->ip_filter->remove(to_filter_rules(*tds__RemoveIPAddressFilter->IPAddressFilter));
+
+
+    return ok ? SOAP_OK : SOAP_FAULT;
 }
 
 
@@ -580,7 +996,31 @@ int DeviceBindingService::CreateCertificate(_tds__CreateCertificate *tds__Create
 
 int DeviceBindingService::GetCertificates(_tds__GetCertificates *tds__GetCertificates, _tds__GetCertificatesResponse &tds__GetCertificatesResponse)
 {
-    SOAP_EMPTY_HANDLER(tds__GetCertificates, "Device");
+    UNUSED(tds__GetCertificates);
+    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if( !ctx->tls )
+        return SOAP_FAULT;
+
+
+    for( const TlsContext::Certificate &certificate : ctx->tls->certificates() )
+    {
+        tt__Certificate* cert = soap_new_tt__Certificate(this->soap);
+        cert->CertificateID   = certificate.id;
+        cert->Certificate     = soap_new_tt__BinaryData(this->soap);
+
+        cert->Certificate->Data.__size = static_cast<int>(certificate.der.size());
+        cert->Certificate->Data.__ptr  = (unsigned char*)soap_malloc(this->soap, certificate.der.size());
+        std::copy(certificate.der.begin(), certificate.der.end(), cert->Certificate->Data.__ptr);
+
+        tds__GetCertificatesResponse.NvtCertificate.push_back(cert);
+    }
+
+
+    return SOAP_OK;
 }
 
 
@@ -615,7 +1055,30 @@ int DeviceBindingService::GetPkcs10Request(_tds__GetPkcs10Request *tds__GetPkcs1
 
 int DeviceBindingService::LoadCertificates(_tds__LoadCertificates *tds__LoadCertificates, _tds__LoadCertificatesResponse &tds__LoadCertificatesResponse)
 {
-    SOAP_EMPTY_HANDLER(tds__LoadCertificates, "Device");
+    UNUSED(tds__LoadCertificatesResponse);
+    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if( !ctx->tls || tds__LoadCertificates->NVTCertificate.empty() )
+        return SOAP_FAULT;
+
+
+    // the chain in request order, leaf first
+    std::vector<std::vector<unsigned char>> chain;
+
+    for( tt__Certificate* cert : tds__LoadCertificates->NVTCertificate )
+    {
+        if( !cert || !cert->Certificate || !cert->Certificate->Data.__ptr || cert->Certificate->Data.__size <= 0 )
+            return SOAP_FAULT;
+
+        const unsigned char* data = cert->Certificate->Data.__ptr;
+        chain.emplace_back(data, data + cert->Certificate->Data.__size);
+    }
+
+
+    return ctx->tls->install(chain) ? SOAP_OK : SOAP_FAULT;
 }
 
 
@@ -0,0 +1,164 @@
+/*
+ --------------------------------------------------------------------------
+ ServiceImaging.cpp
+
+ Implementation of functions (methods) for the service:
+ ONVIF imaging.wsdl server side
+-----------------------------------------------------------------------------
+*/
+
+
+#include "soapImagingBindingService.h"
+#include "ServiceContext.h"
+#include "rtsp-streams.hpp"
+#include "smacros.h"
+#include "stools.h"
+
+
+
+
+
+static float* soap_new_setting(struct soap *soap, const PropertyValue &property)
+{
+    if( !property.available )
+        return NULL;
+
+    return soap_new_ptr(soap, static_cast<float>(property.value));
+}
+
+
+
+static tt__FloatRange* soap_new_range(struct soap *soap, const PropertyValue &property)
+{
+    if( !property.available )
+        return NULL;
+
+    return soap_new_req_tt__FloatRange(soap, static_cast<float>(property.min), static_cast<float>(property.max));
+}
+
+
+
+
+
+int ImagingBindingService::GetServiceCapabilities(_timg__GetServiceCapabilities *timg__GetServiceCapabilities, _timg__GetServiceCapabilitiesResponse &timg__GetServiceCapabilitiesResponse)
+{
+    UNUSED(timg__GetServiceCapabilities);
+    DEBUG_MSG("Imaging: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+    timg__GetServiceCapabilitiesResponse.Capabilities = ctx->getImagingServiceCapabilities(this->soap);
+
+
+    return SOAP_OK;
+}
+
+
+
+int ImagingBindingService::GetImagingSettings(_timg__GetImagingSettings *timg__GetImagingSettings, _timg__GetImagingSettingsResponse &timg__GetImagingSettingsResponse)
+{
+    DEBUG_MSG("Imaging: %s   for source:%s\n", __FUNCTION__, timg__GetImagingSettings->VideoSourceToken.c_str());
+
+
+    ServiceContext* ctx     = (ServiceContext*)this->soap->user;
+    StreamControl*  control = ctx->get_stream_control(timg__GetImagingSettings->VideoSourceToken);
+
+    if( !control )
+        return SOAP_FAULT;
+
+
+    // served from the cached snapshot, the pipeline is not touched
+    StreamSnapshot snapshot = control->getSnapshot();
+
+    timg__GetImagingSettingsResponse.ImagingSettings                  = soap_new_tt__ImagingSettings20(this->soap);
+    timg__GetImagingSettingsResponse.ImagingSettings->Brightness      = soap_new_setting(this->soap, snapshot.brightness);
+    timg__GetImagingSettingsResponse.ImagingSettings->Contrast        = soap_new_setting(this->soap, snapshot.contrast);
+    timg__GetImagingSettingsResponse.ImagingSettings->ColorSaturation = soap_new_setting(this->soap, snapshot.saturation);
+
+
+    return SOAP_OK;
+}
+
+
+
+int ImagingBindingService::SetImagingSettings(_timg__SetImagingSettings *timg__SetImagingSettings, _timg__SetImagingSettingsResponse &timg__SetImagingSettingsResponse)
+{
+    UNUSED(timg__SetImagingSettingsResponse);
+    DEBUG_MSG("Imaging: %s   for source:%s\n", __FUNCTION__, timg__SetImagingSettings->VideoSourceToken.c_str());
+
+
+    ServiceContext* ctx     = (ServiceContext*)this->soap->user;
+    StreamControl*  control = ctx->get_stream_control(timg__SetImagingSettings->VideoSourceToken);
+
+    if( !control || !timg__SetImagingSettings->ImagingSettings )
+        return SOAP_FAULT;
+
+
+    tt__ImagingSettings20* settings = timg__SetImagingSettings->ImagingSettings;
+    bool ok = true;
+
+    if( settings->Brightness )
+        ok &= control->setBrightness(*settings->Brightness);
+
+    if( settings->Contrast )
+        ok &= control->setContrast(*settings->Contrast);
+
+    if( settings->ColorSaturation )
+        ok &= control->setSaturation(*settings->ColorSaturation);
+
+
+    return ok ? SOAP_OK : SOAP_FAULT;
+}
+
+
+
+int ImagingBindingService::GetOptions(_timg__GetOptions *timg__GetOptions, _timg__GetOptionsResponse &timg__GetOptionsResponse)
+{
+    DEBUG_MSG("Imaging: %s   for source:%s\n", __FUNCTION__, timg__GetOptions->VideoSourceToken.c_str());
+
+
+    ServiceContext* ctx     = (ServiceContext*)this->soap->user;
+    StreamControl*  control = ctx->get_stream_control(timg__GetOptions->VideoSourceToken);
+
+    if( !control )
+        return SOAP_FAULT;
+
+
+    StreamSnapshot snapshot = control->getSnapshot();
+
+    timg__GetOptionsResponse.ImagingOptions                  = soap_new_tt__ImagingOptions20(this->soap);
+    timg__GetOptionsResponse.ImagingOptions->Brightness      = soap_new_range(this->soap, snapshot.brightness);
+    timg__GetOptionsResponse.ImagingOptions->Contrast        = soap_new_range(this->soap, snapshot.contrast);
+    timg__GetOptionsResponse.ImagingOptions->ColorSaturation = soap_new_range(this->soap, snapshot.saturation);
+
+
+    return SOAP_OK;
+}
+
+
+
+int ImagingBindingService::Move(_timg__Move *timg__Move, _timg__MoveResponse &timg__MoveResponse)
+{
+    SOAP_EMPTY_HANDLER(timg__Move, "Imaging");
+}
+
+
+
+int ImagingBindingService::GetMoveOptions(_timg__GetMoveOptions *timg__GetMoveOptions, _timg__GetMoveOptionsResponse &timg__GetMoveOptionsResponse)
+{
+    SOAP_EMPTY_HANDLER(timg__GetMoveOptions, "Imaging");
+}
+
+
+
+int ImagingBindingService::Stop(_timg__Stop *timg__Stop, _timg__StopResponse &timg__StopResponse)
+{
+    SOAP_EMPTY_HANDLER(timg__Stop, "Imaging");
+}
+
+
+
+int ImagingBindingService::GetStatus(_timg__GetStatus *timg__GetStatus, _timg__GetStatusResponse &timg__GetStatusResponse)
+{
+    SOAP_EMPTY_HANDLER(timg__GetStatus, "Imaging");
+}
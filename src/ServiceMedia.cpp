@@ -8,8 +8,11 @@
 */
 
 
+#include <algorithm>
+
 #include "soapMediaBindingService.h"
 #include "ServiceContext.h"
+#include "rtsp-streams.hpp"
 #include "smacros.h"
 #include "mosquitto_hander.h"
 
@@ -17,6 +20,36 @@
 
 
 
+static tt__IntRange* soap_new_int_range(struct soap *soap, const PropertyValue &property, int fallback)
+{
+    if( !property.available )
+        return soap_new_req_tt__IntRange(soap, fallback, fallback);
+
+    return soap_new_req_tt__IntRange(soap, static_cast<int>(property.min), static_cast<int>(property.max));
+}
+
+
+
+static bool to_h264_profile(const std::string &name, tt__H264Profile &profile)
+{
+    if( (name == "baseline") || (name == "constrained-baseline") )
+        profile = tt__H264Profile__Baseline;
+    else if( name == "main" )
+        profile = tt__H264Profile__Main;
+    else if( name == "extended" )
+        profile = tt__H264Profile__Extended;
+    else if( name == "high" )
+        profile = tt__H264Profile__High;
+    else
+        return false;
+
+    return true;
+}
+
+
+
+
+
 int MediaBindingService::GetServiceCapabilities(_trt__GetServiceCapabilities *trt__GetServiceCapabilities, _trt__GetServiceCapabilitiesResponse &trt__GetServiceCapabilitiesResponse)
 {
     UNUSED(trt__GetServiceCapabilities);
@@ -458,7 +491,51 @@ int MediaBindingService::SetVideoSourceConfiguration(_trt__SetVideoSourceConfigu
 
 int MediaBindingService::SetVideoEncoderConfiguration(_trt__SetVideoEncoderConfiguration *trt__SetVideoEncoderConfiguration, _trt__SetVideoEncoderConfigurationResponse &trt__SetVideoEncoderConfigurationResponse)
 {
-    SOAP_EMPTY_HANDLER(trt__SetVideoEncoderConfiguration, "Media");
+    UNUSED(trt__SetVideoEncoderConfigurationResponse);
+
+    tt__VideoEncoderConfiguration* cfg = trt__SetVideoEncoderConfiguration->Configuration;
+    if( !cfg )
+        return SOAP_FAULT;
+
+    DEBUG_MSG("Media: %s   for configuration:%s\n", __FUNCTION__, cfg->token.c_str());
+
+
+    ServiceContext* ctx     = (ServiceContext*)this->soap->user;
+    auto            profile = ctx->get_profiles().find(cfg->token);
+    StreamControl*  control = ctx->get_stream_control(cfg->token);
+
+    if( !control || (profile == ctx->get_profiles().end()) )
+        return SOAP_FAULT;
+
+
+    StreamSnapshot snapshot = control->getSnapshot();
+    VideoFormat    format;
+    bool           ok = true;
+
+    // only touch what differs from the configuration we reported
+    int cur_width  = snapshot.format.width  ? snapshot.format.width  : profile->second.get_width();
+    int cur_height = snapshot.format.height ? snapshot.format.height : profile->second.get_height();
+
+    if( cfg->Resolution && ((cfg->Resolution->Width != cur_width) || (cfg->Resolution->Height != cur_height)) )
+    {
+        format.width  = cfg->Resolution->Width;
+        format.height = cfg->Resolution->Height;
+    }
+
+    if( cfg->RateControl && (cfg->RateControl->FrameRateLimit > 0) && (cfg->RateControl->FrameRateLimit != snapshot.format.framerate) )
+        format.framerate = cfg->RateControl->FrameRateLimit;
+
+    if( format.width || format.framerate )
+        ok &= control->setFormat(format);
+
+    if( cfg->RateControl && (cfg->RateControl->BitrateLimit > 0) && (cfg->RateControl->BitrateLimit != static_cast<int>(snapshot.bitrate.value)) )
+        ok &= control->setBitrate(cfg->RateControl->BitrateLimit);
+
+    if( cfg->H264 && (cfg->H264->GovLength > 0) && (cfg->H264->GovLength != static_cast<int>(snapshot.govLength.value)) )
+        ok &= control->setGovLength(cfg->H264->GovLength);
+
+
+    return ok ? SOAP_OK : SOAP_FAULT;
 }
 
 
@@ -514,7 +591,67 @@ int MediaBindingService::GetVideoSourceConfigurationOptions(_trt__GetVideoSource
 
 int MediaBindingService::GetVideoEncoderConfigurationOptions(_trt__GetVideoEncoderConfigurationOptions *trt__GetVideoEncoderConfigurationOptions, _trt__GetVideoEncoderConfigurationOptionsResponse &trt__GetVideoEncoderConfigurationOptionsResponse)
 {
-    SOAP_EMPTY_HANDLER(trt__GetVideoEncoderConfigurationOptions, "Media");
+    std::string token;
+
+    if( trt__GetVideoEncoderConfigurationOptions->ConfigurationToken )
+        token = *trt__GetVideoEncoderConfigurationOptions->ConfigurationToken;
+    else if( trt__GetVideoEncoderConfigurationOptions->ProfileToken )
+        token = *trt__GetVideoEncoderConfigurationOptions->ProfileToken;
+
+    DEBUG_MSG("Media: %s   for configuration:%s\n", __FUNCTION__, token.c_str());
+
+
+    ServiceContext* ctx     = (ServiceContext*)this->soap->user;
+    auto            profile = ctx->get_profiles().find(token);
+    StreamControl*  control = ctx->get_stream_control(token);
+
+    if( !control || (profile == ctx->get_profiles().end()) )
+        return SOAP_FAULT;
+
+
+    StreamSnapshot snapshot = control->getSnapshot();
+    tt__VideoEncoderConfigurationOptions* options = soap_new_tt__VideoEncoderConfigurationOptions(this->soap);
+
+    options->QualityRange = soap_new_req_tt__IntRange(this->soap, 0, 0);
+
+    if( profile->second.get_type() == tt__VideoEncoding__H264 )
+    {
+        tt__H264Options2* h264 = soap_new_tt__H264Options2(this->soap);
+
+        // without a raw caps filter the pipeline only produces the configured size
+        if( snapshot.options.resolutions.empty() )
+            h264->ResolutionsAvailable.push_back(soap_new_req_tt__VideoResolution(this->soap, profile->second.get_width(), profile->second.get_height()));
+
+        for( const VideoFormat &size : snapshot.options.resolutions )
+            h264->ResolutionsAvailable.push_back(soap_new_req_tt__VideoResolution(this->soap, size.width, size.height));
+
+        h264->GovLengthRange        = soap_new_int_range(this->soap, snapshot.govLength, 0);
+        h264->FrameRateRange        = soap_new_int_range(this->soap, snapshot.options.framerate, snapshot.format.framerate);
+        h264->EncodingIntervalRange = soap_new_req_tt__IntRange(this->soap, 1, 1);
+        h264->BitrateRange          = soap_new_int_range(this->soap, snapshot.bitrate, static_cast<int>(snapshot.bitrate.value));
+
+        for( const std::string &name : snapshot.options.profiles )
+        {
+            tt__H264Profile h264_profile;
+            if( to_h264_profile(name, h264_profile) &&
+                (std::find(h264->H264ProfilesSupported.begin(), h264->H264ProfilesSupported.end(), h264_profile) == h264->H264ProfilesSupported.end()) )
+                h264->H264ProfilesSupported.push_back(h264_profile);
+        }
+
+        if( h264->H264ProfilesSupported.empty() )
+            h264->H264ProfilesSupported.push_back(tt__H264Profile__Main);
+
+        // the plain H264 options are a subset of the extended ones
+        options->H264            = soap_new_tt__H264Options(this->soap);
+        *options->H264           = *h264;
+        options->Extension       = soap_new_tt__VideoEncoderOptionsExtension(this->soap);
+        options->Extension->H264 = h264;
+    }
+
+    trt__GetVideoEncoderConfigurationOptionsResponse.Options = options;
+
+
+    return SOAP_OK;
 }
 
 
@@ -576,7 +713,7 @@ int MediaBindingService::GetStreamUri(_trt__GetStreamUri *trt__GetStreamUri, _tr
     if( it != profiles.end() )
     {
         trt__GetStreamUriResponse.MediaUri = soap_new_tt__MediaUri(this->soap);
-        trt__GetStreamUriResponse.MediaUri->Uri = ctx->get_stream_uri(it->second.get_url(), htonl(this->soap->ip));
+        trt__GetStreamUriResponse.MediaUri->Uri = ctx->get_stream_uri(it->first);
         ret = SOAP_OK;
     }
 
@@ -629,7 +766,7 @@ int MediaBindingService::GetSnapshotUri(_trt__GetSnapshotUri *trt__GetSnapshotUr
     if( it != profiles.end() )
     {
         trt__GetSnapshotUriResponse.MediaUri = soap_new_tt__MediaUri(this->soap);
-        trt__GetSnapshotUriResponse.MediaUri->Uri = ctx->get_snapshot_uri(it->second.get_snapurl(), htonl(this->soap->ip));
+        trt__GetSnapshotUriResponse.MediaUri->Uri = ctx->get_snapshot_uri(it->first);
         ret = SOAP_OK;
     }
 
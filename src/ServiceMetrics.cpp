@@ -0,0 +1,138 @@
+#include <sstream>
+
+#include "ServiceMetrics.hpp"
+
+
+void LatencyHistogram::observe(std::chrono::steady_clock::duration latency)
+{
+    double const seconds = std::chrono::duration<double>(latency).count();
+
+    size_t bucket = 0;
+    while (bucket < g_bounds.size() && seconds > g_bounds[bucket])
+        ++bucket;
+
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    sumMicros.fetch_add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count()),
+                        std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+void ServiceMetrics::setComponents(std::vector<ComponentHealth> health)
+{
+    std::lock_guard<std::mutex> lock(m_componentsMutex);
+    m_components = std::move(health);
+}
+
+
+void ServiceMetrics::setStream(StreamUsage usage)
+{
+    std::lock_guard<std::mutex> lock(m_componentsMutex);
+
+    for (StreamUsage &known : m_streams)
+    {
+        if (known.name == usage.name)
+        {
+            known = std::move(usage);
+            return;
+        }
+    }
+    m_streams.push_back(std::move(usage));
+}
+
+
+/*******************************************************************************
+ * Render the counters in the Prometheus text exposition format
+ ******************************************************************************/
+std::string ServiceMetrics::render() const
+{
+    std::ostringstream out;
+
+    auto counter = [&out](char const *name, char const *help, std::atomic<uint64_t> const &value) {
+        out << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " counter\n"
+            << name << " " << value.load(std::memory_order_relaxed) << "\n";
+    };
+
+    counter("onvif_soap_requests_total", "Connections accepted by the SOAP listener", requests);
+    counter("onvif_soap_faults_total", "Requests answered with a SOAP fault", faults);
+    counter("onvif_soap_malformed_requests_total", "Requests whose HTTP or SOAP envelope could not be parsed",
+            malformedRequests);
+    counter("onvif_soap_unknown_operations_total", "Requests for an operation no binding serves", unknownOperations);
+    counter("onvif_soap_handler_exceptions_total", "Exceptions escaping a service handler", handlerExceptions);
+    counter("onvif_soap_accept_errors_total", "Transient accept failures of the SOAP listener", acceptErrors);
+    counter("onvif_soap_listener_restarts_total", "Times the SOAP listening socket was rebound", listenerRestarts);
+    counter("onvif_soap_rejected_clients_total", "Connections refused by the IP address filter", rejectedClients);
+    counter("onvif_tls_handshakes_total", "Completed TLS handshakes of the HTTPS listener", tlsHandshakes);
+    counter("onvif_tls_resumed_total", "TLS handshakes that resumed an earlier session", tlsResumed);
+    counter("onvif_tls_failures_total", "Failed TLS handshakes", tlsFailures);
+    counter("onvif_tls_kernel_offload_total", "TLS connections sending through kernel TLS", tlsKernelOffload);
+    counter("onvif_http_compressed_responses_total", "Responses sent gzip or deflate encoded", compressedResponses);
+    counter("onvif_http_compression_cache_hits_total", "Compressed responses served from the cache",
+            compressionCacheHits);
+    counter("onvif_http_compression_saved_bytes_total", "Body bytes saved by response compression",
+            compressionSavedBytes);
+    counter("onvif_soap_send_fragments_total", "Output pieces handed to fsend by gSOAP", sendFragments);
+    counter("onvif_soap_send_writes_total", "Socket writes the output pieces were gathered into", sendWrites);
+    counter("onvif_ptz_commands_total", "PTZ motions requested by the handlers", ptzCommands);
+    counter("onvif_ptz_coalesced_total", "PTZ motions dropped as redundant or superseded", ptzCoalesced);
+    counter("onvif_ptz_writes_total", "Commands written to the PTZ backend", ptzWrites);
+
+    auto histogram = [&out](char const *name, char const *help, LatencyHistogram const &value) {
+        out << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " histogram\n";
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < LatencyHistogram::g_bounds.size(); ++i)
+        {
+            cumulative += value.buckets[i].load(std::memory_order_relaxed);
+            out << name << "_bucket{le=\"" << LatencyHistogram::g_bounds[i] << "\"} " << cumulative << "\n";
+        }
+        cumulative += value.buckets.back().load(std::memory_order_relaxed);
+        out << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n"
+            << name << "_sum " << value.sumMicros.load(std::memory_order_relaxed) / 1e6 << "\n"
+            << name << "_count " << cumulative << "\n";
+    };
+
+    histogram("onvif_ptz_command_latency_seconds", "SOAP request received to PTZ backend command written",
+              ptzLatency);
+
+    std::lock_guard<std::mutex> lock(m_componentsMutex);
+
+    auto family = [&out, this](char const *name, char const *type, char const *help, auto value) {
+        out << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " " << type << "\n";
+        for (ComponentHealth const &component : m_components)
+            out << name << "{component=\"" << component.name << "\"} " << value(component) << "\n";
+    };
+
+    family("onvif_component_up", "gauge", "Supervised worker is running",
+           [](ComponentHealth const &c) { return c.up ? 1 : 0; });
+    family("onvif_component_failures_total", "counter", "Failures reported by the worker",
+           [](ComponentHealth const &c) { return c.failures; });
+    family("onvif_component_restarts_total", "counter", "Restarts of the worker by the supervisor",
+           [](ComponentHealth const &c) { return c.restarts; });
+    family("onvif_component_backoff_seconds", "gauge", "Delay before the pending or last restart",
+           [](ComponentHealth const &c) { return c.backoffSeconds; });
+    family("onvif_component_last_recovery_seconds", "gauge", "Time from the last failure to the worker running again",
+           [](ComponentHealth const &c) { return c.lastRecoverySeconds; });
+
+    auto streams = [&out, this](char const *name, char const *type, char const *help, auto value) {
+        out << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " " << type << "\n";
+        for (StreamUsage const &stream : m_streams)
+            out << name << "{stream=\"" << stream.name << "\"} " << value(stream) << "\n";
+    };
+
+    streams("onvif_rtsp_stream_warm", "gauge", "Media of the stream held prepared between clients",
+            [](StreamUsage const &s) { return s.warm ? 1 : 0; });
+    streams("onvif_rtsp_stream_clients", "gauge", "RTSP clients connected to the stream",
+            [](StreamUsage const &s) { return s.clients; });
+    streams("onvif_rtsp_stream_cpu_seconds_total", "counter", "CPU time of the streaming threads of the stream",
+            [](StreamUsage const &s) { return s.cpuSeconds; });
+    streams("onvif_rtsp_stream_warm_rss_bytes", "gauge", "Resident memory grown while the warm media was prepared",
+            [](StreamUsage const &s) { return s.warmRssBytes; });
+    streams("onvif_rtsp_stream_gop_cache_bytes", "gauge", "Packets held for replay to joining clients",
+            [](StreamUsage const &s) { return s.gopCacheBytes; });
+
+    return out.str();
+}
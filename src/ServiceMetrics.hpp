@@ -0,0 +1,97 @@
+#ifndef SERVICEMETRICS_HPP
+#define SERVICEMETRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/*******************************************************************************
+ * State of one supervised worker, published by the Supervisor
+ ******************************************************************************/
+struct ComponentHealth
+{
+    std::string name;
+    bool up{false};
+    uint64_t failures{0};
+    uint64_t restarts{0};
+    double backoffSeconds{0.0};      // delay applied before the pending or last restart
+    double lastRecoverySeconds{0.0}; // failure notification to worker running again
+};
+
+
+/*******************************************************************************
+ * Idle cost of one RTSP stream, published by its main loop
+ ******************************************************************************/
+struct StreamUsage
+{
+    std::string name;
+    bool warm{false};      // media held prepared between clients
+    uint64_t clients{0};
+    double cpuSeconds{0.0}; // streaming threads of its pipelines
+    int64_t warmRssBytes{0}; // resident memory grown while the warm media was prepared
+    uint64_t gopCacheBytes{0};
+};
+
+
+/*******************************************************************************
+ * Latency distribution, lock free, rendered as a Prometheus histogram
+ ******************************************************************************/
+struct LatencyHistogram
+{
+    static constexpr std::array<double, 9> g_bounds{0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25};
+
+    std::array<std::atomic<uint64_t>, g_bounds.size() + 1> buckets{}; // not cumulative, the last one is +Inf
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sumMicros{0};
+
+    void observe(std::chrono::steady_clock::duration latency);
+};
+
+
+/*******************************************************************************
+ * Counters of the SOAP listener and health of the supervised workers
+ *
+ * Shared by every copy of the ServiceContext (see ServiceContext::metrics) and
+ * served as plain text on GET /metrics.
+ ******************************************************************************/
+struct ServiceMetrics
+{
+    std::atomic<uint64_t> requests{0};          // connections accepted
+    std::atomic<uint64_t> faults{0};            // requests answered with a SOAP fault
+    std::atomic<uint64_t> malformedRequests{0}; // HTTP or SOAP envelope could not be parsed
+    std::atomic<uint64_t> unknownOperations{0}; // body element not served by any binding
+    std::atomic<uint64_t> handlerExceptions{0}; // exceptions escaping a service handler
+    std::atomic<uint64_t> acceptErrors{0};      // transient accept() failures
+    std::atomic<uint64_t> listenerRestarts{0};  // listening socket rebound after a failure
+    std::atomic<uint64_t> rejectedClients{0};   // connections refused by the IP address filter
+    std::atomic<uint64_t> tlsHandshakes{0};     // completed TLS handshakes, full or resumed
+    std::atomic<uint64_t> tlsResumed{0};        // handshakes that resumed an earlier session
+    std::atomic<uint64_t> tlsFailures{0};       // failed TLS handshakes
+    std::atomic<uint64_t> tlsKernelOffload{0};  // connections sending through kernel TLS
+    std::atomic<uint64_t> compressedResponses{0};   // responses sent gzip or deflate encoded
+    std::atomic<uint64_t> compressionCacheHits{0};  // of those, served from the compressed response cache
+    std::atomic<uint64_t> compressionSavedBytes{0}; // plain minus compressed body bytes
+    std::atomic<uint64_t> sendFragments{0};         // output pieces handed to fsend by gSOAP
+    std::atomic<uint64_t> sendWrites{0};            // socket writes they were gathered into
+    std::atomic<uint64_t> ptzCommands{0};           // PTZ motions requested by the handlers
+    std::atomic<uint64_t> ptzCoalesced{0};          // of those, dropped as redundant or superseded
+    std::atomic<uint64_t> ptzWrites{0};             // commands written to the PTZ backend
+    LatencyHistogram ptzLatency;                    // SOAP request received to backend command written
+
+    void setComponents(std::vector<ComponentHealth> health);
+    void setStream(StreamUsage usage); // replaces the entry of the same name
+    std::string render() const;
+
+  private:
+    mutable std::mutex m_componentsMutex;
+    std::vector<ComponentHealth> m_components;
+    std::vector<StreamUsage> m_streams;
+};
+
+
+#endif // SERVICEMETRICS_HPP
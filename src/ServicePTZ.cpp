@@ -8,9 +8,12 @@
 */
 
 
+#include <cmath>
+
 #include "soapPTZBindingService.h"
 #include "ServiceContext.h"
 #include "smacros.h"
+#include "stools.h"
 
 
 
@@ -25,21 +28,44 @@ int PTZBindingService::GetServiceCapabilities(_tptz__GetServiceCapabilities *tpt
 
 int PTZBindingService::GetConfigurations(_tptz__GetConfigurations *tptz__GetConfigurations, _tptz__GetConfigurationsResponse &tptz__GetConfigurationsResponse)
 {
-    SOAP_EMPTY_HANDLER(tptz__GetConfigurations, "PTZ");
+    UNUSED(tptz__GetConfigurations);
+    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if (ctx->get_ptz_node()->enable) {
+        tptz__GetConfigurationsResponse.PTZConfiguration.push_back(StreamProfile::get_ptz_cfg(this->soap));
+    }
+
+    return SOAP_OK;
+}
+
+
+
+static std::optional<PtzState::Vector> to_ptz_vector(const std::optional<PresetStore::Position> &position)
+{
+    if (!position) {
+        return std::nullopt;
+    }
+
+    return PtzState::Vector{position->pan, position->tilt, position->zoom};
 }
 
 
 
-int GetPTZPreset(struct soap *soap, tt__PTZPreset* ptzp, int number)
+int GetPTZPreset(struct soap *soap, tt__PTZPreset* ptzp, const PresetStore::Preset &preset)
 {
     ptzp->token  = soap_new_std__string(soap);
-    *ptzp->token = std::to_string(number);
+    *ptzp->token = preset.token;
     ptzp->Name   = soap_new_std__string(soap);
-    *ptzp->Name  = std::to_string(number);
+    *ptzp->Name  = preset.name;
 
-    ptzp->PTZPosition             = soap_new_tt__PTZVector(soap);
-    ptzp->PTZPosition->PanTilt    = soap_new_req_tt__Vector2D(soap, 0.0f, 0.0f);
-    ptzp->PTZPosition->Zoom       = soap_new_req_tt__Vector1D(soap, 1.0f);
+    if (preset.position) {
+        ptzp->PTZPosition             = soap_new_tt__PTZVector(soap);
+        ptzp->PTZPosition->PanTilt    = soap_new_req_tt__Vector2D(soap, preset.position->pan, preset.position->tilt);
+        ptzp->PTZPosition->Zoom       = soap_new_req_tt__Vector1D(soap, preset.position->zoom);
+    }
 
     return SOAP_OK;
 }
@@ -52,12 +78,18 @@ int PTZBindingService::GetPresets(_tptz__GetPresets *tptz__GetPresets, _tptz__Ge
     DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
 
 
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if (!ctx->presets) {
+        return SOAP_FAULT;
+    }
+
     soap_default_std__vectorTemplateOfPointerTott__PTZPreset(soap, &tptz__GetPresetsResponse._tptz__GetPresetsResponse::Preset);
-    for (int i = 0; i < 8; i++) {
+    for (const PresetStore::PresetPtr &preset : ctx->presets->list()) {
         tt__PTZPreset* ptzp;
         ptzp = soap_new_tt__PTZPreset(soap);
         tptz__GetPresetsResponse.Preset.push_back(ptzp);
-        GetPTZPreset(this->soap, ptzp, i);
+        GetPTZPreset(this->soap, ptzp, *preset);
     }
 
     return SOAP_OK;
@@ -67,14 +99,55 @@ int PTZBindingService::GetPresets(_tptz__GetPresets *tptz__GetPresets, _tptz__Ge
 
 int PTZBindingService::SetPreset(_tptz__SetPreset *tptz__SetPreset, _tptz__SetPresetResponse &tptz__SetPresetResponse)
 {
-    SOAP_EMPTY_HANDLER(tptz__SetPreset, "PTZ");
+    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if (!ctx->presets) {
+        return SOAP_FAULT;
+    }
+
+    std::string token = tptz__SetPreset->PresetToken ? *tptz__SetPreset->PresetToken : std::string();
+    std::string name  = tptz__SetPreset->PresetName  ? *tptz__SetPreset->PresetName  : std::string();
+
+    // the head keeps the position itself, the one of the state model is kept for GetPresets and tours
+    std::optional<PresetStore::Position> position;
+    if (ctx->ptz_state) {
+        std::optional<PtzState::Vector> current = ctx->ptz_state->status().position;
+        if (current) {
+            position = PresetStore::Position{current->pan, current->tilt, current->zoom};
+        }
+    }
+
+    if (!ctx->presets->set(token, name, position, tptz__SetPresetResponse.PresetToken)) {
+        DEBUG_MSG("PTZ: SetPreset failed: %s\n", ctx->presets->get_str_err().c_str());
+        return SOAP_FAULT;
+    }
+
+    if (!ctx->get_ptz_node()->get_set_preset().empty() && ctx->ptz_commands) {
+        ctx->ptz_commands->send(ctx->get_ptz_node()->set_preset_command(tptz__SetPresetResponse.PresetToken),
+                                ctx->request_received);
+    }
+
+    return SOAP_OK;
 }
 
 
 
 int PTZBindingService::RemovePreset(_tptz__RemovePreset *tptz__RemovePreset, _tptz__RemovePresetResponse &tptz__RemovePresetResponse)
 {
-    SOAP_EMPTY_HANDLER(tptz__RemovePreset, "PTZ");
+    UNUSED(tptz__RemovePresetResponse);
+    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if (!ctx->presets || !ctx->presets->remove(tptz__RemovePreset->PresetToken)) {
+        return SOAP_FAULT;
+    }
+
+    return SOAP_OK;
 }
 
 
@@ -85,35 +158,33 @@ int PTZBindingService::GotoPreset(_tptz__GotoPreset *tptz__GotoPreset, _tptz__Go
     DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
 
 
-    std::string preset_cmd;
-
     ServiceContext* ctx = (ServiceContext*)this->soap->user;
 
-    if (tptz__GotoPreset == NULL) {
-        return SOAP_OK;
-    }
-    if (tptz__GotoPreset->ProfileToken.c_str() == NULL) {
-        return SOAP_OK;
-    }
-    if (tptz__GotoPreset->PresetToken.c_str() == NULL) {
-        return SOAP_OK;
+    if (!ctx->presets) {
+        return SOAP_FAULT;
     }
 
-    if (!ctx->get_ptz_node()->get_move_preset().empty()) {
-        preset_cmd = ctx->get_ptz_node()->get_move_preset().c_str();
-    } else {
-        return SOAP_OK;
+    // the command was compiled when the preset was set, only the speed is left;
+    // a token unknown to the store may still be a preset stored on the head
+    PresetStore::PresetPtr preset = ctx->presets->findOrPassThrough(tptz__GotoPreset->PresetToken);
+    if (!preset) {
+        return SOAP_FAULT;
     }
 
-    std::string template_str_t("%t");
-
-    auto it_t = preset_cmd.find(template_str_t, 0);
+    if (ctx->ptz_moves) {
+        ctx->ptz_moves->cancel();
+    }
 
-    if( it_t != std::string::npos ) {
-        preset_cmd.replace(it_t, template_str_t.size(), tptz__GotoPreset->PresetToken.c_str());
+    // "%s" of the command runs the head at the pan speed asked for
+    const float *speed = NULL;
+    if (tptz__GotoPreset->Speed && tptz__GotoPreset->Speed->PanTilt) {
+        speed = &tptz__GotoPreset->Speed->PanTilt->x;
     }
 
-    system(preset_cmd.c_str());
+    if (ctx->ptz_commands) {
+        ctx->ptz_commands->moveTo(ctx->get_ptz_node()->preset_command(preset->command, speed),
+                                  to_ptz_vector(preset->position), ctx->request_received);
+    }
 
     return SOAP_OK;
 }
@@ -122,25 +193,67 @@ int PTZBindingService::GotoPreset(_tptz__GotoPreset *tptz__GotoPreset, _tptz__Go
 
 int PTZBindingService::GetStatus(_tptz__GetStatus *tptz__GetStatus, _tptz__GetStatusResponse &tptz__GetStatusResponse)
 {
-    SOAP_EMPTY_HANDLER(tptz__GetStatus, "PTZ");
+    UNUSED(tptz__GetStatus);
+    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    // answered from the state model, the backend is not asked
+    if (!ctx->ptz_state) {
+        return SOAP_FAULT;
+    }
+
+    PtzState::Status status = ctx->ptz_state->status();
+
+    tt__PTZStatus* ptzs = soap_new_tt__PTZStatus(this->soap);
+
+    if (status.position) {
+        ptzs->Position          = soap_new_tt__PTZVector(this->soap);
+        ptzs->Position->PanTilt = soap_new_req_tt__Vector2D(this->soap, status.position->pan, status.position->tilt);
+        ptzs->Position->Zoom    = soap_new_req_tt__Vector1D(this->soap, status.position->zoom);
+    }
+
+    ptzs->MoveStatus          = soap_new_tt__PTZMoveStatus(this->soap);
+    ptzs->MoveStatus->PanTilt = soap_new_ptr(this->soap, status.panTiltMoving ? tt__MoveStatus__MOVING : tt__MoveStatus__IDLE);
+    ptzs->MoveStatus->Zoom    = soap_new_ptr(this->soap, status.zoomMoving ? tt__MoveStatus__MOVING : tt__MoveStatus__IDLE);
+
+    ptzs->UtcTime = time(NULL);
+
+    tptz__GetStatusResponse.PTZStatus = ptzs;
+
+    return SOAP_OK;
 }
 
 
 
 int PTZBindingService::GetConfiguration(_tptz__GetConfiguration *tptz__GetConfiguration, _tptz__GetConfigurationResponse &tptz__GetConfigurationResponse)
 {
-    SOAP_EMPTY_HANDLER(tptz__GetConfiguration, "PTZ");
+    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if (!ctx->get_ptz_node()->enable || tptz__GetConfiguration->PTZConfigurationToken != "PTZToken") {
+        return SOAP_FAULT;
+    }
+
+    tptz__GetConfigurationResponse.PTZConfiguration = StreamProfile::get_ptz_cfg(this->soap);
+
+    return SOAP_OK;
 }
 
 
 
-int GetPTZNode(struct soap *soap, tt__PTZNode* ptzn)
+int GetPTZNode(struct soap *soap, tt__PTZNode* ptzn, int max_presets, const PtzState::Limits &limits)
 {
-    ptzn->token = "PTZNodeToken";
+    ptzn->token = PTZNode::node_token;
     ptzn->Name  = soap_new_std__string(soap);
     *ptzn->Name = "PTZ";
 
     ptzn->SupportedPTZSpaces = soap_new_tt__PTZSpaces(soap);;
+    soap_default_std__vectorTemplateOfPointerTott__Space2DDescription(soap, &ptzn->SupportedPTZSpaces->tt__PTZSpaces::AbsolutePanTiltPositionSpace);
+    soap_default_std__vectorTemplateOfPointerTott__Space1DDescription(soap, &ptzn->SupportedPTZSpaces->tt__PTZSpaces::AbsoluteZoomPositionSpace);
     soap_default_std__vectorTemplateOfPointerTott__Space2DDescription(soap, &ptzn->SupportedPTZSpaces->tt__PTZSpaces::RelativePanTiltTranslationSpace);
     soap_default_std__vectorTemplateOfPointerTott__Space1DDescription(soap, &ptzn->SupportedPTZSpaces->tt__PTZSpaces::RelativeZoomTranslationSpace);
     soap_default_std__vectorTemplateOfPointerTott__Space2DDescription(soap, &ptzn->SupportedPTZSpaces->tt__PTZSpaces::ContinuousPanTiltVelocitySpace);
@@ -149,6 +262,12 @@ int GetPTZNode(struct soap *soap, tt__PTZNode* ptzn)
     soap_default_std__vectorTemplateOfPointerTott__Space1DDescription(soap, &ptzn->SupportedPTZSpaces->tt__PTZSpaces::ZoomSpeedSpace);
 
 
+    auto ptzs0 = soap_new_tt__Space2DDescription(soap);
+    ptzn->SupportedPTZSpaces->AbsolutePanTiltPositionSpace.push_back(ptzs0);
+
+    auto ptzz0 = soap_new_tt__Space1DDescription(soap);
+    ptzn->SupportedPTZSpaces->AbsoluteZoomPositionSpace.push_back(ptzz0);
+
     auto ptzs1 = soap_new_tt__Space2DDescription(soap);
     ptzn->SupportedPTZSpaces->RelativePanTiltTranslationSpace.push_back(ptzs1);
 
@@ -167,6 +286,13 @@ int GetPTZNode(struct soap *soap, tt__PTZNode* ptzn)
     auto ptzs6 = soap_new_tt__Space1DDescription(soap);
     ptzn->SupportedPTZSpaces->ZoomSpeedSpace.push_back(ptzs6);
 
+    ptzs0->URI         = "http://www.onvif.org/ver10/tptz/PanTiltSpaces/PositionGenericSpace";
+    ptzs0->XRange      = soap_new_req_tt__FloatRange(soap, limits.min.pan, limits.max.pan);
+    ptzs0->YRange      = soap_new_req_tt__FloatRange(soap, limits.min.tilt, limits.max.tilt);
+
+    ptzz0->URI         = "http://www.onvif.org/ver10/tptz/ZoomSpaces/PositionGenericSpace";
+    ptzz0->XRange      = soap_new_req_tt__FloatRange(soap, limits.min.zoom, limits.max.zoom);
+
     ptzs1->URI         = "http://www.onvif.org/ver10/tptz/PanTiltSpaces/TranslationGenericSpace";
     ptzs1->XRange      = soap_new_req_tt__FloatRange(soap, -1.0f, 1.0f);
     ptzs1->YRange      = soap_new_req_tt__FloatRange(soap, -1.0f, 1.0f);
@@ -188,7 +314,7 @@ int GetPTZNode(struct soap *soap, tt__PTZNode* ptzn)
     ptzs6->XRange      = soap_new_req_tt__FloatRange(soap, 0.0f, 1.0f);
 
 
-    ptzn->MaximumNumberOfPresets = 8;
+    ptzn->MaximumNumberOfPresets = max_presets;
     ptzn->HomeSupported          = true;
     ptzn->FixedHomePosition      = (bool *)soap_malloc(soap, sizeof(bool));
     soap_s2bool(soap, "true", ptzn->FixedHomePosition);
@@ -204,11 +330,14 @@ int PTZBindingService::GetNodes(_tptz__GetNodes *tptz__GetNodes, _tptz__GetNodes
     DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
 
 
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
     soap_default_std__vectorTemplateOfPointerTott__PTZNode(soap, &tptz__GetNodesResponse._tptz__GetNodesResponse::PTZNode);
     tt__PTZNode* ptzn;
     ptzn = soap_new_tt__PTZNode(soap);
     tptz__GetNodesResponse.PTZNode.push_back(ptzn);
-    GetPTZNode(this->soap, ptzn);
+    GetPTZNode(this->soap, ptzn, ctx->get_ptz_node()->get_max_presets(),
+               ctx->ptz_state ? ctx->ptz_state->limits() : PtzState::Limits());
 
     return SOAP_OK;
 }
@@ -220,8 +349,11 @@ int PTZBindingService::GetNode(_tptz__GetNode *tptz__GetNode, _tptz__GetNodeResp
     UNUSED(tptz__GetNode);
     DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
 
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
     tptz__GetNodeResponse.PTZNode = soap_new_tt__PTZNode(this->soap);
-    GetPTZNode(this->soap, tptz__GetNodeResponse.PTZNode);
+    GetPTZNode(this->soap, tptz__GetNodeResponse.PTZNode, ctx->get_ptz_node()->get_max_presets(),
+               ctx->ptz_state ? ctx->ptz_state->limits() : PtzState::Limits());
 
     return SOAP_OK;
 }
@@ -248,8 +380,6 @@ int PTZBindingService::GotoHomePosition(_tptz__GotoHomePosition *tptz__GotoHomeP
     UNUSED(tptz__GotoHomePositionResponse);
     DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
 
-    std::string preset_cmd;
-	
     ServiceContext* ctx = (ServiceContext*)this->soap->user;
 
     if (tptz__GotoHomePosition == NULL) {
@@ -259,21 +389,23 @@ int PTZBindingService::GotoHomePosition(_tptz__GotoHomePosition *tptz__GotoHomeP
         return SOAP_OK;
     }
 
-    if (!ctx->get_ptz_node()->get_move_preset().empty()) {
-        preset_cmd = ctx->get_ptz_node()->get_move_preset().c_str();
-    } else {
+    if (ctx->get_ptz_node()->get_move_preset().empty()) {
         return SOAP_OK;
     }
 
-    std::string template_str_t("%t");
-
-    auto it_t = preset_cmd.find(template_str_t, 0);
+    if (ctx->ptz_moves) {
+        ctx->ptz_moves->cancel();
+    }
 
-    if( it_t != std::string::npos ) {
-        preset_cmd.replace(it_t, template_str_t.size(), "1");
+    const float *speed = NULL;
+    if (tptz__GotoHomePosition->Speed && tptz__GotoHomePosition->Speed->PanTilt) {
+        speed = &tptz__GotoHomePosition->Speed->PanTilt->x;
     }
 
-    system(preset_cmd.c_str());
+    if (ctx->ptz_commands) {
+        ctx->ptz_commands->moveTo(ctx->get_ptz_node()->home_command(speed), PtzState::Vector{},
+                                  ctx->request_received);
+    }
 
     return SOAP_OK;
 }
@@ -299,20 +431,28 @@ int PTZBindingService::ContinuousMove(_tptz__ContinuousMove *tptz__ContinuousMov
     if (tptz__ContinuousMove->Velocity == NULL) {
         return SOAP_OK;
     }
-    if (tptz__ContinuousMove->Velocity->PanTilt == NULL) {
+    if (tptz__ContinuousMove->Velocity->PanTilt == NULL && tptz__ContinuousMove->Velocity->Zoom == NULL) {
         return SOAP_OK;
     }
 
-    if (tptz__ContinuousMove->Velocity->PanTilt->x > 0) {
-        system(ctx->get_ptz_node()->get_move_right().c_str());
-    } else if (tptz__ContinuousMove->Velocity->PanTilt->x < 0) {
-        system(ctx->get_ptz_node()->get_move_left().c_str());
+    if (!ctx->ptz_commands) {
+        return SOAP_FAULT;
     }
-    if (tptz__ContinuousMove->Velocity->PanTilt->y > 0) {
-        system(ctx->get_ptz_node()->get_move_up().c_str());
-    } else if (tptz__ContinuousMove->Velocity->PanTilt->y < 0) {
-        system(ctx->get_ptz_node()->get_move_down().c_str());
+
+    ctx->ptz_moves->cancel();
+
+    PtzState::Vector velocity;
+    if (tptz__ContinuousMove->Velocity->PanTilt) {
+        velocity.pan  = tptz__ContinuousMove->Velocity->PanTilt->x;
+        velocity.tilt = tptz__ContinuousMove->Velocity->PanTilt->y;
     }
+    if (tptz__ContinuousMove->Velocity->Zoom) {
+        velocity.zoom = tptz__ContinuousMove->Velocity->Zoom->x;
+    }
+
+    // a joystick repeating the same velocity costs no backend command, the
+    // velocity picks the speed step of the move commands
+    ctx->ptz_commands->move(velocity, ctx->request_received);
 
     return SOAP_OK;
 }
@@ -337,23 +477,18 @@ int PTZBindingService::RelativeMove(_tptz__RelativeMove *tptz__RelativeMove, _tp
         return SOAP_OK;
     }
 
-    if (tptz__RelativeMove->Translation->PanTilt->x > 0) {
-        system(ctx->get_ptz_node()->get_move_right().c_str());
-        usleep(300000);
-        system(ctx->get_ptz_node()->get_move_stop().c_str());
-    } else if (tptz__RelativeMove->Translation->PanTilt->x < 0) {
-        system(ctx->get_ptz_node()->get_move_left().c_str());
-        usleep(300000);
-        system(ctx->get_ptz_node()->get_move_stop().c_str());
+    if (!ctx->ptz_commands) {
+        return SOAP_FAULT;
     }
-    if (tptz__RelativeMove->Translation->PanTilt->y > 0) {
-        system(ctx->get_ptz_node()->get_move_up().c_str());
-        usleep(300000);
-        system(ctx->get_ptz_node()->get_move_stop().c_str());
-    } else if (tptz__RelativeMove->Translation->PanTilt->y < 0) {
-        system(ctx->get_ptz_node()->get_move_down().c_str());
-        usleep(300000);
-        system(ctx->get_ptz_node()->get_move_stop().c_str());
+
+    ctx->ptz_moves->cancel();
+
+    // both axes at once for a fixed time, the actuator thread stops the head
+    float x = tptz__RelativeMove->Translation->PanTilt->x;
+    float y = tptz__RelativeMove->Translation->PanTilt->y;
+
+    if (x != 0 || y != 0) {
+        ctx->ptz_commands->pulse({x, y, 0.0f}, std::chrono::milliseconds(300), ctx->request_received);
     }
 
     return SOAP_OK;
@@ -370,7 +505,46 @@ int PTZBindingService::SendAuxiliaryCommand(_tptz__SendAuxiliaryCommand *tptz__S
 
 int PTZBindingService::AbsoluteMove(_tptz__AbsoluteMove *tptz__AbsoluteMove, _tptz__AbsoluteMoveResponse &tptz__AbsoluteMoveResponse)
 {
-    SOAP_EMPTY_HANDLER(tptz__AbsoluteMove, "PTZ");
+    UNUSED(tptz__AbsoluteMoveResponse);
+    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if (!ctx->ptz_moves || !tptz__AbsoluteMove->Position) {
+        return SOAP_FAULT;
+    }
+
+    std::optional<PtzState::Vector> current = ctx->ptz_state->status().position;
+    if (!current) {
+        return SOAP_FAULT;
+    }
+
+    // an axis left out keeps its position
+    PtzState::Vector target = *current;
+    if (tptz__AbsoluteMove->Position->PanTilt) {
+        target.pan  = tptz__AbsoluteMove->Position->PanTilt->x;
+        target.tilt = tptz__AbsoluteMove->Position->PanTilt->y;
+    }
+    if (tptz__AbsoluteMove->Position->Zoom) {
+        target.zoom = tptz__AbsoluteMove->Position->Zoom->x;
+    }
+
+    PtzState::Vector speed{1.0f, 1.0f, 1.0f};
+    if (tptz__AbsoluteMove->Speed && tptz__AbsoluteMove->Speed->PanTilt) {
+        speed.pan  = std::fabs(tptz__AbsoluteMove->Speed->PanTilt->x);
+        speed.tilt = std::fabs(tptz__AbsoluteMove->Speed->PanTilt->y);
+    }
+    if (tptz__AbsoluteMove->Speed && tptz__AbsoluteMove->Speed->Zoom) {
+        speed.zoom = std::fabs(tptz__AbsoluteMove->Speed->Zoom->x);
+    }
+
+    // returns at once, the control loop moves the head
+    if (!ctx->ptz_moves->moveTo(target, speed)) {
+        return SOAP_FAULT;
+    }
+
+    return SOAP_OK;
 }
 
 
@@ -383,58 +557,313 @@ int PTZBindingService::Stop(_tptz__Stop *tptz__Stop, _tptz__StopResponse &tptz__
 
     ServiceContext* ctx = (ServiceContext*)this->soap->user;
 
-    system(ctx->get_ptz_node()->get_move_stop().c_str());
+    if (!ctx->ptz_commands) {
+        return SOAP_FAULT;
+    }
+
+    // ahead of any move still waiting for the backend
+    ctx->ptz_moves->cancel();
+    ctx->ptz_commands->stop(ctx->request_received);
 
     return SOAP_OK;
 }
 
 
 
+static tt__PTZPresetTourSpot* to_tour_spot(struct soap *soap, const PresetStore::TourSpot &spot)
+{
+    tt__PTZPresetTourSpot* ptzs = soap_new_tt__PTZPresetTourSpot(soap);
+
+    ptzs->PresetDetail = soap_new_tt__PTZPresetTourPresetDetail(soap);
+    if (spot.preset.empty()) {
+        ptzs->PresetDetail->__union_PTZPresetTourPresetDetail      = SOAP_UNION__tt__union_PTZPresetTourPresetDetail_Home;
+        ptzs->PresetDetail->union_PTZPresetTourPresetDetail.Home    = true;
+    } else {
+        ptzs->PresetDetail->__union_PTZPresetTourPresetDetail             = SOAP_UNION__tt__union_PTZPresetTourPresetDetail_PresetToken;
+        ptzs->PresetDetail->union_PTZPresetTourPresetDetail.PresetToken    = soap_new_std__string(soap);
+        *ptzs->PresetDetail->union_PTZPresetTourPresetDetail.PresetToken   = spot.preset;
+    }
+
+    if (spot.speed) {
+        ptzs->Speed          = soap_new_tt__PTZSpeed(soap);
+        ptzs->Speed->PanTilt = soap_new_req_tt__Vector2D(soap, *spot.speed, *spot.speed);
+    }
+
+    ptzs->StayTime = soap_new_ptr(soap, (LONG64)spot.stayMs);
+
+    return ptzs;
+}
+
+
+
+static tt__PresetTour* to_preset_tour(struct soap *soap, const PresetStore::Tour &tour, const PresetTourEngine &engine)
+{
+    tt__PresetTour* ptzt = soap_new_tt__PresetTour(soap);
+
+    ptzt->token     = soap_new_std__string(soap);
+    *ptzt->token    = tour.token;
+    ptzt->Name      = soap_new_std__string(soap);
+    *ptzt->Name     = tour.name;
+    ptzt->AutoStart = tour.autoStart;
+
+    PresetStore::TourSpot current;
+    PresetTourEngine::State state = engine.state(tour.token, &current);
+
+    ptzt->Status        = soap_new_tt__PTZPresetTourStatus(soap);
+    ptzt->Status->State = state == PresetTourEngine::State::Touring ? tt__PTZPresetTourState__Touring :
+                          state == PresetTourEngine::State::Paused  ? tt__PTZPresetTourState__Paused  :
+                                                                      tt__PTZPresetTourState__Idle;
+    if (state != PresetTourEngine::State::Idle) {
+        ptzt->Status->CurrentTourSpot = to_tour_spot(soap, current);
+    }
+
+    ptzt->StartingCondition = soap_new_tt__PTZPresetTourStartingCondition(soap);
+    if (tour.recurringTime) {
+        ptzt->StartingCondition->RecurringTime = soap_new_ptr(soap, *tour.recurringTime);
+    }
+    if (tour.recurringDuration) {
+        ptzt->StartingCondition->RecurringDuration = soap_new_ptr(soap, (LONG64)*tour.recurringDuration);
+    }
+    ptzt->StartingCondition->Direction = soap_new_ptr(soap,
+        tour.direction == PresetStore::TourDirection::Backward ? tt__PTZPresetTourDirection__Backward :
+        tour.direction == PresetStore::TourDirection::Extended ? tt__PTZPresetTourDirection__Extended :
+                                                                 tt__PTZPresetTourDirection__Forward);
+    ptzt->StartingCondition->RandomPresetOrder = soap_new_ptr(soap, tour.randomOrder);
+
+    for (const PresetStore::TourSpot &spot : tour.spots) {
+        ptzt->TourSpot.push_back(to_tour_spot(soap, spot));
+    }
+
+    return ptzt;
+}
+
+
+
 int PTZBindingService::GetPresetTours(_tptz__GetPresetTours *tptz__GetPresetTours, _tptz__GetPresetToursResponse &tptz__GetPresetToursResponse)
 {
-    SOAP_EMPTY_HANDLER(tptz__GetPresetTours, "PTZ");
+    UNUSED(tptz__GetPresetTours);
+    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if (!ctx->presets || !ctx->tours) {
+        return SOAP_FAULT;
+    }
+
+    for (const PresetStore::TourPtr &tour : ctx->presets->tours()) {
+        tptz__GetPresetToursResponse.PresetTour.push_back(to_preset_tour(this->soap, *tour, *ctx->tours));
+    }
+
+    return SOAP_OK;
 }
 
 
 
 int PTZBindingService::GetPresetTour(_tptz__GetPresetTour *tptz__GetPresetTour, _tptz__GetPresetTourResponse &tptz__GetPresetTourResponse)
 {
-    SOAP_EMPTY_HANDLER(tptz__GetPresetTour, "PTZ");
+    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if (!ctx->presets || !ctx->tours) {
+        return SOAP_FAULT;
+    }
+
+    PresetStore::TourPtr tour = ctx->presets->findTour(tptz__GetPresetTour->PresetTourToken);
+    if (!tour) {
+        return SOAP_FAULT;
+    }
+
+    tptz__GetPresetTourResponse.PresetTour = to_preset_tour(this->soap, *tour, *ctx->tours);
+
+    return SOAP_OK;
 }
 
 
 
 int PTZBindingService::GetPresetTourOptions(_tptz__GetPresetTourOptions *tptz__GetPresetTourOptions, _tptz__GetPresetTourOptionsResponse &tptz__GetPresetTourOptionsResponse)
 {
-    SOAP_EMPTY_HANDLER(tptz__GetPresetTourOptions, "PTZ");
+    UNUSED(tptz__GetPresetTourOptions);
+    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if (!ctx->presets) {
+        return SOAP_FAULT;
+    }
+
+    tt__PTZPresetTourOptions* options = soap_new_tt__PTZPresetTourOptions(this->soap);
+    options->AutoStart = true;
+
+    options->StartingCondition                    = soap_new_tt__PTZPresetTourStartingConditionOptions(this->soap);
+    options->StartingCondition->RecurringTime     = soap_new_req_tt__IntRange(this->soap, 1, 10000);
+    options->StartingCondition->RecurringDuration = soap_new_req_tt__DurationRange(this->soap, (LONG64)1000, (LONG64)86400000);
+    options->StartingCondition->Direction.push_back(tt__PTZPresetTourDirection__Forward);
+    options->StartingCondition->Direction.push_back(tt__PTZPresetTourDirection__Backward);
+    options->StartingCondition->Direction.push_back(tt__PTZPresetTourDirection__Extended);
+
+    options->TourSpot               = soap_new_tt__PTZPresetTourSpotOptions(this->soap);
+    options->TourSpot->PresetDetail = soap_new_tt__PTZPresetTourPresetDetailOptions(this->soap);
+    options->TourSpot->PresetDetail->Home = soap_new_ptr(this->soap, true);
+    for (const PresetStore::PresetPtr &preset : ctx->presets->list()) {
+        options->TourSpot->PresetDetail->PresetToken.push_back(preset->token);
+    }
+    options->TourSpot->StayTime = soap_new_req_tt__DurationRange(this->soap, (LONG64)100, (LONG64)3600000);
+
+    tptz__GetPresetTourOptionsResponse.Options = options;
+
+    return SOAP_OK;
 }
 
 
 
 int PTZBindingService::CreatePresetTour(_tptz__CreatePresetTour *tptz__CreatePresetTour, _tptz__CreatePresetTourResponse &tptz__CreatePresetTourResponse)
 {
-    SOAP_EMPTY_HANDLER(tptz__CreatePresetTour, "PTZ");
+    UNUSED(tptz__CreatePresetTour);
+    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    // an empty tour, the spots follow with ModifyPresetTour
+    if (!ctx->presets || !ctx->presets->setTour(PresetStore::Tour(), tptz__CreatePresetTourResponse.PresetTourToken)) {
+        return SOAP_FAULT;
+    }
+
+    return SOAP_OK;
 }
 
 
 
 int PTZBindingService::ModifyPresetTour(_tptz__ModifyPresetTour *tptz__ModifyPresetTour, _tptz__ModifyPresetTourResponse &tptz__ModifyPresetTourResponse)
 {
-    SOAP_EMPTY_HANDLER(tptz__ModifyPresetTour, "PTZ");
+    UNUSED(tptz__ModifyPresetTourResponse);
+    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    const tt__PresetTour* ptzt = tptz__ModifyPresetTour->PresetTour;
+    if (!ctx->presets || !ctx->tours || !ptzt || !ptzt->token || !ctx->presets->findTour(*ptzt->token)) {
+        return SOAP_FAULT;
+    }
+
+    PresetStore::Tour tour;
+    tour.token     = *ptzt->token;
+    tour.name      = ptzt->Name ? *ptzt->Name : std::string();
+    tour.autoStart = ptzt->AutoStart;
+
+    if (ptzt->StartingCondition) {
+        const tt__PTZPresetTourStartingCondition* condition = ptzt->StartingCondition;
+
+        if (condition->RecurringTime) {
+            tour.recurringTime = *condition->RecurringTime;
+        }
+        if (condition->RecurringDuration) {
+            tour.recurringDuration = *condition->RecurringDuration;
+        }
+        if (condition->Direction) {
+            tour.direction = *condition->Direction == tt__PTZPresetTourDirection__Backward ? PresetStore::TourDirection::Backward :
+                             *condition->Direction == tt__PTZPresetTourDirection__Extended ? PresetStore::TourDirection::Extended :
+                                                                                             PresetStore::TourDirection::Forward;
+        }
+        tour.randomOrder = condition->RandomPresetOrder && *condition->RandomPresetOrder;
+    }
+
+    for (const tt__PTZPresetTourSpot* ptzs : ptzt->TourSpot) {
+        if (!ptzs || !ptzs->PresetDetail) {
+            return SOAP_FAULT;
+        }
+
+        PresetStore::TourSpot spot;
+
+        // presets and the home position, there is no absolute positioning
+        const tt__PTZPresetTourPresetDetail* detail = ptzs->PresetDetail;
+        if (detail->__union_PTZPresetTourPresetDetail == SOAP_UNION__tt__union_PTZPresetTourPresetDetail_PresetToken &&
+            detail->union_PTZPresetTourPresetDetail.PresetToken &&
+            ctx->presets->find(*detail->union_PTZPresetTourPresetDetail.PresetToken)) {
+            spot.preset = *detail->union_PTZPresetTourPresetDetail.PresetToken;
+        } else if (detail->__union_PTZPresetTourPresetDetail != SOAP_UNION__tt__union_PTZPresetTourPresetDetail_Home) {
+            return SOAP_FAULT;
+        }
+
+        if (ptzs->Speed && ptzs->Speed->PanTilt) {
+            spot.speed = ptzs->Speed->PanTilt->x;
+        }
+        spot.stayMs = ptzs->StayTime ? *ptzs->StayTime : 10000;
+
+        tour.spots.push_back(spot);
+    }
+
+    std::string token;
+    if (!ctx->presets->setTour(tour, token)) {
+        return SOAP_FAULT;
+    }
+
+    // a running tour would go on with the old spots, it starts over with the
+    // new ones unless none are left; a paused one is left stopped
+    bool running = ctx->tours->state(token) == PresetTourEngine::State::Touring;
+    ctx->tours->stop(token);
+    if (running) {
+        ctx->tours->start(token, PTZNode::node_token);
+    }
+
+    return SOAP_OK;
 }
 
 
 
 int PTZBindingService::OperatePresetTour(_tptz__OperatePresetTour *tptz__OperatePresetTour, _tptz__OperatePresetTourResponse &tptz__OperatePresetTourResponse)
 {
-    SOAP_EMPTY_HANDLER(tptz__OperatePresetTour, "PTZ");
+    UNUSED(tptz__OperatePresetTourResponse);
+    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if (!ctx->tours) {
+        return SOAP_FAULT;
+    }
+
+    const std::string &token = tptz__OperatePresetTour->PresetTourToken;
+
+    switch (tptz__OperatePresetTour->Operation) {
+        case tt__PTZPresetTourOperation__Start:
+            return ctx->tours->start(token, PTZNode::node_token) ? SOAP_OK : SOAP_FAULT;
+
+        case tt__PTZPresetTourOperation__Stop:
+            ctx->tours->stop(token);
+            return SOAP_OK;
+
+        case tt__PTZPresetTourOperation__Pause:
+            ctx->tours->pause(token);
+            return SOAP_OK;
+
+        default:
+            return SOAP_FAULT;
+    }
 }
 
 
 
 int PTZBindingService::RemovePresetTour(_tptz__RemovePresetTour *tptz__RemovePresetTour, _tptz__RemovePresetTourResponse &tptz__RemovePresetTourResponse)
 {
-    SOAP_EMPTY_HANDLER(tptz__RemovePresetTour, "PTZ");
+    UNUSED(tptz__RemovePresetTourResponse);
+    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+
+
+    ServiceContext* ctx = (ServiceContext*)this->soap->user;
+
+    if (!ctx->presets || !ctx->tours) {
+        return SOAP_FAULT;
+    }
+
+    ctx->tours->stop(tptz__RemovePresetTour->PresetTourToken);
+
+    return ctx->presets->removeTour(tptz__RemovePresetTour->PresetTourToken) ? SOAP_OK : SOAP_FAULT;
 }
 
 
@@ -0,0 +1,262 @@
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#include "GSoapService.hpp"
+#include "soapRoutes.h"
+
+
+namespace
+{
+
+using ServeFunction = int (*)(struct soap *, ServiceSet const &);
+
+struct Route
+{
+    std::string_view qname;
+    ServeFunction serve;
+};
+
+
+/*******************************************************************************
+ * One table entry per operation of every service in FOREACH_SERVICE
+ *
+ * The generated call refers to the owning service instance as "service" and,
+ * depending on the gSOAP version, to the soap context as "soap".
+ ******************************************************************************/
+#define ROUTE_ENTRY(binding, qname, call)                                                                              \
+    Route{qname, [](struct soap *soap, ServiceSet const &services) {                                                   \
+              binding *service = services.binding##_inst;                                                              \
+              (void)soap;                                                                                              \
+              return call;                                                                                             \
+          }},
+
+#define ROUTES_OF(service, soap) SOAP_ROUTES_##service(ROUTE_ENTRY)
+
+constexpr Route g_routes[] = {FOREACH_SERVICE(ROUTES_OF, soap)};
+
+constexpr size_t g_routeCount = sizeof(g_routes) / sizeof(g_routes[0]);
+
+
+/*******************************************************************************
+ * FNV-1a over the QName, fed in pieces so lookups need no concatenation
+ ******************************************************************************/
+constexpr uint32_t hash_piece(uint32_t hash, std::string_view piece)
+{
+    for (char c : piece)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+constexpr uint32_t hash_qname(std::string_view qname)
+{
+    return hash_piece(2166136261u, qname);
+}
+
+
+constexpr uint32_t hash_qname(std::string_view prefix, std::string_view name)
+{
+    return hash_piece(hash_piece(hash_piece(2166136261u, prefix), ":"), name);
+}
+
+
+/*******************************************************************************
+ * Slot of a key for a given bucket displacement (murmur3 finaliser)
+ ******************************************************************************/
+constexpr uint32_t displace(uint32_t hash, uint32_t displacement)
+{
+    hash ^= displacement * 0x9e3779b9u;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+
+constexpr size_t next_pow2(size_t value)
+{
+    size_t result = 1;
+    while (result < value)
+        result <<= 1;
+    return result;
+}
+
+
+/*******************************************************************************
+ * Perfect hash over the routes (hash and displace)
+ *
+ * Keys are spread over buckets of about four, then every bucket, largest
+ * first, searches for the displacement that puts all of its keys into free
+ * slots. A lookup is one hash of the QName, one table read per level and one
+ * string compare.
+ ******************************************************************************/
+struct RouteTable
+{
+    static constexpr size_t slotCount = next_pow2(2 * g_routeCount);
+    static constexpr size_t bucketCount = g_routeCount / 4 + 1;
+    static constexpr uint32_t maxDisplacement = 1u << 16;
+
+    std::array<uint32_t, bucketCount> displacement{};
+    std::array<int16_t, slotCount> slots{};
+    bool complete{false};
+
+    constexpr Route const *find(uint32_t hash) const
+    {
+        int16_t index = slots[displace(hash, displacement[hash % bucketCount]) & (slotCount - 1)];
+        return index < 0 ? nullptr : &g_routes[index];
+    }
+};
+
+
+constexpr RouteTable build_route_table()
+{
+    constexpr size_t N = g_routeCount;
+    constexpr size_t B = RouteTable::bucketCount;
+
+    RouteTable table{};
+    std::array<uint32_t, N> hashes{};
+    std::array<bool, N> duplicate{};
+    std::array<size_t, B + 1> bucketStart{};
+    std::array<size_t, N> byBucket{};
+    std::array<size_t, B> order{};
+
+    for (auto &slot : table.slots)
+        slot = -1;
+
+    for (size_t i = 0; i < N; ++i)
+        hashes[i] = hash_qname(g_routes[i].qname);
+
+    // an element served by several bindings goes to the first, like the dispatch chain
+    for (size_t i = 0; i < N; ++i)
+        for (size_t j = 0; j < i && !duplicate[i]; ++j)
+            duplicate[i] = hashes[i] == hashes[j] && g_routes[i].qname == g_routes[j].qname;
+
+    // counting sort of the keys by bucket
+    for (size_t i = 0; i < N; ++i)
+        if (!duplicate[i])
+            ++bucketStart[hashes[i] % B + 1];
+    for (size_t b = 0; b < B; ++b)
+        bucketStart[b + 1] += bucketStart[b];
+
+    std::array<size_t, B> fill{};
+    for (size_t i = 0; i < N; ++i)
+    {
+        if (duplicate[i])
+            continue;
+        size_t b = hashes[i] % B;
+        byBucket[bucketStart[b] + fill[b]++] = i;
+    }
+
+    // largest buckets first while the table is still empty
+    for (size_t b = 0; b < B; ++b)
+        order[b] = b;
+    for (size_t i = 1; i < B; ++i)
+    {
+        size_t b = order[i];
+        size_t j = i;
+        for (; j > 0 && fill[order[j - 1]] < fill[b]; --j)
+            order[j] = order[j - 1];
+        order[j] = b;
+    }
+
+    for (size_t b : order)
+    {
+        if (!fill[b])
+            break;
+
+        bool placed = false;
+        for (uint32_t d = 0; d < RouteTable::maxDisplacement && !placed; ++d)
+        {
+            size_t k = bucketStart[b];
+            for (; k < bucketStart[b] + fill[b]; ++k)
+            {
+                size_t slot = displace(hashes[byBucket[k]], d) & (RouteTable::slotCount - 1);
+                if (table.slots[slot] >= 0)
+                    break;
+                table.slots[slot] = static_cast<int16_t>(byBucket[k]);
+            }
+
+            placed = k == bucketStart[b] + fill[b];
+            if (placed)
+            {
+                table.displacement[b] = d;
+                continue;
+            }
+
+            // undo the partial placement and try the next displacement
+            for (size_t u = bucketStart[b]; u < k; ++u)
+                table.slots[displace(hashes[byBucket[u]], d) & (RouteTable::slotCount - 1)] = -1;
+        }
+
+        if (!placed)
+            return table;
+    }
+
+    table.complete = true;
+    return table;
+}
+
+
+constexpr RouteTable g_routeTable = build_route_table();
+
+static_assert(g_routeTable.complete, "no perfect hash found for the SOAP operation table");
+static_assert(g_routeCount < 32768, "route index does not fit the slot table");
+
+
+/*******************************************************************************
+ * Our prefix for the namespace of the body element
+ *
+ * Clients pick their own prefixes, the table is keyed by the prefixes of the
+ * generated namespace map, so the client prefix is resolved through the
+ * namespace URI it is bound to in the message.
+ ******************************************************************************/
+std::string_view local_prefix(struct soap *soap, size_t prefixLen)
+{
+    struct soap_nlist *np = soap_lookup_ns(soap, soap->tag, prefixLen);
+
+    if (!np || np->index < 0 || !soap->local_namespaces || !soap->local_namespaces[np->index].id)
+        return {};
+
+    return soap->local_namespaces[np->index].id;
+}
+
+} // namespace
+
+
+/*******************************************************************************
+ * Hand the request to the serve function of its operation
+ *
+ * @return SOAP_NO_METHOD if the operation is not in the table, otherwise the
+ *         result of the serve function
+ ******************************************************************************/
+int ServiceRouter::dispatch(struct soap *soap, ServiceSet const &services)
+{
+    soap_peek_element(soap);
+
+    std::string_view tag = soap->tag;
+    size_t colon = tag.find(':');
+    size_t prefixLen = colon == std::string_view::npos ? 0 : colon;
+    std::string_view name = colon == std::string_view::npos ? tag : tag.substr(colon + 1);
+
+    if (name.empty())
+        return SOAP_NO_METHOD;
+
+    std::string_view prefix = local_prefix(soap, prefixLen);
+    if (prefix.empty())
+        return SOAP_NO_METHOD;
+
+    Route const *route = g_routeTable.find(hash_qname(prefix, name));
+
+    if (!route || route->qname.size() != prefix.size() + 1 + name.size() ||
+        route->qname.substr(0, prefix.size()) != prefix || route->qname[prefix.size()] != ':' ||
+        route->qname.substr(prefix.size() + 1) != name)
+        return SOAP_NO_METHOD;
+
+    return route->serve(soap, services);
+}
@@ -0,0 +1,192 @@
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ShellCoprocess.hpp"
+#include "armoury/logger.hpp"
+
+
+namespace
+{
+
+constexpr int g_ackFd = 3; // the shell writes a newline there after each command
+
+
+// eval 'command' </dev/null, the quoting of the command itself is left intact;
+// the command does not get the acknowledgement descriptor
+std::string eval_line(std::string const &command)
+{
+    std::string line = "eval '";
+    for (char c : command)
+    {
+        if (c == '\'')
+            line += "'\\''";
+        else
+            line += c == '\n' ? ' ' : c;
+    }
+    line += "' </dev/null 3>&-; echo >&3\n";
+    return line;
+}
+
+} // namespace
+
+
+ShellCoprocess::ShellCoprocess(int timeoutMs) : m_timeoutMs(timeoutMs)
+{
+}
+
+
+ShellCoprocess::~ShellCoprocess()
+{
+    close();
+    reap();
+}
+
+
+bool ShellCoprocess::spawn()
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds))
+        return false;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], g_ackFd);
+
+    // the daemon threads block the termination signals, the shell must not;
+    // a group of its own is killed as a whole on a timeout
+    sigset_t none;
+    sigemptyset(&none);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+
+    char *const argv[] = {const_cast<char *>("sh"), const_cast<char *>("-s"), nullptr};
+    int const err = posix_spawn(&m_pid, "/bin/sh", &actions, &attr, argv, environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    ::close(fds[1]);
+
+    if (err)
+    {
+        arms::log<arms::LOG_INFO>("Can't start the PTZ command shell: {}", err);
+        ::close(fds[0]);
+        m_pid = -1;
+        return false;
+    }
+
+    m_fd = fds[0];
+    return true;
+}
+
+
+void ShellCoprocess::close()
+{
+    if (m_fd < 0)
+        return;
+
+    // the shell exits at the end of its input, once its last command is done
+    ::close(m_fd);
+    m_fd = -1;
+    m_exited.push_back(m_pid);
+    m_pid = -1;
+}
+
+
+void ShellCoprocess::reap()
+{
+    for (auto it = m_exited.begin(); it != m_exited.end();)
+    {
+        if (waitpid(*it, nullptr, WNOHANG) != 0)
+            it = m_exited.erase(it);
+        else
+            ++it;
+    }
+}
+
+
+bool ShellCoprocess::send(std::string const &line)
+{
+    size_t sent = 0;
+    while (sent < line.size())
+    {
+        ssize_t r = ::send(m_fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        sent += static_cast<size_t>(r);
+    }
+    return true;
+}
+
+
+/*******************************************************************************
+ * Wait for the acknowledgement of the command sent last
+ *
+ * A shell that does not answer in time is killed with its process group and
+ * dropped, as is one that exited.
+ ******************************************************************************/
+bool ShellCoprocess::wait()
+{
+    pollfd pfd{m_fd, POLLIN, 0};
+
+    int r;
+    do
+        r = poll(&pfd, 1, m_timeoutMs);
+    while (r < 0 && errno == EINTR);
+
+    if (r > 0)
+    {
+        char ack;
+        ssize_t const received = recv(m_fd, &ack, 1, MSG_DONTWAIT);
+        if (received == 1)
+            return true;
+    }
+    else if (r == 0)
+    {
+        arms::log<arms::LOG_WARNING>("PTZ command still running after {} ms, restarting the shell", m_timeoutMs);
+        kill(-m_pid, SIGKILL);
+    }
+
+    close();
+    return false;
+}
+
+
+bool ShellCoprocess::run(std::string const &command)
+{
+    reap();
+
+    // a shell that exited, by a syntax error of a command or killed, is replaced
+    if (m_pid > 0 && waitpid(m_pid, nullptr, WNOHANG) == m_pid)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+        m_pid = -1;
+    }
+
+    std::string const line = eval_line(command);
+
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        if (m_fd < 0 && !spawn())
+            return false;
+
+        if (send(line))
+            return wait();
+
+        // a part of the line may have gone through, that shell is dropped
+        close();
+    }
+
+    return false;
+}
@@ -0,0 +1,54 @@
+#ifndef SHELL_COPROCESS_HPP
+#define SHELL_COPROCESS_HPP
+
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+
+/*******************************************************************************
+ * One long-lived /bin/sh running the backend commands handed to it
+ *
+ * system() forks and execs a shell for every command. Here the shell is
+ * spawned once and reads the commands from a socket, so running one costs a
+ * send(); the shell still forks the programs a command starts, but shell
+ * builtins and the exec of the shell itself are gone. Each command runs on its
+ * own in an eval with stdin from /dev/null, a command can not read the ones
+ * after it.
+ *
+ * run() returns when the shell acknowledges the end of the command. One that
+ * is still running after the timeout gets the shell and everything it started
+ * killed, the next command goes to a new shell; a hung backend costs one
+ * timeout, not every command after it. While run() waits, the pipeline in
+ * front keeps coalescing the moves and puts a stop ahead of them.
+ *
+ * A shell that exited is spawned again on the next command.
+ ******************************************************************************/
+class ShellCoprocess
+{
+  public:
+    explicit ShellCoprocess(int timeoutMs);
+    ~ShellCoprocess();
+
+    ShellCoprocess(ShellCoprocess const &) = delete;
+    ShellCoprocess &operator=(ShellCoprocess const &) = delete;
+
+    // false if no shell could be started, it did not take the command or the
+    // command did not end in time
+    bool run(std::string const &command);
+
+  private:
+    bool spawn();
+    bool send(std::string const &line);
+    bool wait();
+    void close();
+    void reap();
+
+    int const m_timeoutMs;
+    int m_fd{-1};
+    pid_t m_pid{-1};
+    std::vector<pid_t> m_exited; // closed shells not reaped yet
+};
+
+
+#endif // SHELL_COPROCESS_HPP
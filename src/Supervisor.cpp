@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+#include <utility>
+
+#include "Supervisor.hpp"
+#include <armoury/logger.hpp>
+
+
+namespace
+{
+
+// first restart after a stable run is immediate, repeated failures back off
+constexpr std::chrono::milliseconds g_initialBackoff{50};
+constexpr std::chrono::milliseconds g_maxBackoff{30000};
+constexpr std::chrono::seconds g_stableRun{60};
+
+
+sigset_t supervised_signals()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGUSR2);
+    return set;
+}
+
+} // namespace
+
+
+/*******************************************************************************
+ * Failure notifications of the workers
+ *
+ * Shared with the notifiers, so a worker reporting after the supervisor is
+ * gone writes to a still valid descriptor and is ignored.
+ ******************************************************************************/
+struct Supervisor::Channel
+{
+    int eventFd{-1};
+    std::mutex mutex;
+    std::vector<size_t> failed;
+    std::atomic<bool> closed{false};
+
+    ~Channel()
+    {
+        if (eventFd >= 0)
+            close(eventFd);
+    }
+
+    void notify(size_t id)
+    {
+        if (closed)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            failed.push_back(id);
+        }
+
+        uint64_t one = 1;
+        ssize_t written = write(eventFd, &one, sizeof(one));
+        (void)written;
+    }
+
+    std::vector<size_t> take()
+    {
+        uint64_t count = 0;
+        ssize_t got = read(eventFd, &count, sizeof(count));
+        (void)got;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::exchange(failed, {});
+    }
+
+    // a worker stopped on purpose reports like a failed one
+    void discard(size_t id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed.erase(std::remove(failed.begin(), failed.end(), id), failed.end());
+    }
+};
+
+
+Supervisor::Supervisor(std::shared_ptr<ServiceMetrics> metrics)
+    : m_channel{std::make_shared<Channel>()}, m_metrics{std::move(metrics)}
+{
+    sigset_t signals = supervised_signals();
+
+    m_channel->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    m_signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (m_channel->eventFd < 0 || m_signalFd < 0 || m_epollFd < 0)
+        throw std::runtime_error("Error: can't create the supervisor descriptors");
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+
+    event.data.fd = m_channel->eventFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_channel->eventFd, &event);
+
+    event.data.fd = m_signalFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_signalFd, &event);
+}
+
+
+Supervisor::~Supervisor()
+{
+    m_channel->closed = true;
+    close(m_epollFd);
+    close(m_signalFd);
+}
+
+
+void Supervisor::blockSignals()
+{
+    sigset_t signals = supervised_signals();
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+}
+
+
+size_t Supervisor::add(std::string name, Actions actions)
+{
+    Component component;
+    component.name = std::move(name);
+    component.actions = std::move(actions);
+
+    m_components.push_back(std::move(component));
+    return m_components.size() - 1;
+}
+
+
+Supervisor::Notifier Supervisor::notifier(size_t id) const
+{
+    std::shared_ptr<Channel> channel = m_channel;
+    return [channel, id] { channel->notify(id); };
+}
+
+
+void Supervisor::onHandover(std::function<bool()> handover)
+{
+    m_handover = std::move(handover);
+}
+
+
+void Supervisor::start()
+{
+    for (Component &component : m_components)
+    {
+        component.actions.start();
+        component.running = true;
+        component.startedAt = Clock::now();
+    }
+
+    publishHealth();
+}
+
+
+/*******************************************************************************
+ * Supervise until a termination signal or an unrecoverable worker
+ *
+ * @return exit status for main()
+ ******************************************************************************/
+int Supervisor::run()
+{
+    epoll_event events[2];
+
+    for (;;)
+    {
+        int count = epoll_wait(m_epollFd, events, 2, nextTimeout(Clock::now()));
+        if (count < 0 && errno != EINTR)
+        {
+            arms::log<arms::LOG_INFO>("Supervisor wait failed: {}", errno);
+            return EXIT_FAILURE;
+        }
+
+        Clock::time_point now = Clock::now();
+        bool notified = false;
+
+        for (int i = 0; i < count; ++i)
+        {
+            if (events[i].data.fd == m_channel->eventFd)
+            {
+                for (size_t id : m_channel->take())
+                    handleFailure(id, now);
+                notified = true;
+            }
+            else if (events[i].data.fd == m_signalFd)
+            {
+                signalfd_siginfo info{};
+                if (read(m_signalFd, &info, sizeof(info)) != sizeof(info))
+                    continue;
+
+                if (info.ssi_signo == SIGHUP)
+                {
+                    arms::log<arms::LOG_INFO>("SIGHUP ignored");
+                    continue;
+                }
+
+                if (info.ssi_signo == SIGUSR2)
+                {
+                    if (m_handover && m_handover())
+                    {
+                        m_handingOver = true;
+                        return EXIT_SUCCESS;
+                    }
+                    arms::log<arms::LOG_INFO>("Handover failed, still serving");
+                    continue;
+                }
+
+                arms::log<arms::LOG_INFO>("Received signal {}, stopping", info.ssi_signo);
+                return EXIT_SUCCESS;
+            }
+        }
+
+        restartDue(Clock::now());
+
+        // a failure report is the only reason to ask the workers, there is no poll
+        if (notified)
+        {
+            for (Component &component : m_components)
+            {
+                if (component.running && component.actions.check && component.actions.check())
+                {
+                    arms::log<arms::LOG_INFO>("Component {} can not be recovered", component.name);
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+}
+
+
+void Supervisor::stop()
+{
+    m_channel->closed = true;
+
+    for (auto it = m_components.rbegin(); it != m_components.rend(); ++it)
+    {
+        if (it->running)
+            it->actions.stop();
+        it->running = false;
+        it->restartPending = false;
+    }
+
+    publishHealth();
+}
+
+
+/*******************************************************************************
+ * Stop one component ahead of the others, it is not restarted any more
+ ******************************************************************************/
+void Supervisor::stop(size_t id)
+{
+    if (id >= m_components.size())
+        return;
+
+    Component &component = m_components[id];
+    if (component.running)
+        component.actions.stop();
+    m_channel->discard(id);
+
+    component.running = false;
+    component.restartPending = false;
+    publishHealth();
+}
+
+
+void Supervisor::handleFailure(size_t id, Clock::time_point now)
+{
+    if (id >= m_components.size())
+        return;
+
+    Component &component = m_components[id];
+
+    // several reports of the same failure
+    if (component.restartPending)
+        return;
+
+    if (now - component.startedAt >= g_stableRun)
+        component.backoff = std::chrono::milliseconds{0};
+    else if (component.backoff.count() == 0)
+        component.backoff = g_initialBackoff;
+    else
+        component.backoff = std::min(component.backoff * 2, g_maxBackoff);
+
+    component.running = false;
+    component.restartPending = true;
+    component.failures++;
+    component.failedAt = now;
+    component.restartAt = now + component.backoff;
+
+    arms::log<arms::LOG_INFO>("Component {} failed, restart in {} ms", component.name, component.backoff.count());
+    publishHealth();
+}
+
+
+void Supervisor::restartDue(Clock::time_point now)
+{
+    bool restarted = false;
+
+    for (size_t id = 0; id < m_components.size(); ++id)
+    {
+        Component &component = m_components[id];
+        if (!component.restartPending || component.restartAt > now)
+            continue;
+
+        component.actions.stop();
+        m_channel->discard(id);
+        component.actions.start();
+
+        component.running = true;
+        component.restartPending = false;
+        component.restarts++;
+        component.startedAt = Clock::now();
+        component.lastRecovery =
+            std::chrono::duration_cast<std::chrono::microseconds>(component.startedAt - component.failedAt);
+
+        arms::log<arms::LOG_INFO>("Component {} restarted after {} us", component.name,
+                                  component.lastRecovery.count());
+        restarted = true;
+    }
+
+    if (restarted)
+        publishHealth();
+}
+
+
+/*******************************************************************************
+ * Milliseconds until the next due restart, -1 to wait for a notification only
+ ******************************************************************************/
+int Supervisor::nextTimeout(Clock::time_point now) const
+{
+    std::optional<Clock::time_point> next;
+
+    for (Component const &component : m_components)
+    {
+        if (component.restartPending)
+            next = next ? std::min(*next, component.restartAt) : component.restartAt;
+    }
+
+    if (!next)
+        return -1;
+    if (*next <= now)
+        return 0;
+
+    // round up, waking early would spin until the deadline
+    return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(*next - now).count());
+}
+
+
+void Supervisor::publishHealth()
+{
+    if (!m_metrics)
+        return;
+
+    std::vector<ComponentHealth> health;
+    health.reserve(m_components.size());
+
+    for (Component const &component : m_components)
+    {
+        ComponentHealth entry;
+        entry.name = component.name;
+        entry.up = component.running;
+        entry.failures = component.failures;
+        entry.restarts = component.restarts;
+        entry.backoffSeconds = std::chrono::duration<double>(component.backoff).count();
+        entry.lastRecoverySeconds = std::chrono::duration<double>(component.lastRecovery).count();
+        health.push_back(std::move(entry));
+    }
+
+    m_metrics->setComponents(std::move(health));
+}
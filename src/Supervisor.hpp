@@ -0,0 +1,97 @@
+#ifndef SUPERVISOR_HPP
+#define SUPERVISOR_HPP
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ServiceMetrics.hpp"
+
+
+/*******************************************************************************
+ * Supervisor of the long running workers of the daemon
+ *
+ * Every worker (the SOAP listener, each RTSP main loop, the MQTT loop) is
+ * registered with its start/stop actions and gets a notifier to call when it
+ * fails. Notifications arrive through an eventfd and termination signals
+ * through a signalfd, both waited on with epoll, so a failure is handled as
+ * soon as it is reported instead of on the next poll. Restarts are delayed by
+ * a per-component exponential backoff that resets once the worker has run
+ * stable for a while. Health is published to the ServiceMetrics.
+ *
+ * The epoll wait has a timeout only while a restart is waiting for its
+ * backoff. The optional check action, which tells whether a worker can still
+ * be recovered, runs when a failure is reported instead of on a timer.
+ *
+ * SIGUSR2 runs the handover action; when it succeeds run() returns with
+ * handingOver() set so the caller can drain before stopping.
+ ******************************************************************************/
+class Supervisor
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+    using Notifier = std::function<void()>;
+
+    struct Actions
+    {
+        std::function<void()> start;
+        std::function<void()> stop;
+        std::function<bool()> check; // optional, true if the worker can not be recovered
+    };
+
+    explicit Supervisor(std::shared_ptr<ServiceMetrics> metrics);
+    ~Supervisor();
+
+    Supervisor(Supervisor const &) = delete;
+    Supervisor &operator=(Supervisor const &) = delete;
+
+    // must run before any thread is created so every thread inherits the mask
+    static void blockSignals();
+
+    size_t add(std::string name, Actions actions);
+    Notifier notifier(size_t id) const;
+    void onHandover(std::function<bool()> handover);
+
+    void start();
+    int run();
+    void stop();
+    void stop(size_t id);
+
+    bool handingOver() const { return m_handingOver; }
+
+  private:
+    struct Channel;
+
+    struct Component
+    {
+        std::string name;
+        Actions actions;
+        bool running{false};
+        bool restartPending{false};
+        uint64_t failures{0};
+        uint64_t restarts{0};
+        std::chrono::milliseconds backoff{0};
+        std::chrono::microseconds lastRecovery{0};
+        Clock::time_point startedAt{};
+        Clock::time_point failedAt{};
+        Clock::time_point restartAt{};
+    };
+
+    void handleFailure(size_t id, Clock::time_point now);
+    void restartDue(Clock::time_point now);
+    int nextTimeout(Clock::time_point now) const;
+    void publishHealth();
+
+    std::shared_ptr<Channel> m_channel;
+    std::shared_ptr<ServiceMetrics> m_metrics;
+    std::vector<Component> m_components;
+    std::function<bool()> m_handover;
+    bool m_handingOver{false};
+    int m_signalFd{-1};
+    int m_epollFd{-1};
+};
+
+
+#endif // SUPERVISOR_HPP
@@ -0,0 +1,205 @@
+#include <cstdio>
+#include <memory>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include "TlsContext.hpp"
+#include <armoury/logger.hpp>
+
+
+namespace
+{
+
+constexpr long g_sessionCacheSize = 1024;
+constexpr long g_sessionTimeout = 3600; // seconds, tickets and cached sessions
+constexpr unsigned char g_sessionIdContext[] = "onvif_srvd";
+
+
+using X509Ptr = std::unique_ptr<X509, decltype(&X509_free)>;
+using FilePtr = std::unique_ptr<FILE, decltype(&fclose)>;
+
+
+std::string ssl_error()
+{
+    char text[256] = "";
+    ERR_error_string_n(ERR_get_error(), text, sizeof(text));
+    ERR_clear_error();
+    return text;
+}
+
+
+std::string fingerprint_id(X509 *certificate)
+{
+    static char const hex[] = "0123456789abcdef";
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    if (!X509_digest(certificate, EVP_sha256(), digest, &length))
+        return {};
+
+    std::string id;
+    for (unsigned int i = 0; i < length && i < 8; ++i)
+    {
+        id += hex[digest[i] >> 4];
+        id += hex[digest[i] & 0xf];
+    }
+    return id;
+}
+
+
+X509Ptr from_der(std::vector<unsigned char> const &der)
+{
+    unsigned char const *data = der.data();
+    return X509Ptr{d2i_X509(NULL, &data, static_cast<long>(der.size())), &X509_free};
+}
+
+} // namespace
+
+
+TlsContext::TlsContext(std::string certificateFile, std::string keyFile)
+    : m_certificateFile{std::move(certificateFile)}, m_keyFile{std::move(keyFile)}
+{
+    OPENSSL_init_ssl(0, NULL);
+}
+
+
+TlsContext::~TlsContext()
+{
+    SSL_CTX_free(m_ctx);
+}
+
+
+bool TlsContext::load()
+{
+    SSL_CTX *ctx = build(m_certificateFile);
+    if (!ctx)
+        return false;
+
+    publish(ctx);
+    return true;
+}
+
+
+SSL_CTX *TlsContext::acquire(uint64_t &generation) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    generation = m_generation.load(std::memory_order_relaxed);
+    if (m_ctx)
+        SSL_CTX_up_ref(m_ctx);
+    return m_ctx;
+}
+
+
+std::vector<TlsContext::Certificate> TlsContext::certificates() const
+{
+    std::vector<Certificate> result;
+
+    FilePtr file{fopen(m_certificateFile.c_str(), "r"), &fclose};
+    if (!file)
+        return result;
+
+    while (X509 *raw = PEM_read_X509(file.get(), NULL, NULL, NULL))
+    {
+        X509Ptr certificate{raw, &X509_free};
+
+        unsigned char *der = NULL;
+        int length = i2d_X509(certificate.get(), &der);
+        if (length <= 0)
+            continue;
+
+        result.push_back({fingerprint_id(certificate.get()), std::vector<unsigned char>(der, der + length)});
+        OPENSSL_free(der);
+    }
+
+    ERR_clear_error(); // end of file
+    return result;
+}
+
+
+/*******************************************************************************
+ * Replace the certificate chain, the file is only replaced once the new chain
+ * has been loaded into a working context
+ ******************************************************************************/
+bool TlsContext::install(std::vector<std::vector<unsigned char>> const &chain)
+{
+    if (chain.empty())
+        return false;
+
+    std::string const staged = m_certificateFile + ".new";
+    {
+        FilePtr file{fopen(staged.c_str(), "w"), &fclose};
+        if (!file)
+            return false;
+
+        for (std::vector<unsigned char> const &der : chain)
+        {
+            X509Ptr certificate = from_der(der);
+            if (!certificate || !PEM_write_X509(file.get(), certificate.get()))
+            {
+                arms::log<arms::LOG_INFO>("Rejected certificate: {}", ssl_error());
+                file.reset();
+                unlink(staged.c_str());
+                return false;
+            }
+        }
+    }
+
+    SSL_CTX *ctx = build(staged);
+    if (!ctx || rename(staged.c_str(), m_certificateFile.c_str()))
+    {
+        SSL_CTX_free(ctx);
+        unlink(staged.c_str());
+        return false;
+    }
+
+    publish(ctx);
+    arms::log<arms::LOG_INFO>("Installed TLS certificate chain of {} certificates", chain.size());
+    return true;
+}
+
+
+SSL_CTX *TlsContext::build(std::string const &certificateFile) const
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx)
+        return nullptr;
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    long options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+#ifdef SSL_OP_ENABLE_KTLS
+    options |= SSL_OP_ENABLE_KTLS;
+#endif
+    SSL_CTX_set_options(ctx, options);
+
+    // resumption by session id and by ticket, tickets need no server state
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, g_sessionCacheSize);
+    SSL_CTX_set_timeout(ctx, g_sessionTimeout);
+    SSL_CTX_set_session_id_context(ctx, g_sessionIdContext, sizeof(g_sessionIdContext) - 1);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, certificateFile.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, m_keyFile.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1)
+    {
+        arms::log<arms::LOG_INFO>("Can't load TLS certificate {}: {}", certificateFile, ssl_error());
+        SSL_CTX_free(ctx);
+        return nullptr;
+    }
+
+    return ctx;
+}
+
+
+void TlsContext::publish(SSL_CTX *ctx)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    SSL_CTX_free(m_ctx);
+    m_ctx = ctx;
+    m_generation.fetch_add(1, std::memory_order_release);
+}
@@ -0,0 +1,66 @@
+#ifndef TLS_CONTEXT_HPP
+#define TLS_CONTEXT_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <openssl/ssl.h>
+
+
+/*******************************************************************************
+ * Server TLS context of the HTTPS listeners
+ *
+ * One SSL_CTX is shared by every HTTPS listener thread, so the session cache
+ * and the session ticket keys are common to all of them: a client resuming a
+ * session skips the key exchange whichever shard accepts it, and the full
+ * handshake is paid once per client. Kernel TLS is enabled where OpenSSL and
+ * the kernel support it, records are then encrypted in sendmsg().
+ *
+ * The certificate file holds the PEM chain, leaf first, for the key in the key
+ * file. install() replaces the chain (LoadCertificates) and swaps in a new
+ * SSL_CTX, connections in progress keep the one they started with.
+ ******************************************************************************/
+class TlsContext
+{
+  public:
+    struct Certificate
+    {
+        std::string id; // leading bytes of the SHA-256 fingerprint, hex
+        std::vector<unsigned char> der;
+    };
+
+    TlsContext(std::string certificateFile, std::string keyFile);
+    ~TlsContext();
+
+    TlsContext(TlsContext const &) = delete;
+    TlsContext &operator=(TlsContext const &) = delete;
+
+    // build the SSL_CTX from the files, false if they do not form a usable pair
+    bool load();
+
+    // new reference to the current SSL_CTX, generation tells when it changed
+    SSL_CTX *acquire(uint64_t &generation) const;
+    uint64_t generation() const { return m_generation.load(std::memory_order_acquire); }
+
+    std::vector<Certificate> certificates() const;
+
+    // the first certificate must belong to the key, the others complete its chain
+    bool install(std::vector<std::vector<unsigned char>> const &chain);
+
+  private:
+    SSL_CTX *build(std::string const &certificateFile) const;
+    void publish(SSL_CTX *ctx);
+
+    std::string const m_certificateFile;
+    std::string const m_keyFile;
+
+    mutable std::mutex m_mutex;
+    SSL_CTX *m_ctx{nullptr};
+    std::atomic<uint64_t> m_generation{0};
+};
+
+
+#endif // TLS_CONTEXT_HPP
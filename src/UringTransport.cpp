@@ -0,0 +1,503 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <initializer_list>
+#include <new>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define ONVIF_HAVE_IO_URING 1
+#endif
+
+#include "UringTransport.hpp"
+#include <armoury/logger.hpp>
+
+
+char const *const UringTransport::g_pluginId = "UringTransport-1.0";
+
+
+#ifdef ONVIF_HAVE_IO_URING
+
+namespace
+{
+
+constexpr unsigned g_ringEntries = 16;
+
+// completion tags
+constexpr uint64_t g_tagOperation = 1;
+constexpr uint64_t g_tagTimeout = 2;
+constexpr uint64_t g_tagClose = 3;
+
+
+/*******************************************************************************
+ * Minimal single threaded io_uring on the raw kernel interface
+ ******************************************************************************/
+class Ring
+{
+  public:
+    ~Ring()
+    {
+        if (m_sqes != MAP_FAILED)
+            munmap(m_sqes, m_sqesSize);
+        if (m_cqMap != MAP_FAILED && m_cqMap != m_sqMap)
+            munmap(m_cqMap, m_cqMapSize);
+        if (m_sqMap != MAP_FAILED)
+            munmap(m_sqMap, m_sqMapSize);
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+
+    bool init(unsigned entries)
+    {
+        io_uring_params params{};
+        m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (m_fd < 0)
+            return false;
+
+        m_sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool const single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            m_sqMapSize = m_cqMapSize = std::max(m_sqMapSize, m_cqMapSize);
+
+        m_sqMap = mmap(NULL, m_sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if (m_sqMap == MAP_FAILED)
+            return false;
+
+        m_cqMap = single ? m_sqMap
+                         : mmap(NULL, m_cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd,
+                                IORING_OFF_CQ_RING);
+        if (m_cqMap == MAP_FAILED)
+            return false;
+
+        m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = static_cast<io_uring_sqe *>(
+            mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES));
+        if (m_sqes == MAP_FAILED)
+            return false;
+
+        char *sq = static_cast<char *>(m_sqMap);
+        char *cq = static_cast<char *>(m_cqMap);
+        m_sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        m_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        m_sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        m_sqEntries = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+        m_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        m_cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        m_cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        m_sqeTail = *m_sqTail;
+        return true;
+    }
+
+    bool supports(std::initializer_list<int> opcodes) const
+    {
+        size_t const size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+        alignas(io_uring_probe) char storage[size] = {};
+        io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(storage);
+
+        if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+            return false;
+
+        for (int opcode : opcodes)
+            if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED))
+                return false;
+        return true;
+    }
+
+    bool registerBuffer(void *base, size_t size)
+    {
+        iovec iov{base, size};
+        return syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    }
+
+    io_uring_sqe *next()
+    {
+        if (m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+            return nullptr;
+
+        unsigned index = m_sqeTail & m_sqMask;
+        io_uring_sqe *sqe = &m_sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        m_sqArray[index] = index;
+        ++m_sqeTail;
+        return sqe;
+    }
+
+    // submit everything prepared and wait for at least minComplete completions
+    int enter(unsigned minComplete)
+    {
+        __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+
+        for (;;)
+        {
+            unsigned toSubmit = m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+            long r = syscall(__NR_io_uring_enter, m_fd, toSubmit, minComplete,
+                             minComplete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+            if (r >= 0 || errno != EINTR)
+                return r < 0 ? -errno : 0;
+        }
+    }
+
+    bool pop(io_uring_cqe &cqe)
+    {
+        unsigned head = *m_cqHead;
+        if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+            return false;
+
+        cqe = m_cqes[head & m_cqMask];
+        __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+  private:
+    int m_fd{-1};
+    void *m_sqMap{MAP_FAILED};
+    void *m_cqMap{MAP_FAILED};
+    io_uring_sqe *m_sqes{static_cast<io_uring_sqe *>(MAP_FAILED)};
+    size_t m_sqMapSize{0};
+    size_t m_cqMapSize{0};
+    size_t m_sqesSize{0};
+
+    unsigned *m_sqHead{nullptr};
+    unsigned *m_sqTail{nullptr};
+    unsigned *m_sqArray{nullptr};
+    unsigned m_sqMask{0};
+    unsigned m_sqEntries{0};
+    unsigned m_sqeTail{0};
+
+    unsigned *m_cqHead{nullptr};
+    unsigned *m_cqTail{nullptr};
+    unsigned m_cqMask{0};
+    io_uring_cqe *m_cqes{nullptr};
+};
+
+
+/*******************************************************************************
+ * Plugin data, the default hooks are kept for the traffic we do not handle
+ ******************************************************************************/
+struct UringData
+{
+    Ring ring;
+    bool fixedBuffer{false};
+    SOAP_SOCKET blocking{SOAP_INVALID_SOCKET};
+    __kernel_timespec timeout{};
+
+    SOAP_SOCKET (*faccept)(struct soap *, SOAP_SOCKET, struct sockaddr *, int *){nullptr};
+    size_t (*frecv)(struct soap *, char *, size_t){nullptr};
+    int (*fsend)(struct soap *, char const *, size_t){nullptr};
+    int (*fclosesocket)(struct soap *, SOAP_SOCKET){nullptr};
+};
+
+
+UringData *uring_data(struct soap *soap)
+{
+    return static_cast<UringData *>(soap_lookup_plugin(soap, UringTransport::g_pluginId));
+}
+
+
+bool uses_default_path(struct soap *soap)
+{
+#ifdef WITH_OPENSSL
+    if (soap->ssl)
+        return true;
+#endif
+    return (soap->omode & SOAP_IO_UDP) || !soap_valid_socket(soap->socket);
+}
+
+
+// gSOAP timeouts are seconds when positive and microseconds when negative
+bool set_timeout(__kernel_timespec &ts, int timeout)
+{
+    if (!timeout)
+        return false;
+
+    long long usec = timeout > 0 ? timeout * 1000000LL : -static_cast<long long>(timeout);
+    ts.tv_sec = usec / 1000000;
+    ts.tv_nsec = (usec % 1000000) * 1000;
+    return true;
+}
+
+
+/*******************************************************************************
+ * Submit the prepared operation, with a linked timeout, and wait for it
+ *
+ * @return the result of the operation, -ECANCELED if the timeout fired
+ ******************************************************************************/
+int run_operation(UringData &data, io_uring_sqe *sqe, int timeout)
+{
+    sqe->user_data = g_tagOperation;
+
+    if (set_timeout(data.timeout, timeout))
+    {
+        sqe->flags |= IOSQE_IO_LINK;
+
+        io_uring_sqe *link = data.ring.next();
+        if (link)
+        {
+            link->opcode = IORING_OP_LINK_TIMEOUT;
+            link->fd = -1;
+            link->addr = reinterpret_cast<uint64_t>(&data.timeout);
+            link->len = 1;
+            link->user_data = g_tagTimeout;
+        }
+        else
+        {
+            sqe->flags &= ~IOSQE_IO_LINK;
+        }
+    }
+
+    for (;;)
+    {
+        int r = data.ring.enter(1);
+        if (r < 0)
+            return r;
+
+        io_uring_cqe cqe;
+        while (data.ring.pop(cqe))
+        {
+            // timeout and close completions are of no interest
+            if (cqe.user_data == g_tagOperation)
+                return cqe.res;
+        }
+    }
+}
+
+
+io_uring_sqe *prepare(UringData &data, uint8_t opcode, int fd, void const *addr, size_t len)
+{
+    io_uring_sqe *sqe = data.ring.next();
+    if (!sqe)
+    {
+        // only reachable with completions never reaped, flush and retry
+        data.ring.enter(0);
+        sqe = data.ring.next();
+    }
+    if (sqe)
+    {
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(addr);
+        sqe->len = static_cast<uint32_t>(len);
+    }
+    return sqe;
+}
+
+
+/*******************************************************************************
+ * io_uring waits in the kernel, on an O_NONBLOCK socket (soap_accept sets it
+ * when timeouts are configured) every not yet ready operation would fail
+ ******************************************************************************/
+void make_blocking(UringData &data, SOAP_SOCKET sock)
+{
+    if (data.blocking == sock)
+        return;
+
+    fcntl(sock, F_SETFL, 0);
+    data.blocking = sock;
+}
+
+
+SOAP_SOCKET uring_accept(struct soap *soap, SOAP_SOCKET master, struct sockaddr *addr, int *len)
+{
+    UringData *data = uring_data(soap);
+
+    socklen_t addrLen = static_cast<socklen_t>(*len);
+    io_uring_sqe *sqe = data ? prepare(*data, IORING_OP_ACCEPT, master, addr, 0) : nullptr;
+    if (!sqe)
+        return data ? data->faccept(soap, master, addr, len) : SOAP_INVALID_SOCKET;
+
+    sqe->addr2 = reinterpret_cast<uint64_t>(&addrLen);
+    sqe->accept_flags = SOCK_CLOEXEC;
+
+    int r = run_operation(*data, sqe, 0);
+    if (r < 0)
+    {
+        errno = -r;
+        return SOAP_INVALID_SOCKET;
+    }
+
+    *len = static_cast<int>(addrLen);
+    return r;
+}
+
+
+size_t uring_recv(struct soap *soap, char *buf, size_t len)
+{
+    UringData *data = uring_data(soap);
+    if (!data || uses_default_path(soap))
+        return data ? data->frecv(soap, buf, len) : 0;
+
+    make_blocking(*data, soap->socket);
+
+    bool const fixed = data->fixedBuffer && buf >= soap->buf && buf + len <= soap->buf + sizeof(soap->buf);
+
+    for (;;)
+    {
+        io_uring_sqe *sqe = prepare(*data, fixed ? IORING_OP_READ_FIXED : IORING_OP_RECV, soap->socket, buf, len);
+        if (!sqe)
+            return data->frecv(soap, buf, len);
+
+        int r = run_operation(*data, sqe, soap->recv_timeout);
+        if (r >= 0)
+            return static_cast<size_t>(r);
+
+        if (r == -EINTR || r == -EAGAIN)
+            continue;
+
+        // a timeout is reported like the default path does, without an errno
+        soap->errnum = r == -ECANCELED ? 0 : -r;
+        return 0;
+    }
+}
+
+
+int uring_send(struct soap *soap, char const *s, size_t n)
+{
+    UringData *data = uring_data(soap);
+    if (!data || uses_default_path(soap))
+        return data ? data->fsend(soap, s, n) : SOAP_EOF;
+
+    make_blocking(*data, soap->socket);
+
+    while (n)
+    {
+        io_uring_sqe *sqe = prepare(*data, IORING_OP_SEND, soap->socket, s, n);
+        if (!sqe)
+            return data->fsend(soap, s, n);
+        sqe->msg_flags = MSG_NOSIGNAL;
+
+        int r = run_operation(*data, sqe, soap->send_timeout);
+        if (r == -EINTR || r == -EAGAIN)
+            continue;
+
+        if (r < 0)
+        {
+            soap->errnum = r == -ECANCELED ? 0 : -r;
+            return SOAP_EOF;
+        }
+
+        s += r;
+        n -= static_cast<size_t>(r);
+    }
+
+    return SOAP_OK;
+}
+
+
+int uring_close(struct soap *soap, SOAP_SOCKET sock)
+{
+    UringData *data = uring_data(soap);
+
+    io_uring_sqe *sqe = data ? prepare(*data, IORING_OP_CLOSE, sock, NULL, 0) : nullptr;
+    if (!sqe)
+        return data ? data->fclosesocket(soap, sock) : SOAP_OK;
+
+    // submitted right away so the peer sees the end of the connection, the
+    // completion is reaped with the next operation
+    sqe->user_data = g_tagClose;
+    if (data->ring.enter(0) < 0)
+        return data->fclosesocket(soap, sock);
+
+    if (data->blocking == sock)
+        data->blocking = SOAP_INVALID_SOCKET;
+    return SOAP_OK;
+}
+
+
+void uring_delete(struct soap *soap, struct soap_plugin *plugin)
+{
+    UringData *data = static_cast<UringData *>(plugin->data);
+
+    // soap_done() may still close sockets after the plugins are gone
+    soap->faccept = data->faccept;
+    soap->frecv = data->frecv;
+    soap->fsend = data->fsend;
+    soap->fclosesocket = data->fclosesocket;
+
+    delete data;
+}
+
+
+int uring_create(struct soap *soap, struct soap_plugin *plugin, void *arg);
+
+
+int uring_copy(struct soap *soap, struct soap_plugin *dst, struct soap_plugin *src)
+{
+    (void)src;
+    return uring_create(soap, dst, NULL);
+}
+
+
+int uring_create(struct soap *soap, struct soap_plugin *plugin, void *arg)
+{
+    (void)arg;
+
+    UringData *data = new (std::nothrow) UringData;
+    if (!data)
+        return SOAP_EOM;
+
+    if (!data->ring.init(g_ringEntries) ||
+        !data->ring.supports({IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_CLOSE,
+                              IORING_OP_LINK_TIMEOUT, IORING_OP_READ_FIXED}))
+    {
+        delete data;
+        return SOAP_PLUGIN_ERROR;
+    }
+
+    // pinned memory is limited by RLIMIT_MEMLOCK, reads then go through RECV
+    data->fixedBuffer = data->ring.registerBuffer(soap->buf, sizeof(soap->buf));
+
+    data->faccept = soap->faccept;
+    data->frecv = soap->frecv;
+    data->fsend = soap->fsend;
+    data->fclosesocket = soap->fclosesocket;
+
+    soap->faccept = uring_accept;
+    soap->frecv = uring_recv;
+    soap->fsend = uring_send;
+    soap->fclosesocket = uring_close;
+
+    plugin->id = UringTransport::g_pluginId;
+    plugin->data = data;
+    plugin->fcopy = uring_copy;
+    plugin->fdelete = uring_delete;
+    return SOAP_OK;
+}
+
+} // namespace
+
+
+bool UringTransport::attach(struct soap *soap)
+{
+    if (soap_register_plugin(soap, uring_create) != SOAP_OK)
+    {
+        soap->error = SOAP_OK;
+        arms::log<arms::LOG_INFO>("io_uring not available, SOAP uses the default transport");
+        return false;
+    }
+
+    if (uring_data(soap)->fixedBuffer)
+        arms::log<arms::LOG_INFO>("SOAP transport: io_uring with registered buffer");
+    else
+        arms::log<arms::LOG_INFO>("SOAP transport: io_uring");
+    return true;
+}
+
+#else
+
+bool UringTransport::attach(struct soap *soap)
+{
+    (void)soap;
+    return false;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef URING_TRANSPORT_HPP
+#define URING_TRANSPORT_HPP
+
+#include "stdsoap2.h"
+
+
+/*******************************************************************************
+ * io_uring transport for a gSOAP context
+ *
+ * A gSOAP plugin replacing the faccept, frecv, fsend and fclosesocket hooks.
+ * Every socket operation is one io_uring_enter() that submits the operation
+ * together with its send/recv timeout as a linked timeout, where the default
+ * path polls before each recv and send. Reads into soap->buf use it as a
+ * registered buffer and closes are submitted without waiting for them.
+ *
+ * Operations are not queued across hook calls. The hooks are synchronous and
+ * each one needs its result before gSOAP knows the next: the length read
+ * decides what follows, and a send buffer is reused as soon as fsend
+ * returns. Deeper batches would mean speculative reads into soap->buf and a
+ * copy of every send. A close can not wait for the next accept either, as
+ * soap_accept() polls the listener before it calls faccept and the peer
+ * would not see the end of the connection while the listener is idle. The
+ * gain is the poll() before every recv and send, and soap_gather_send keeps
+ * a response in one send.
+ *
+ * attach() leaves the context on the default path when the kernel has no
+ * io_uring (or lacks one of the operations used), SSL and UDP traffic always
+ * goes through the default hooks.
+ ******************************************************************************/
+class UringTransport
+{
+  public:
+    static char const *const g_pluginId;
+
+    // true if the context now uses io_uring
+    static bool attach(struct soap *soap);
+};
+
+
+#endif // URING_TRANSPORT_HPP
@@ -0,0 +1,309 @@
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <new>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "UringTransport.hpp"
+#include "VectoredSend.hpp"
+
+
+char const *const VectoredSend::g_pluginId = "VectoredSend-1.0";
+
+
+namespace
+{
+
+constexpr size_t g_directPiece = 16 * 1024; // larger pieces are not copied into the buffer
+constexpr size_t g_maxBuffer = 256 * 1024;  // a longer response is written in corked parts
+
+
+/*******************************************************************************
+ * Plugin data, the gathered output and the wrapped hooks
+ ******************************************************************************/
+struct SendData
+{
+    ServiceMetrics *metrics{nullptr};
+    std::string buffer; // cleared after each write, its capacity is kept
+    SOAP_SOCKET socket{SOAP_INVALID_SOCKET}; // connection the socket options were set for
+    bool tcp{false};
+    bool corked{false};
+
+    int (*fsend)(struct soap *, char const *, size_t){nullptr};
+    size_t (*frecv)(struct soap *, char *, size_t){nullptr};
+    int (*fclose)(struct soap *){nullptr};
+    int (*fclosesocket)(struct soap *, SOAP_SOCKET){nullptr};
+};
+
+
+SendData *send_data(struct soap *soap)
+{
+    return static_cast<SendData *>(soap_lookup_plugin(soap, VectoredSend::g_pluginId));
+}
+
+
+// sendmsg() on the socket ourselves, otherwise through the wrapped fsend
+bool writes_socket(struct soap *soap)
+{
+#ifdef WITH_OPENSSL
+    if (soap->ssl)
+        return false;
+#endif
+    return !soap_lookup_plugin(soap, UringTransport::g_pluginId);
+}
+
+
+void set_option(SOAP_SOCKET sock, int option, int value)
+{
+    setsockopt(sock, IPPROTO_TCP, option, &value, sizeof(value));
+}
+
+
+void begin_connection(struct soap *soap, SendData &data)
+{
+    if (data.socket == soap->socket)
+        return;
+
+    // fails on the unix socket listener, which has no segments to merge
+    int one = 1;
+    data.tcp = setsockopt(soap->socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == 0;
+    data.socket = soap->socket;
+    data.corked = false;
+}
+
+
+void cork(SendData &data, bool on)
+{
+    if (!data.tcp || data.corked == on)
+        return;
+
+    set_option(data.socket, TCP_CORK, on ? 1 : 0);
+    data.corked = on;
+}
+
+
+// gSOAP timeouts are seconds when positive and microseconds when negative
+bool wait_writable(struct soap *soap)
+{
+    int timeout = soap->send_timeout > 0 ? soap->send_timeout * 1000 : -soap->send_timeout / 1000;
+    if (!soap->send_timeout)
+        timeout = -1;
+
+    pollfd pfd{soap->socket, POLLOUT, 0};
+    int r;
+    do
+        r = poll(&pfd, 1, timeout);
+    while (r < 0 && errno == EINTR);
+
+    return r > 0;
+}
+
+
+/*******************************************************************************
+ * Write all of the vector to the socket, a non-blocking socket is polled
+ ******************************************************************************/
+int send_vector(struct soap *soap, iovec *iov, int count)
+{
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = static_cast<size_t>(count);
+
+    while (msg.msg_iovlen)
+    {
+        ssize_t r = sendmsg(soap->socket, &msg, MSG_NOSIGNAL);
+        if (r < 0)
+        {
+            if (errno == EINTR || ((errno == EAGAIN || errno == EWOULDBLOCK) && wait_writable(soap)))
+                continue;
+
+            // a timeout is reported like the default path does, without an errno
+            soap->errnum = errno == EAGAIN || errno == EWOULDBLOCK ? 0 : errno;
+            return SOAP_EOF;
+        }
+
+        size_t sent = static_cast<size_t>(r);
+        while (msg.msg_iovlen && sent >= msg.msg_iov->iov_len)
+        {
+            sent -= msg.msg_iov->iov_len;
+            ++msg.msg_iov;
+            --msg.msg_iovlen;
+        }
+        if (msg.msg_iovlen)
+        {
+            msg.msg_iov->iov_base = static_cast<char *>(msg.msg_iov->iov_base) + sent;
+            msg.msg_iov->iov_len -= sent;
+        }
+    }
+
+    return SOAP_OK;
+}
+
+
+/*******************************************************************************
+ * Write the gathered output, final at the end of a response
+ ******************************************************************************/
+int flush(struct soap *soap, SendData &data, bool final)
+{
+    int error = SOAP_OK;
+
+    if (!data.buffer.empty())
+    {
+        if (writes_socket(soap))
+        {
+            iovec iov{&data.buffer[0], data.buffer.size()};
+            error = send_vector(soap, &iov, 1);
+        }
+        else
+            error = data.fsend(soap, data.buffer.data(), data.buffer.size());
+
+        data.buffer.clear();
+        if (data.metrics)
+            data.metrics->sendWrites++;
+    }
+
+    if (final)
+        cork(data, false);
+
+    return error;
+}
+
+
+int gather_send(struct soap *soap, char const *s, size_t n)
+{
+    SendData *data = send_data(soap);
+    if (!data || (soap->omode & SOAP_IO_UDP) || !soap_valid_socket(soap->socket))
+        return data ? data->fsend(soap, s, n) : SOAP_EOF;
+
+    begin_connection(soap, *data);
+    if (data->metrics)
+        data->metrics->sendFragments++;
+
+    if (n >= g_directPiece && writes_socket(soap))
+    {
+        // more of the response may follow, only full segments go out now
+        cork(*data, true);
+
+        iovec iov[2] = {{&data->buffer[0], data->buffer.size()}, {const_cast<char *>(s), n}};
+        int const first = data->buffer.empty() ? 1 : 0;
+        int error = send_vector(soap, iov + first, 2 - first);
+
+        data->buffer.clear();
+        if (data->metrics)
+            data->metrics->sendWrites++;
+        return error;
+    }
+
+    data->buffer.append(s, n);
+
+    if (data->buffer.size() < g_maxBuffer)
+        return SOAP_OK;
+
+    cork(*data, true);
+    return flush(soap, *data, false);
+}
+
+
+size_t gather_recv(struct soap *soap, char *s, size_t n)
+{
+    SendData *data = send_data(soap);
+    if (!data)
+        return 0;
+
+    // the previous response of a kept-alive connection is complete
+    if (flush(soap, *data, true) != SOAP_OK)
+        return 0;
+
+    return data->frecv(soap, s, n);
+}
+
+
+int gather_close(struct soap *soap)
+{
+    SendData *data = send_data(soap);
+    if (!data)
+        return SOAP_OK;
+
+    // before a TLS close_notify or a shutdown of the socket
+    flush(soap, *data, true);
+    data->socket = SOAP_INVALID_SOCKET;
+
+    return data->fclose(soap);
+}
+
+
+int gather_closesocket(struct soap *soap, SOAP_SOCKET sock)
+{
+    SendData *data = send_data(soap);
+    if (!data)
+        return SOAP_OK;
+
+    if (sock == soap->socket)
+        flush(soap, *data, true);
+    if (sock == data->socket)
+        data->socket = SOAP_INVALID_SOCKET;
+
+    return data->fclosesocket(soap, sock);
+}
+
+
+void gather_delete(struct soap *soap, struct soap_plugin *plugin)
+{
+    SendData *data = static_cast<SendData *>(plugin->data);
+
+    soap->fsend = data->fsend;
+    soap->frecv = data->frecv;
+    soap->fclose = data->fclose;
+    soap->fclosesocket = data->fclosesocket;
+
+    delete data;
+}
+
+
+int gather_create(struct soap *soap, struct soap_plugin *plugin, void *arg);
+
+
+int gather_copy(struct soap *soap, struct soap_plugin *dst, struct soap_plugin *src)
+{
+    return gather_create(soap, dst, static_cast<SendData *>(src->data)->metrics);
+}
+
+
+int gather_create(struct soap *soap, struct soap_plugin *plugin, void *arg)
+{
+    SendData *data = new (std::nothrow) SendData;
+    if (!data)
+        return SOAP_EOM;
+
+    data->metrics = static_cast<ServiceMetrics *>(arg);
+    data->fsend = soap->fsend;
+    data->frecv = soap->frecv;
+    data->fclose = soap->fclose;
+    data->fclosesocket = soap->fclosesocket;
+
+    soap->fsend = gather_send;
+    soap->frecv = gather_recv;
+    soap->fclose = gather_close;
+    soap->fclosesocket = gather_closesocket;
+
+    plugin->id = VectoredSend::g_pluginId;
+    plugin->data = data;
+    plugin->fcopy = gather_copy;
+    plugin->fdelete = gather_delete;
+    return SOAP_OK;
+}
+
+} // namespace
+
+
+bool VectoredSend::attach(struct soap *soap, ServiceMetrics *metrics)
+{
+    if (soap_register_plugin_arg(soap, gather_create, metrics) != SOAP_OK)
+    {
+        soap->error = SOAP_OK;
+        return false;
+    }
+    return true;
+}
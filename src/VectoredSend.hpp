@@ -0,0 +1,42 @@
+#ifndef VECTORED_SEND_HPP
+#define VECTORED_SEND_HPP
+
+#include "ServiceMetrics.hpp"
+#include "stdsoap2.h"
+
+
+/*******************************************************************************
+ * Buffered output path of a gSOAP context
+ *
+ * gSOAP hands the response to fsend piece by piece (status line, header lines,
+ * envelope fragments), each one a send() and, with TCP_NODELAY, a segment of
+ * its own. This plugin gathers the pieces in a buffer kept by the worker and
+ * writes the response with a single sendmsg() when gSOAP reads the next
+ * request or closes the connection. A piece too large to be worth copying is
+ * sent straight from the caller together with the gathered bytes in one
+ * vectored sendmsg(); a response larger than the buffer is written in several
+ * parts with TCP_CORK set until its end, so only full segments leave early.
+ * TCP_NODELAY is set on the connection so the last partial segment of a
+ * response never waits for the acknowledgement of the previous one.
+ *
+ * TLS and io_uring connections are gathered the same way and flushed through
+ * the underlying fsend, as one SSL_write() or one io_uring send.
+ *
+ * There is no MSG_ZEROCOPY. The pages sent must stay untouched until the
+ * kernel reports them done on the error queue, which on TCP is after the
+ * peer acknowledged them. gSOAP reuses its buffer as soon as fsend returns,
+ * so a zero-copy send would have to wait for that round trip. The SOAP
+ * responses are a few kilobytes, well below the size where skipping the
+ * copy pays for the page pinning and the completion handling.
+ ******************************************************************************/
+class VectoredSend
+{
+  public:
+    static char const *const g_pluginId;
+
+    // true if the context now gathers its output
+    static bool attach(struct soap *soap, ServiceMetrics *metrics);
+};
+
+
+#endif // VECTORED_SEND_HPP
@@ -46,6 +46,26 @@
 #include <sys/ioctl.h>
 
 #include "eth_dev_param.h"
+#include "RtNetlink.hpp"
+
+
+
+
+
+static int apply(const RtNetlink::Change &change)
+{
+    if( !change.index )
+        return -1;
+
+
+    RtNetlink netlink;
+
+    if( netlink.apply(change) != 0 )
+        return -1;
+
+
+    return 0;  //good job
+}
 
 
 
@@ -120,16 +140,13 @@ int Eth_Dev_Param::set_ip(const char *IP)
         return -1;
 
 
-    struct sockaddr_in* addr = (struct sockaddr_in*)&_ifr.ifr_addr;
-
-    memset(addr, 0, sizeof( struct sockaddr_in) );
-    addr->sin_family  = AF_INET;
+    struct in_addr in;
 
-    if( inet_pton(AF_INET, IP, &addr->sin_addr) <= 0 )
+    if( inet_pton(AF_INET, IP, &in) <= 0 )
         return -1;
 
 
-    return ioctl(_sd, SIOCSIFADDR, &_ifr);
+    return set_ip(in.s_addr);
 }
 
 
@@ -140,14 +157,15 @@ int Eth_Dev_Param::set_ip(uint32_t IP)
         return -1;
 
 
-    struct sockaddr_in* addr = (struct sockaddr_in*)&_ifr.ifr_addr;
+    // keeps the prefix of the current address, /32 on a link without one
+    int prefix = get_mask_prefix();
 
-    memset(addr, 0, sizeof( struct sockaddr_in) );
-    addr->sin_family      = AF_INET;
-    addr->sin_addr.s_addr = IP;
+    RtNetlink::Change change;
+    change.index = get_index();
+    change.ipv4  = RtNetlink::Address4{IP, prefix ? prefix : 32};
 
 
-    return ioctl(_sd, SIOCSIFADDR, &_ifr);
+    return apply(change);
 }
 
 
@@ -179,7 +197,7 @@ int Eth_Dev_Param::get_ip(uint32_t *IP) const
         return -1;
 
 
-    if( ioctl(_sd, SIOCGIFDSTADDR, &_ifr) != 0 )
+    if( ioctl(_sd, SIOCGIFADDR, &_ifr) != 0 )
         return -1;
 
     struct sockaddr_in* addr = (struct sockaddr_in*)&_ifr.ifr_addr;
@@ -198,16 +216,13 @@ int Eth_Dev_Param::set_mask(const char *mask)
         return -1;
 
 
-    struct sockaddr_in* addr = (struct sockaddr_in*)&_ifr.ifr_addr;
-
-    memset(addr, 0, sizeof( struct sockaddr_in) );
-    addr->sin_family  = AF_INET;
+    struct in_addr in;
 
-    if( inet_pton(AF_INET, mask, &addr->sin_addr) <= 0 )
+    if( inet_pton(AF_INET, mask, &in) <= 0 )
         return -1;
 
 
-    return ioctl(_sd, SIOCSIFNETMASK, &_ifr);
+    return set_mask(in.s_addr);
 }
 
 
@@ -218,14 +233,23 @@ int Eth_Dev_Param::set_mask(uint32_t mask)
         return -1;
 
 
-    struct sockaddr_in* addr = (struct sockaddr_in*)&_ifr.ifr_addr;
+    uint32_t IP;
+
+    if( get_ip(&IP) != 0 )
+        return -1;
+
+
+    int prefix = 0;
+    for(uint32_t bits = ntohl(mask); bits != 0; bits <<= 1)
+        prefix++;
+
 
-    memset(addr, 0, sizeof( struct sockaddr_in) );
-    addr->sin_family      = AF_INET;
-    addr->sin_addr.s_addr = mask;
+    RtNetlink::Change change;
+    change.index = get_index();
+    change.ipv4  = RtNetlink::Address4{IP, prefix};
 
 
-    return ioctl(_sd, SIOCSIFNETMASK, &_ifr);
+    return apply(change);
 }
 
 
@@ -274,7 +298,9 @@ int Eth_Dev_Param::get_mask_prefix() const
 {
     int prefix = 0;
     uint32_t mask;
-    get_mask(&mask);
+
+    if( get_mask(&mask) != 0 )
+        return 0;
 
     mask = ntohl(mask);
 
@@ -294,12 +320,14 @@ int Eth_Dev_Param::set_gateway(const char *gateway)
     if( !is_open() || !gateway )
         return -1;
 
-    char cmd[64];
 
+    struct in_addr in;
+
+    if( inet_pton(AF_INET, gateway, &in) <= 0 )
+        return -1;
 
-    sprintf(cmd, "route add %s %s", gateway, _ifr.ifr_name);
 
-    return run_shell_cmd(cmd);
+    return set_gateway(in.s_addr);
 }
 
 
@@ -309,15 +337,13 @@ int Eth_Dev_Param::set_gateway(uint32_t gateway)
     if( !is_open() )
         return -1;
 
-    char cmd[64];
-
-    struct in_addr in;
-    in.s_addr = gateway;
 
+    RtNetlink::Change change;
+    change.index   = get_index();
+    change.gateway = gateway;
 
-    sprintf(cmd, "route add %s %s", inet_ntoa(in), _ifr.ifr_name);
 
-    return run_shell_cmd(cmd);
+    return apply(change);
 }
 
 
@@ -353,49 +379,24 @@ int Eth_Dev_Param::get_gateway(uint32_t *gateway) const
         return -1;
 
 
-    char devname[64];
-    unsigned long d, g, m;
-    int flgs, ref, use, metric, mtu, win, ir;
-
-
-    FILE *fp = fopen("/proc/net/route", "r");
+    RtNetlink netlink;
+    std::vector<RtNetlink::Link> links;
 
-    if( !fp )
-        return -1; //can't open file
-
-
-    if( fscanf(fp, "%*[^\n]\n") < 0 ) // Skip the first line
-    {
-        fclose(fp);
-        return -1;   // Empty or missing line, or read error
-    }
+    if( !netlink.dump(links) )
+        return -1;
 
 
-    while( !feof(fp) )
+    for(const RtNetlink::Link &link : links)
     {
-        int r;
-        r = fscanf(fp, "%63s%lx%lx%X%d%d%d%lx%d%d%d\n",
-                   devname, &d, &g, &flgs, &ref, &use, &metric, &m, &mtu, &win, &ir);
-
-
-        if (r != 11)
-        {
-            fclose(fp);
-            return -1;
-        }
-
-        if( strcmp(devname, _ifr.ifr_name) != 0 )
+        if( link.name != _ifr.ifr_name || !link.gateway )
             continue;
 
-        fclose(fp);
-        *gateway = g;
-
+        *gateway = link.gateway;
         return 0; //good job
     }
 
 
-    fclose(fp);
-    return -1; //can't finde
+    return -1; //no default route through the interface
 }
 
 
@@ -410,16 +411,17 @@ int Eth_Dev_Param::set_hwaddr(const char *hwaddr)
     int tmp_mac[6]; // int for sscanf!!!
 
 
-    sscanf(hwaddr, "%x:%x:%x:%x:%x:%x", &tmp_mac[0], &tmp_mac[1], &tmp_mac[2], &tmp_mac[3], &tmp_mac[4], &tmp_mac[5]);
+    if( sscanf(hwaddr, "%x:%x:%x:%x:%x:%x", &tmp_mac[0], &tmp_mac[1], &tmp_mac[2], &tmp_mac[3], &tmp_mac[4], &tmp_mac[5]) != 6 )
+        return -1;
 
 
-    _ifr.ifr_hwaddr.sa_family = ARPHRD_ETHER;
+    uint8_t mac[6];
 
     for(int i = 0; i < 6; i++)
-        _ifr.ifr_hwaddr.sa_data[i] = tmp_mac[i];
+        mac[i] = tmp_mac[i];
 
 
-    return ioctl(_sd, SIOCSIFHWADDR, &_ifr);
+    return set_hwaddr(mac);
 }
 
 
@@ -430,22 +432,17 @@ int Eth_Dev_Param::set_hwaddr(const uint8_t *hwaddr)
         return -1;
 
 
-    _ifr.ifr_hwaddr.sa_family = ARPHRD_ETHER;
-    memcpy(_ifr.ifr_hwaddr.sa_data, hwaddr, 6);
-
-
-    char cmd[32];
+    RtNetlink::HwAddress mac;
+    memcpy(mac.data(), hwaddr, mac.size());
 
-    sprintf(cmd, "ifconfig %s down", dev_name());
-    run_shell_cmd(cmd);
 
-    int ret = ioctl(_sd, SIOCSIFHWADDR, &_ifr);
+    // down, new address and up again in one netlink batch
+    RtNetlink::Change change;
+    change.index  = get_index();
+    change.hwaddr = mac;
 
-    sprintf(cmd, "ifconfig %s up", dev_name());
-    run_shell_cmd(cmd);
 
-
-    return ret;
+    return apply(change);
 }
 
 
@@ -498,22 +495,11 @@ int Eth_Dev_Param::get_hwaddr(uint8_t *hwaddr) const
 
 
 
-int Eth_Dev_Param::run_shell_cmd(const char *cmd) const
+unsigned int Eth_Dev_Param::get_index() const
 {
-    FILE *ptr;
-
-    if(!cmd)
-        return -1;
-
-
-    ptr = popen(cmd, "w");
-    if(!ptr)
-        return -1;
-
-
-    if(pclose(ptr)<0)
-        return -1;
+    if( !is_open() )
+        return 0;
 
 
-    return 0;  //good job
+    return if_nametoindex(_ifr.ifr_name);
 }
@@ -41,6 +41,17 @@
 
 #include <stdint.h>
 #include <net/if.h>
+#include <netinet/in.h>
+
+
+
+
+
+struct Eth_IPv6_Addr
+{
+    struct in6_addr addr;
+    int             prefix;
+};
 
 
 
@@ -89,12 +100,13 @@ class Eth_Dev_Param
         int get_hwaddr(uint8_t *hwaddr) const;
 
 
+        unsigned int get_index() const;
+
+
     private:
         int          _sd;
         bool         _opened;
         struct ifreq _ifr;
-
-        int run_shell_cmd(const char *cmd) const;
 };
 
 
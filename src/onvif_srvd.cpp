@@ -9,11 +9,25 @@
 #include <stdlib.h>
 #include <string>
 #include <unistd.h>
+#include <algorithm>
+#include <chrono>
 #include <list>
+#include <memory>
+#include <vector>
 
 #include "ConfigLoader.hpp"
 #include "Configuration.hpp"
 #include "GSoapService.hpp"
+#include "ListenSockets.hpp"
+#include "MqttLoop.hpp"
+#include "NetworkState.hpp"
+#include "PresetTourEngine.hpp"
+#include "PtzCommandPipeline.hpp"
+#include "PtzMoveController.hpp"
+#include "PtzPositionFile.hpp"
+#include "RunLoopWorker.hpp"
+#include "ShellCoprocess.hpp"
+#include "Supervisor.hpp"
 #include "armoury/ThreadWarden.hpp"
 #include "daemon.hpp"
 #include "rtsp-streams.hpp"
@@ -21,6 +35,22 @@
 #include "DeviceBinding.nsmap"
 
 
+namespace
+{
+constexpr char g_networkWatchName[]{"networkWatch"};
+constexpr char g_presetToursName[]{"presetTours"};
+constexpr char g_ptzCommandsName[]{"ptzCommands"};
+constexpr char g_ptzMoveLoopName[]{"ptzMoveLoop"};
+constexpr char g_ptzPositionWatchName[]{"ptzPositionWatch"};
+
+using NetworkWatch = RunLoopWorker<NetworkState, &NetworkState::poll, g_networkWatchName>;
+using PresetTourWorker = RunLoopWorker<PresetTourEngine, &PresetTourEngine::run, g_presetToursName>;
+using PtzCommandWorker = RunLoopWorker<PtzCommandPipeline, &PtzCommandPipeline::run, g_ptzCommandsName>;
+using PtzMoveWorker = RunLoopWorker<PtzMoveController, &PtzMoveController::run, g_ptzMoveLoopName>;
+using PtzPositionWatch = RunLoopWorker<PtzPositionFile, &PtzPositionFile::poll, g_ptzPositionWatchName>;
+} // namespace
+
+
 void processing_cfg(Configuration const &configStruct, ServiceContext &service_ctx, RTSPStream &rtspStreams, Daemon &onvifDaemon)
 {
     // New function to handle config file
@@ -43,6 +73,10 @@ void processing_cfg(Configuration const &configStruct, ServiceContext &service_c
 
     // ONVIF Service Options
     service_ctx.port = configStruct.port;
+    service_ctx.soap_io_uring = configStruct.soapIoUring;
+    service_ctx.soap_gather_send = configStruct.soapGatherSend;
+    service_ctx.unix_socket = configStruct.unixSocket;
+    service_ctx.https_port = configStruct.httpsPort;
     service_ctx.user = configStruct.user.c_str();
     service_ctx.password = configStruct.password.c_str();
     service_ctx.manufacturer = configStruct.manufacturer.c_str();
@@ -56,13 +90,111 @@ void processing_cfg(Configuration const &configStruct, ServiceContext &service_c
         service_ctx.scopes.push_back(it->scopeUri);
     }
 
-    service_ctx.eth_ifs.push_back(Eth_Dev_Param());
-    if (service_ctx.eth_ifs.back().open(configStruct.interfaces.c_str()) != 0)
-        onvifDaemon.daemon_error_exit("Can't open ethernet interface: %s - %m\n", configStruct.interfaces.c_str());
+    for (std::string const &interface : configStruct.interfaces)
+    {
+        service_ctx.eth_ifs.push_back(Eth_Dev_Param());
+        if (service_ctx.eth_ifs.back().open(interface.c_str()) != 0)
+            onvifDaemon.daemon_error_exit("Can't open ethernet interface: %s - %m\n", interface.c_str());
+    }
+
+    if (configStruct.httpsPort > 0)
+    {
+        service_ctx.tls = std::make_shared<TlsContext>(configStruct.httpsCertificate, configStruct.httpsKey);
+        if (!service_ctx.tls->load())
+            onvifDaemon.daemon_error_exit("Can't load TLS certificate: %s\n", configStruct.httpsCertificate.c_str());
+    }
+
+    if (configStruct.httpCompression)
+        service_ctx.compression =
+            std::make_shared<ResponseCompression>(std::max(configStruct.compressionThreshold, 0), service_ctx.metrics);
 
     if (!service_ctx.set_tz_format(configStruct.tz_format.c_str()))
         onvifDaemon.daemon_error_exit("Can't set tz_format: %s\n", service_ctx.get_cstr_err());
 
+    // PTZ
+    if (configStruct.ptz)
+    {
+        PTZNode *ptz_node = service_ctx.get_ptz_node();
+        ptz_node->enable = true;
+        ptz_node->set_move_left(configStruct.ptzMoveLeft.c_str());
+        ptz_node->set_move_right(configStruct.ptzMoveRight.c_str());
+        ptz_node->set_move_up(configStruct.ptzMoveUp.c_str());
+        ptz_node->set_move_down(configStruct.ptzMoveDown.c_str());
+        ptz_node->set_move_stop(configStruct.ptzMoveStop.c_str());
+        ptz_node->set_move_preset(configStruct.ptzMovePreset.c_str());
+        ptz_node->set_set_preset(configStruct.ptzSetPreset.c_str());
+        ptz_node->set_zoom_in(configStruct.ptzZoomIn.c_str());
+        ptz_node->set_zoom_out(configStruct.ptzZoomOut.c_str());
+        ptz_node->set_zoom_stop(configStruct.ptzZoomStop.c_str());
+        if (!ptz_node->set_speeds(configStruct.ptzSpeeds))
+            onvifDaemon.daemon_error_exit("Can't set ptz_speeds: %s\n", ptz_node->get_cstr_err());
+        if (!ptz_node->set_max_presets(configStruct.ptzMaxPresets))
+            onvifDaemon.daemon_error_exit("Can't set ptz_max_presets: %s\n", ptz_node->get_cstr_err());
+
+        service_ctx.presets = std::make_shared<PresetStore>(
+            configStruct.ptzPresetJournal, ptz_node->get_max_presets(), ptz_node->get_move_preset());
+        if (!service_ctx.presets->load())
+            onvifDaemon.daemon_error_exit("Can't load PTZ presets: %s\n", service_ctx.presets->get_str_err().c_str());
+
+        PtzState::Limits limits;
+        limits.min = {configStruct.ptzPanLimits[0], configStruct.ptzTiltLimits[0], configStruct.ptzZoomLimits[0]};
+        limits.max = {configStruct.ptzPanLimits[1], configStruct.ptzTiltLimits[1], configStruct.ptzZoomLimits[1]};
+        if (!limits.valid())
+            onvifDaemon.daemon_error_exit("Can't set PTZ limits: outside the generic position spaces\n");
+
+        service_ctx.ptz_state = std::make_shared<PtzState>(
+            PtzState::Vector{configStruct.ptzPanTiltRate, configStruct.ptzPanTiltRate, configStruct.ptzZoomRate}, limits,
+            !configStruct.ptzPositionFile.empty());
+        std::shared_ptr<PtzState> state = service_ctx.ptz_state;
+
+        if (configStruct.ptzCommandTimeout <= 0)
+            onvifDaemon.daemon_error_exit("Can't set ptz_command_timeout: must be positive\n");
+
+        // the commands run in one shell, only the actuator thread of the pipeline uses it
+        PTZNode const node = *ptz_node;
+        auto shell = std::make_shared<ShellCoprocess>(configStruct.ptzCommandTimeout);
+        PtzCommandPipeline::Backend backend;
+        backend.quantize = [node](PtzState::Vector const &velocity) { return node.quantize(velocity); };
+        backend.commands = [node](PtzState::Vector const &from, PtzState::Vector const &to) {
+            return node.velocity_commands(from, to);
+        };
+        backend.stop = node.stop_commands();
+        backend.write = [shell](std::string const &command) { return shell->run(command); };
+        service_ctx.ptz_commands = std::make_shared<PtzCommandPipeline>(state, backend, service_ctx.metrics);
+
+        std::shared_ptr<PtzCommandPipeline> commands = service_ctx.ptz_commands;
+        service_ctx.ptz_moves = std::make_shared<PtzMoveController>(
+            state,
+            [commands](PtzState::Vector const &velocity) {
+                return commands->move(velocity, PtzCommandPipeline::Clock::now());
+            },
+            !configStruct.ptzPositionFile.empty(), node.has_zoom());
+
+        std::shared_ptr<PresetStore> presets = service_ctx.presets;
+        std::shared_ptr<PtzMoveController> moves = service_ctx.ptz_moves;
+        service_ctx.tours = std::make_shared<PresetTourEngine>(
+            presets, [presets, commands, moves, node](PresetStore::TourSpot const &spot) {
+                float const *speed = spot.speed ? &*spot.speed : nullptr;
+                std::string cmd;
+                std::optional<PtzState::Vector> target;
+                if (spot.preset.empty())
+                {
+                    // the home position of the tours, as GotoHomePosition moves there
+                    cmd = node.home_command(speed);
+                    target = PtzState::Vector{};
+                }
+                else if (PresetStore::PresetPtr preset = presets->find(spot.preset))
+                {
+                    cmd = node.preset_command(preset->command, speed);
+                    if (preset->position)
+                        target = PtzState::Vector{preset->position->pan, preset->position->tilt,
+                                                  preset->position->zoom};
+                }
+                moves->cancel();
+                commands->moveTo(cmd, target, PtzCommandPipeline::Clock::now());
+            });
+    }
+
     DEBUG_MSG("Configured Service\n");
 
     // Onvif Media Profiles
@@ -75,6 +207,17 @@ void processing_cfg(Configuration const &configStruct, ServiceContext &service_c
         profile.set_snapurl(it->snapUrl.c_str());
         profile.set_type(it->type.c_str());
 
+        // the RTSP stream serving the profile is the one its url points at (":tcpPort/rtspUrl")
+        for (auto const &stream : configStruct.rtspStreams)
+        {
+            std::string const suffix = ":" + stream.tcpPort + stream.rtspUrl;
+            if (it->url.size() >= suffix.size() &&
+                it->url.compare(it->url.size() - suffix.size(), suffix.size(), suffix) == 0)
+            {
+                profile.set_stream(stream.rtspUrl.c_str());
+            }
+        }
+
         if (!service_ctx.add_profile(profile))
             onvifDaemon.daemon_error_exit("Can't add Profile: %s\n", service_ctx.get_cstr_err());
 
@@ -91,6 +234,8 @@ void processing_cfg(Configuration const &configStruct, ServiceContext &service_c
         rtspConfig.set_rtspUrl(it->rtspUrl.c_str());
         rtspConfig.set_testStream(it->testStream);
         rtspConfig.set_testStreamSrc(it->testStreamSrc.c_str());
+        if (!rtspConfig.set_warm(it->warm.c_str()))
+            onvifDaemon.daemon_error_exit("Can't set warm: %s\n", rtspConfig.get_cstr_err());
 
         if (!rtspStreams.AddStream(rtspConfig))
             onvifDaemon.daemon_error_exit("Can't add Stream: %s\n", rtspStreams.get_cstr_err());
@@ -98,11 +243,19 @@ void processing_cfg(Configuration const &configStruct, ServiceContext &service_c
         DEBUG_MSG("configured Media Profile %s\n", rtspConfig.get_rtspUrl().c_str());
         rtspConfig.clear();
     }
+
+    service_ctx.update_endpoints();
+
+    // addresses changed by DHCP or any other tool change the XAddrs as well
+    service_ctx.network->setOnChange([&service_ctx] { service_ctx.update_endpoints(); });
 }
 
 int main()
 {
+    // before any thread exists, termination signals are read by the supervisor
+    Supervisor::blockSignals();
     arms::signals::registerThreadInterruptSignal();
+    ListenSockets::inherit();
 
     std::optional<std::string> const configFile{arms::files::findConfigFile("/etc/onvif_srvd/config.cfg")};
     Configuration const configStruct{configFile};
@@ -111,7 +264,6 @@ int main()
     Daemon onvifDaemon;
 
     std::list<GStreamerRTSP> listOfStreams;
-    arms::signals::registerThreadInterruptSignal();
 
     DEBUG_MSG("processing_cfg\n");
     processing_cfg(configStruct, service_ctx, rtspStreams, onvifDaemon);
@@ -123,28 +275,213 @@ int main()
                                onvifDaemon.GetDaemonInfo().get_logFileCount());
     arms::log<arms::LOG_INFO>("Logging Enabled");
 
+    Supervisor supervisor{service_ctx.metrics};
+
     auto addedStreams = rtspStreams.get_streams();
     arms::log<arms::LOG_INFO>("Found {} Streams", addedStreams.size());
 
-    // Create a thread for each stream and store it in a list
+    // Create a main loop for each stream, run and restarted by the supervisor
     for( auto it = addedStreams.cbegin(); it != addedStreams.cend(); ++it )
     {
-        listOfStreams.emplace_back(it->second);
+        listOfStreams.emplace_back(it->second, service_ctx.metrics);
+        GStreamerRTSP &stream = listOfStreams.back();
+        service_ctx.stream_controls[it->first] = stream.getControl();
+
+        size_t id = supervisor.add("rtsp:" + it->first, {[&stream] { stream.start(); },
+                                                          [&stream] { stream.stop(); }, {}});
+        stream.setExitNotifier(supervisor.notifier(id));
+    }
+
+    arms::ThreadWarden<MqttLoop> mqttLoop;
+    size_t mqttId = 0;
+    {
+        mqttId = supervisor.add("mqtt", {[&mqttLoop] { mqttLoop.start(); }, [&mqttLoop] { mqttLoop.stop(); },
+                                         [&mqttLoop] { return mqttLoop.checkAndRestartOnFailure(); }});
+
+        auto [locked] = arms::makeLocked<arms::WriteLock>(mqttLoop.inputData);
+        assert(locked);
+        locked->mosq = service_ctx.mosq;
+        locked->onFailure = supervisor.notifier(mqttId);
+    }
+
+    // keeps the network snapshot of the Get handlers current
+    arms::ThreadWarden<NetworkWatch> networkWatch;
+    {
+        size_t id = supervisor.add("network", {[&networkWatch] { networkWatch.start(); },
+                                               [&networkWatch] { networkWatch.stop(); },
+                                               [&networkWatch] { return networkWatch.checkAndRestartOnFailure(); }});
+
+        auto [locked] = arms::makeLocked<arms::WriteLock>(networkWatch.inputData);
+        assert(locked);
+        locked->loop = service_ctx.network;
+        locked->onFailure = supervisor.notifier(id);
+    }
+
+    // the timer thread of the preset tours
+    arms::ThreadWarden<PresetTourWorker> presetTours;
+    if (service_ctx.tours)
+    {
+        size_t id = supervisor.add("ptzTours", {[&presetTours] { presetTours.start(); },
+                                                [&presetTours] { presetTours.stop(); },
+                                                [&presetTours] { return presetTours.checkAndRestartOnFailure(); }});
+
+        auto [locked] = arms::makeLocked<arms::WriteLock>(presetTours.inputData);
+        assert(locked);
+        locked->loop = service_ctx.tours;
+        locked->onFailure = supervisor.notifier(id);
+
+        service_ctx.tours->autoStart(PTZNode::node_token);
     }
 
-    arms::ThreadWarden<GSoapInstance, ServiceContext> gSoapInstance{service_ctx};
-    gSoapInstance.start();
+    // writes the commands of the PTZ handlers to the backend
+    arms::ThreadWarden<PtzCommandWorker> ptzCommands;
+    if (service_ctx.ptz_commands)
+    {
+        size_t id = supervisor.add("ptzCommands", {[&ptzCommands] { ptzCommands.start(); },
+                                                   [&ptzCommands] { ptzCommands.stop(); },
+                                                   [&ptzCommands] { return ptzCommands.checkAndRestartOnFailure(); }});
+
+        auto [locked] = arms::makeLocked<arms::WriteLock>(ptzCommands.inputData);
+        assert(locked);
+        locked->loop = service_ctx.ptz_commands;
+        locked->onFailure = supervisor.notifier(id);
+    }
+
+    // the control loop of AbsoluteMove
+    arms::ThreadWarden<PtzMoveWorker> ptzMoves;
+    if (service_ctx.ptz_moves)
+    {
+        size_t id = supervisor.add("ptzMoves", {[&ptzMoves] { ptzMoves.start(); },
+                                                [&ptzMoves] { ptzMoves.stop(); },
+                                                [&ptzMoves] { return ptzMoves.checkAndRestartOnFailure(); }});
 
-    bool failVal = false;
+        auto [locked] = arms::makeLocked<arms::WriteLock>(ptzMoves.inputData);
+        assert(locked);
+        locked->loop = service_ctx.ptz_moves;
+        locked->onFailure = supervisor.notifier(id);
+    }
 
-    while(!failVal)
+    // position feedback of the PTZ backend, GetStatus dead-reckons without
+    arms::ThreadWarden<PtzPositionWatch> ptzPositionWatch;
+    if (service_ctx.ptz_state && !configStruct.ptzPositionFile.empty())
     {
-        failVal = gSoapInstance.checkAndRestartOnFailure();
-        sleep(1);
+        size_t id = supervisor.add("ptzPosition", {[&ptzPositionWatch] { ptzPositionWatch.start(); },
+                                                   [&ptzPositionWatch] { ptzPositionWatch.stop(); },
+                                                   [&ptzPositionWatch] { return ptzPositionWatch.checkAndRestartOnFailure(); }});
+
+        auto [locked] = arms::makeLocked<arms::WriteLock>(ptzPositionWatch.inputData);
+        assert(locked);
+        locked->loop = std::make_shared<PtzPositionFile>(configStruct.ptzPositionFile, service_ctx.ptz_state);
+        locked->onFailure = supervisor.notifier(id);
     }
 
-    gSoapInstance.stop();
+    // every instance copies the context, so shard and notifier have to be set first
+    using GSoapWarden = arms::ThreadWarden<GSoapInstance, ServiceContext>;
+    std::list<std::unique_ptr<GSoapWarden>> gSoapInstances;
+    std::vector<size_t> soapIds;
+
+    // the shards listen on all addresses, or on the address of every interface
+    std::vector<std::string> listenerInterfaces{""};
+    if (configStruct.interfaceListeners)
+        listenerInterfaces = configStruct.interfaces;
+
+    // plain HTTP, HTTPS or both
+    std::vector<bool> listenerTls;
+    if (configStruct.port > 0)
+        listenerTls.push_back(false);
+    if (configStruct.httpsPort > 0)
+        listenerTls.push_back(true);
+
+    int const shards = std::max(configStruct.soapShards, 1);
+    for (bool const tls : listenerTls)
+    {
+        for (std::string const &interface : listenerInterfaces)
+        {
+            for (int shard = 0; shard < shards; ++shard)
+            {
+                std::unique_ptr<GSoapWarden> &instance = gSoapInstances.emplace_back();
+
+                std::string name = tls ? "soaps" : "soap";
+                if (!interface.empty())
+                    name += "@" + interface;
+                if (shards > 1)
+                    name += ":" + std::to_string(shard);
+
+                Supervisor::Actions actions{[&instance] { instance->start(); }, [&instance] { instance->stop(); },
+                                            [&instance] { return instance->checkAndRestartOnFailure(); }};
+                size_t id = supervisor.add(name, std::move(actions));
+                soapIds.push_back(id);
+
+                ServiceContext shard_ctx = service_ctx;
+                shard_ctx.listener_https = tls;
+                shard_ctx.listener_shard = shards > 1 ? shard : -1;
+                shard_ctx.listener_affinity = configStruct.soapShardAffinity;
+                shard_ctx.listener_interface = interface;
+                shard_ctx.on_listener_failure = supervisor.notifier(id);
+                instance = std::make_unique<GSoapWarden>(shard_ctx);
+            }
+        }
+    }
+
+    // same bindings on the unix socket for co-located clients
+    if (!service_ctx.unix_socket.empty())
+    {
+        std::unique_ptr<GSoapWarden> &instance = gSoapInstances.emplace_back();
+
+        Supervisor::Actions actions{[&instance] { instance->start(); }, [&instance] { instance->stop(); },
+                                    [&instance] { return instance->checkAndRestartOnFailure(); }};
+        size_t id = supervisor.add("soap:unix", std::move(actions));
+        soapIds.push_back(id);
+
+        ServiceContext local_ctx = service_ctx;
+        local_ctx.listener_unix = true;
+        local_ctx.on_listener_failure = supervisor.notifier(id);
+        instance = std::make_unique<GSoapWarden>(local_ctx);
+    }
+
+    // SIGUSR2: the new binary takes over the listening sockets once it is up
+    supervisor.onHandover([] {
+        pid_t child = ListenSockets::handover(std::chrono::seconds{10});
+        if (child < 0)
+            return false;
+
+        ListenSockets::notify(("MAINPID=" + std::to_string(child)).c_str());
+        return true;
+    });
+
+    supervisor.start();
+    ListenSockets::closeUnclaimed();
+    ListenSockets::ready();
+
+    int status = supervisor.run();
+
+    if (supervisor.handingOver())
+    {
+        // stop accepting, the SOAP request in flight is finished by stop(), the
+        // MQTT client id now belongs to the new binary
+        for (size_t id : soapIds)
+            supervisor.stop(id);
+        supervisor.stop(mqttId);
+        for (GStreamerRTSP &stream : listOfStreams)
+            stream.stopListening();
+
+        auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds{configStruct.drainTimeout};
+        auto connected = [&listOfStreams] {
+            size_t count = 0;
+            for (GStreamerRTSP const &stream : listOfStreams)
+                count += stream.clientCount();
+            return count;
+        };
+
+        arms::log<arms::LOG_INFO>("Draining {} RTSP clients", connected());
+        while (connected() && std::chrono::steady_clock::now() < deadline)
+            usleep(100000);
+    }
+
+    supervisor.stop();
+
+    service_ctx.CloseMqttComms();
     arms::log<arms::LOG_INFO>("Stopped");
 
-    return EXIT_FAILURE; // Error, normal exit from the main loop only through the signal handler.
+    return status;
 }
@@ -16,7 +16,11 @@
  * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
  * Boston, MA 02110-1301, USA.
  */
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
 #include <sstream>
+#include <unistd.h>
 
 #include "rtsp-streams.hpp"
 #include <armoury/logger.hpp>
@@ -117,6 +121,31 @@ bool RTSPStreamConfig::set_testStreamSrc(const char *new_val)
 }
 
 
+/*
+*  Access Functions for configuring streams
+*/
+bool RTSPStreamConfig::set_warm(const char *new_val)
+{
+    if(!new_val)
+    {
+        str_err = "warm is empty";
+        return false;
+    }
+
+
+    std::string mode = new_val;
+    if( !mode.empty() && mode != "prepared" && mode != "suspended" )
+    {
+        str_err = "warm must be \"prepared\" or \"suspended\": " + mode;
+        return false;
+    }
+
+
+    warm = mode;
+    return true;
+}
+
+
 /*
 *  Access Functions for configuring streams
 */
@@ -127,6 +156,7 @@ void RTSPStreamConfig::clear()
     tcpPort.clear();
     rtspUrl.clear();
     testStream = 0;
+    warm.clear();
 }
 
 
@@ -163,3 +193,1442 @@ bool RTSPStream::AddStream(const RTSPStreamConfig& stream)
 
 
 
+
+
+/*
+*  Helpers for reading and writing numeric element properties as doubles
+*/
+static bool has_property(GstElement *element, const char *property)
+{
+    return g_object_class_find_property(G_OBJECT_GET_CLASS(element), property) != NULL;
+}
+
+
+static bool read_property(GstElement *element, const char *property, PropertyValue &out)
+{
+    GParamSpec *spec = g_object_class_find_property(G_OBJECT_GET_CLASS(element), property);
+    if (!spec)
+        return false;
+
+    GValue raw = G_VALUE_INIT;
+    GValue value = G_VALUE_INIT;
+    g_value_init(&raw, spec->value_type);
+    g_value_init(&value, G_TYPE_DOUBLE);
+
+    g_object_get_property(G_OBJECT(element), property, &raw);
+    bool ok = g_value_transform(&raw, &value);
+    if (ok)
+        out.value = g_value_get_double(&value);
+
+    if (G_IS_PARAM_SPEC_DOUBLE(spec))
+    {
+        out.min = G_PARAM_SPEC_DOUBLE(spec)->minimum;
+        out.max = G_PARAM_SPEC_DOUBLE(spec)->maximum;
+    }
+    else if (G_IS_PARAM_SPEC_FLOAT(spec))
+    {
+        out.min = G_PARAM_SPEC_FLOAT(spec)->minimum;
+        out.max = G_PARAM_SPEC_FLOAT(spec)->maximum;
+    }
+    else if (G_IS_PARAM_SPEC_UINT(spec))
+    {
+        out.min = G_PARAM_SPEC_UINT(spec)->minimum;
+        out.max = G_PARAM_SPEC_UINT(spec)->maximum;
+    }
+    else if (G_IS_PARAM_SPEC_INT(spec))
+    {
+        out.min = G_PARAM_SPEC_INT(spec)->minimum;
+        out.max = G_PARAM_SPEC_INT(spec)->maximum;
+    }
+
+    out.available = ok;
+
+    g_value_unset(&value);
+    g_value_unset(&raw);
+    return ok;
+}
+
+
+static bool write_property(GstElement *element, const char *property, double new_val)
+{
+    GParamSpec *spec = g_object_class_find_property(G_OBJECT_GET_CLASS(element), property);
+    if (!spec || !(spec->flags & G_PARAM_WRITABLE))
+        return false;
+
+    GValue raw = G_VALUE_INIT;
+    GValue value = G_VALUE_INIT;
+    g_value_init(&raw, spec->value_type);
+    g_value_init(&value, G_TYPE_DOUBLE);
+    g_value_set_double(&value, new_val);
+
+    bool ok = g_value_transform(&value, &raw);
+    if (ok)
+    {
+        g_param_value_validate(spec, &raw); // clamp to the element range
+        g_object_set_property(G_OBJECT(element), property, &raw);
+    }
+
+    g_value_unset(&value);
+    g_value_unset(&raw);
+    return ok;
+}
+
+
+/*
+*  Property names used by the common H.264 encoders for the key frame interval
+*/
+static const char *const gop_properties[] = {"key-int-max", "gop-size", "keyframe-period", "iframeinterval"};
+
+
+static const char *find_gop_property(GstElement *encoder)
+{
+    for (const char *property : gop_properties)
+    {
+        if (has_property(encoder, property))
+            return property;
+    }
+    return NULL;
+}
+
+
+/*
+*  The capsfilter forcing the raw video format in front of the encoder,
+*  e.g. "videoscale ! videorate ! video/x-raw,width=1024,height=768,framerate=25/1"
+*/
+static bool is_raw_video_filter(GstElement *element)
+{
+    GstElementFactory *factory = gst_element_get_factory(element);
+    if (!factory || g_strcmp0(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)), "capsfilter") != 0)
+        return false;
+
+    GstCaps *caps = NULL;
+    g_object_get(element, "caps", &caps, NULL);
+
+    bool raw = caps && gst_caps_get_size(caps) > 0 &&
+               gst_structure_has_name(gst_caps_get_structure(caps, 0), "video/x-raw");
+
+    if (caps)
+        gst_caps_unref(caps);
+    return raw;
+}
+
+
+static void read_format(GstElement *filter, VideoFormat &out)
+{
+    GstCaps *caps = NULL;
+    g_object_get(filter, "caps", &caps, NULL);
+    if (!caps)
+        return;
+
+    if (gst_caps_get_size(caps) > 0)
+    {
+        GstStructure *structure = gst_caps_get_structure(caps, 0);
+        int num = 0;
+        int den = 0;
+
+        gst_structure_get_int(structure, "width", &out.width);
+        gst_structure_get_int(structure, "height", &out.height);
+        if (gst_structure_get_fraction(structure, "framerate", &num, &den) && den > 0)
+            out.framerate = num / den;
+    }
+
+    gst_caps_unref(caps);
+}
+
+
+/*
+*  Current filter caps with the known fields of the format replaced
+*/
+static GstCaps *make_format_caps(GstElement *filter, VideoFormat const &format)
+{
+    GstCaps *current = NULL;
+    g_object_get(filter, "caps", &current, NULL);
+    if (!current)
+        return NULL;
+
+    GstCaps *caps = gst_caps_copy_nth(current, 0);
+    gst_caps_unref(current);
+
+    if (format.width > 0 && format.height > 0)
+        gst_caps_set_simple(caps, "width", G_TYPE_INT, format.width, "height", G_TYPE_INT, format.height, NULL);
+    if (format.framerate > 0)
+        gst_caps_set_simple(caps, "framerate", GST_TYPE_FRACTION, format.framerate, 1, NULL);
+
+    return caps;
+}
+
+
+/*
+*  Raw caps both the upstream elements can produce and the encoder accepts,
+*  the filter itself is left out so the answer is what it could be changed to
+*/
+static GstCaps *query_allowed_caps(GstElement *filter)
+{
+    GstPad *sink = gst_element_get_static_pad(filter, "sink");
+    GstPad *src = gst_element_get_static_pad(filter, "src");
+
+    GstCaps *upstream = gst_pad_peer_query_caps(sink, NULL);
+    GstCaps *downstream = gst_pad_peer_query_caps(src, NULL);
+    GstCaps *allowed = gst_caps_intersect(upstream, downstream);
+
+    gst_caps_unref(downstream);
+    gst_caps_unref(upstream);
+    gst_object_unref(src);
+    gst_object_unref(sink);
+    return allowed;
+}
+
+
+static void read_framerate_range(const GValue *rate, PropertyValue &out)
+{
+    const GValue *low = rate;
+    const GValue *high = rate;
+
+    if (GST_VALUE_HOLDS_FRACTION_RANGE(rate))
+    {
+        low = gst_value_get_fraction_range_min(rate);
+        high = gst_value_get_fraction_range_max(rate);
+    }
+    else if (!GST_VALUE_HOLDS_FRACTION(rate))
+        return;
+
+    if (gst_value_get_fraction_denominator(low) <= 0 || gst_value_get_fraction_denominator(high) <= 0)
+        return;
+
+    // "any framerate" is reported as 0/1 .. MAXINT/1, clients want a usable slider
+    double min = std::max(1, gst_value_get_fraction_numerator(low) / gst_value_get_fraction_denominator(low));
+    double max = std::min(120, gst_value_get_fraction_numerator(high) / gst_value_get_fraction_denominator(high));
+    if (min > max)
+        return;
+
+    out.min = out.available ? std::min(out.min, min) : min;
+    out.max = out.available ? std::max(out.max, max) : max;
+    out.available = true;
+}
+
+
+static void read_options(GstElement *filter, GstElement *encoder, EncoderOptions &out)
+{
+    static const VideoFormat common_sizes[] = {{1920, 1080}, {1280, 720}, {1024, 768}, {800, 600},
+                                               {704, 576},   {640, 480},  {352, 288},  {320, 240}};
+
+    if (filter)
+    {
+        GstCaps *allowed = query_allowed_caps(filter);
+
+        for (VideoFormat const &size : common_sizes)
+        {
+            GstCaps *caps = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT, size.width, "height",
+                                                G_TYPE_INT, size.height, NULL);
+            if (gst_caps_can_intersect(allowed, caps))
+                out.resolutions.push_back(size);
+            gst_caps_unref(caps);
+        }
+
+        for (guint i = 0; i < gst_caps_get_size(allowed); ++i)
+        {
+            const GValue *rate = gst_structure_get_value(gst_caps_get_structure(allowed, i), "framerate");
+            if (rate)
+                read_framerate_range(rate, out.framerate);
+        }
+
+        gst_caps_unref(allowed);
+    }
+
+    GstPad *src = encoder ? gst_element_get_static_pad(encoder, "src") : NULL;
+    if (src)
+    {
+        GstCaps *caps = gst_pad_get_pad_template_caps(src);
+        const GValue *profiles =
+            gst_caps_get_size(caps) > 0 ? gst_structure_get_value(gst_caps_get_structure(caps, 0), "profile") : NULL;
+
+        if (profiles && GST_VALUE_HOLDS_LIST(profiles))
+        {
+            for (guint i = 0; i < gst_value_list_get_size(profiles); ++i)
+            {
+                const GValue *profile = gst_value_list_get_value(profiles, i);
+                if (G_VALUE_HOLDS_STRING(profile))
+                    out.profiles.push_back(g_value_get_string(profile));
+            }
+        }
+        else if (profiles && G_VALUE_HOLDS_STRING(profiles))
+            out.profiles.push_back(g_value_get_string(profiles));
+
+        gst_caps_unref(caps);
+        gst_object_unref(src);
+    }
+}
+
+
+/*
+*  Copy the non default settings of an element to a fresh instance of it
+*/
+static void copy_properties(GstElement *from, GstElement *to)
+{
+    guint count = 0;
+    GParamSpec **specs = g_object_class_list_properties(G_OBJECT_GET_CLASS(from), &count);
+
+    for (guint i = 0; i < count; ++i)
+    {
+        GParamSpec *spec = specs[i];
+
+        // "name" and "parent" belong to GstObject and must stay unique
+        if (spec->owner_type == GST_TYPE_OBJECT || spec->owner_type == G_TYPE_OBJECT)
+            continue;
+        if ((spec->flags & G_PARAM_READWRITE) != G_PARAM_READWRITE || (spec->flags & G_PARAM_CONSTRUCT_ONLY))
+            continue;
+
+        GValue value = G_VALUE_INIT;
+        g_value_init(&value, spec->value_type);
+        g_object_get_property(G_OBJECT(from), spec->name, &value);
+
+        if (!g_param_value_defaults(spec, &value))
+            g_object_set_property(G_OBJECT(to), spec->name, &value);
+
+        g_value_unset(&value);
+    }
+
+    g_free(specs);
+}
+
+
+static void shutdown_element(GstElement *element, gpointer userData)
+{
+    (void)userData;
+    gst_element_set_state(element, GST_STATE_NULL);
+}
+
+
+
+/*
+*  StreamControl: live access to the elements of the running media
+*/
+StreamControl::StreamControl(std::string streamName)
+    : m_name{std::move(streamName)}
+{
+}
+
+
+void StreamControl::attach(GstRTSPMediaFactory *factory)
+{
+    g_signal_connect(factory, "media-configure", G_CALLBACK(onMediaConfigure), this);
+}
+
+
+StreamSnapshot StreamControl::getSnapshot() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_snapshot;
+}
+
+
+bool StreamControl::setBrightness(double value)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return setProperty(m_balance, "brightness", value, m_snapshot.brightness, m_pendingBrightness);
+}
+
+
+bool StreamControl::setContrast(double value)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return setProperty(m_balance, "contrast", value, m_snapshot.contrast, m_pendingContrast);
+}
+
+
+bool StreamControl::setSaturation(double value)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return setProperty(m_balance, "saturation", value, m_snapshot.saturation, m_pendingSaturation);
+}
+
+
+bool StreamControl::setBitrate(double kbps)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return setEncoderProperty("bitrate", kbps, m_snapshot.bitrate, m_pendingBitrate);
+}
+
+
+bool StreamControl::setGovLength(int frames)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // the property name is only known once an encoder has been seen
+    if (m_encoder.get() && !m_gopProperty)
+        return false;
+
+    return setEncoderProperty(m_gopProperty, frames, m_snapshot.govLength, m_pendingGovLength);
+}
+
+
+bool StreamControl::setFormat(VideoFormat const &format)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    VideoFormat wanted = m_snapshot.format;
+    if (format.width > 0 && format.height > 0)
+    {
+        wanted.width = format.width;
+        wanted.height = format.height;
+    }
+    if (format.framerate > 0)
+        wanted.framerate = format.framerate;
+
+    if (!m_media)
+    {
+        m_pendingFormat = wanted;
+        m_snapshot.format = wanted;
+        return true;
+    }
+
+    if (wanted.width == m_snapshot.format.width && wanted.height == m_snapshot.format.height &&
+        wanted.framerate == m_snapshot.format.framerate)
+        return true;
+
+    // nothing in the pipeline can scale or drop frames
+    if (!m_filter.get())
+        return false;
+
+    GstCaps *caps = make_format_caps(m_filter.get(), wanted);
+    if (!caps)
+        return false;
+
+    GstCaps *allowed = query_allowed_caps(m_filter.get());
+    bool ok = gst_caps_can_intersect(allowed, caps);
+    gst_caps_unref(allowed);
+
+    // the filter sends a reconfigure event upstream, the encoder follows the new caps
+    if (ok)
+    {
+        g_object_set(m_filter.get(), "caps", caps, NULL);
+        m_snapshot.format = wanted;
+        m_pendingFormat.reset();
+    }
+
+    gst_caps_unref(caps);
+    return ok;
+}
+
+
+/*
+*  Must be called with m_mutex held. Without a running media the value is
+*  kept as pending and applied by configure().
+*/
+bool StreamControl::setProperty(GObjWrapper<GstElement> const &element, const char *property, double value,
+                                PropertyValue &cached, std::optional<double> &pending)
+{
+    if (!element.get())
+    {
+        pending = value;
+        if (cached.available)
+            cached.value = std::min(std::max(value, cached.min), cached.max);
+        return true;
+    }
+
+    if (!write_property(element.get(), property, value))
+        return false;
+
+    pending.reset();
+    read_property(element.get(), property, cached);
+    return true;
+}
+
+
+/*
+*  Must be called with m_mutex held. Properties the encoder refuses to change
+*  while streaming are kept as pending and applied to a new encoder instance.
+*/
+bool StreamControl::setEncoderProperty(const char *property, double value, PropertyValue &cached,
+                                       std::optional<double> &pending)
+{
+    if (!m_encoder.get() || GST_STATE(m_encoder.get()) <= GST_STATE_READY)
+        return setProperty(m_encoder, property, value, cached, pending);
+
+    GParamSpec *spec = g_object_class_find_property(G_OBJECT_GET_CLASS(m_encoder.get()), property);
+    if (!spec || !(spec->flags & G_PARAM_WRITABLE))
+        return false;
+
+    if (spec->flags & GST_PARAM_MUTABLE_PLAYING)
+        return setProperty(m_encoder, property, value, cached, pending);
+
+    pending = value;
+    if (cached.available)
+        cached.value = std::min(std::max(value, cached.min), cached.max);
+
+    scheduleEncoderSwap();
+    return true;
+}
+
+
+/*
+*  Must be called with m_mutex held. Blocks the encoder input on the next
+*  buffer, swapEncoder() then replaces the element while no data is in flight.
+*/
+void StreamControl::scheduleEncoderSwap()
+{
+    if (m_swapPending)
+        return;
+
+    GstPad *sink = gst_element_get_static_pad(m_encoder.get(), "sink");
+    GstPad *input = sink ? gst_pad_get_peer(sink) : NULL;
+
+    if (input)
+    {
+        gst_pad_add_probe(input, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BLOCK | GST_PAD_PROBE_TYPE_BUFFER),
+                          onEncoderInputBlocked, this, NULL);
+        m_swapPending = true;
+        gst_object_unref(input);
+    }
+
+    if (sink)
+        gst_object_unref(sink);
+}
+
+
+GstPadProbeReturn StreamControl::onEncoderInputBlocked(GstPad *pad, GstPadProbeInfo *info, gpointer userData)
+{
+    (void)info;
+    static_cast<StreamControl *>(userData)->swapEncoder(pad);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+
+/*
+*  Runs in the streaming thread with the encoder input blocked. The blocked
+*  buffer goes to the new encoder once the probe is removed, which starts
+*  with a key frame, so clients only see a new SPS/PPS. Frames still held in
+*  the lookahead of the old encoder are dropped.
+*/
+void StreamControl::swapEncoder(GstPad *input)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_swapPending = false;
+
+    GstElement *old = m_encoder.get();
+    if (!old)
+        return;
+
+    GstPad *oldSink = gst_element_get_static_pad(old, "sink");
+    GstPad *oldSrc = gst_element_get_static_pad(old, "src");
+    GstPad *output = gst_pad_get_peer(oldSrc);
+    GstPad *peer = gst_pad_get_peer(oldSink);
+    GstObject *parent = gst_object_get_parent(GST_OBJECT(old));
+
+    // the probe belongs to the input of an encoder of an earlier media
+    if (peer != input || !output || !parent)
+    {
+        if (parent)
+            gst_object_unref(parent);
+        if (peer)
+            gst_object_unref(peer);
+        if (output)
+            gst_object_unref(output);
+        gst_object_unref(oldSrc);
+        gst_object_unref(oldSink);
+        return;
+    }
+
+    GstElement *fresh = gst_element_factory_create(gst_element_get_factory(old), NULL);
+    copy_properties(old, fresh);
+    applyEncoderPending(fresh);
+
+    gst_pad_unlink(input, oldSink);
+    gst_pad_unlink(oldSrc, output);
+
+    GObjWrapper<GstElement> retired = std::move(m_encoder);
+    gst_bin_remove(GST_BIN(parent), old);
+    gst_bin_add(GST_BIN(parent), fresh);
+
+    GstPad *freshSink = gst_element_get_static_pad(fresh, "sink");
+    GstPad *freshSrc = gst_element_get_static_pad(fresh, "src");
+    gst_pad_link(input, freshSink);
+    gst_pad_link(freshSrc, output);
+    gst_element_sync_state_with_parent(fresh);
+
+    // the old encoder may join its own threads while stopping, not from here
+    gst_element_call_async(retired.get(), shutdown_element, NULL, NULL);
+
+    m_encoder = GObjWrapper<GstElement>{GST_ELEMENT(gst_object_ref(fresh))};
+    read_property(fresh, "bitrate", m_snapshot.bitrate);
+    if (m_gopProperty)
+        read_property(fresh, m_gopProperty, m_snapshot.govLength);
+
+    arms::log<arms::LOG_INFO>("Stream {} encoder replaced to apply new settings", m_name);
+
+    gst_object_unref(freshSrc);
+    gst_object_unref(freshSink);
+    gst_object_unref(parent);
+    gst_object_unref(peer);
+    gst_object_unref(output);
+    gst_object_unref(oldSrc);
+    gst_object_unref(oldSink);
+}
+
+
+/*
+*  Must be called with m_mutex held, on an encoder that accepts every property
+*/
+void StreamControl::applyEncoderPending(GstElement *encoder)
+{
+    if (m_pendingBitrate)
+        write_property(encoder, "bitrate", *m_pendingBitrate);
+    if (m_pendingGovLength && m_gopProperty)
+        write_property(encoder, m_gopProperty, *m_pendingGovLength);
+
+    m_pendingBitrate.reset();
+    m_pendingGovLength.reset();
+}
+
+
+void StreamControl::onMediaConfigure(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer userData)
+{
+    (void)factory;
+    static_cast<StreamControl *>(userData)->configure(media);
+}
+
+
+void StreamControl::onMediaUnprepared(GstRTSPMedia *media, gpointer userData)
+{
+    static_cast<StreamControl *>(userData)->release(media);
+}
+
+
+void StreamControl::configure(GstRTSPMedia *media)
+{
+    GstElement *bin = gst_rtsp_media_get_element(media);
+    if (!bin)
+        return;
+
+    GObjWrapper<GstElement> balance;
+    GObjWrapper<GstElement> encoder;
+    GObjWrapper<GstElement> filter;
+
+    GstIterator *it = gst_bin_iterate_recurse(GST_BIN(bin));
+    GValue item = G_VALUE_INIT;
+
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+    {
+        GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+        GstElementFactory *elementFactory = gst_element_get_factory(element);
+
+        if (!balance.get() && has_property(element, "brightness") && has_property(element, "contrast") &&
+            has_property(element, "saturation"))
+        {
+            balance = GObjWrapper<GstElement>{GST_ELEMENT(gst_object_ref(element))};
+        }
+
+        if (!encoder.get() && elementFactory &&
+            gst_element_factory_list_is_type(elementFactory, GST_ELEMENT_FACTORY_TYPE_VIDEO_ENCODER) &&
+            has_property(element, "bitrate"))
+        {
+            encoder = GObjWrapper<GstElement>{GST_ELEMENT(gst_object_ref(element))};
+        }
+
+        if (!filter.get() && is_raw_video_filter(element))
+        {
+            filter = GObjWrapper<GstElement>{GST_ELEMENT(gst_object_ref(element))};
+        }
+
+        g_value_reset(&item);
+    }
+
+    g_value_unset(&item);
+    gst_iterator_free(it);
+    gst_object_unref(bin);
+
+    g_signal_connect(media, "unprepared", G_CALLBACK(onMediaUnprepared), this);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_media = media;
+    m_balance = std::move(balance);
+    m_encoder = std::move(encoder);
+    m_filter = std::move(filter);
+    m_gopProperty = m_encoder.get() ? find_gop_property(m_encoder.get()) : nullptr;
+    m_swapPending = false;
+    m_snapshot = StreamSnapshot{};
+
+    if (m_balance.get())
+    {
+        if (m_pendingBrightness)
+            write_property(m_balance.get(), "brightness", *m_pendingBrightness);
+        if (m_pendingContrast)
+            write_property(m_balance.get(), "contrast", *m_pendingContrast);
+        if (m_pendingSaturation)
+            write_property(m_balance.get(), "saturation", *m_pendingSaturation);
+
+        read_property(m_balance.get(), "brightness", m_snapshot.brightness);
+        read_property(m_balance.get(), "contrast", m_snapshot.contrast);
+        read_property(m_balance.get(), "saturation", m_snapshot.saturation);
+    }
+
+    if (m_encoder.get())
+    {
+        applyEncoderPending(m_encoder.get());
+
+        read_property(m_encoder.get(), "bitrate", m_snapshot.bitrate);
+        if (m_gopProperty)
+            read_property(m_encoder.get(), m_gopProperty, m_snapshot.govLength);
+    }
+
+    if (m_filter.get())
+    {
+        // the pipeline is not negotiated yet, the new caps are simply used from the start
+        if (m_pendingFormat)
+        {
+            GstCaps *caps = make_format_caps(m_filter.get(), *m_pendingFormat);
+            if (caps)
+            {
+                g_object_set(m_filter.get(), "caps", caps, NULL);
+                gst_caps_unref(caps);
+            }
+        }
+
+        read_format(m_filter.get(), m_snapshot.format);
+    }
+    m_pendingFormat.reset();
+
+    read_options(m_filter.get(), m_encoder.get(), m_snapshot.options);
+
+    arms::log<arms::LOG_INFO>("Stream {} configured, colour balance: {}, encoder: {}, raw caps filter: {}", m_name,
+                              m_balance.get() != nullptr, m_encoder.get() != nullptr, m_filter.get() != nullptr);
+}
+
+
+void StreamControl::release(GstRTSPMedia *media)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // a newer media may already have been configured for this stream
+    if (media != m_media)
+        return;
+
+    // keep the last snapshot as the value to restore on the next configure
+    if (m_snapshot.brightness.available)
+        m_pendingBrightness = m_snapshot.brightness.value;
+    if (m_snapshot.contrast.available)
+        m_pendingContrast = m_snapshot.contrast.value;
+    if (m_snapshot.saturation.available)
+        m_pendingSaturation = m_snapshot.saturation.value;
+    if (m_snapshot.bitrate.available)
+        m_pendingBitrate = m_snapshot.bitrate.value;
+    if (m_snapshot.govLength.available)
+        m_pendingGovLength = m_snapshot.govLength.value;
+    if (m_snapshot.format.width > 0 || m_snapshot.format.framerate > 0)
+        m_pendingFormat = m_snapshot.format;
+
+    m_media = nullptr;
+    m_swapPending = false;
+    m_balance = GObjWrapper<GstElement>{};
+    m_encoder = GObjWrapper<GstElement>{};
+    m_filter = GObjWrapper<GstElement>{};
+}
+
+
+
+/*
+*  GopCache: replay of the last GOP to joining clients
+*/
+static constexpr size_t gop_max_bytes = 4 * 1024 * 1024; // a longer GOP is not cached, joining clients get a key unit
+static constexpr std::chrono::milliseconds key_unit_interval{500};
+
+
+// what gst_video_event_new_upstream_force_key_unit() builds, without linking gstvideo
+static GstEvent *make_force_key_unit()
+{
+    return gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM,
+                                gst_structure_new("GstForceKeyUnit", "running-time", GST_TYPE_CLOCK_TIME,
+                                                  GST_CLOCK_TIME_NONE, "all-headers", G_TYPE_BOOLEAN, TRUE, "count",
+                                                  G_TYPE_UINT, 0, NULL));
+}
+
+
+static bool is_video_payloader(GstElement *element)
+{
+    GstPad *sink = gst_element_get_static_pad(element, "sink");
+    if (!sink)
+        return false;
+
+    GstCaps *caps = gst_pad_get_pad_template_caps(sink);
+    bool video = gst_caps_get_size(caps) > 0 &&
+                 g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "video/");
+
+    gst_caps_unref(caps);
+    gst_object_unref(sink);
+    return video;
+}
+
+
+/*
+*  Sends the packets straight to one client, over its RTSP connection or to
+*  its RTP port from the socket of the stream
+*/
+static void send_packets(GstRTSPStreamTransport *transport, GstBufferList *packets)
+{
+    const GstRTSPTransport *tr = gst_rtsp_stream_transport_get_transport(transport);
+    guint count = gst_buffer_list_length(packets);
+
+    if (tr->lower_transport == GST_RTSP_LOWER_TRANS_TCP)
+    {
+        for (guint i = 0; i < count; ++i)
+            gst_rtsp_stream_transport_send_rtp(transport, gst_buffer_list_get(packets, i));
+        return;
+    }
+
+    // multicast clients share the packets of everyone else
+    if (tr->lower_transport != GST_RTSP_LOWER_TRANS_UDP || !tr->destination)
+        return;
+
+    GSocketAddress *address = g_inet_socket_address_new_from_string(tr->destination, tr->client_port.min);
+    if (!address)
+        return;
+
+    GstRTSPStream *stream = gst_rtsp_stream_transport_get_stream(transport);
+    GSocket *socket = gst_rtsp_stream_get_rtp_socket(stream, g_socket_address_get_family(address));
+
+    for (guint i = 0; socket && i < count; ++i)
+    {
+        GstMapInfo map;
+        GstBuffer *packet = gst_buffer_list_get(packets, i);
+        if (!gst_buffer_map(packet, &map, GST_MAP_READ))
+            continue;
+
+        g_socket_send_to(socket, address, reinterpret_cast<const gchar *>(map.data), map.size, NULL, NULL);
+        gst_buffer_unmap(packet, &map);
+    }
+
+    if (socket)
+        g_object_unref(socket);
+    g_object_unref(address);
+}
+
+
+GopCache::GopCache(std::string streamName)
+    : m_name{std::move(streamName)}, m_packets{gst_buffer_list_new()}
+{
+}
+
+
+GopCache::~GopCache()
+{
+    gst_buffer_list_unref(m_packets);
+}
+
+
+void GopCache::attach(GstRTSPMediaFactory *factory, GstRTSPServer *server)
+{
+    g_signal_connect(factory, "media-configure", G_CALLBACK(onMediaConfigure), this);
+    g_signal_connect(server, "client-connected", G_CALLBACK(onClientConnected), this);
+}
+
+
+size_t GopCache::bytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+}
+
+
+void GopCache::onMediaConfigure(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer userData)
+{
+    (void)factory;
+    static_cast<GopCache *>(userData)->configure(media);
+}
+
+
+void GopCache::onMediaUnprepared(GstRTSPMedia *media, gpointer userData)
+{
+    static_cast<GopCache *>(userData)->release(media);
+}
+
+
+// packets cached before a suspend are stale once the media resumes
+void GopCache::onMediaNewState(GstRTSPMedia *media, gint state, gpointer userData)
+{
+    GopCache *cache = static_cast<GopCache *>(userData);
+    if (state == GST_STATE_PLAYING)
+        return;
+
+    std::lock_guard<std::mutex> lock(cache->m_mutex);
+    if (media != cache->m_media)
+        return;
+
+    cache->m_joining.clear();
+    cache->m_newGop = false;
+    cache->reset(false);
+}
+
+
+void GopCache::onClientConnected(GstRTSPServer *server, GstRTSPClient *client, gpointer userData)
+{
+    (void)server;
+    g_signal_connect(client, "play-request", G_CALLBACK(onPlayRequest), userData);
+    g_signal_connect(client, "send-message", G_CALLBACK(onSendMessage), userData);
+}
+
+
+void GopCache::onPlayRequest(GstRTSPClient *client, GstRTSPContext *ctx, gpointer userData)
+{
+    (void)client;
+    static_cast<GopCache *>(userData)->join(ctx);
+}
+
+
+void GopCache::onSendMessage(GstRTSPClient *client, GstRTSPContext *ctx, gpointer message, gpointer userData)
+{
+    (void)client;
+    static_cast<GopCache *>(userData)->announce(ctx, static_cast<GstRTSPMessage *>(message));
+}
+
+
+GstPadProbeReturn GopCache::onPayloaderInput(GstPad *pad, GstPadProbeInfo *info, gpointer userData)
+{
+    (void)pad;
+    static_cast<GopCache *>(userData)->input(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+
+GstPadProbeReturn GopCache::onPayloaderOutput(GstPad *pad, GstPadProbeInfo *info, gpointer userData)
+{
+    (void)pad;
+    static_cast<GopCache *>(userData)->output(info);
+    return GST_PAD_PROBE_OK;
+}
+
+
+/*
+*  The payloaders are named pay%d after the index of their stream, the first
+*  one taking video is cached
+*/
+void GopCache::configure(GstRTSPMedia *media)
+{
+    GstElement *bin = gst_rtsp_media_get_element(media);
+    if (!bin)
+        return;
+
+    GstElement *payloader = NULL;
+    guint index = 0;
+
+    for (guint i = 0; !payloader && i < gst_rtsp_media_n_streams(media); ++i)
+    {
+        std::string name = "pay" + std::to_string(i);
+        GstElement *element = gst_bin_get_by_name(GST_BIN(bin), name.c_str());
+
+        if (element && is_video_payloader(element))
+        {
+            payloader = element;
+            index = i;
+        }
+        else if (element)
+            gst_object_unref(element);
+    }
+    gst_object_unref(bin);
+
+    if (!payloader)
+        return;
+
+    g_signal_connect(media, "unprepared", G_CALLBACK(onMediaUnprepared), this);
+    g_signal_connect(media, "new-state", G_CALLBACK(onMediaNewState), this);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_media = media;
+    m_streamIndex = index;
+    m_input = GObjWrapper<GstPad>{gst_element_get_static_pad(payloader, "sink")};
+    m_output = GObjWrapper<GstPad>{gst_element_get_static_pad(payloader, "src")};
+    gst_object_unref(payloader);
+
+    m_inputProbe = gst_pad_add_probe(m_input.get(), GST_PAD_PROBE_TYPE_BUFFER, onPayloaderInput, this, NULL);
+    m_outputProbe = gst_pad_add_probe(m_output.get(),
+                                      static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER |
+                                                                   GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                                      onPayloaderOutput, this, NULL);
+    m_joining.clear();
+    m_newGop = false;
+    reset(false);
+}
+
+
+void GopCache::release(GstRTSPMedia *media)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (media != m_media)
+        return;
+
+    gst_pad_remove_probe(m_input.get(), m_inputProbe);
+    gst_pad_remove_probe(m_output.get(), m_outputProbe);
+
+    m_media = nullptr;
+    m_input = GObjWrapper<GstPad>{};
+    m_output = GObjWrapper<GstPad>{};
+    m_joining.clear();
+    reset(false);
+}
+
+
+/*
+*  Runs in the main loop once the client plays, its transport is already fed
+*  by the media. The replay goes out with the next packet of the payloader.
+*/
+void GopCache::join(GstRTSPContext *ctx)
+{
+    GstRTSPStreamTransport *transport =
+        ctx->sessmedia ? gst_rtsp_session_media_get_transport(ctx->sessmedia, m_streamIndex) : NULL;
+    GObjWrapper<GstPad> input;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!transport || ctx->media != m_media)
+            return;
+
+        if (m_valid && gst_buffer_list_length(m_packets) > 0)
+        {
+            m_joining.emplace_back(GST_RTSP_STREAM_TRANSPORT(g_object_ref(transport)));
+            return;
+        }
+
+        // the next key frame reaches the client live
+        auto now = std::chrono::steady_clock::now();
+        if (now - m_lastKeyUnit < key_unit_interval)
+            return;
+
+        m_lastKeyUnit = now;
+        input = m_input;
+    }
+
+    gst_pad_push_event(input.get(), make_force_key_unit());
+}
+
+
+/*
+*  Runs in the main loop as the PLAY response goes out, before join(). The
+*  RTP-Info entry of the cached stream gets the seq and rtptime of the first
+*  cached packet, the replay and the live packets after it follow on without
+*  a gap. A GOP starting in between leaves a gap before its key frame, which
+*  the client takes for lost packets.
+*/
+void GopCache::announce(GstRTSPContext *ctx, GstRTSPMessage *message)
+{
+    if (ctx->method != GST_RTSP_PLAY || gst_rtsp_message_get_type(message) != GST_RTSP_MESSAGE_RESPONSE)
+        return;
+
+    gchar *value = NULL;
+    if (gst_rtsp_message_get_header(message, GST_RTSP_HDR_RTP_INFO, &value, 0) != GST_RTSP_OK)
+        return;
+
+    guint8 header[8];
+    std::string control;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (ctx->media != m_media || !m_valid || gst_buffer_list_length(m_packets) == 0 ||
+            gst_buffer_extract(gst_buffer_list_get(m_packets, 0), 0, header, sizeof(header)) != sizeof(header))
+            return;
+
+        // url=...;seq=...;rtptime=... per stream, the control of a stream ends in stream=<index>
+        control = "stream=" + std::to_string(m_streamIndex);
+    }
+
+    // RTP header: sequence number at byte 2, timestamp at byte 4, big endian
+    guint seq = (guint(header[2]) << 8) | header[3];
+    guint32 rtptime = (guint32(header[4]) << 24) | (guint32(header[5]) << 16) |
+                      (guint32(header[6]) << 8) | header[7];
+
+    std::string rewritten;
+    gchar **entries = g_strsplit(value, ",", -1);
+
+    for (gchar **entry = entries; *entry; ++entry)
+    {
+        std::string info = g_strstrip(*entry);
+        size_t url_end = info.find(';');
+        std::string url = info.substr(0, url_end);
+
+        if (url.size() >= control.size() && url.compare(url.size() - control.size(), control.size(), control) == 0)
+            info = url + ";seq=" + std::to_string(seq) + ";rtptime=" + std::to_string(rtptime);
+
+        rewritten += (rewritten.empty() ? "" : ", ") + info;
+    }
+    g_strfreev(entries);
+
+    gst_rtsp_message_remove_header(message, GST_RTSP_HDR_RTP_INFO, -1);
+    gst_rtsp_message_add_header(message, GST_RTSP_HDR_RTP_INFO, rewritten.c_str());
+}
+
+
+/*
+*  Runs in the streaming thread before the frame is payloaded, its packets
+*  are the next ones seen by output()
+*/
+void GopCache::input(GstBuffer *buffer)
+{
+    if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+        return;
+
+    bool header = GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_HEADER);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // SPS/PPS sent ahead of the key frame open the GOP, the key frame goes on with it
+    if (!header && m_headerOnly && (m_newGop || m_valid))
+    {
+        m_headerOnly = false;
+        return;
+    }
+
+    m_newGop = true;
+    m_headerOnly = header;
+}
+
+
+void GopCache::output(GstPadProbeInfo *info)
+{
+    std::vector<GObjWrapper<GstRTSPStreamTransport>> joining;
+    GstBufferList *replay = NULL;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // clients waiting for a key frame get this one live
+        if (m_newGop)
+        {
+            m_newGop = false;
+            m_joining.clear();
+            reset(true);
+        }
+
+        if (!m_joining.empty())
+        {
+            joining.swap(m_joining);
+            replay = gst_buffer_list_ref(m_packets);
+        }
+    }
+
+    // ahead of the live packet, not yet handed to the sinks
+    for (auto const &transport : joining)
+        send_packets(transport.get(), replay);
+    if (replay)
+        gst_buffer_list_unref(replay);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER)
+        store(GST_PAD_PROBE_INFO_BUFFER(info));
+    else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        for (guint i = 0; i < gst_buffer_list_length(list); ++i)
+            store(gst_buffer_list_get(list, i));
+    }
+}
+
+
+/*
+*  Must be called with m_mutex held. A replay in progress keeps its own
+*  reference, the list is copied on write rather than the packets.
+*/
+void GopCache::store(GstBuffer *packet)
+{
+    if (!m_valid)
+        return;
+
+    size_t size = gst_buffer_get_size(packet);
+    if (m_bytes + size > gop_max_bytes)
+    {
+        arms::log<arms::LOG_INFO>("Stream {} GOP over {} bytes, not cached", m_name, gop_max_bytes);
+        reset(false);
+        return;
+    }
+
+    m_packets = gst_buffer_list_make_writable(m_packets);
+    gst_buffer_list_add(m_packets, gst_buffer_ref(packet));
+    m_bytes += size;
+}
+
+
+// must be called with m_mutex held
+void GopCache::reset(bool valid)
+{
+    gst_buffer_list_unref(m_packets);
+    m_packets = gst_buffer_list_new();
+    m_bytes = 0;
+    m_valid = valid;
+    if (!valid)
+        m_headerOnly = false;
+}
+
+
+
+/*
+*  WarmMedia: media prepared ahead of the first client
+*/
+static constexpr std::chrono::seconds warm_timeout{5}; // a live source that sends nothing never prerolls
+
+
+static int64_t resident_bytes()
+{
+    long pages = 0;
+    long resident = 0;
+
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+
+    return int64_t(resident) * sysconf(_SC_PAGESIZE);
+}
+
+
+static double thread_cpu_seconds(clockid_t clock)
+{
+    timespec cpu{};
+    if (clock_gettime(clock, &cpu) != 0)
+        return 0.0;
+    return cpu.tv_sec + cpu.tv_nsec / 1e9;
+}
+
+
+WarmMedia::WarmMedia(std::string streamName, std::string mode)
+    : m_name{std::move(streamName)}, m_mode{std::move(mode)}
+{
+}
+
+
+WarmMedia::~WarmMedia()
+{
+    if (m_rewarmSource)
+        g_source_remove(m_rewarmSource);
+
+    GstRTSPMedia *media = NULL;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        media = std::exchange(m_media, nullptr);
+    }
+
+    // the unprepare may finish later on the main context, without this object
+    if (media)
+    {
+        g_signal_handlers_disconnect_by_data(media, this);
+        gst_rtsp_media_unprepare(media);
+        g_object_unref(media);
+    }
+}
+
+
+void WarmMedia::attach(GstRTSPMediaFactory *factory)
+{
+    m_factory = factory;
+    g_signal_connect(factory, "media-configure", G_CALLBACK(onMediaConfigure), this);
+
+    // the pipeline stays paused between clients, the streaming threads idle
+    if (m_mode == "suspended")
+        gst_rtsp_media_factory_set_suspend_mode(factory, GST_RTSP_SUSPEND_MODE_PAUSE);
+}
+
+
+void WarmMedia::warm(std::string const &url)
+{
+    m_url = url;
+    if (!construct())
+        return;
+
+    auto const deadline = std::chrono::steady_clock::now() + warm_timeout;
+    while (!isWarm() && std::chrono::steady_clock::now() < deadline)
+    {
+        if (!g_main_context_iteration(NULL, FALSE))
+            g_usleep(10000);
+    }
+
+    if (!isWarm())
+        arms::log<arms::LOG_INFO>("Stream {} not prerolled within {} s, left preparing", m_name,
+                                  warm_timeout.count());
+}
+
+
+bool WarmMedia::isWarm() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_media && m_prepared;
+}
+
+
+double WarmMedia::cpuSeconds() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    double seconds = m_exitedCpu;
+    for (pthread_t thread : m_threads)
+    {
+        clockid_t clock;
+        if (pthread_getcpuclockid(thread, &clock) == 0)
+            seconds += thread_cpu_seconds(clock);
+    }
+    return seconds;
+}
+
+
+int64_t WarmMedia::rssBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_rssBytes;
+}
+
+
+/*
+*  The shared factory keeps the media it constructs for the url, a DESCRIBE
+*  of the same port and path gets this one
+*/
+bool WarmMedia::construct()
+{
+    GstRTSPUrl *url = NULL;
+    if (gst_rtsp_url_parse(m_url.c_str(), &url) != GST_RTSP_OK)
+        return false;
+
+    int64_t before = resident_bytes();
+    GstRTSPMedia *media = gst_rtsp_media_factory_construct(m_factory, url);
+    gst_rtsp_url_free(url);
+
+    if (!media)
+    {
+        arms::log<arms::LOG_INFO>("Stream {} media can't be constructed for warm start", m_name);
+        return false;
+    }
+
+    g_signal_connect(media, "prepared", G_CALLBACK(onMediaPrepared), this);
+    g_signal_connect(media, "unprepared", G_CALLBACK(onMediaUnprepared), this);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_media = media;
+        m_prepared = false;
+        m_rssBefore = before;
+    }
+
+    // the bus of the media is watched on the default main context
+    if (!gst_rtsp_media_prepare(media, NULL))
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_media = nullptr;
+        g_object_unref(media);
+        arms::log<arms::LOG_INFO>("Stream {} media can't be prepared for warm start", m_name);
+        return false;
+    }
+
+    return true;
+}
+
+
+void WarmMedia::onMediaConfigure(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer userData)
+{
+    (void)factory;
+
+    GstElement *bin = gst_rtsp_media_get_element(media);
+    GstObject *pipeline = bin ? gst_object_get_parent(GST_OBJECT(bin)) : NULL;
+    GstBus *bus = pipeline ? gst_element_get_bus(GST_ELEMENT(pipeline)) : NULL;
+
+    // stream-status is posted by the thread entering or leaving its loop
+    if (bus)
+    {
+        gst_bus_enable_sync_message_emission(bus);
+        g_signal_connect(bus, "sync-message::stream-status", G_CALLBACK(onStreamStatus), userData);
+        gst_object_unref(bus);
+    }
+
+    if (pipeline)
+        gst_object_unref(pipeline);
+    if (bin)
+        gst_object_unref(bin);
+}
+
+
+void WarmMedia::onMediaPrepared(GstRTSPMedia *media, gpointer userData)
+{
+    static_cast<WarmMedia *>(userData)->prepared(media);
+}
+
+
+void WarmMedia::onMediaUnprepared(GstRTSPMedia *media, gpointer userData)
+{
+    static_cast<WarmMedia *>(userData)->unprepared(media);
+}
+
+
+void WarmMedia::onStreamStatus(GstBus *bus, GstMessage *message, gpointer userData)
+{
+    (void)bus;
+    static_cast<WarmMedia *>(userData)->streamStatus(message);
+}
+
+
+gboolean WarmMedia::onRewarm(gpointer userData)
+{
+    WarmMedia *self = static_cast<WarmMedia *>(userData);
+    self->m_rewarmSource = 0;
+    self->construct();
+    return G_SOURCE_REMOVE;
+}
+
+
+void WarmMedia::prepared(GstRTSPMedia *media)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (media != m_media)
+        return;
+
+    m_prepared = true;
+    m_rssBytes = resident_bytes() - m_rssBefore;
+
+    arms::log<arms::LOG_INFO>("Stream {} media warm ({}), resident set grew by {} kB", m_name, m_mode,
+                              m_rssBytes / 1024);
+}
+
+
+/*
+*  The held prepare keeps a working media from unpreparing, this one failed
+*/
+void WarmMedia::unprepared(GstRTSPMedia *media)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (media != m_media)
+            return;
+
+        m_media = nullptr;
+        m_prepared = false;
+    }
+
+    g_object_unref(media);
+
+    arms::log<arms::LOG_INFO>("Stream {} warm media unprepared, constructing it again", m_name);
+    if (!m_rewarmSource)
+        m_rewarmSource = g_timeout_add_seconds(1, onRewarm, this);
+}
+
+
+void WarmMedia::streamStatus(GstMessage *message)
+{
+    GstStreamStatusType type;
+    GstElement *owner = NULL;
+    gst_message_parse_stream_status(message, &type, &owner);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    pthread_t self = pthread_self();
+
+    if (type == GST_STREAM_STATUS_TYPE_ENTER)
+        m_threads.push_back(self);
+    else if (type == GST_STREAM_STATUS_TYPE_LEAVE)
+    {
+        auto it = std::find_if(m_threads.begin(), m_threads.end(),
+                               [self](pthread_t thread) { return pthread_equal(thread, self); });
+        if (it != m_threads.end())
+        {
+            m_exitedCpu += thread_cpu_seconds(CLOCK_THREAD_CPUTIME_ID);
+            m_threads.erase(it);
+        }
+    }
+}
@@ -2,9 +2,16 @@
 #define RTSP_STREAMS_HPP
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <utility>
+#include <chrono>
 #include <optional>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <vector>
 #include <armoury/logger.hpp>
 #include <armoury/ThreadWarden.hpp>
 #include <armoury/json.hpp>
@@ -12,6 +19,9 @@
 #include <gst/gst.h>
 #include <gst/rtsp-server/rtsp-server.h>
 
+#include "ListenSockets.hpp"
+#include "ServiceMetrics.hpp"
+
 #define DEFAULT_RTSP_PORT "8554"
 
 
@@ -27,6 +37,7 @@ public:
     std::string  get_rtspUrl       (void) const { return rtspUrl;      }
     bool         get_testStream    (void) const { return testStream;   }
     std::string  get_testStreamSrc (void) const { return testStreamSrc;}
+    std::string  get_warm          (void) const { return warm;         }
 
     //methods for parsing opt from cmd
     bool set_pipeline      (const char *new_val);
@@ -35,6 +46,7 @@ public:
     bool set_rtspUrl       (const char *new_val);
     bool set_testStream    (int         new_val);
     bool set_testStreamSrc (const char *new_val);
+    bool set_warm          (const char *new_val);
 
 
     std::string get_str_err()  const { return str_err;         }
@@ -52,6 +64,7 @@ private:
     std::string rtspUrl;
     bool testStream;
     std::string testStreamSrc;
+    std::string warm;
 
     std::string  str_err;
 };
@@ -115,6 +128,262 @@ private:
     T *ptr{};
 };
 
+/*******************************************************************************
+ * Current value and valid range of a tunable pipeline element property
+ ******************************************************************************/
+struct PropertyValue
+{
+    bool   available{false};
+    double value{0.0};
+    double min{0.0};
+    double max{0.0};
+};
+
+
+/*******************************************************************************
+ * Raw video format fed to the encoder, zero fields are unknown
+ ******************************************************************************/
+struct VideoFormat
+{
+    int width{0};
+    int height{0};
+    int framerate{0};
+};
+
+
+/*******************************************************************************
+ * What the encoder branch of a pipeline can be switched to without a restart
+ *
+ * Resolutions are the common sizes accepted by both the elements upstream of
+ * the raw caps filter and the encoder, the framerate range comes from the same
+ * caps query and the profiles from the encoder source pad template.
+ ******************************************************************************/
+struct EncoderOptions
+{
+    std::vector<VideoFormat> resolutions;
+    PropertyValue framerate;
+    std::vector<std::string> profiles;
+};
+
+
+/*******************************************************************************
+ * Cached view of the live properties of a stream pipeline
+ *
+ * Brightness, contrast and saturation come from a colour balance element
+ * (videobalance or any element exposing the same properties), bitrate is taken
+ * from the video encoder in kbit/s and the GOP length from its key frame
+ * interval property. The format is the one forced by the raw video caps filter
+ * in front of the encoder.
+ ******************************************************************************/
+struct StreamSnapshot
+{
+    PropertyValue brightness;
+    PropertyValue contrast;
+    PropertyValue saturation;
+    PropertyValue bitrate;
+    PropertyValue govLength;
+    VideoFormat format;
+    EncoderOptions options;
+};
+
+
+/*******************************************************************************
+ * Live control of the elements inside a running RTSP media pipeline
+ *
+ * The control hooks the "media-configure" signal of the media factory, keeps a
+ * reference to the tunable elements of the current media and caches their
+ * properties, so Get requests never have to walk the pipeline. Values set
+ * while no media is running are remembered and applied on the next configure.
+ *
+ * Encoder properties that the element only accepts in the READY state are
+ * applied by swapping in a new encoder instance on the next buffer, resolution
+ * and framerate by changing the raw caps filter and letting the pipeline
+ * renegotiate. Neither interrupts the clients of the shared media.
+ ******************************************************************************/
+class StreamControl
+{
+public:
+    explicit StreamControl(std::string streamName);
+
+    void attach(GstRTSPMediaFactory *factory);
+
+    std::string getName() const { return m_name; }
+    StreamSnapshot getSnapshot() const;
+
+    bool setBrightness(double value);
+    bool setContrast(double value);
+    bool setSaturation(double value);
+    bool setBitrate(double kbps);
+    bool setGovLength(int frames);
+    bool setFormat(VideoFormat const &format);
+
+private:
+    static void onMediaConfigure(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer userData);
+    static void onMediaUnprepared(GstRTSPMedia *media, gpointer userData);
+    static GstPadProbeReturn onEncoderInputBlocked(GstPad *pad, GstPadProbeInfo *info, gpointer userData);
+
+    void configure(GstRTSPMedia *media);
+    void release(GstRTSPMedia *media);
+    bool setProperty(GObjWrapper<GstElement> const &element, char const *property, double value,
+                     PropertyValue &cached, std::optional<double> &pending);
+    bool setEncoderProperty(char const *property, double value, PropertyValue &cached,
+                            std::optional<double> &pending);
+    void scheduleEncoderSwap();
+    void swapEncoder(GstPad *input);
+    void applyEncoderPending(GstElement *encoder);
+
+    std::string m_name;
+
+    mutable std::mutex m_mutex;
+    StreamSnapshot m_snapshot;
+    GstRTSPMedia *m_media{nullptr};
+    GObjWrapper<GstElement> m_balance;
+    GObjWrapper<GstElement> m_encoder;
+    GObjWrapper<GstElement> m_filter;
+    char const *m_gopProperty{nullptr};
+    bool m_swapPending{false};
+
+    std::optional<double> m_pendingBrightness;
+    std::optional<double> m_pendingContrast;
+    std::optional<double> m_pendingSaturation;
+    std::optional<double> m_pendingBitrate;
+    std::optional<double> m_pendingGovLength;
+    std::optional<VideoFormat> m_pendingFormat;
+};
+
+
+/*******************************************************************************
+ * Last group of pictures of a stream, replayed to the clients joining it
+ *
+ * A client joining the shared media gets the packets from the next one on and
+ * its decoder shows nothing until the next key frame, seconds away with the
+ * default GOP of x264enc. The cache keeps the RTP packets of the video
+ * payloader from its last key frame on. When a client starts playing they are
+ * sent to its transport from the streaming thread, ahead of the next live
+ * packet, so the client sees one sequence starting with a key frame. The
+ * RTP-Info of its PLAY response is moved back to the seq and rtptime of the
+ * first cached packet, or the client would take the replay for packets from
+ * before its session and drop them.
+ *
+ * Without a usable cache, no key frame seen yet or a GOP over the size cap,
+ * the encoder is asked for a key unit instead, at most once per interval.
+ ******************************************************************************/
+class GopCache
+{
+public:
+    explicit GopCache(std::string streamName);
+    ~GopCache();
+
+    GopCache(GopCache const &) = delete;
+    GopCache &operator=(GopCache const &) = delete;
+
+    void attach(GstRTSPMediaFactory *factory, GstRTSPServer *server);
+
+    size_t bytes() const;
+
+private:
+    static void onMediaConfigure(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer userData);
+    static void onMediaUnprepared(GstRTSPMedia *media, gpointer userData);
+    static void onMediaNewState(GstRTSPMedia *media, gint state, gpointer userData);
+    static void onClientConnected(GstRTSPServer *server, GstRTSPClient *client, gpointer userData);
+    static void onPlayRequest(GstRTSPClient *client, GstRTSPContext *ctx, gpointer userData);
+    static void onSendMessage(GstRTSPClient *client, GstRTSPContext *ctx, gpointer message, gpointer userData);
+    static GstPadProbeReturn onPayloaderInput(GstPad *pad, GstPadProbeInfo *info, gpointer userData);
+    static GstPadProbeReturn onPayloaderOutput(GstPad *pad, GstPadProbeInfo *info, gpointer userData);
+
+    void configure(GstRTSPMedia *media);
+    void release(GstRTSPMedia *media);
+    void join(GstRTSPContext *ctx);
+    void announce(GstRTSPContext *ctx, GstRTSPMessage *message);
+    void input(GstBuffer *buffer);
+    void output(GstPadProbeInfo *info);
+    void store(GstBuffer *packet);
+    void reset(bool valid);
+
+    std::string m_name;
+
+    mutable std::mutex m_mutex;
+    GstRTSPMedia *m_media{nullptr};
+    guint m_streamIndex{0};
+    GObjWrapper<GstPad> m_input;  // sink pad of the video payloader
+    GObjWrapper<GstPad> m_output; // its source pad
+    gulong m_inputProbe{0};
+    gulong m_outputProbe{0};
+
+    GstBufferList *m_packets{nullptr};
+    size_t m_bytes{0};
+    bool m_valid{false};      // the packets start with a key frame
+    bool m_newGop{false};     // the next packet starts a key frame
+    bool m_headerOnly{false}; // the GOP so far is codec headers, the key frame itself is next
+    std::vector<GObjWrapper<GstRTSPStreamTransport>> m_joining;
+    std::chrono::steady_clock::time_point m_lastKeyUnit{};
+};
+
+
+/*******************************************************************************
+ * Media of a stream kept prepared from startup, and what the stream costs
+ *
+ * The factory builds and prerolls the launch pipeline on the first DESCRIBE,
+ * so the first viewer waits for it while a viewer of a running shared media
+ * does not. A warm stream constructs its media at startup and holds one
+ * prepare of its own, the media then stays prepared when the last client
+ * leaves and the next DESCRIBE finds it ready. "prepared" leaves the pipeline
+ * as the server does between clients, "suspended" also pauses it, cheaper
+ * while idle at the cost of a resume and a new key frame on the next PLAY.
+ * A warm media that fails is constructed again a second later.
+ *
+ * The CPU time of the streaming threads of every media of the factory is
+ * counted from their stream-status messages, threads the elements start on
+ * their own (the workers of x264) are not seen. The memory of the warm media
+ * is the growth of the resident set while it was prepared.
+ ******************************************************************************/
+class WarmMedia
+{
+public:
+    WarmMedia(std::string streamName, std::string mode);
+    ~WarmMedia();
+
+    WarmMedia(WarmMedia const &) = delete;
+    WarmMedia &operator=(WarmMedia const &) = delete;
+
+    void attach(GstRTSPMediaFactory *factory);
+
+    // construct and prepare the media served for url, waiting for it up to a
+    // timeout while nothing else runs the default main context yet
+    void warm(std::string const &url);
+
+    bool isWarm() const;
+    double cpuSeconds() const;
+    int64_t rssBytes() const;
+
+private:
+    static void onMediaConfigure(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer userData);
+    static void onMediaPrepared(GstRTSPMedia *media, gpointer userData);
+    static void onMediaUnprepared(GstRTSPMedia *media, gpointer userData);
+    static void onStreamStatus(GstBus *bus, GstMessage *message, gpointer userData);
+    static gboolean onRewarm(gpointer userData);
+
+    bool construct();
+    void prepared(GstRTSPMedia *media);
+    void unprepared(GstRTSPMedia *media);
+    void streamStatus(GstMessage *message);
+
+    std::string m_name;
+    std::string m_mode;
+    std::string m_url;
+    GstRTSPMediaFactory *m_factory{nullptr};
+    guint m_rewarmSource{0};
+
+    mutable std::mutex m_mutex;
+    GstRTSPMedia *m_media{nullptr}; // holds a prepare and a reference
+    bool m_prepared{false};
+    int64_t m_rssBefore{0};
+    int64_t m_rssBytes{0};
+    std::vector<pthread_t> m_threads; // streaming threads in their loop
+    double m_exitedCpu{0.0};          // of the threads that left it
+};
+
+
 namespace api {
 
 struct StreamSettings : arms::json::Support<StreamSettings>
@@ -183,6 +452,7 @@ class GStreamerRTSPLoop
     struct Input
     {
         GMainLoop* loop{nullptr};
+        std::function<void()> onExit; // any return of the loop is reported
     } dataIn;
     struct Output
     {
@@ -196,6 +466,10 @@ class GStreamerRTSPLoop
         {
             g_main_loop_run(dataIn.loop);
         }
+        if (dataIn.onExit)
+        {
+            dataIn.onExit();
+        }
         return 1;
     }
 
@@ -206,7 +480,11 @@ class GStreamerRTSPLoop
 class GStreamerRTSP
 {
 public:
-    GStreamerRTSP(RTSPStreamConfig stream)
+    GStreamerRTSP(RTSPStreamConfig stream, std::shared_ptr<ServiceMetrics> metrics = {})
+        : m_control{std::make_shared<StreamControl>(stream.get_rtspUrl())},
+          m_gopCache{std::make_shared<GopCache>(stream.get_rtspUrl())},
+          m_warm{std::make_shared<WarmMedia>(stream.get_rtspUrl(), stream.get_warm())},
+          m_metrics{std::move(metrics)}
     {
         // Build stream URI
         std::stringstream ss;
@@ -250,11 +528,27 @@ public:
         gst_rtsp_media_factory_set_launch (factory.get(), s.c_str());
         gst_rtsp_media_factory_set_shared (factory.get(), TRUE);
 
+        /* track the elements of every media built by the factory for live changes */
+        m_control->attach(factory.get());
+
+        /* replay the last GOP to joining clients, they start on a key frame */
+        m_gopCache->attach(factory.get(), server.get());
+        m_warm->attach(factory.get());
+
         /* attach the test factory to the /test url */
         gst_rtsp_mount_points_add_factory (mounts.get(), stream.get_rtspUrl().c_str(), factory.get());
 
-        /* attach the server to the default maincontext */
-        gst_rtsp_server_attach (server.get(), NULL);
+        /* build the media before the first client asks for it, the key is made from the port and path */
+        if (!stream.get_warm().empty())
+            m_warm->warm("rtsp://127.0.0.1:" + stream.get_tcpPort() + stream.get_rtspUrl());
+
+        /* publish the idle cost of the stream with the other metrics */
+        if (m_metrics)
+            m_usageSource = g_timeout_add_seconds(1, publishUsage, this);
+
+        /* accept on the default maincontext, from the socket inherited from systemd
+         * or the previous binary if there is one */
+        listen(std::atoi(stream.get_tcpPort().c_str()));
 
         /* start serving */
         arms::log<arms::LOG_INFO>("stream ready at rtsp://127.0.0.1:{}{}", stream.get_tcpPort(), stream.get_rtspUrl());
@@ -264,22 +558,124 @@ public:
         assert(locked);
         locked->loop = m_loop;
         }
+    }
 
-        m_loopThread.start();
+    ~GStreamerRTSP()
+    {
+        if (m_usageSource)
+            g_source_remove(m_usageSource);
+        stopListening();
+        stop();
+        if (m_socket.get())
+            ListenSockets::release(g_socket_get_fd(m_socket.get()));
+    }
 
+    // the main loop thread is run by the supervisor
+    void start()
+    {
+        m_loopThread.start();
     }
 
-    ~GStreamerRTSP()
+    void stop()
     {
         g_main_loop_quit(m_loop);
         m_loopThread.stop();
     }
 
+    void setExitNotifier(std::function<void()> notifier)
+    {
+        auto [locked] = arms::makeLocked<arms::WriteLock>(m_loopThread.inputData);
+        assert(locked);
+        locked->onExit = std::move(notifier);
+    }
+
+    // new clients go to whoever else accepts on the socket, connected ones stay
+    void stopListening()
+    {
+        if (m_listenSource)
+        {
+            g_source_destroy(m_listenSource);
+            g_source_unref(m_listenSource);
+            m_listenSource = nullptr;
+        }
+    }
+
+    size_t clientCount() const
+    {
+        GList *clients = gst_rtsp_server_client_filter(server.get(), NULL, NULL);
+        size_t count = g_list_length(clients);
+        g_list_free_full(clients, g_object_unref);
+        return count;
+    }
+
+    std::shared_ptr<StreamControl> getControl() const { return m_control; }
+
 private:
+    static gboolean publishUsage(gpointer userData)
+    {
+        GStreamerRTSP *self = static_cast<GStreamerRTSP *>(userData);
+
+        StreamUsage usage;
+        usage.name = self->m_control->getName();
+        usage.warm = self->m_warm->isWarm();
+        usage.clients = self->clientCount();
+        usage.cpuSeconds = self->m_warm->cpuSeconds();
+        usage.warmRssBytes = self->m_warm->rssBytes();
+        usage.gopCacheBytes = self->m_gopCache->bytes();
+        self->m_metrics->setStream(std::move(usage));
+
+        return G_SOURCE_CONTINUE;
+    }
+
+    // what gst_rtsp_server_attach() does, with the socket chosen here
+    void listen(int port)
+    {
+        GError *error = NULL;
+        int fd = ListenSockets::take(port);
+
+        GSocket *socket = NULL;
+        if (fd >= 0)
+        {
+            socket = g_socket_new_from_fd(fd, &error);
+        }
+        else
+        {
+            // dual-stack, GIO clears IPV6_V6ONLY; IPv4 only if the kernel has no IPv6
+            gst_rtsp_server_set_address(server.get(), "::");
+            socket = gst_rtsp_server_create_socket(server.get(), NULL, NULL);
+            if (!socket)
+            {
+                gst_rtsp_server_set_address(server.get(), "0.0.0.0");
+                socket = gst_rtsp_server_create_socket(server.get(), NULL, &error);
+            }
+        }
+        if (!socket)
+        {
+            arms::log<arms::LOG_INFO>("Can't listen on RTSP port {}: {}", port, error ? error->message : "");
+            g_clear_error(&error);
+            return;
+        }
+
+        m_socket = GObjWrapper<GSocket>{socket};
+        ListenSockets::hold(g_socket_get_fd(socket));
+
+        m_listenSource = g_socket_create_source(socket, G_IO_IN, NULL);
+        g_source_set_callback(m_listenSource, (GSourceFunc)gst_rtsp_server_io_func, g_object_ref(server.get()),
+                              g_object_unref);
+        g_source_attach(m_listenSource, NULL);
+    }
+
+    std::shared_ptr<StreamControl> m_control;
+    std::shared_ptr<GopCache> m_gopCache;
+    std::shared_ptr<WarmMedia> m_warm;
+    std::shared_ptr<ServiceMetrics> m_metrics;
+    guint m_usageSource{0};
     GMainLoop* m_loop;
     GObjWrapper<GstRTSPMediaFactory> factory;
     GObjWrapper<GstRTSPMountPoints> mounts;
     GObjWrapper<GstRTSPServer> server;
+    GObjWrapper<GSocket> m_socket;
+    GSource *m_listenSource{nullptr};
 
     arms::ThreadWarden<GStreamerRTSPLoop> m_loopThread;
 };